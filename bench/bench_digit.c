@@ -0,0 +1,75 @@
+// Compares the compile-time selected digit primitives with their portable
+// fallbacks: make bench
+#include <stdio.h>
+#include <time.h>
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0x9E3779B97F4A7C15ull
+#include "../test/test_util.h"
+
+#define N 1024
+#define ROUNDS 20000
+
+static bn_digit_t a[N], b[N], r[N];
+static volatile bn_digit_t sink;
+
+static double now(void) { return (double)clock() / CLOCKS_PER_SEC; }
+
+// Runs a carry chain over {a} and {b} with the given primitive and returns
+// the time per call in nanoseconds.
+#define BENCH_CARRY(fn, ...)                                                   \
+  do {                                                                         \
+    double start = now();                                                      \
+    for (int round = 0; round < ROUNDS; ++round) {                             \
+      bn_digit_t c = 0;                                                        \
+      for (size_t i = 0; i < N; ++i)                                           \
+        r[i] = fn(__VA_ARGS__);                                                \
+      sink = c;                                                                \
+    }                                                                          \
+    elapsed = (now() - start) * 1e9 / ((double)ROUNDS * N);                    \
+  } while (0)
+
+static void report(const char *name, double fast, double portable) {
+  printf("%-16s %8.3f ns %8.3f ns %6.2fx\n", name, fast, portable,
+         portable / fast);
+}
+
+int main(void) {
+  double elapsed, fast;
+  for (size_t i = 0; i < N; ++i) {
+    a[i] = rand_digit();
+    b[i] = rand_digit();
+  }
+
+  printf("%-16s %11s %11s %7s\n", "primitive", "selected", "portable",
+         "speedup");
+
+  BENCH_CARRY(bn_digit_add2, a[i], b[i] + c, &c);
+  fast = elapsed;
+  BENCH_CARRY(bn_digit_add2_portable, a[i], b[i] + c, &c);
+  report("bn_digit_add2", fast, elapsed);
+
+  BENCH_CARRY(bn_digit_add3, a[i], b[i], c, &c);
+  fast = elapsed;
+  BENCH_CARRY(bn_digit_add3_portable, a[i], b[i], c, &c);
+  report("bn_digit_add3", fast, elapsed);
+
+  BENCH_CARRY(bn_digit_sub, a[i], b[i] + c, &c);
+  fast = elapsed;
+  BENCH_CARRY(bn_digit_sub_portable, a[i], b[i] + c, &c);
+  report("bn_digit_sub", fast, elapsed);
+
+  BENCH_CARRY(bn_digit_sub2, a[i], b[i], c, &c);
+  fast = elapsed;
+  BENCH_CARRY(bn_digit_sub2_portable, a[i], b[i], c, &c);
+  report("bn_digit_sub2", fast, elapsed);
+
+  BENCH_CARRY(bn_digit_mul, a[i], b[i] ^ c, &c);
+  fast = elapsed;
+  BENCH_CARRY(bn_digit_mul_portable, a[i], b[i] ^ c, &c);
+  report("bn_digit_mul", fast, elapsed);
+
+  return 0;
+}
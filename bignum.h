@@ -24,6 +24,10 @@ typedef enum {
   BN_EMPTY_STRING,
   BN_WRONG_FORMAT,
   BN_UNIMPLEMENTED,
+  BN_BUFFER_TOO_SMALL,
+  BN_EVEN_MODULUS,
+  BN_NO_SPECIAL_FORM,
+  BN_NOT_INVERTIBLE,
 } bn_err_t;
 
 typedef uintptr_t bn_digit_t;
@@ -41,20 +45,44 @@ typedef uintptr_t bn_digit_t;
 #define HALF_DIGIT_BASE ((bn_digit_t)1 << HALF_DIGIT_BITS)
 #define HALF_DIGIT_MASK (HALF_DIGIT_BASE - 1)
 
+// Number of digits stored inside a bn_t itself. Up to this size numbers need
+// no heap memory. A bn_t holds no pointer into itself, so it may be moved by
+// value; a copy by value shares the heap digits, free only one of them.
+#ifndef BN_INLINE_DIGITS
+#define BN_INLINE_DIGITS 4
+#endif
+#if BN_INLINE_DIGITS < 1
+#error BN_INLINE_DIGITS must be at least 1.
+#endif
+
 typedef struct {
-  bn_digit_t *digits;
-  size_t size;     // Number of digits used
-  size_t capacity; // Allocated space
-  int sign;        // +1 or -1
+  bn_digit_t *heap; // The digits if capacity > BN_INLINE_DIGITS
+  size_t size;      // Number of digits used
+  size_t capacity;  // Allocated space, inline_digits if <= BN_INLINE_DIGITS
+  int sign;         // +1 or -1
+  bn_digit_t inline_digits[BN_INLINE_DIGITS];
 } bn_t;
 
+// The digits of a bn_t, least significant first. Evaluates bn twice.
+#define BN_DIGITS(bn)                                                          \
+  ((bn)->capacity > BN_INLINE_DIGITS ? (bn)->heap : (bn)->inline_digits)
+
 BNDEF bn_err_t bn_from_string(bn_t *bn, const char *s, bn_digit_t radix);
 BNDEF bn_err_t bn_from_int(bn_t *bn, int i);
 BNDEF bn_err_t bn_clone(bn_t *to, const bn_t *from);
+BNDEF void bn_swap(bn_t *a, bn_t *b);
 BNDEF void bn_print_digits(bn_t *bn);
 BNDEF void bn_free(bn_t *bn);
 
 BNDEF bn_err_t bn_to_string(const bn_t *bn, char **s);
+BNDEF bn_err_t bn_to_string_radix(const bn_t *bn, char **s, bn_digit_t radix);
+// Writes bn into {buf, size}, which must hold bn_sizeinbase(bn, radix) + 2
+// characters for the sign and the terminating zero.
+BNDEF bn_err_t bn_to_string_buf(const bn_t *bn, char *buf, size_t size,
+                                bn_digit_t radix);
+// Upper bound for the number of characters of |bn| in radix, exact if radix
+// is a power of two
+BNDEF size_t bn_sizeinbase(const bn_t *bn, bn_digit_t radix);
 BNDEF void bn_print(const bn_t *bn);
 
 BNDEF int bn_cmp(const bn_t *A, const bn_t *B);
@@ -67,10 +95,340 @@ BNDEF bn_err_t bn_sub_single(bn_t *Z, const bn_t *X, bn_digit_t y);
 BNDEF bn_err_t bn_sub(bn_t *Z, const bn_t *X, const bn_t *Y);
 BNDEF bn_err_t bn_mul_single(bn_t *Z, const bn_t *X, bn_digit_t y);
 BNDEF bn_err_t bn_mul(bn_t *Z, const bn_t *X, const bn_t *Y);
+BNDEF bn_err_t bn_sqr(bn_t *Z, const bn_t *X);
 BNDEF bn_err_t bn_div_single(bn_t *Q, bn_digit_t *remainder, const bn_t *X, bn_digit_t y);
 BNDEF bn_err_t bn_div(bn_t *Q, bn_t *R, const bn_t *X, const bn_t *Y);
+
+// Divisor prepared for repeated division by the same value: normalized once,
+// with a precomputed reciprocal which replaces hardware divisions by
+// multiplications. bn_div_single_pre requires a single-digit divisor.
+typedef struct {
+  bn_digit_t *digits; // shifted left until the top bit is set
+  size_t size;
+  unsigned shift;
+  bn_digit_t inv;     // reciprocal of the top digit(s)
+  int sign;
+} bn_divisor_t;
+
+BNDEF bn_err_t bn_divisor_init(bn_divisor_t *D, const bn_t *B);
+BNDEF void bn_divisor_free(bn_divisor_t *D);
+BNDEF bn_err_t bn_div_pre(bn_t *Q, bn_t *R, const bn_t *X, const bn_divisor_t *D);
+BNDEF bn_err_t bn_div_single_pre(bn_t *Q, bn_digit_t *remainder, const bn_t *X,
+                                 const bn_divisor_t *D);
+
+// Z = X 2^shift and X / 2^shift rounded toward zero, for any shift. Z may be
+// X.
 BNDEF bn_err_t bn_lshift(bn_t *Z, const bn_t *X, size_t shift);
 BNDEF bn_err_t bn_rshift(bn_t *Z, const bn_t *X, size_t shift);
+// Z = X & Y, X | Y, X ^ Y and ~X = -X - 1, where negative numbers are in
+// two's complement with infinitely many leading ones.
+BNDEF bn_err_t bn_and(bn_t *Z, const bn_t *X, const bn_t *Y);
+BNDEF bn_err_t bn_or(bn_t *Z, const bn_t *X, const bn_t *Y);
+BNDEF bn_err_t bn_xor(bn_t *Z, const bn_t *X, const bn_t *Y);
+BNDEF bn_err_t bn_not(bn_t *Z, const bn_t *X);
+// Bit {bit} of X in two's complement, and setting it to value in place
+BNDEF bool bn_tstbit(const bn_t *X, size_t bit);
+BNDEF bn_err_t bn_setbit(bn_t *X, size_t bit, bool value);
+// Number of set bits of X >= 0, SIZE_MAX for X < 0
+BNDEF size_t bn_popcount(const bn_t *X);
+// Index of the first 0 bit, or 1 bit, from bit {start} on, SIZE_MAX if there
+// is none
+BNDEF size_t bn_scan0(const bn_t *X, size_t start);
+BNDEF size_t bn_scan1(const bn_t *X, size_t start);
+// Number of bits of |X|, 0 for X = 0
+BNDEF size_t bn_bitlength(const bn_t *X);
+
+// Z = X mod N with 0 <= Z < |N|
+BNDEF bn_err_t bn_mod(bn_t *Z, const bn_t *X, const bn_t *N);
+
+// Barrett context for reductions modulo a fixed N > 0 of k digits: with the
+// reciprocal mu = floor(B^2k / N) a number below B^2k is reduced by two
+// multiplications instead of a division. Any N works, even or odd.
+typedef struct {
+  bn_digit_t *digits; // N
+  bn_digit_t *mu;     // floor(B^2k / N), k + 1 digits
+  size_t size;
+} bn_barrett_ctx_t;
+
+BNDEF bn_err_t bn_barrett_ctx_init(bn_barrett_ctx_t *C, const bn_t *N);
+BNDEF void bn_barrett_ctx_free(bn_barrett_ctx_t *C);
+// Z = X mod N with 0 <= Z < N, for any X. Numbers of more than 2k digits are
+// divided.
+BNDEF bn_err_t bn_mod_barrett(bn_t *Z, const bn_t *X, const bn_barrett_ctx_t *C);
+// Z = X Y mod N, for 0 <= X, Y < N
+BNDEF bn_err_t bn_mulmod_barrett(bn_t *Z, const bn_t *X, const bn_t *Y,
+                                 const bn_barrett_ctx_t *C);
+BNDEF bn_err_t bn_sqrmod_barrett(bn_t *Z, const bn_t *X,
+                                 const bn_barrett_ctx_t *C);
+
+// Forms of moduli N = 2^k - c, with k the bit length of N, which are reduced
+// by folding the bits above 2^k back in as multiples of c, using shifts,
+// additions and single-digit multiplications only.
+typedef enum {
+  BN_FORM_GENERIC = 0,
+  BN_FORM_PSEUDO_MERSENNE, // c < B, like 2^255 - 19 or 2^521 - 1
+  BN_FORM_SOLINAS, // c a short sum of +-2^32i, k a multiple of 32, like P-256
+} bn_form_t;
+
+typedef struct {
+  bn_digit_t *digits; // N
+  size_t size;
+  size_t bits; // k
+  bn_form_t form;
+  bn_digit_t c; // BN_FORM_PSEUDO_MERSENNE
+  // BN_FORM_SOLINAS: c = 2^k - N of size digits, and the layers which fold
+  // the 32-bit chunks above 2^k back in. Every layer is a coefficient
+  // followed by the chunk above 2^k which goes into each chunk of size
+  // digits, k/32 for none.
+  bn_digit_t *cp;
+  int32_t *layers;
+  size_t nlayers;
+} bn_special_ctx_t;
+
+BNDEF bn_form_t bn_modulus_form(const bn_t *N);
+// Returns BN_NO_SPECIAL_FORM if N > 0 has neither special form.
+BNDEF bn_err_t bn_special_ctx_init(bn_special_ctx_t *C, const bn_t *N);
+BNDEF void bn_special_ctx_free(bn_special_ctx_t *C);
+// Z = X mod N with 0 <= Z < N, for any X. Numbers of more than 2n digits are
+// divided.
+BNDEF bn_err_t bn_mod_special(bn_t *Z, const bn_t *X, const bn_special_ctx_t *C);
+// Z = X Y mod N, for 0 <= X, Y < N
+BNDEF bn_err_t bn_mulmod_special(bn_t *Z, const bn_t *X, const bn_t *Y,
+                                 const bn_special_ctx_t *C);
+BNDEF bn_err_t bn_sqrmod_special(bn_t *Z, const bn_t *X,
+                                 const bn_special_ctx_t *C);
+BNDEF bn_err_t bn_modexp_special(bn_t *Z, const bn_t *X, const bn_t *E,
+                                 const bn_special_ctx_t *C);
+
+// Montgomery context for arithmetic modulo a fixed odd N > 0 of n digits.
+// Residues are kept in Montgomery form x R mod N with R = B^n, in which
+// products are reduced by adding multiples of N instead of dividing by it.
+typedef struct {
+  bn_digit_t *digits; // N
+  bn_digit_t *rr;     // R^2 mod N, n digits
+  size_t size;
+  bn_digit_t ninv;    // -N^-1 mod B
+} bn_mont_ctx_t;
+
+// Returns BN_EVEN_MODULUS if N is even.
+BNDEF bn_err_t bn_mont_ctx_init(bn_mont_ctx_t *M, const bn_t *N);
+BNDEF void bn_mont_ctx_free(bn_mont_ctx_t *M);
+// Z = X R mod N, for any X
+BNDEF bn_err_t bn_mont_to(bn_t *Z, const bn_t *X, const bn_mont_ctx_t *M);
+// Z = X / R mod N, for 0 <= X < N
+BNDEF bn_err_t bn_mont_from(bn_t *Z, const bn_t *X, const bn_mont_ctx_t *M);
+// Z = X Y / R mod N, for 0 <= X, Y < N
+BNDEF bn_err_t bn_mont_mul(bn_t *Z, const bn_t *X, const bn_t *Y,
+                           const bn_mont_ctx_t *M);
+BNDEF bn_err_t bn_mont_sqr(bn_t *Z, const bn_t *X, const bn_mont_ctx_t *M);
+// Z = X^E mod N for E >= 0 and N > 0, with 0 <= Z < N. Odd pseudo-Mersenne
+// moduli from BN_PMERSENNE_FOLD_THRESHOLD digits whose c 2^s fits a digit,
+// and odd Solinas moduli from BN_SOLINAS_FOLD_THRESHOLD digits, are reduced
+// by folding, other odd moduli use Montgomery multiplication. Even moduli of
+// a special form are always folded, other even ones use Barrett reduction or
+// division.
+BNDEF bn_err_t bn_modexp(bn_t *Z, const bn_t *X, const bn_t *E, const bn_t *N);
+BNDEF bn_err_t bn_modexp_mont(bn_t *Z, const bn_t *X, const bn_t *E,
+                              const bn_mont_ctx_t *M);
+
+// G = gcd(|A|, |B|) >= 0, with gcd(0, 0) = 0. Lehmer steps on the top two
+// digits reduce the operands, and half-GCD steps from BN_GCD_DC_THRESHOLD
+// digits on.
+BNDEF bn_err_t bn_gcd(bn_t *G, const bn_t *A, const bn_t *B);
+// G = gcd(A, B) = S A + T B with |S| <= max(|B| / 2G, 1) and
+// |T| <= max(|A| / 2G, 1), where S = sign(A), T = 0 if B = 0 and S = 0,
+// T = sign(B) if A = 0 or |A| = |B|. S and T may be NULL; the outputs may be
+// the inputs, but must differ from each other.
+BNDEF bn_err_t bn_gcdext(bn_t *G, bn_t *S, bn_t *T, const bn_t *A,
+                         const bn_t *B);
+// Z = A^-1 mod N for N != 0, with 0 <= Z < |N|. Returns BN_NOT_INVERTIBLE if
+// gcd(A, N) != 1.
+BNDEF bn_err_t bn_invmod(bn_t *Z, const bn_t *A, const bn_t *N);
+// Z[i] = X[i]^-1 mod N for i < count and N != 0, with 0 <= Z[i] < |N|, by
+// one inversion and 3(count - 1) multiplications modulo N. Z[i] of an X[i]
+// which is not invertible is 0, and BN_NOT_INVERTIBLE is returned; the
+// others are still inverted. The _mont and _barrett variants multiply with a
+// prepared context. Z[i] may be X[i], but not an operand of another index.
+BNDEF bn_err_t bn_invmod_batch(bn_t *Z, const bn_t *X, size_t count,
+                               const bn_t *N);
+BNDEF bn_err_t bn_invmod_batch_mont(bn_t *Z, const bn_t *X, size_t count,
+                                    const bn_mont_ctx_t *M);
+BNDEF bn_err_t bn_invmod_batch_barrett(bn_t *Z, const bn_t *X, size_t count,
+                                       const bn_barrett_ctx_t *C);
+
+// Z = floor(sqrt(X)) for X >= 0, R = X - Z^2. R may be NULL.
+BNDEF bn_err_t bn_sqrt(bn_t *Z, const bn_t *X);
+BNDEF bn_err_t bn_sqrtrem(bn_t *Z, bn_t *R, const bn_t *X);
+// Z = X^(1/k) rounded toward zero for k >= 1 and X >= 0 or odd k,
+// R = X - Z^k. R may be NULL.
+BNDEF bn_err_t bn_root(bn_t *Z, const bn_t *X, unsigned long k);
+BNDEF bn_err_t bn_rootrem(bn_t *Z, bn_t *R, const bn_t *X, unsigned long k);
+// Whether X = Y^2, and X = Y^k for some Y and k > 1, where 0, 1 and -1 are
+// powers and other negative X need odd k.
+BNDEF bool bn_is_perfect_square(const bn_t *X);
+BNDEF bool bn_is_perfect_power(const bn_t *X);
+
+// Z = X^e, with X^0 = 1, by left-to-right binary powering on squares.
+BNDEF bn_err_t bn_pow_ui(bn_t *Z, const bn_t *X, unsigned long e);
+// Z = n!, the binomial coefficient C(n, k), which is 0 for k > n, and the
+// product of the primes up to n. Factorials and binomials are products of
+// prime powers found on a sieve, all are multiplied as balanced trees.
+BNDEF bn_err_t bn_fac_ui(bn_t *Z, unsigned long n);
+BNDEF bn_err_t bn_bin_uiui(bn_t *Z, unsigned long n, unsigned long k);
+BNDEF bn_err_t bn_primorial_ui(bn_t *Z, unsigned long n);
+
+// Batches of independent operations, Z[i] = X[i] Y[i] and Z[i] = X[i]^E[i]
+// mod N[i] for i < count, with the same results as bn_mul and bn_modexp. One
+// operation per SIMD lane runs at a time: products of BN_BATCH_MUL_THRESHOLD
+// to BN_KARATSUBA_THRESHOLD digits and powers modulo odd N[i] of about the
+// same size are grouped, the rest is computed one by one. Z[i] may be X[i],
+// Y[i], E[i] or N[i], but not an operand of another index.
+BNDEF bn_err_t bn_mul_batch(bn_t *Z, const bn_t *X, const bn_t *Y,
+                            size_t count);
+BNDEF bn_err_t bn_modexp_batch(bn_t *Z, const bn_t *X, const bn_t *E,
+                               const bn_t *N, size_t count);
+
+// Kernels of the batch functions, picked like those of bn_select_kernels,
+// with the BN_BATCH environment variable ("scalar", "avx2" or "ifma").
+typedef enum {
+  BN_BATCH_AUTO = 0,
+  BN_BATCH_SCALAR, // one operation at a time
+  BN_BATCH_AVX2,   // 4 lanes of 28-bit limbs
+  BN_BATCH_IFMA,   // 8 lanes of 52-bit limbs, AVX-512 IFMA
+} bn_batch_t;
+
+// Returns the kernels actually selected, which falls back to
+// BN_BATCH_SCALAR if the CPU does not support the requested ones.
+BNDEF bn_batch_t bn_select_batch(bn_batch_t batch);
+BNDEF bn_batch_t bn_get_batch(void);
+
+// Low-level functions on raw little-endian digit spans {ptr, len}. They never
+// allocate: outputs are sized by the caller, carries and borrows are returned.
+// Unless noted otherwise, outputs may be equal to an input but must not
+// overlap it partially.
+
+BNDEF void bn_mpn_zero(bn_digit_t *rp, size_t n);
+BNDEF void bn_mpn_copy(bn_digit_t *rp, const bn_digit_t *ap, size_t n);
+BNDEF size_t bn_mpn_normalized_size(const bn_digit_t *ap, size_t n);
+// -1, 0, 1 for {ap, n} <, ==, > {bp, n}
+BNDEF int bn_mpn_cmp(const bn_digit_t *ap, const bn_digit_t *bp, size_t n);
+// {rp, n} = {ap, n} + b
+BNDEF bn_digit_t bn_mpn_add_1(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                              bn_digit_t b);
+// {rp, n} = {ap, n} - b
+BNDEF bn_digit_t bn_mpn_sub_1(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                              bn_digit_t b);
+// {rp, n} = {ap, n} + {bp, n}
+BNDEF bn_digit_t bn_mpn_add_n(bn_digit_t *rp, const bn_digit_t *ap,
+                              const bn_digit_t *bp, size_t n);
+// {rp, n} = {ap, n} - {bp, n}
+BNDEF bn_digit_t bn_mpn_sub_n(bn_digit_t *rp, const bn_digit_t *ap,
+                              const bn_digit_t *bp, size_t n);
+// {rp, an} = {ap, an} + {bp, bn} for an >= bn
+BNDEF bn_digit_t bn_mpn_add(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                            const bn_digit_t *bp, size_t bn);
+// {rp, an} = {ap, an} - {bp, bn} for an >= bn
+BNDEF bn_digit_t bn_mpn_sub(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                            const bn_digit_t *bp, size_t bn);
+// {rp, n} = {ap, n} * b, returns the high digit
+BNDEF bn_digit_t bn_mpn_mul_1(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                              bn_digit_t b);
+// {rp, n} += {ap, n} * b, returns the high digit
+BNDEF bn_digit_t bn_mpn_addmul_1(bn_digit_t *rp, const bn_digit_t *ap,
+                                 size_t n, bn_digit_t b);
+// {rp, n} -= {ap, n} * b, returns the high digit to subtract
+BNDEF bn_digit_t bn_mpn_submul_1(bn_digit_t *rp, const bn_digit_t *ap,
+                                 size_t n, bn_digit_t b);
+// {rp, n + 1} = {rp, n} + {ap, n} * {bp, 2}, returns the high digit. rp[n] is
+// only written.
+BNDEF bn_digit_t bn_mpn_addmul_2(bn_digit_t *rp, const bn_digit_t *ap,
+                                 size_t n, const bn_digit_t *bp);
+// {rp, n} = {ap, n} << shift for 0 < shift < DIGIT_BITS, returns the bits
+// shifted out. rp may be above ap.
+BNDEF bn_digit_t bn_mpn_lshift(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                               unsigned shift);
+// {rp, n} = {ap, n} >> shift for 0 < shift < DIGIT_BITS, returns the bits
+// shifted out in the high bits. rp may be below ap.
+BNDEF bn_digit_t bn_mpn_rshift(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                               unsigned shift);
+// {rp, n} = {ap, n} & {bp, n}, | and ^, and {rp, n} = ~{ap, n}
+BNDEF void bn_mpn_and_n(bn_digit_t *rp, const bn_digit_t *ap,
+                        const bn_digit_t *bp, size_t n);
+BNDEF void bn_mpn_ior_n(bn_digit_t *rp, const bn_digit_t *ap,
+                        const bn_digit_t *bp, size_t n);
+BNDEF void bn_mpn_xor_n(bn_digit_t *rp, const bn_digit_t *ap,
+                        const bn_digit_t *bp, size_t n);
+BNDEF void bn_mpn_com(bn_digit_t *rp, const bn_digit_t *ap, size_t n);
+// Number of set bits of {ap, n}
+BNDEF size_t bn_mpn_popcount(const bn_digit_t *ap, size_t n);
+// {rp, an + bn} = {ap, an} * {bp, bn} for an >= bn >= 1, rp must not overlap
+// the inputs. {scratch} holds bn_mpn_mul_itch(an, bn) digits.
+BNDEF size_t bn_mpn_mul_itch(size_t an, size_t bn);
+BNDEF void bn_mpn_mul(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                      const bn_digit_t *bp, size_t bn, bn_digit_t *scratch);
+// {rp, 2n} = {ap, n}^2, {scratch} holds bn_mpn_sqr_itch(n) digits.
+BNDEF size_t bn_mpn_sqr_itch(size_t n);
+BNDEF void bn_mpn_sqr(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                      bn_digit_t *scratch);
+// {qp, n} = {ap, n} / d, returns the remainder. qp may be ap.
+BNDEF bn_digit_t bn_mpn_divrem_1(bn_digit_t *qp, const bn_digit_t *ap,
+                                 size_t n, bn_digit_t d);
+// {qp, nn - dn + 1} = {np, nn} / {dp, dn}, {rp, dn} = {np, nn} % {dp, dn}
+// for nn >= dn >= 1 and a nonzero top digit of {dp, dn}. The outputs must not
+// overlap the inputs. {scratch} holds bn_mpn_div_qr_itch(nn, dn) digits.
+BNDEF size_t bn_mpn_div_qr_itch(size_t nn, size_t dn);
+BNDEF void bn_mpn_div_qr(bn_digit_t *qp, bn_digit_t *rp, const bn_digit_t *np,
+                         size_t nn, const bn_digit_t *dp, size_t dn,
+                         bn_digit_t *scratch);
+// Binary GCD of single and double digits, where gcd(0, b) = b
+BNDEF bn_digit_t bn_mpn_gcd_11(bn_digit_t a, bn_digit_t b);
+// {rp, 2} = gcd({ap, 2}, {bp, 2})
+BNDEF void bn_mpn_gcd_22(bn_digit_t *rp, const bn_digit_t *ap,
+                         const bn_digit_t *bp);
+// {sp, (n + 1) / 2} = floor(sqrt({ap, n})) for a nonzero top digit, with the
+// remainder in {rp, returned size} of at most (n + 1) / 2 + 1 digits. rp may
+// be NULL; the outputs must not overlap the input.
+BNDEF size_t bn_mpn_sqrtrem(bn_digit_t *sp, bn_digit_t *rp,
+                            const bn_digit_t *ap, size_t n);
+
+// Implementations of the innermost digit loops (add_n, sub_n, mul_1,
+// addmul_1). By default the best kernels supported by the CPU are picked on
+// first use; the BN_KERNELS environment variable ("portable" or "adx") or
+// bn_select_kernels override that choice. Select the kernels before using the
+// library from several threads.
+typedef enum {
+  BN_KERNELS_AUTO = 0,
+  BN_KERNELS_PORTABLE, // C
+  BN_KERNELS_ADX,      // x86-64 assembly using MULX/ADCX/ADOX
+} bn_kernels_t;
+
+// Returns the kernels actually selected, which falls back to
+// BN_KERNELS_PORTABLE if the CPU does not support the requested ones.
+BNDEF bn_kernels_t bn_select_kernels(bn_kernels_t kernels);
+BNDEF bn_kernels_t bn_get_kernels(void);
+
+// Number of threads large multiplications are split across, including the
+// calling one. The default of 1 keeps everything on the calling thread;
+// above that, the subproducts of operands from BN_PARALLEL_THRESHOLD digits
+// on are handed to a pool of threads - 1 workers. Returns the number in
+// effect, which is 1 if the library is built without threads. Set it before
+// using the library from several threads.
+BNDEF unsigned bn_set_threads(unsigned threads);
+BNDEF unsigned bn_get_threads(void);
+
+// Arena the arithmetic functions take their temporaries from. Every thread
+// has its own arena; bn_scratch_use makes the calling thread use S instead,
+// or its own arena again if S is NULL, and returns the previous choice.
+typedef struct {
+  struct _bn_scratch_block *block;
+  size_t used;
+  size_t spilled;
+} bn_scratch_t;
+
+BNDEF bn_scratch_t *bn_scratch_use(bn_scratch_t *S);
+// Frees the memory held by S, or by the calling thread's own arena if S is
+// NULL, for example before the thread exits.
+BNDEF void bn_scratch_free(bn_scratch_t *S);
 
 #ifdef __cplusplus
 }
@@ -85,6 +443,29 @@ BNDEF bn_err_t bn_rshift(bn_t *Z, const bn_t *X, size_t shift);
 #define BN_ASSERT assert
 #endif
 
+// Allocation functions used for all memory of the library, including the
+// strings returned by bn_to_string. Override all three together.
+#if defined(BN_MALLOC) || defined(BN_REALLOC) || defined(BN_FREE)
+#if !defined(BN_MALLOC) || !defined(BN_REALLOC) || !defined(BN_FREE)
+#error Define BN_MALLOC, BN_REALLOC and BN_FREE together.
+#endif
+#else
+#define BN_MALLOC malloc
+#define BN_REALLOC realloc
+#define BN_FREE free
+#endif
+
+// Storage class of the per-thread scratch arenas
+#ifndef BN_THREAD_LOCAL
+#if defined(_MSC_VER)
+#define BN_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__)
+#define BN_THREAD_LOCAL __thread
+#else
+#define BN_THREAD_LOCAL
+#endif
+#endif
+
 #include <stdio.h>
 #include <string.h>
 
@@ -107,20 +488,270 @@ BNDEF bn_err_t bn_rshift(bn_t *Z, const bn_t *X, size_t shift);
 #include <stdlib.h>
 #include <string.h>
 
-#define BN_DEFAULT_CAPACITY 10
+// Operand size (in digits) from which bn_mul switches from the schoolbook
+// basecase to Karatsuba.
+#ifndef BN_KARATSUBA_THRESHOLD
+#define BN_KARATSUBA_THRESHOLD 32
+#endif
+// Operand sizes from which the Toom-3 (Toom-33, Toom-32, Toom-42) and Toom-4
+// (Toom-44) tiers are used.
+#ifndef BN_TOOM3_THRESHOLD
+#define BN_TOOM3_THRESHOLD 160
+#endif
+#ifndef BN_TOOM4_THRESHOLD
+#define BN_TOOM4_THRESHOLD 400
+#endif
+// Operand size from which bn_mul uses the number-theoretic transform.
+#ifndef BN_NTT_THRESHOLD
+#define BN_NTT_THRESHOLD 4000
+#endif
+// Divisor size from which bn_div switches from schoolbook division to
+// Burnikel-Ziegler.
+#ifndef BN_BZ_DIV_THRESHOLD
+#define BN_BZ_DIV_THRESHOLD 60
+#endif
+#if BN_BZ_DIV_THRESHOLD < 4
+#error BN_BZ_DIV_THRESHOLD must be at least 4.
+#endif
+// Number of parts (digits) from which bn_from_string combines halves of the
+// string with the fast multiplication instead of folding in one part at a time.
+#ifndef BN_FROM_STRING_DC_THRESHOLD
+#define BN_FROM_STRING_DC_THRESHOLD 60
+#endif
+// Number size from which bn_to_string splits the number by powers of the
+// radix instead of dividing off one digit's worth of characters at a time.
+#ifndef BN_TO_STRING_DC_THRESHOLD
+#define BN_TO_STRING_DC_THRESHOLD 30
+#endif
+
+// Operand size from which bn_mul_batch multiplies in SIMD lanes. Smaller
+// products spend more time converting to and from limbs than multiplying.
+#ifndef BN_BATCH_MUL_THRESHOLD
+#define BN_BATCH_MUL_THRESHOLD 16
+#endif
+
+// Modulus sizes from which bn_modexp reduces odd pseudo-Mersenne and Solinas
+// moduli by folding instead of Montgomery reduction. Even ones are always
+// folded.
+#ifndef BN_PMERSENNE_FOLD_THRESHOLD
+#define BN_PMERSENNE_FOLD_THRESHOLD 3
+#endif
+#ifndef BN_SOLINAS_FOLD_THRESHOLD
+#define BN_SOLINAS_FOLD_THRESHOLD 10
+#endif
+
+// Size from which the half GCD recurses instead of taking Lehmer steps, and
+// from which bn_gcd and friends reduce by half-GCD steps.
+#ifndef BN_HGCD_THRESHOLD
+#define BN_HGCD_THRESHOLD 100
+#endif
+#ifndef BN_GCD_DC_THRESHOLD
+#define BN_GCD_DC_THRESHOLD 300
+#endif
+
+// Same thresholds for squaring, which has a faster basecase.
+#ifndef BN_SQR_KARATSUBA_THRESHOLD
+#define BN_SQR_KARATSUBA_THRESHOLD 48
+#endif
+#ifndef BN_SQR_TOOM3_THRESHOLD
+#define BN_SQR_TOOM3_THRESHOLD 200
+#endif
+#ifndef BN_SQR_TOOM4_THRESHOLD
+#define BN_SQR_TOOM4_THRESHOLD 500
+#endif
+#ifndef BN_SQR_NTT_THRESHOLD
+#define BN_SQR_NTT_THRESHOLD 4000
+#endif
+
+// Operand size from which the subproducts of Karatsuba, Toom-Cook and the
+// transforms of the NTT run in parallel, if bn_set_threads allows it.
+#ifndef BN_PARALLEL_THRESHOLD
+#define BN_PARALLEL_THRESHOLD 2000
+#endif
+
+// The NTT tier works on 64-bit digits only.
+#if UINTPTR_MAX == 0xFFFFFFFFFFFFFFFF
+#define BN_HAVE_NTT 1
+#else
+#define BN_HAVE_NTT 0
+#endif
+
+// The thread pool needs POSIX threads, define BN_NO_THREADS to leave it out.
+#if !defined(BN_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+#define BN_HAVE_THREADS 1
+#include <pthread.h>
+#else
+#define BN_HAVE_THREADS 0
+#endif
+
+// Atomic access for what is set up lazily and shared by all threads: the
+// kernels and the caches, which are built once and never freed. Without
+// compiler support these are not thread-safe.
+#if defined(__GNUC__) || defined(__clang__)
+#define _BN_ATOMIC_LOAD_PTR(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define _BN_ATOMIC_CAS_PTR(p, expected, desired)                               \
+  __sync_bool_compare_and_swap(p, expected, desired)
+#define _BN_ATOMIC_LOAD_RELAXED(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define _BN_ATOMIC_STORE_RELAXED(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define _BN_ATOMIC_LOAD_PTR(p) (*(p))
+#define _BN_ATOMIC_CAS_PTR(p, expected, desired)                               \
+  (_InterlockedCompareExchangePointer((void *volatile *)(p), desired,           \
+                                      expected) == (expected))
+#define _BN_ATOMIC_LOAD_RELAXED(p) (*(p))
+#define _BN_ATOMIC_STORE_RELAXED(p, v) (*(p) = (v))
+#else
+#define _BN_ATOMIC_LOAD_PTR(p) (*(p))
+#define _BN_ATOMIC_CAS_PTR(p, expected, desired)                               \
+  (*(p) == (expected) ? (*(p) = (desired), true) : false)
+#define _BN_ATOMIC_LOAD_RELAXED(p) (*(p))
+#define _BN_ATOMIC_STORE_RELAXED(p, v) (*(p) = (v))
+#endif
+
+//////////////////// MEMORY ////////////////////
+
+// The temporaries of the arithmetic functions are carved out of a bump arena.
+// An arena is a stack of blocks; a block that overflows is followed by one at
+// least twice its size, and once the arena is empty again all blocks are
+// merged into one. After the first few operations of a size, temporaries are
+// taken without heap calls.
+
+#define BN_SCRATCH_MIN_DIGITS 256
+
+struct _bn_scratch_block {
+  struct _bn_scratch_block *prev;
+  size_t prev_used; // digits used in prev when this block was started
+  size_t capacity;
+  bn_digit_t digits[];
+};
+
+typedef struct {
+  struct _bn_scratch_block *block;
+  size_t used;
+} _bn_scratch_mark_t;
+
+static BN_THREAD_LOCAL bn_scratch_t _bn_scratch_own;
+static BN_THREAD_LOCAL bn_scratch_t *_bn_scratch_used;
+
+bn_scratch_t *bn_scratch_use(bn_scratch_t *S) {
+  bn_scratch_t *prev = _bn_scratch_used;
+  _bn_scratch_used = S;
+  return prev;
+}
+
+// Returns the arena of the calling thread
+static bn_scratch_t *_bn_scratch(void) {
+  return _bn_scratch_used != NULL ? _bn_scratch_used : &_bn_scratch_own;
+}
+
+static _bn_scratch_mark_t _bn_scratch_mark(const bn_scratch_t *S) {
+  const _bn_scratch_mark_t mark = {S->block, S->used};
+  return mark;
+}
+
+// Returns n digits, which stay valid until the arena is released to a mark
+// taken before.
+bn_digit_t *_bn_scratch_alloc(bn_scratch_t *S, size_t n) {
+  struct _bn_scratch_block *block = S->block;
+  if (block != NULL && block->capacity - S->used >= n) {
+    bn_digit_t *p = block->digits + S->used;
+    S->used += n;
+    return p;
+  }
+  size_t capacity = block != NULL ? 2 * block->capacity : BN_SCRATCH_MIN_DIGITS;
+  if (capacity < n)
+    capacity = n;
+  struct _bn_scratch_block *next =
+      BN_MALLOC(sizeof(struct _bn_scratch_block) + capacity * sizeof(bn_digit_t));
+  BN_ASSERT(next != NULL);
+  next->prev = block;
+  next->prev_used = S->used;
+  next->capacity = capacity;
+  S->block = next;
+  S->used = n;
+  return next->digits;
+}
+
+// Frees everything allocated since mark was taken.
+static void _bn_scratch_release(bn_scratch_t *S, _bn_scratch_mark_t mark) {
+  while (S->block != mark.block) {
+    struct _bn_scratch_block *block = S->block;
+    if (block->prev == NULL)
+      break; // mark was taken on the empty arena, the first block is kept
+    S->block = block->prev;
+    S->used = block->prev_used;
+    S->spilled += block->capacity;
+    BN_FREE(block);
+  }
+  S->used = mark.used;
+  if (S->spilled > 0 && S->used == 0 && S->block->prev == NULL) {
+    // The arena is empty, replace its blocks by one that holds them all.
+    const size_t capacity = S->block->capacity + S->spilled;
+    BN_FREE(S->block);
+    S->block = BN_MALLOC(sizeof(struct _bn_scratch_block) +
+                         capacity * sizeof(bn_digit_t));
+    BN_ASSERT(S->block != NULL);
+    S->block->prev = NULL;
+    S->block->prev_used = 0;
+    S->block->capacity = capacity;
+    S->spilled = 0;
+  }
+}
+
+void bn_scratch_free(bn_scratch_t *S) {
+  if (S == NULL)
+    S = &_bn_scratch_own;
+  while (S->block != NULL) {
+    struct _bn_scratch_block *prev = S->block->prev;
+    BN_FREE(S->block);
+    S->block = prev;
+  }
+  S->used = 0;
+  S->spilled = 0;
+}
 
 //////////////////// DIGIT ARITHMETIC ////////////////////
 
-// a + b, {carry} is set to 0 or 1
-bn_digit_t bn_digit_add2(bn_digit_t a, bn_digit_t b, bn_digit_t *carry) {
+// The digit primitives are selected at compile time: carry builtins or MSVC
+// intrinsics for additions and subtractions, a double-width integer type
+// (unsigned __int128 for 64-bit digits on GCC/Clang) or _umul128 for
+// multiplications. The portable versions below are the fallback, define
+// BN_NO_DIGIT_INTRINSICS to force them.
+
+#if !defined(BN_NO_DIGIT_INTRINSICS)
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#define BN_HAVE_MSVC_DIGIT_INTRINSICS 1
+#endif
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_addcll) && __has_builtin(__builtin_subcll) &&      \
+    UINTPTR_MAX == 0xFFFFFFFFFFFFFFFF
+#define BN_HAVE_BUILTIN_ADDC 1
+#endif
+#endif
+#if __GNUC__ >= 5 || __clang__
+#define BN_HAVE_BUILTIN_OVERFLOW 1
+#endif
+#if (__GNUC__ || __clang__) && UINTPTR_MAX == 0xFFFFFFFFFFFFFFFF &&            \
+    defined(__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 bn_ddigit_t;
+#define BN_HAVE_DDIGIT 1
+#elif (__GNUC__ || __clang__) && UINTPTR_MAX == 0xFFFFFFFF
+typedef uint64_t bn_ddigit_t;
+#define BN_HAVE_DDIGIT 1
+#endif
+#endif // BN_NO_DIGIT_INTRINSICS
+
+bn_digit_t bn_digit_add2_portable(bn_digit_t a, bn_digit_t b,
+                                  bn_digit_t *carry) {
   bn_digit_t result = a + b;
   *carry = (result < a) ? 1 : 0;
   return result;
 }
 
-// a + b + c, {carry} is set to 0, 1 or 2
-bn_digit_t bn_digit_add3(bn_digit_t a, bn_digit_t b, bn_digit_t c,
-                                bn_digit_t *carry) {
+bn_digit_t bn_digit_add3_portable(bn_digit_t a, bn_digit_t b, bn_digit_t c,
+                                  bn_digit_t *carry) {
   bn_digit_t result = a + b;
   *carry = (result < a) ? 1 : 0;
   result += c;
@@ -129,15 +760,16 @@ bn_digit_t bn_digit_add3(bn_digit_t a, bn_digit_t b, bn_digit_t c,
   return result;
 }
 
-// a - b, {borrow} is set to 0 or 1
-bn_digit_t bn_digit_sub(bn_digit_t a, bn_digit_t b, bn_digit_t *borrow) {
+bn_digit_t bn_digit_sub_portable(bn_digit_t a, bn_digit_t b,
+                                 bn_digit_t *borrow) {
   bn_digit_t result = a - b;
   *borrow = (result > a) ? 1 : 0;
   return result;
 }
 
-bn_digit_t bn_digit_sub2(bn_digit_t a, bn_digit_t b,
-                                bn_digit_t borrow_in, bn_digit_t *borrow_out) {
+bn_digit_t bn_digit_sub2_portable(bn_digit_t a, bn_digit_t b,
+                                  bn_digit_t borrow_in,
+                                  bn_digit_t *borrow_out) {
   bn_digit_t result = a - b;
   *borrow_out = (result > a) ? 1 : 0;
   if (result < borrow_in)
@@ -146,8 +778,8 @@ bn_digit_t bn_digit_sub2(bn_digit_t a, bn_digit_t b,
   return result;
 }
 
-// a * b, low half is returned, high half is in {half}
-bn_digit_t bn_digit_mul(bn_digit_t a, bn_digit_t b, bn_digit_t *high) {
+bn_digit_t bn_digit_mul_portable(bn_digit_t a, bn_digit_t b,
+                                 bn_digit_t *high) {
   bn_digit_t a_low = a & HALF_DIGIT_MASK;
   bn_digit_t a_high = a >> HALF_DIGIT_BITS;
   bn_digit_t b_low = b & HALF_DIGIT_MASK;
@@ -159,13 +791,109 @@ bn_digit_t bn_digit_mul(bn_digit_t a, bn_digit_t b, bn_digit_t *high) {
   bn_digit_t r_high = a_high * b_high;
 
   bn_digit_t carry = 0;
-  bn_digit_t low = bn_digit_add3(r_low, r_mid1 << HALF_DIGIT_BITS,
-                                 r_mid2 << HALF_DIGIT_BITS, &carry);
+  bn_digit_t low = bn_digit_add3_portable(r_low, r_mid1 << HALF_DIGIT_BITS,
+                                          r_mid2 << HALF_DIGIT_BITS, &carry);
   *high = (r_mid1 >> HALF_DIGIT_BITS) + (r_mid2 >> HALF_DIGIT_BITS) + r_high +
           carry;
   return low;
 }
 
+// a + b, {carry} is set to 0 or 1
+bn_digit_t bn_digit_add2(bn_digit_t a, bn_digit_t b, bn_digit_t *carry) {
+#if BN_HAVE_BUILTIN_ADDC
+  unsigned long long c;
+  bn_digit_t result = __builtin_addcll(a, b, 0, &c);
+  *carry = c;
+  return result;
+#elif BN_HAVE_MSVC_DIGIT_INTRINSICS
+  unsigned long long result;
+  *carry = _addcarry_u64(0, a, b, &result);
+  return result;
+#elif BN_HAVE_BUILTIN_OVERFLOW
+  bn_digit_t result;
+  *carry = __builtin_add_overflow(a, b, &result);
+  return result;
+#else
+  return bn_digit_add2_portable(a, b, carry);
+#endif
+}
+
+// a + b + c, {carry} is set to 0, 1 or 2
+bn_digit_t bn_digit_add3(bn_digit_t a, bn_digit_t b, bn_digit_t c,
+                         bn_digit_t *carry) {
+#if BN_HAVE_MSVC_DIGIT_INTRINSICS
+  unsigned long long result;
+  unsigned char c1 = _addcarry_u64(0, a, b, &result);
+  unsigned char c2 = _addcarry_u64(0, result, c, &result);
+  *carry = c1 + c2;
+  return result;
+#elif BN_HAVE_BUILTIN_OVERFLOW
+  bn_digit_t result;
+  bn_digit_t c1 = __builtin_add_overflow(a, b, &result);
+  bn_digit_t c2 = __builtin_add_overflow(result, c, &result);
+  *carry = c1 + c2;
+  return result;
+#else
+  return bn_digit_add3_portable(a, b, c, carry);
+#endif
+}
+
+// a - b, {borrow} is set to 0 or 1
+bn_digit_t bn_digit_sub(bn_digit_t a, bn_digit_t b, bn_digit_t *borrow) {
+#if BN_HAVE_BUILTIN_ADDC
+  unsigned long long c;
+  bn_digit_t result = __builtin_subcll(a, b, 0, &c);
+  *borrow = c;
+  return result;
+#elif BN_HAVE_MSVC_DIGIT_INTRINSICS
+  unsigned long long result;
+  *borrow = _subborrow_u64(0, a, b, &result);
+  return result;
+#elif BN_HAVE_BUILTIN_OVERFLOW
+  bn_digit_t result;
+  *borrow = __builtin_sub_overflow(a, b, &result);
+  return result;
+#else
+  return bn_digit_sub_portable(a, b, borrow);
+#endif
+}
+
+// a - b - borrow_in with borrow_in <= 1, {borrow_out} is set to 0 or 1
+bn_digit_t bn_digit_sub2(bn_digit_t a, bn_digit_t b, bn_digit_t borrow_in,
+                         bn_digit_t *borrow_out) {
+#if BN_HAVE_MSVC_DIGIT_INTRINSICS
+  unsigned long long result;
+  unsigned char b1 = _subborrow_u64(0, a, b, &result);
+  unsigned char b2 = _subborrow_u64(0, result, borrow_in, &result);
+  *borrow_out = b1 + b2;
+  return result;
+#elif BN_HAVE_BUILTIN_OVERFLOW
+  bn_digit_t result;
+  bn_digit_t b1 = __builtin_sub_overflow(a, b, &result);
+  bn_digit_t b2 = __builtin_sub_overflow(result, borrow_in, &result);
+  *borrow_out = b1 + b2;
+  return result;
+#else
+  return bn_digit_sub2_portable(a, b, borrow_in, borrow_out);
+#endif
+}
+
+// a * b, low half is returned, high half is in {high}
+bn_digit_t bn_digit_mul(bn_digit_t a, bn_digit_t b, bn_digit_t *high) {
+#if BN_HAVE_DDIGIT
+  bn_ddigit_t result = (bn_ddigit_t)a * b;
+  *high = (bn_digit_t)(result >> DIGIT_BITS);
+  return (bn_digit_t)result;
+#elif BN_HAVE_MSVC_DIGIT_INTRINSICS
+  unsigned long long h;
+  bn_digit_t low = _umul128(a, b, &h);
+  *high = h;
+  return low;
+#else
+  return bn_digit_mul_portable(a, b, high);
+#endif
+}
+
 int bn_digit_count_leading_zeros(bn_digit_t value) {
 #if UINTPTR_MAX == 0xFFFFFFFFFFFFFFFF
 // 64-bit system
@@ -192,6 +920,45 @@ int bn_digit_count_leading_zeros(bn_digit_t value) {
 #endif
 }
 
+int bn_digit_count_trailing_zeros(bn_digit_t value) {
+#if UINTPTR_MAX == 0xFFFFFFFFFFFFFFFF
+// 64-bit system
+#if __GNUC__ || __clang__
+  return value == 0 ? 64 : __builtin_ctzll(value);
+#elif _MSC_VER
+  unsigned long index = 0; // NOLINT(runtime/int). MSVC insists.
+  return _BitScanForward64(&index, value) ? index : 64;
+#else
+#error Unsupported compiler.
+#endif
+#elif UINTPTR_MAX == 0xFFFFFFFF
+// 32-bit system
+#if __GNUC__ || __clang__
+  return value == 0 ? 32 : __builtin_ctz(value);
+#elif _MSC_VER
+  unsigned long index = 0; // NOLINT(runtime/int). MSVC insists.
+  return _BitScanForward(&index, value) ? index : 32;
+#else
+#error Unsupported compiler.
+#endif
+#else
+#error Unsupported platform.
+#endif
+}
+
+int bn_digit_popcount(bn_digit_t value) {
+#if __GNUC__ || __clang__
+  return __builtin_popcountll(value);
+#else
+  // Bits counted in pairs, nibbles and bytes, then the bytes are added up by
+  // the multiplication.
+  value -= value >> 1 & (bn_digit_t)-1 / 3;
+  value = (value & (bn_digit_t)-1 / 5) + (value >> 2 & (bn_digit_t)-1 / 5);
+  value = (value + (value >> 4)) & (bn_digit_t)-1 / 17;
+  return (int)((value * ((bn_digit_t)-1 / 255)) >> (DIGIT_BITS - 8));
+#endif
+}
+
 // quotient = (high << digit_bits + low - remainder) / divisor
 bn_digit_t bn_digit_div(bn_digit_t high, bn_digit_t low,
                                bn_digit_t divisor, bn_digit_t *remainder) {
@@ -300,97 +1067,2385 @@ bn_digit_t bn_digit_pow(bn_digit_t base, bn_digit_t exponent) {
   }
   return result;
 }
-//////////////////// STRING BUILDER ////////////////////
 
-typedef struct {
-  char *s;
-  size_t size;
-  size_t capacity;
-} bn_sb_t;
-void bn_sb_append_char(bn_sb_t *sb, const char c) {
-  BN_ASSERT(sb->capacity >= sb->size);
-  if (sb->size == sb->capacity) {
-    sb->capacity = sb->capacity == 0 ? 256 : 2 * sb->capacity;
-    sb->s = realloc(sb->s, sizeof(char) * sb->capacity);
-  }
-  sb->s[sb->size++] = c;
+// Division by invariant divisors with precomputed reciprocals (Moller and
+// Granlund, "Improved division by invariant integers"). The divisor must be
+// normalized, i.e. have its most significant bit set.
+
+// floor((B^2 - 1) / d) - B, the reciprocal for bn_digit_div_2by1
+bn_digit_t bn_digit_reciprocal(bn_digit_t d) {
+  BN_ASSERT(d >> (DIGIT_BITS - 1));
+  bn_digit_t r;
+  // B^2 - 1 - B * d = (B - 1 - d) * B + B - 1
+  return bn_digit_div(~d, ~(bn_digit_t)0, d, &r);
 }
-void bn_sb_append(bn_sb_t *sb, const char *s) {
-  if (s == NULL)
-    return;
-  while (*s != '\0')
-    bn_sb_append_char(sb, *s++);
+
+// floor((B^3 - 1) / (d1 * B + d0)) - B, the reciprocal for bn_digit_div_3by2
+bn_digit_t bn_digit_reciprocal_3by2(bn_digit_t d1, bn_digit_t d0) {
+  bn_digit_t v = bn_digit_reciprocal(d1);
+  bn_digit_t p = d1 * v + d0;
+  if (p < d0) {
+    v--;
+    if (p >= d1) {
+      v--;
+      p -= d1;
+    }
+    p -= d1;
+  }
+  bn_digit_t t1;
+  bn_digit_t t0 = bn_digit_mul(v, d0, &t1);
+  p += t1;
+  if (p < t1) {
+    v--;
+    if (p > d1 || (p == d1 && t0 >= d0))
+      v--;
+  }
+  return v;
 }
-char *bn_sb_to_str(bn_sb_t *sb) {
-  if (sb->size == 0 || sb->s[sb->size - 1] != '\0') {
-    bn_sb_append_char(sb, '\0');
+
+// quotient = (u1 * B + u0 - remainder) / d with u1 < d, see
+// bn_digit_reciprocal
+bn_digit_t bn_digit_div_2by1(bn_digit_t u1, bn_digit_t u0, bn_digit_t d,
+                             bn_digit_t dinv, bn_digit_t *remainder) {
+  BN_ASSERT(u1 < d);
+  bn_digit_t q1, c;
+  bn_digit_t q0 = bn_digit_mul(dinv, u1, &q1);
+  q0 = bn_digit_add2(q0, u0, &c);
+  q1 += u1 + 1 + c;
+  bn_digit_t r = u0 - q1 * d;
+  if (r > q0) {
+    q1--;
+    r += d;
   }
-  return sb->s;
+  if (r >= d) {
+    q1++;
+    r -= d;
+  }
+  *remainder = r;
+  return q1;
 }
-void bn_sb_reverse(bn_sb_t *sb) {
-  if (sb->size == 0)
-    return;
-  size_t len = sb->s[sb->size - 1] == '\0' ? sb->size - 1 : sb->size;
-  for (size_t i = 0; i < len / 2; ++i) {
-    char c = sb->s[i];
-    sb->s[i] = sb->s[len - i - 1];
-    sb->s[len - i - 1] = c;
+
+// quotient = (u2 * B^2 + u1 * B + u0 - remainder) / (d1 * B + d0) with
+// u2 * B + u1 < d1 * B + d0, the remainder is {r1, r0}. See
+// bn_digit_reciprocal_3by2.
+bn_digit_t bn_digit_div_3by2(bn_digit_t u2, bn_digit_t u1, bn_digit_t u0,
+                             bn_digit_t d1, bn_digit_t d0, bn_digit_t dinv,
+                             bn_digit_t *r1, bn_digit_t *r0) {
+  bn_digit_t q, c, b;
+  bn_digit_t q0 = bn_digit_mul(dinv, u2, &q);
+  q0 = bn_digit_add2(q0, u1, &c);
+  q += u2 + c;
+
+  // {h, l} = {u1, u0} - q * {d1, d0} - {d1, d0} mod B^2
+  bn_digit_t h = u1 - d1 * q;
+  bn_digit_t l = bn_digit_sub(u0, d0, &b);
+  h -= d1 + b;
+  bn_digit_t t1;
+  bn_digit_t t0 = bn_digit_mul(d0, q, &t1);
+  l = bn_digit_sub(l, t0, &b);
+  h -= t1 + b;
+  q++;
+
+  if (h >= q0) {
+    q--;
+    l = bn_digit_add2(l, d0, &c);
+    h += d1 + c;
   }
+  if (h > d1 || (h == d1 && l >= d0)) {
+    q++;
+    l = bn_digit_sub(l, d0, &b);
+    h -= d1 + b;
+  }
+  *r1 = h;
+  *r0 = l;
+  return q;
 }
-void bn_sb_free(bn_sb_t *sb) {
-  free(sb->s);
-  sb->size = 0;
-  sb->capacity = 0;
+
+//////////////////// DIGIT SPANS ////////////////////
+
+// The bn_mpn_* functions work on raw little-endian digit spans {ptr, len}.
+// Outputs must be sized by the caller, nothing is allocated here.
+
+void bn_mpn_zero(bn_digit_t *rp, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    rp[i] = 0;
 }
 
-//////////////////// BN UTILITIES ////////////////////
+void bn_mpn_copy(bn_digit_t *rp, const bn_digit_t *ap, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    rp[i] = ap[i];
+}
 
-void bn_resize(bn_t *bn, size_t size) {
-  if (size > bn->capacity) {
-    bn->capacity = size;
-    bn->digits = realloc(bn->digits, bn->capacity * sizeof(bn_digit_t));
-    BN_ASSERT(bn->digits != NULL);
+// Returns the length of {ap, n} without its leading zero digits.
+size_t bn_mpn_normalized_size(const bn_digit_t *ap, size_t n) {
+  while (n > 0 && ap[n - 1] == 0)
+    n--;
+  return n;
+}
+
+// Compares {ap, n} and {bp, n}, returns -1, 0, 1
+int bn_mpn_cmp(const bn_digit_t *ap, const bn_digit_t *bp, size_t n) {
+  while (n-- > 0) {
+    if (ap[n] != bp[n])
+      return ap[n] > bp[n] ? 1 : -1;
   }
-  for (size_t i = bn->size; i < size; ++i) {
-    bn->digits[i] = 0;
+  return 0;
+}
+
+// Compares {ap, an} and {bp, bn} of possibly different lengths
+int bn_mpn_cmp2(const bn_digit_t *ap, size_t an, const bn_digit_t *bp,
+                size_t bn) {
+  an = bn_mpn_normalized_size(ap, an);
+  bn = bn_mpn_normalized_size(bp, bn);
+  if (an != bn)
+    return an > bn ? 1 : -1;
+  return bn_mpn_cmp(ap, bp, an);
+}
+
+// {rp, n} = {ap, n} + b, returns the carry
+bn_digit_t bn_mpn_add_1(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                        bn_digit_t b) {
+  for (size_t i = 0; i < n; ++i)
+    rp[i] = bn_digit_add2(ap[i], b, &b);
+  return b;
+}
+
+// {rp, n} = {ap, n} - b, returns the borrow
+bn_digit_t bn_mpn_sub_1(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                        bn_digit_t b) {
+  for (size_t i = 0; i < n; ++i)
+    rp[i] = bn_digit_sub(ap[i], b, &b);
+  return b;
+}
+
+// {rp, n} = {ap, n} + {bp, n}, returns the carry
+bn_digit_t bn_mpn_add_n_portable(bn_digit_t *rp, const bn_digit_t *ap,
+                                 const bn_digit_t *bp, size_t n) {
+  bn_digit_t carry = 0;
+  for (size_t i = 0; i < n; ++i)
+    rp[i] = bn_digit_add3(ap[i], bp[i], carry, &carry);
+  return carry;
+}
+
+// {rp, n} = {ap, n} - {bp, n}, returns the borrow
+bn_digit_t bn_mpn_sub_n_portable(bn_digit_t *rp, const bn_digit_t *ap,
+                                 const bn_digit_t *bp, size_t n) {
+  bn_digit_t borrow = 0;
+  for (size_t i = 0; i < n; ++i)
+    rp[i] = bn_digit_sub2(ap[i], bp[i], borrow, &borrow);
+  return borrow;
+}
+
+// {rp, n} = {ap, n} * b, returns the high digit
+bn_digit_t bn_mpn_mul_1_portable(bn_digit_t *rp, const bn_digit_t *ap,
+                                 size_t n, bn_digit_t b) {
+  bn_digit_t carry = 0;
+  for (size_t i = 0; i < n; ++i) {
+    bn_digit_t high, c;
+    bn_digit_t low = bn_digit_mul(ap[i], b, &high);
+    rp[i] = bn_digit_add2(low, carry, &c);
+    carry = high + c;
   }
-  bn->size = size;
+  return carry;
 }
 
-void bn_append_digit(bn_t *bn, bn_digit_t d) {
-  BN_ASSERT(bn->capacity >= bn->size);
-  if (bn->size == bn->capacity) {
-    bn->capacity = bn->capacity == 0 ? BN_DEFAULT_CAPACITY : 2 * bn->capacity;
-    bn->digits = realloc(bn->digits, bn->capacity * sizeof(bn_digit_t));
+// {rp, n} += {ap, n} * b, returns the high digit
+bn_digit_t bn_mpn_addmul_1_portable(bn_digit_t *rp, const bn_digit_t *ap,
+                                    size_t n, bn_digit_t b) {
+  bn_digit_t carry = 0;
+  for (size_t i = 0; i < n; ++i) {
+    bn_digit_t high, c;
+    bn_digit_t low = bn_digit_mul(ap[i], b, &high);
+    rp[i] = bn_digit_add3(rp[i], low, carry, &c);
+    // rp[i] + low + carry + (high << DIGIT_BITS) fits in two digits, so this
+    // can not overflow.
+    carry = high + c;
   }
-  bn->digits[bn->size++] = d;
+  return carry;
 }
 
-void bn_set_digit(bn_t *bn, size_t i, bn_digit_t d) {
-  if (i >= bn->size) {
-    bn_resize(bn, i+1);
+// {rp, n} -= {ap, n} * b, returns the high digit, which is still to be
+// subtracted from the digit above {rp}
+bn_digit_t bn_mpn_submul_1_portable(bn_digit_t *rp, const bn_digit_t *ap,
+                                    size_t n, bn_digit_t b) {
+  bn_digit_t carry = 0;
+  for (size_t i = 0; i < n; ++i) {
+    bn_digit_t high, c;
+    bn_digit_t low = bn_digit_mul(ap[i], b, &high);
+    low = bn_digit_add2(low, carry, &c);
+    high += c;
+    rp[i] = bn_digit_sub(rp[i], low, &c);
+    carry = high + c;
   }
-  bn->digits[i] = d;
+  return carry;
 }
 
-void bn_reverse_digits(bn_t *bn) {
-  if (bn->size == 0)
-    return;
-  for (size_t i = 0; i < bn->size / 2; ++i) {
-    bn_digit_t d = bn->digits[i];
-    bn->digits[i] = bn->digits[bn->size - i - 1];
-    bn->digits[bn->size - i - 1] = d;
+// {rp, n + 1} = {rp, n} + {ap, n} * {bp, 2}, returns the high digit. Two rows
+// of a schoolbook multiplication at once: every a[i] is loaded once for both
+// products and {rp} is read and written once instead of twice.
+bn_digit_t bn_mpn_addmul_2_portable(bn_digit_t *rp, const bn_digit_t *ap,
+                                    size_t n, const bn_digit_t *bp) {
+  const bn_digit_t b0 = bp[0], b1 = bp[1];
+  // c0 and c1 are still to be added at rp[i] and rp[i + 1].
+  bn_digit_t c0 = 0, c1 = 0;
+  for (size_t i = 0; i < n; ++i) {
+    bn_digit_t high, c;
+    bn_digit_t low = bn_digit_mul(ap[i], b0, &high);
+    rp[i] = bn_digit_add3(rp[i], low, c0, &c);
+    high += c;
+    // a[i] * b1 + high + c1 fits in two digits, like in addmul_1.
+    bn_digit_t high1;
+    low = bn_digit_mul(ap[i], b1, &high1);
+    c0 = bn_digit_add3(low, high, c1, &c);
+    c1 = high1 + c;
   }
+  rp[n] = c0;
+  return c1;
 }
 
-const uint8_t CHAR_VALUE[] = {
-    255, 255, 255, 255, 255, 255, 255, 255, // 0..7
-    255, 255, 255, 255, 255, 255, 255, 255, // 8..15
-    255, 255, 255, 255, 255, 255, 255, 255, // 16..23
-    255, 255, 255, 255, 255, 255, 255, 255, // 24..31
-    255, 255, 255, 255, 255, 255, 255, 255, // 32..39
-    255, 255, 255, 255, 255, 255, 255, 255, // 40..47
-    0,   1,   2,   3,   4,   5,   6,   7,   // 48..55    '0' == 48
+// x86-64 versions of the kernels above. add_n/sub_n keep the carry in the
+// flags register across the whole loop, mul_1 uses MULX (BMI2) and
+// addmul_1/submul_1 run two independent carry chains with ADCX/ADOX (ADX), one
+// for the high halves of the products and one for the accumulation into {rp}.
+// They are only called when cpuid reports BMI2 and ADX, see
+// bn_select_kernels. Define BN_NO_ASM to leave them out.
+#if !defined(BN_NO_ASM) && defined(__x86_64__) && (__GNUC__ || __clang__)
+#define BN_HAVE_X86_64_ASM 1
+#include <cpuid.h>
+
+// The loops below only use instructions that leave the flags of the carry
+// chains alone for their bookkeeping: LEA, MOV, DEC (keeps CF) and JRCXZ.
+#define _BN_ASM_AORS_N(op)                                                     \
+  "movq %[r], %%rcx\n\t"                                                       \
+  "testq %%rcx, %%rcx\n\t" /* clears CF */                                     \
+  "jz 2f\n"                                                                    \
+  "1:\n\t"                                                                     \
+  "movq (%[ap]), %[t0]\n\t" op " (%[bp]), %[t0]\n\t"                           \
+  "movq %[t0], (%[rp])\n\t"                                                    \
+  "leaq 8(%[ap]), %[ap]\n\t"                                                   \
+  "leaq 8(%[bp]), %[bp]\n\t"                                                   \
+  "leaq 8(%[rp]), %[rp]\n\t"                                                   \
+  "decq %%rcx\n\t"                                                             \
+  "jnz 1b\n"                                                                   \
+  "2:\n\t"                                                                     \
+  "movq %[q], %%rcx\n\t"                                                       \
+  "jrcxz 4f\n"                                                                 \
+  "3:\n\t"                                                                     \
+  "movq (%[ap]), %[t0]\n\t"                                                    \
+  "movq 8(%[ap]), %[t1]\n\t" op " (%[bp]), %[t0]\n\t" op " 8(%[bp]), %[t1]\n\t" \
+  "movq %[t0], (%[rp])\n\t"                                                    \
+  "movq %[t1], 8(%[rp])\n\t"                                                   \
+  "movq 16(%[ap]), %[t0]\n\t"                                                  \
+  "movq 24(%[ap]), %[t1]\n\t" op " 16(%[bp]), %[t0]\n\t" op                    \
+  " 24(%[bp]), %[t1]\n\t"                                                      \
+  "movq %[t0], 16(%[rp])\n\t"                                                  \
+  "movq %[t1], 24(%[rp])\n\t"                                                  \
+  "leaq 32(%[ap]), %[ap]\n\t"                                                  \
+  "leaq 32(%[bp]), %[bp]\n\t"                                                  \
+  "leaq 32(%[rp]), %[rp]\n\t"                                                  \
+  "decq %%rcx\n\t"                                                             \
+  "jnz 3b\n"                                                                   \
+  "4:\n\t"                                                                     \
+  "movl $0, %k[t0]\n\t"                                                        \
+  "adcq $0, %[t0]\n\t"
+
+static bn_digit_t _bn_mpn_add_n_x86_64(bn_digit_t *rp, const bn_digit_t *ap,
+                                       const bn_digit_t *bp, size_t n) {
+  bn_digit_t t0, t1;
+  __asm__ volatile(_BN_ASM_AORS_N("adcq")
+                   : [rp] "+r"(rp), [ap] "+r"(ap), [bp] "+r"(bp),
+                     [t0] "=&r"(t0), [t1] "=&r"(t1)
+                   : [r] "r"(n & 3), [q] "r"(n >> 2)
+                   : "rcx", "cc", "memory");
+  return t0;
+}
+
+static bn_digit_t _bn_mpn_sub_n_x86_64(bn_digit_t *rp, const bn_digit_t *ap,
+                                       const bn_digit_t *bp, size_t n) {
+  bn_digit_t t0, t1;
+  __asm__ volatile(_BN_ASM_AORS_N("sbbq")
+                   : [rp] "+r"(rp), [ap] "+r"(ap), [bp] "+r"(bp),
+                     [t0] "=&r"(t0), [t1] "=&r"(t1)
+                   : [r] "r"(n & 3), [q] "r"(n >> 2)
+                   : "rcx", "cc", "memory");
+  return t0;
+}
+
+static bn_digit_t _bn_mpn_mul_1_mulx(bn_digit_t *rp, const bn_digit_t *ap,
+                                     size_t n, bn_digit_t b) {
+  // r[i] = lo(a[i] * b) + hi(a[i - 1] * b) + CF
+  bn_digit_t carry, lo, hi;
+  if (n == 0)
+    return 0;
+  __asm__ volatile("xorl %k[carry], %k[carry]\n" // clears CF
+                   "1:\n\t"
+                   "mulxq (%[ap]), %[lo], %[hi]\n\t"
+                   "adcq %[carry], %[lo]\n\t"
+                   "movq %[lo], (%[rp])\n\t"
+                   "movq %[hi], %[carry]\n\t"
+                   "leaq 8(%[ap]), %[ap]\n\t"
+                   "leaq 8(%[rp]), %[rp]\n\t"
+                   "decq %[n]\n\t"
+                   "jnz 1b\n\t"
+                   "adcq $0, %[carry]\n\t"
+                   : [rp] "+r"(rp), [ap] "+r"(ap), [n] "+r"(n),
+                     [carry] "=&r"(carry), [lo] "=&r"(lo), [hi] "=&r"(hi)
+                   : "d"(b)
+                   : "cc", "memory");
+  return carry;
+}
+
+static bn_digit_t _bn_mpn_addmul_1_adx(bn_digit_t *rp, const bn_digit_t *ap,
+                                       size_t n, bn_digit_t b) {
+  // r[i] = r[i] + OF + lo(a[i] * b) + hi(a[i - 1] * b) + CF
+  bn_digit_t carry, lo0, hi0, lo1, hi1;
+  __asm__ volatile(
+      "xorl %k[carry], %k[carry]\n\t" // clears CF and OF
+      "movq %[r], %%rcx\n"
+      "1:\n\t"
+      "jrcxz 2f\n\t"
+      "mulxq (%[ap]), %[lo0], %[hi0]\n\t"
+      "adcxq %[carry], %[lo0]\n\t"
+      "adoxq (%[rp]), %[lo0]\n\t"
+      "movq %[lo0], (%[rp])\n\t"
+      "movq %[hi0], %[carry]\n\t"
+      "leaq 8(%[ap]), %[ap]\n\t"
+      "leaq 8(%[rp]), %[rp]\n\t"
+      "leaq -1(%%rcx), %%rcx\n\t"
+      "jmp 1b\n"
+      "2:\n\t"
+      "movq %[q], %%rcx\n"
+      "3:\n\t"
+      "jrcxz 4f\n\t"
+      "mulxq (%[ap]), %[lo0], %[hi0]\n\t"
+      "mulxq 8(%[ap]), %[lo1], %[hi1]\n\t"
+      "adcxq %[carry], %[lo0]\n\t"
+      "adoxq (%[rp]), %[lo0]\n\t"
+      "movq %[lo0], (%[rp])\n\t"
+      "adcxq %[hi0], %[lo1]\n\t"
+      "adoxq 8(%[rp]), %[lo1]\n\t"
+      "movq %[lo1], 8(%[rp])\n\t"
+      "mulxq 16(%[ap]), %[lo0], %[hi0]\n\t"
+      "adcxq %[hi1], %[lo0]\n\t"
+      "adoxq 16(%[rp]), %[lo0]\n\t"
+      "movq %[lo0], 16(%[rp])\n\t"
+      "mulxq 24(%[ap]), %[lo1], %[carry]\n\t"
+      "adcxq %[hi0], %[lo1]\n\t"
+      "adoxq 24(%[rp]), %[lo1]\n\t"
+      "movq %[lo1], 24(%[rp])\n\t"
+      "leaq 32(%[ap]), %[ap]\n\t"
+      "leaq 32(%[rp]), %[rp]\n\t"
+      "leaq -1(%%rcx), %%rcx\n\t"
+      "jmp 3b\n"
+      "4:\n\t"
+      // The result fits in a digit, so neither of these can overflow.
+      "movl $0, %k[lo0]\n\t"
+      "adcxq %[lo0], %[carry]\n\t"
+      "adoxq %[lo0], %[carry]\n\t"
+      : [rp] "+r"(rp), [ap] "+r"(ap), [carry] "=&r"(carry), [lo0] "=&r"(lo0),
+        [hi0] "=&r"(hi0), [lo1] "=&r"(lo1), [hi1] "=&r"(hi1)
+      : [r] "r"(n & 3), [q] "r"(n >> 2), "d"(b)
+      : "rcx", "cc", "memory");
+  return carry;
+}
+
+static bn_digit_t _bn_mpn_submul_1_adx(bn_digit_t *rp, const bn_digit_t *ap,
+                                       size_t n, bn_digit_t b) {
+  // r - a * b = ~(~r + a * b): the addmul_1 loop on the complemented digits
+  // of {rp}, whose high digit is the borrow. NOT leaves the flags alone.
+  bn_digit_t carry, lo0, hi0, lo1, hi1, t;
+  __asm__ volatile(
+      "xorl %k[carry], %k[carry]\n\t" // clears CF and OF
+      "movq %[r], %%rcx\n"
+      "1:\n\t"
+      "jrcxz 2f\n\t"
+      "mulxq (%[ap]), %[lo0], %[hi0]\n\t"
+      "movq (%[rp]), %[t]\n\t"
+      "notq %[t]\n\t"
+      "adcxq %[carry], %[lo0]\n\t"
+      "adoxq %[t], %[lo0]\n\t"
+      "notq %[lo0]\n\t"
+      "movq %[lo0], (%[rp])\n\t"
+      "movq %[hi0], %[carry]\n\t"
+      "leaq 8(%[ap]), %[ap]\n\t"
+      "leaq 8(%[rp]), %[rp]\n\t"
+      "leaq -1(%%rcx), %%rcx\n\t"
+      "jmp 1b\n"
+      "2:\n\t"
+      "movq %[q], %%rcx\n\t"
+      // The loop body is too long for a JRCXZ over it, so test at the bottom.
+      "jmp 5f\n"
+      "3:\n\t"
+      "mulxq (%[ap]), %[lo0], %[hi0]\n\t"
+      "mulxq 8(%[ap]), %[lo1], %[hi1]\n\t"
+      "movq (%[rp]), %[t]\n\t"
+      "notq %[t]\n\t"
+      "adcxq %[carry], %[lo0]\n\t"
+      "adoxq %[t], %[lo0]\n\t"
+      "notq %[lo0]\n\t"
+      "movq %[lo0], (%[rp])\n\t"
+      "movq 8(%[rp]), %[t]\n\t"
+      "notq %[t]\n\t"
+      "adcxq %[hi0], %[lo1]\n\t"
+      "adoxq %[t], %[lo1]\n\t"
+      "notq %[lo1]\n\t"
+      "movq %[lo1], 8(%[rp])\n\t"
+      "mulxq 16(%[ap]), %[lo0], %[hi0]\n\t"
+      "movq 16(%[rp]), %[t]\n\t"
+      "notq %[t]\n\t"
+      "adcxq %[hi1], %[lo0]\n\t"
+      "adoxq %[t], %[lo0]\n\t"
+      "notq %[lo0]\n\t"
+      "movq %[lo0], 16(%[rp])\n\t"
+      "mulxq 24(%[ap]), %[lo1], %[carry]\n\t"
+      "movq 24(%[rp]), %[t]\n\t"
+      "notq %[t]\n\t"
+      "adcxq %[hi0], %[lo1]\n\t"
+      "adoxq %[t], %[lo1]\n\t"
+      "notq %[lo1]\n\t"
+      "movq %[lo1], 24(%[rp])\n\t"
+      "leaq 32(%[ap]), %[ap]\n\t"
+      "leaq 32(%[rp]), %[rp]\n\t"
+      "leaq -1(%%rcx), %%rcx\n"
+      "5:\n\t"
+      "jrcxz 4f\n\t"
+      "jmp 3b\n"
+      "4:\n\t"
+      "movl $0, %k[lo0]\n\t"
+      "adcxq %[lo0], %[carry]\n\t"
+      "adoxq %[lo0], %[carry]\n\t"
+      : [rp] "+r"(rp), [ap] "+r"(ap), [carry] "=&r"(carry), [lo0] "=&r"(lo0),
+        [hi0] "=&r"(hi0), [lo1] "=&r"(lo1), [hi1] "=&r"(hi1), [t] "=&r"(t)
+      : [r] "r"(n & 3), [q] "r"(n >> 2), "d"(b)
+      : "rcx", "cc", "memory");
+  return carry;
+}
+
+// Two addmul_1 rows. Both chains of the ADX kernel are taken by one row, so
+// the rows are not interleaved here.
+static bn_digit_t _bn_mpn_addmul_2_adx(bn_digit_t *rp, const bn_digit_t *ap,
+                                       size_t n, const bn_digit_t *bp) {
+  rp[n] = _bn_mpn_addmul_1_adx(rp, ap, n, bp[0]);
+  return _bn_mpn_addmul_1_adx(rp + 1, ap, n, bp[1]);
+}
+
+#undef _BN_ASM_AORS_N
+#endif // BN_HAVE_X86_64_ASM
+
+// Returns true if the CPU supports the BN_KERNELS_ADX kernels.
+static bool _bn_cpu_has_adx(void) {
+#if BN_HAVE_X86_64_ASM
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid_max(0, NULL) < 7)
+    return false;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  (void)eax, (void)ecx, (void)edx;
+  // CPUID.(EAX=7, ECX=0):EBX bit 8 is BMI2 (MULX), bit 19 is ADX.
+  return (ebx & (1u << 8)) && (ebx & (1u << 19));
+#else
+  return false;
+#endif
+}
+
+static bn_digit_t _bn_mpn_add_n_init(bn_digit_t *rp, const bn_digit_t *ap,
+                                     const bn_digit_t *bp, size_t n);
+static bn_digit_t _bn_mpn_sub_n_init(bn_digit_t *rp, const bn_digit_t *ap,
+                                     const bn_digit_t *bp, size_t n);
+static bn_digit_t _bn_mpn_mul_1_init(bn_digit_t *rp, const bn_digit_t *ap,
+                                     size_t n, bn_digit_t b);
+static bn_digit_t _bn_mpn_addmul_1_init(bn_digit_t *rp, const bn_digit_t *ap,
+                                        size_t n, bn_digit_t b);
+static bn_digit_t _bn_mpn_submul_1_init(bn_digit_t *rp, const bn_digit_t *ap,
+                                        size_t n, bn_digit_t b);
+static bn_digit_t _bn_mpn_addmul_2_init(bn_digit_t *rp, const bn_digit_t *ap,
+                                        size_t n, const bn_digit_t *bp);
+
+// The kernels behind bn_mpn_add_n, bn_mpn_sub_n, bn_mpn_mul_1,
+// bn_mpn_addmul_1, bn_mpn_submul_1 and bn_mpn_addmul_2. They start out as
+// stubs which select the kernels on first use.
+static struct {
+  bn_kernels_t selected;
+  bn_digit_t (*add_n)(bn_digit_t *, const bn_digit_t *, const bn_digit_t *,
+                      size_t);
+  bn_digit_t (*sub_n)(bn_digit_t *, const bn_digit_t *, const bn_digit_t *,
+                      size_t);
+  bn_digit_t (*mul_1)(bn_digit_t *, const bn_digit_t *, size_t, bn_digit_t);
+  bn_digit_t (*addmul_1)(bn_digit_t *, const bn_digit_t *, size_t,
+                         bn_digit_t);
+  bn_digit_t (*submul_1)(bn_digit_t *, const bn_digit_t *, size_t,
+                         bn_digit_t);
+  bn_digit_t (*addmul_2)(bn_digit_t *, const bn_digit_t *, size_t,
+                         const bn_digit_t *);
+} _bn_kernels = {BN_KERNELS_AUTO,       _bn_mpn_add_n_init,
+                 _bn_mpn_sub_n_init,    _bn_mpn_mul_1_init,
+                 _bn_mpn_addmul_1_init, _bn_mpn_submul_1_init,
+                 _bn_mpn_addmul_2_init};
+
+// The kernels are stored atomically, as the stubs may replace them while
+// other threads call them.
+#define _BN_KERNEL(name) _BN_ATOMIC_LOAD_RELAXED(&_bn_kernels.name)
+
+bn_kernels_t bn_select_kernels(bn_kernels_t kernels) {
+  if (kernels == BN_KERNELS_AUTO) {
+    const char *env = getenv("BN_KERNELS");
+    if (env != NULL && strcmp(env, "portable") == 0)
+      kernels = BN_KERNELS_PORTABLE;
+    else if (env != NULL && strcmp(env, "adx") == 0)
+      kernels = BN_KERNELS_ADX;
+    else
+      kernels = _bn_cpu_has_adx() ? BN_KERNELS_ADX : BN_KERNELS_PORTABLE;
+  }
+  if (kernels == BN_KERNELS_ADX && !_bn_cpu_has_adx())
+    kernels = BN_KERNELS_PORTABLE;
+
+  switch (kernels) {
+#if BN_HAVE_X86_64_ASM
+  case BN_KERNELS_ADX:
+    _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.add_n, _bn_mpn_add_n_x86_64);
+    _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.sub_n, _bn_mpn_sub_n_x86_64);
+    _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.mul_1, _bn_mpn_mul_1_mulx);
+    _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.addmul_1, _bn_mpn_addmul_1_adx);
+    _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.submul_1, _bn_mpn_submul_1_adx);
+    _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.addmul_2, _bn_mpn_addmul_2_adx);
+    break;
+#endif
+  default:
+    kernels = BN_KERNELS_PORTABLE;
+    _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.add_n, bn_mpn_add_n_portable);
+    _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.sub_n, bn_mpn_sub_n_portable);
+    _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.mul_1, bn_mpn_mul_1_portable);
+    _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.addmul_1, bn_mpn_addmul_1_portable);
+    _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.submul_1, bn_mpn_submul_1_portable);
+    _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.addmul_2, bn_mpn_addmul_2_portable);
+    break;
+  }
+  _BN_ATOMIC_STORE_RELAXED(&_bn_kernels.selected, kernels);
+  return kernels;
+}
+
+// Selects the kernels on first use. Threads making their first calls at the
+// same time wait for a single selection.
+#if BN_HAVE_THREADS
+static pthread_once_t _bn_kernels_once = PTHREAD_ONCE_INIT;
+
+static void _bn_kernels_auto(void) { bn_select_kernels(BN_KERNELS_AUTO); }
+#endif
+
+static void _bn_kernels_init(void) {
+#if BN_HAVE_THREADS
+  pthread_once(&_bn_kernels_once, _bn_kernels_auto);
+#else
+  bn_select_kernels(BN_KERNELS_AUTO);
+#endif
+}
+
+bn_kernels_t bn_get_kernels(void) {
+  if (_BN_ATOMIC_LOAD_RELAXED(&_bn_kernels.selected) == BN_KERNELS_AUTO)
+    _bn_kernels_init();
+  return _BN_ATOMIC_LOAD_RELAXED(&_bn_kernels.selected);
+}
+
+static bn_digit_t _bn_mpn_add_n_init(bn_digit_t *rp, const bn_digit_t *ap,
+                                     const bn_digit_t *bp, size_t n) {
+  _bn_kernels_init();
+  return _BN_KERNEL(add_n)(rp, ap, bp, n);
+}
+
+static bn_digit_t _bn_mpn_sub_n_init(bn_digit_t *rp, const bn_digit_t *ap,
+                                     const bn_digit_t *bp, size_t n) {
+  _bn_kernels_init();
+  return _BN_KERNEL(sub_n)(rp, ap, bp, n);
+}
+
+static bn_digit_t _bn_mpn_mul_1_init(bn_digit_t *rp, const bn_digit_t *ap,
+                                     size_t n, bn_digit_t b) {
+  _bn_kernels_init();
+  return _BN_KERNEL(mul_1)(rp, ap, n, b);
+}
+
+static bn_digit_t _bn_mpn_addmul_1_init(bn_digit_t *rp, const bn_digit_t *ap,
+                                        size_t n, bn_digit_t b) {
+  _bn_kernels_init();
+  return _BN_KERNEL(addmul_1)(rp, ap, n, b);
+}
+
+static bn_digit_t _bn_mpn_submul_1_init(bn_digit_t *rp, const bn_digit_t *ap,
+                                        size_t n, bn_digit_t b) {
+  _bn_kernels_init();
+  return _BN_KERNEL(submul_1)(rp, ap, n, b);
+}
+
+static bn_digit_t _bn_mpn_addmul_2_init(bn_digit_t *rp, const bn_digit_t *ap,
+                                        size_t n, const bn_digit_t *bp) {
+  _bn_kernels_init();
+  return _BN_KERNEL(addmul_2)(rp, ap, n, bp);
+}
+
+// {rp, n} = {ap, n} + {bp, n}, returns the carry
+bn_digit_t bn_mpn_add_n(bn_digit_t *rp, const bn_digit_t *ap,
+                        const bn_digit_t *bp, size_t n) {
+  return _BN_KERNEL(add_n)(rp, ap, bp, n);
+}
+
+// {rp, n} = {ap, n} - {bp, n}, returns the borrow
+bn_digit_t bn_mpn_sub_n(bn_digit_t *rp, const bn_digit_t *ap,
+                        const bn_digit_t *bp, size_t n) {
+  return _BN_KERNEL(sub_n)(rp, ap, bp, n);
+}
+
+// {rp, n} = {ap, n} * b, returns the high digit
+bn_digit_t bn_mpn_mul_1(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                        bn_digit_t b) {
+  return _BN_KERNEL(mul_1)(rp, ap, n, b);
+}
+
+// {rp, n} += {ap, n} * b, returns the high digit
+bn_digit_t bn_mpn_addmul_1(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                           bn_digit_t b) {
+  return _BN_KERNEL(addmul_1)(rp, ap, n, b);
+}
+
+// {rp, n} -= {ap, n} * b, returns the high digit, which is still to be
+// subtracted from the digit above {rp}
+bn_digit_t bn_mpn_submul_1(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                           bn_digit_t b) {
+  return _BN_KERNEL(submul_1)(rp, ap, n, b);
+}
+
+// {rp, n + 1} = {rp, n} + {ap, n} * {bp, 2}, returns the high digit
+bn_digit_t bn_mpn_addmul_2(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                           const bn_digit_t *bp) {
+  return _BN_KERNEL(addmul_2)(rp, ap, n, bp);
+}
+
+// {rp, an} = {ap, an} + {bp, bn} with an >= bn, returns the carry
+bn_digit_t bn_mpn_add(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                      const bn_digit_t *bp, size_t bn) {
+  BN_ASSERT(an >= bn);
+  bn_digit_t carry = bn_mpn_add_n(rp, ap, bp, bn);
+  return bn_mpn_add_1(rp + bn, ap + bn, an - bn, carry);
+}
+
+// {rp, an} = {ap, an} - {bp, bn} with an >= bn, returns the borrow
+bn_digit_t bn_mpn_sub(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                      const bn_digit_t *bp, size_t bn) {
+  BN_ASSERT(an >= bn);
+  bn_digit_t borrow = bn_mpn_sub_n(rp, ap, bp, bn);
+  return bn_mpn_sub_1(rp + bn, ap + bn, an - bn, borrow);
+}
+
+// {rp, an} = |{ap, an} - {bp, bn}| with an >= bn.
+// Returns 1 if {ap, an} < {bp, bn}, 0 otherwise.
+int bn_mpn_diff(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                const bn_digit_t *bp, size_t bn) {
+  BN_ASSERT(an >= bn);
+  if (bn_mpn_cmp2(ap, an, bp, bn) >= 0) {
+    bn_mpn_sub(rp, ap, an, bp, bn);
+    return 0;
+  }
+  // {ap, an} < {bp, bn}, so at most the low bn digits of {ap, an} are set.
+  bn_mpn_sub_n(rp, bp, ap, bn);
+  bn_mpn_zero(rp + bn, an - bn);
+  return 1;
+}
+
+// Bitwise operations on {ap, n} and {bp, n}. The four digits of a step are
+// loaded before any is stored, so compilers can keep them in one or two
+// vector registers even when rp is ap or bp.
+#define _BN_MPN_LOGIC_N(name, op)                                              \
+  void name(bn_digit_t *rp, const bn_digit_t *ap, const bn_digit_t *bp,        \
+            size_t n) {                                                        \
+    size_t i = 0;                                                              \
+    for (; i + 4 <= n; i += 4) {                                               \
+      const bn_digit_t a0 = ap[i], a1 = ap[i + 1], a2 = ap[i + 2],             \
+                       a3 = ap[i + 3];                                         \
+      const bn_digit_t b0 = bp[i], b1 = bp[i + 1], b2 = bp[i + 2],             \
+                       b3 = bp[i + 3];                                         \
+      rp[i] = a0 op b0;                                                        \
+      rp[i + 1] = a1 op b1;                                                    \
+      rp[i + 2] = a2 op b2;                                                    \
+      rp[i + 3] = a3 op b3;                                                    \
+    }                                                                          \
+    for (; i < n; ++i)                                                         \
+      rp[i] = ap[i] op bp[i];                                                  \
+  }
+
+_BN_MPN_LOGIC_N(bn_mpn_and_n, &)
+_BN_MPN_LOGIC_N(bn_mpn_ior_n, |)
+_BN_MPN_LOGIC_N(bn_mpn_xor_n, ^)
+#undef _BN_MPN_LOGIC_N
+
+// {rp, n} = ~{ap, n}
+void bn_mpn_com(bn_digit_t *rp, const bn_digit_t *ap, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const bn_digit_t a0 = ap[i], a1 = ap[i + 1], a2 = ap[i + 2],
+                     a3 = ap[i + 3];
+    rp[i] = ~a0;
+    rp[i + 1] = ~a1;
+    rp[i + 2] = ~a2;
+    rp[i + 3] = ~a3;
+  }
+  for (; i < n; ++i)
+    rp[i] = ~ap[i];
+}
+
+#if BN_HAVE_X86_64_ASM
+#include <emmintrin.h>
+
+// Set bits of {ap, n} for even n, two digits at a time with SSE2, which every
+// x86-64 CPU has. Every byte counts its own bits, and PSADBW adds up the
+// bytes of each half.
+static size_t _bn_mpn_popcount_sse2(const bn_digit_t *ap, size_t n) {
+  const __m128i m1 = _mm_set1_epi8(0x55);
+  const __m128i m2 = _mm_set1_epi8(0x33);
+  const __m128i m4 = _mm_set1_epi8(0x0f);
+  __m128i sum = _mm_setzero_si128();
+  for (size_t i = 0; i < n; i += 2) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(ap + i));
+    x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi64(x, 1), m1));
+    x = _mm_add_epi8(_mm_and_si128(x, m2),
+                     _mm_and_si128(_mm_srli_epi64(x, 2), m2));
+    x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi64(x, 4)), m4);
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(x, _mm_setzero_si128()));
+  }
+  return (size_t)_mm_cvtsi128_si64(sum) +
+         (size_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum));
+}
+#endif
+
+// Number of set bits of {ap, n}
+size_t bn_mpn_popcount(const bn_digit_t *ap, size_t n) {
+  size_t count = 0, i = 0;
+#if BN_HAVE_X86_64_ASM
+  i = n - n % 2;
+  count = _bn_mpn_popcount_sse2(ap, i);
+#endif
+  for (; i < n; ++i)
+    count += bn_digit_popcount(ap[i]);
+  return count;
+}
+
+// A read-only bn_t of the normalized {dp, n}. Spans that fit are copied into
+// the inline digits.
+static bn_t _bn_view(const bn_digit_t *dp, size_t n) {
+  bn_t V = {0};
+  V.size = n;
+  V.sign = 1;
+  if (n > BN_INLINE_DIGITS) {
+    V.heap = (bn_digit_t *)dp;
+    V.capacity = n;
+  } else {
+    bn_mpn_copy(V.inline_digits, dp, n);
+    V.capacity = BN_INLINE_DIGITS;
+  }
+  return V;
+}
+
+//////////////////// THREADS ////////////////////
+
+// Large products are split into tasks for a pool of worker threads. A fork
+// queues a task, which an idle worker takes off the queue; a join runs the
+// task itself if no worker took it yet, and otherwise runs other queued
+// tasks until it is done. So nested forks never wait on a busy pool, and the
+// threads stay busy while there is work. Tasks take their temporaries from
+// the arena of the thread running them.
+
+typedef enum {
+  _BN_TASK_QUEUED,
+  _BN_TASK_RUNNING,
+  _BN_TASK_DONE,
+} _bn_task_state_t;
+
+typedef struct _bn_task {
+  void (*run)(struct _bn_task *);
+  _bn_task_state_t state; // guarded by the pool lock
+  struct _bn_task *next;
+} _bn_task_t;
+
+#if BN_HAVE_THREADS
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t queued; // a task was queued or the thread count changed
+  pthread_cond_t done;   // a task is done
+  _bn_task_t *head, *tail;
+  unsigned threads; // including the calling thread
+  unsigned workers; // running, workers beyond threads - 1 exit
+  pthread_t *handles; // of the workers, owned by bn_set_threads
+} _bn_pool = {PTHREAD_MUTEX_INITIALIZER,
+              PTHREAD_COND_INITIALIZER,
+              PTHREAD_COND_INITIALIZER,
+              NULL,
+              NULL,
+              1,
+              0,
+              NULL};
+
+// Runs T, which is off the queue, with the pool lock held before and after.
+static void _bn_task_run_locked(_bn_task_t *T) {
+  T->state = _BN_TASK_RUNNING;
+  pthread_mutex_unlock(&_bn_pool.lock);
+  T->run(T);
+  pthread_mutex_lock(&_bn_pool.lock);
+  T->state = _BN_TASK_DONE;
+  pthread_cond_broadcast(&_bn_pool.done);
+}
+
+// Takes T, or the oldest task if T is NULL, off the queue. Returns NULL if
+// it is not there.
+static _bn_task_t *_bn_pool_take(_bn_task_t *T) {
+  _bn_task_t **link = &_bn_pool.head, *prev = NULL;
+  while (*link != NULL && T != NULL && *link != T) {
+    prev = *link;
+    link = &(*link)->next;
+  }
+  _bn_task_t *taken = *link;
+  if (taken != NULL) {
+    *link = taken->next;
+    if (_bn_pool.tail == taken)
+      _bn_pool.tail = prev;
+  }
+  return taken;
+}
+
+static void *_bn_worker(void *arg) {
+  const unsigned id = (unsigned)(uintptr_t)arg;
+  pthread_mutex_lock(&_bn_pool.lock);
+  for (;;) {
+    while (_bn_pool.head == NULL && id + 1 < _bn_pool.threads)
+      pthread_cond_wait(&_bn_pool.queued, &_bn_pool.lock);
+    if (id + 1 >= _bn_pool.threads)
+      break;
+    _bn_task_run_locked(_bn_pool_take(NULL));
+  }
+  pthread_mutex_unlock(&_bn_pool.lock);
+  // The tasks left on the queue are run by the threads joining them.
+  bn_scratch_free(NULL);
+  return NULL;
+}
+
+static void _bn_fork(_bn_task_t *T) {
+  T->next = NULL;
+  pthread_mutex_lock(&_bn_pool.lock);
+  T->state = _BN_TASK_QUEUED;
+  if (_bn_pool.tail != NULL)
+    _bn_pool.tail->next = T;
+  else
+    _bn_pool.head = T;
+  _bn_pool.tail = T;
+  pthread_cond_broadcast(&_bn_pool.queued);
+  pthread_mutex_unlock(&_bn_pool.lock);
+}
+
+static void _bn_join(_bn_task_t *T) {
+  pthread_mutex_lock(&_bn_pool.lock);
+  if (T->state == _BN_TASK_QUEUED)
+    _bn_task_run_locked(_bn_pool_take(T));
+  while (T->state != _BN_TASK_DONE) {
+    _bn_task_t *other = _bn_pool_take(NULL);
+    if (other != NULL)
+      _bn_task_run_locked(other);
+    else
+      pthread_cond_wait(&_bn_pool.done, &_bn_pool.lock);
+  }
+  pthread_mutex_unlock(&_bn_pool.lock);
+}
+
+// Starts or stops workers. Workers beyond the new count finish their task
+// and exit, and are joined before bn_set_threads returns. Must not be called
+// from a task.
+unsigned bn_set_threads(unsigned threads) {
+  static pthread_mutex_t resize = PTHREAD_MUTEX_INITIALIZER;
+  if (threads < 1)
+    threads = 1;
+  // The workers find the kernels selected.
+  bn_get_kernels();
+  pthread_mutex_lock(&resize);
+  if (threads > _bn_pool.workers + 1) {
+    pthread_t *handles = (pthread_t *)BN_REALLOC(
+        _bn_pool.handles, (threads - 1) * sizeof(pthread_t));
+    if (handles == NULL)
+      threads = _bn_pool.workers + 1;
+    else
+      _bn_pool.handles = handles;
+  }
+
+  pthread_mutex_lock(&_bn_pool.lock);
+  _bn_pool.threads = threads;
+  while (_bn_pool.workers + 1 < threads) {
+    if (pthread_create(&_bn_pool.handles[_bn_pool.workers], NULL, _bn_worker,
+                       (void *)(uintptr_t)_bn_pool.workers) != 0) {
+      threads = _bn_pool.threads = _bn_pool.workers + 1;
+      break;
+    }
+    _bn_pool.workers++;
+  }
+  pthread_cond_broadcast(&_bn_pool.queued);
+  pthread_mutex_unlock(&_bn_pool.lock);
+
+  while (_bn_pool.workers + 1 > threads)
+    pthread_join(_bn_pool.handles[--_bn_pool.workers], NULL);
+  if (_bn_pool.workers == 0) {
+    BN_FREE(_bn_pool.handles);
+    _bn_pool.handles = NULL;
+  }
+  pthread_mutex_unlock(&resize);
+  return threads;
+}
+
+unsigned bn_get_threads(void) { return _bn_pool.threads; }
+#else
+static void _bn_fork(_bn_task_t *T) {
+  T->state = _BN_TASK_RUNNING;
+  T->run(T);
+  T->state = _BN_TASK_DONE;
+}
+
+static void _bn_join(_bn_task_t *T) { (void)T; }
+
+unsigned bn_set_threads(unsigned threads) {
+  (void)threads;
+  return 1;
+}
+
+unsigned bn_get_threads(void) { return 1; }
+#endif // BN_HAVE_THREADS
+
+// Whether the subproducts of operands of n digits are worth a fork
+static bool _bn_parallel(size_t n) {
+#if BN_HAVE_THREADS
+  return n >= BN_PARALLEL_THRESHOLD && _bn_pool.threads > 1;
+#else
+  (void)n;
+  return false;
+#endif
+}
+
+// {rp} = {ap, an} * {bp, bn}, or {ap, an}^2 if bp is NULL, as a task
+typedef struct {
+  _bn_task_t task;
+  bn_digit_t *rp;
+  const bn_digit_t *ap, *bp;
+  size_t an, bn;
+} _bn_mul_task_t;
+
+static void _bn_mul_task_run(_bn_task_t *T) {
+  const _bn_mul_task_t *M = (const _bn_mul_task_t *)T;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  if (M->bp == NULL)
+    bn_mpn_sqr(M->rp, M->ap, M->an,
+               _bn_scratch_alloc(S, bn_mpn_sqr_itch(M->an)));
+  else
+    bn_mpn_mul(M->rp, M->ap, M->an, M->bp, M->bn,
+               _bn_scratch_alloc(S, bn_mpn_mul_itch(M->an, M->bn)));
+  _bn_scratch_release(S, mark);
+}
+
+static void _bn_mul_fork(_bn_mul_task_t *M, bn_digit_t *rp,
+                         const bn_digit_t *ap, size_t an,
+                         const bn_digit_t *bp, size_t bn) {
+  M->task.run = _bn_mul_task_run;
+  M->rp = rp;
+  M->ap = ap;
+  M->an = an;
+  M->bp = bp;
+  M->bn = bn;
+  _bn_fork(&M->task);
+}
+
+//////////////////// MULTIPLICATION ////////////////////
+
+// All bn_mpn_mul* functions compute {rp, an + bn} = {ap, an} * {bp, bn} with
+// an >= bn >= 1. {rp} must not overlap the inputs. Temporaries are carved out
+// of {scratch}, which must hold bn_mpn_mul_itch(an, bn) digits.
+
+void bn_mpn_mul(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                const bn_digit_t *bp, size_t bn, bn_digit_t *scratch);
+// {rp, 2n} = {ap, n}^2, scratch as for bn_mpn_mul (see bn_mpn_sqr_itch)
+void bn_mpn_sqr(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                bn_digit_t *scratch);
+
+// {qp, n} = {ap, n} / (d >> shift), returns the remainder. d is the
+// normalized divisor (shifted left by shift bits) and dinv its
+// bn_digit_reciprocal. {qp} may be {ap}.
+bn_digit_t bn_mpn_divrem_1_pre(bn_digit_t *qp, const bn_digit_t *ap, size_t n,
+                               bn_digit_t d, unsigned shift, bn_digit_t dinv) {
+  BN_ASSERT(d >> (DIGIT_BITS - 1));
+  if (n == 0)
+    return 0;
+  bn_digit_t r = 0;
+  if (shift == 0) {
+    while (n-- > 0)
+      qp[n] = bn_digit_div_2by1(r, ap[n], d, dinv, &r);
+    return r;
+  }
+  // Shift the dividend on the fly.
+  r = ap[n - 1] >> (DIGIT_BITS - shift);
+  for (size_t i = n - 1; i > 0; --i) {
+    bn_digit_t u = (ap[i] << shift) | (ap[i - 1] >> (DIGIT_BITS - shift));
+    qp[i] = bn_digit_div_2by1(r, u, d, dinv, &r);
+  }
+  qp[0] = bn_digit_div_2by1(r, ap[0] << shift, d, dinv, &r);
+  return r >> shift;
+}
+
+// {ap, n} % (d >> shift), like bn_mpn_divrem_1_pre without the quotient
+bn_digit_t bn_mpn_mod_1_pre(const bn_digit_t *ap, size_t n, bn_digit_t d,
+                            unsigned shift, bn_digit_t dinv) {
+  BN_ASSERT(d >> (DIGIT_BITS - 1));
+  if (n == 0)
+    return 0;
+  bn_digit_t r = 0;
+  if (shift == 0) {
+    while (n-- > 0)
+      bn_digit_div_2by1(r, ap[n], d, dinv, &r);
+    return r;
+  }
+  r = ap[n - 1] >> (DIGIT_BITS - shift);
+  for (size_t i = n - 1; i > 0; --i) {
+    bn_digit_t u = (ap[i] << shift) | (ap[i - 1] >> (DIGIT_BITS - shift));
+    bn_digit_div_2by1(r, u, d, dinv, &r);
+  }
+  bn_digit_div_2by1(r, ap[0] << shift, d, dinv, &r);
+  return r >> shift;
+}
+
+// {qp, n} = {ap, n} / d, returns the remainder. One hardware division for
+// the reciprocal, multiplications for the digits.
+bn_digit_t bn_mpn_divrem_1(bn_digit_t *qp, const bn_digit_t *ap, size_t n,
+                           bn_digit_t d) {
+  BN_ASSERT(d != 0);
+  unsigned shift = bn_digit_count_leading_zeros(d);
+  d <<= shift;
+  return bn_mpn_divrem_1_pre(qp, ap, n, d, shift, bn_digit_reciprocal(d));
+}
+
+// {rp, n} = {ap, n} << shift for 0 < shift < DIGIT_BITS, returns the bits
+// shifted out (in the low bits of the returned digit).
+bn_digit_t bn_mpn_lshift(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                         unsigned shift) {
+  BN_ASSERT(shift > 0 && shift < DIGIT_BITS);
+  bn_digit_t out = ap[n - 1] >> (DIGIT_BITS - shift);
+  for (size_t i = n - 1; i > 0; --i)
+    rp[i] = (ap[i] << shift) | (ap[i - 1] >> (DIGIT_BITS - shift));
+  rp[0] = ap[0] << shift;
+  return out;
+}
+
+// {rp, n} = {ap, n} >> shift for 0 < shift < DIGIT_BITS, returns the bits
+// shifted out (in the high bits of the returned digit).
+bn_digit_t bn_mpn_rshift(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                         unsigned shift) {
+  BN_ASSERT(shift > 0 && shift < DIGIT_BITS);
+  bn_digit_t out = ap[0] << (DIGIT_BITS - shift);
+  for (size_t i = 0; i + 1 < n; ++i)
+    rp[i] = (ap[i] >> shift) | (ap[i + 1] << (DIGIT_BITS - shift));
+  rp[n - 1] = ap[n - 1] >> shift;
+  return out;
+}
+
+// d^-1 mod B for odd d
+bn_digit_t bn_digit_binvert(bn_digit_t d) {
+  BN_ASSERT(d & 1);
+  // Newton iteration, every step doubles the number of correct bits
+  // (d * d == 1 mod 8 for odd d).
+  bn_digit_t inv = d;
+  for (int i = 3; i < (int)DIGIT_BITS; i *= 2)
+    inv *= 2 - d * inv;
+  return inv;
+}
+
+// {qp, n} = {ap, n} / d for a division known to be exact. Uses the inverse
+// of d modulo B instead of a hardware division per digit.
+void bn_mpn_divexact_1(bn_digit_t *qp, const bn_digit_t *ap, size_t n,
+                       bn_digit_t d) {
+  BN_ASSERT(d != 0);
+  unsigned shift = 0;
+  while (!(d & 1)) {
+    d >>= 1;
+    shift++;
+  }
+  if (shift > 0) {
+    bn_digit_t out = bn_mpn_rshift(qp, ap, n, shift);
+    BN_ASSERT(out == 0);
+    (void)out;
+    ap = qp;
+  }
+  if (d == 1) {
+    if (qp != ap)
+      bn_mpn_copy(qp, ap, n);
+    return;
+  }
+  const bn_digit_t dinv = bn_digit_binvert(d);
+  bn_digit_t borrow = 0;
+  for (size_t i = 0; i < n; ++i) {
+    bn_digit_t b;
+    bn_digit_t x = bn_digit_sub(ap[i], borrow, &b);
+    bn_digit_t q = x * dinv;
+    qp[i] = q;
+    // q * d == x mod B, the high digit of q * d is what x borrowed from the
+    // remaining digits.
+    bn_digit_mul(q, d, &borrow);
+    borrow += b;
+  }
+  BN_ASSERT(borrow == 0);
+}
+
+// Schoolbook multiplication, one row of {ap} * digit per digit of {bp}, added
+// two rows at a time.
+void bn_mpn_mul_basecase(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                         const bn_digit_t *bp, size_t bn) {
+  BN_ASSERT(an >= bn && bn >= 1);
+  rp[an] = bn_mpn_mul_1(rp, ap, an, bp[0]);
+  size_t j = 1;
+  for (; j + 1 < bn; j += 2)
+    rp[an + j + 1] = bn_mpn_addmul_2(rp + j, ap, an, bp + j);
+  if (j < bn)
+    rp[an + j] = bn_mpn_addmul_1(rp + j, ap, an, bp[j]);
+}
+
+// Schoolbook squaring: every off-diagonal product a_i * a_j (i < j) is
+// computed once, the sum is doubled and the squares a_i^2 are added.
+void bn_mpn_sqr_basecase(bn_digit_t *rp, const bn_digit_t *ap, size_t n) {
+  BN_ASSERT(n >= 1);
+  rp[0] = 0;
+  rp[2 * n - 1] = 0;
+  if (n > 1) {
+    rp[n] = bn_mpn_mul_1(rp + 1, ap + 1, n - 1, ap[0]);
+    for (size_t i = 1; i < n - 1; ++i)
+      rp[n + i] = bn_mpn_addmul_1(rp + 2 * i + 1, ap + i + 1, n - i - 1, ap[i]);
+    bn_digit_t out = bn_mpn_lshift(rp, rp, 2 * n, 1);
+    BN_ASSERT(out == 0);
+    (void)out;
+  }
+  bn_digit_t carry = 0;
+  for (size_t i = 0; i < n; ++i) {
+    bn_digit_t high, c;
+    bn_digit_t low = bn_digit_mul(ap[i], ap[i], &high);
+    rp[2 * i] = bn_digit_add3(rp[2 * i], low, carry, &c);
+    rp[2 * i + 1] = bn_digit_add3(rp[2 * i + 1], high, c, &carry);
+  }
+  BN_ASSERT(carry == 0);
+}
+
+// Toom-Cook evaluation/interpolation schemes. Splitting the operands into ka
+// and kb pieces gives a product polynomial with ka + kb - 1 coefficients,
+// which is evaluated at as many points: x[0..points-2] and infinity.
+// Coefficient i is recovered as (sum_j m[i][j] * r_j) / divisor[i], where
+// r_j is the product evaluated at point j (the inverse Vandermonde matrix).
+typedef struct {
+  int points;
+  int x[6];
+  bn_digit_t divisor[7];
+  int m[7][7];
+} _bn_toom_scheme_t;
+
+// Toom-32
+const _bn_toom_scheme_t _BN_TOOM_4_POINTS = {
+    .points = 4,
+    .x = {0, 1, -1},
+    .divisor = {1, 2, 2, 1},
+    .m = {{1, 0, 0, 0},
+          {0, 1, -1, -2},
+          {-2, 1, 1, 0},
+          {0, 0, 0, 1}},
+};
+// Toom-33 and Toom-42
+const _bn_toom_scheme_t _BN_TOOM_5_POINTS = {
+    .points = 5,
+    .x = {0, 1, -1, 2},
+    .divisor = {1, 6, 2, 6, 1},
+    .m = {{1, 0, 0, 0, 0},
+          {-3, 6, -2, -1, 12},
+          {-2, 1, 1, 0, -2},
+          {3, -3, -1, 1, -12},
+          {0, 0, 0, 0, 1}},
+};
+// Toom-44
+const _bn_toom_scheme_t _BN_TOOM_7_POINTS = {
+    .points = 7,
+    .x = {0, 1, -1, 2, -2, 3},
+    .divisor = {1, 60, 24, 24, 24, 120, 1},
+    .m = {{1, 0, 0, 0, 0, 0, 0},
+          {-20, 60, -30, -15, 3, 2, -720},
+          {-30, 16, 16, -1, -1, 0, 96},
+          {10, -14, -1, 7, -1, -1, 360},
+          {6, -4, -4, 1, 1, 0, -120},
+          {-10, 10, 5, -5, -1, 1, -360},
+          {0, 0, 0, 0, 0, 0, 1}},
+};
+
+typedef enum {
+  BN_MUL_BASECASE,
+  BN_MUL_KARATSUBA,
+  BN_MUL_UNBALANCED,
+  BN_MUL_TOOM,
+  BN_MUL_NTT,
+} _bn_mul_algorithm_t;
+
+typedef struct {
+  _bn_mul_algorithm_t algorithm;
+  size_t ka, kb; // Toom: number of pieces of {ap} and {bp}
+  size_t k;      // Toom: piece size
+} _bn_mul_plan_t;
+
+// Returns the piece size for splitting {an} digits into ka pieces and {bn}
+// digits into kb pieces, or 0 if one of the top pieces would be empty.
+size_t _bn_toom_piece_size(size_t an, size_t bn, size_t ka, size_t kb) {
+  size_t k = (an + ka - 1) / ka;
+  size_t kbn = (bn + kb - 1) / kb;
+  if (kbn > k)
+    k = kbn;
+  if (an <= (ka - 1) * k || bn <= (kb - 1) * k)
+    return 0;
+  return k;
+}
+
+void _bn_toom_consider(_bn_mul_plan_t *plan, size_t an, size_t bn, size_t ka,
+                       size_t kb) {
+  size_t k = _bn_toom_piece_size(an, bn, ka, kb);
+  if (k == 0 || (plan->algorithm == BN_MUL_TOOM && plan->k <= k))
+    return;
+  plan->algorithm = BN_MUL_TOOM;
+  plan->ka = ka;
+  plan->kb = kb;
+  plan->k = k;
+}
+
+// Picks the multiplication algorithm for an {an} x {bn} product. Among the
+// applicable Toom variants, the one with the smallest pieces wins.
+_bn_mul_plan_t _bn_mpn_mul_plan(size_t an, size_t bn) {
+  _bn_mul_plan_t plan = {.algorithm = BN_MUL_BASECASE};
+  if (bn < BN_KARATSUBA_THRESHOLD)
+    return plan;
+#if BN_HAVE_NTT
+  if (bn >= BN_NTT_THRESHOLD) {
+    plan.algorithm = BN_MUL_NTT;
+    return plan;
+  }
+#endif
+  if (bn >= BN_TOOM3_THRESHOLD) {
+    _bn_toom_consider(&plan, an, bn, 3, 3);
+    _bn_toom_consider(&plan, an, bn, 3, 2);
+    _bn_toom_consider(&plan, an, bn, 4, 2);
+    if (bn >= BN_TOOM4_THRESHOLD)
+      _bn_toom_consider(&plan, an, bn, 4, 4);
+    if (plan.algorithm == BN_MUL_TOOM)
+      return plan;
+  }
+  // Karatsuba only applies when both operands split at the same point,
+  // otherwise {ap} is processed in chunks of bn digits.
+  if (bn <= (an + 1) / 2)
+    plan.algorithm = BN_MUL_UNBALANCED;
+  else
+    plan.algorithm = BN_MUL_KARATSUBA;
+  return plan;
+}
+
+// Same as _bn_mpn_mul_plan for squaring {n} digits.
+_bn_mul_plan_t _bn_mpn_sqr_plan(size_t n) {
+  _bn_mul_plan_t plan = {.algorithm = BN_MUL_BASECASE};
+  if (n < BN_SQR_KARATSUBA_THRESHOLD)
+    return plan;
+#if BN_HAVE_NTT
+  if (n >= BN_SQR_NTT_THRESHOLD) {
+    plan.algorithm = BN_MUL_NTT;
+    return plan;
+  }
+#endif
+  if (n >= BN_SQR_TOOM4_THRESHOLD)
+    _bn_toom_consider(&plan, n, n, 4, 4);
+  if (n >= BN_SQR_TOOM3_THRESHOLD)
+    _bn_toom_consider(&plan, n, n, 3, 3);
+  if (plan.algorithm != BN_MUL_TOOM)
+    plan.algorithm = BN_MUL_KARATSUBA;
+  return plan;
+}
+
+size_t _bn_max(size_t a, size_t b) { return a > b ? a : b; }
+
+size_t bn_mpn_mul_ntt_itch(size_t an, size_t bn);
+size_t bn_mpn_sqr_ntt_itch(size_t n);
+
+size_t bn_mpn_mul_itch(size_t an, size_t bn) {
+  _bn_mul_plan_t plan = _bn_mpn_mul_plan(an, bn);
+  switch (plan.algorithm) {
+  case BN_MUL_BASECASE:
+    return 0;
+  case BN_MUL_KARATSUBA: {
+    size_t h = (an + 1) / 2;
+    return 4 * h + 1 +
+           _bn_max(bn_mpn_mul_itch(h, h), bn_mpn_mul_itch(an - h, bn - h));
+  }
+  case BN_MUL_UNBALANCED: {
+    size_t itch = bn_mpn_mul_itch(bn, bn);
+    if (an % bn > 0)
+      itch = _bn_max(itch, bn_mpn_mul_itch(bn, an % bn));
+    return 2 * bn + itch;
+  }
+  case BN_MUL_TOOM: {
+    size_t k = plan.k;
+    size_t ta = an - (plan.ka - 1) * k;
+    size_t tb = bn - (plan.kb - 1) * k;
+    size_t itch = _bn_max(bn_mpn_mul_itch(k + 1, k + 1), bn_mpn_mul_itch(k, k));
+    itch = _bn_max(itch, ta >= tb ? bn_mpn_mul_itch(ta, tb)
+                                  : bn_mpn_mul_itch(tb, ta));
+    return (plan.ka + plan.kb - 1) * (2 * k + 2) + 4 * k + 8 + itch;
+  }
+  case BN_MUL_NTT:
+#if BN_HAVE_NTT
+    return bn_mpn_mul_ntt_itch(an, bn);
+#else
+    break;
+#endif
+  }
+  return 0;
+}
+
+size_t bn_mpn_sqr_itch(size_t n) {
+  _bn_mul_plan_t plan = _bn_mpn_sqr_plan(n);
+  switch (plan.algorithm) {
+  case BN_MUL_BASECASE:
+  case BN_MUL_UNBALANCED:
+    return 0;
+  case BN_MUL_KARATSUBA: {
+    size_t h = (n + 1) / 2;
+    return 4 * h + 1 + _bn_max(bn_mpn_sqr_itch(h), bn_mpn_sqr_itch(n - h));
+  }
+  case BN_MUL_TOOM: {
+    size_t k = plan.k;
+    size_t itch = _bn_max(bn_mpn_sqr_itch(k + 1), bn_mpn_sqr_itch(k));
+    itch = _bn_max(itch, bn_mpn_sqr_itch(n - (plan.ka - 1) * k));
+    return (2 * plan.ka - 1) * (2 * k + 2) + 4 * k + 8 + itch;
+  }
+  case BN_MUL_NTT:
+#if BN_HAVE_NTT
+    return bn_mpn_sqr_ntt_itch(n);
+#else
+    break;
+#endif
+  }
+  return 0;
+}
+
+// Karatsuba multiplication. With a = a1 * B^h + a0 and b = b1 * B^h + b0:
+//   a * b = z2 * B^2h + (z0 + z2 - (a0 - a1)(b0 - b1)) * B^h + z0
+// where z0 = a0 * b0 and z2 = a1 * b1.
+void bn_mpn_mul_karatsuba(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                          const bn_digit_t *bp, size_t bn,
+                          bn_digit_t *scratch) {
+  const size_t h = (an + 1) / 2;
+  BN_ASSERT(an >= bn && bn > h);
+  const size_t a1n = an - h;
+  const size_t b1n = bn - h;
+
+  // Scratch layout: zm[2h] | da[h] | db[h] | 1 spare digit | recursion.
+  // Once zm is known, da and db are reused for the middle term t[2h + 1].
+  bn_digit_t *zm = scratch;
+  bn_digit_t *da = zm + 2 * h;
+  bn_digit_t *db = da + h;
+  bn_digit_t *next = db + h + 1;
+
+  int negative = bn_mpn_diff(da, ap, h, ap + h, a1n);
+  negative ^= bn_mpn_diff(db, bp, h, bp + h, b1n);
+  if (_bn_parallel(bn)) {
+    _bn_mul_task_t high, middle;
+    _bn_mul_fork(&high, rp + 2 * h, ap + h, a1n, bp + h, b1n);
+    _bn_mul_fork(&middle, zm, da, h, db, h);
+    bn_mpn_mul(rp, ap, h, bp, h, next);
+    _bn_join(&middle.task);
+    _bn_join(&high.task);
+  } else {
+    bn_mpn_mul(zm, da, h, db, h, next);
+    bn_mpn_mul(rp, ap, h, bp, h, next);
+    bn_mpn_mul(rp + 2 * h, ap + h, a1n, bp + h, b1n, next);
+  }
+
+  bn_digit_t *t = da;
+  t[2 * h] = bn_mpn_add(t, rp, 2 * h, rp + 2 * h, a1n + b1n);
+  if (negative)
+    t[2 * h] += bn_mpn_add_n(t, t, zm, 2 * h);
+  else
+    t[2 * h] -= bn_mpn_sub_n(t, t, zm, 2 * h);
+
+  // The middle term fits into the result, so any excess digits are zero.
+  size_t avail = an + bn - h;
+  size_t tn = 2 * h + 1;
+  while (tn > avail) {
+    BN_ASSERT(t[tn - 1] == 0);
+    tn--;
+  }
+  bn_digit_t carry = bn_mpn_add(rp + h, rp + h, avail, t, tn);
+  BN_ASSERT(carry == 0);
+  (void)carry;
+}
+
+// Karatsuba squaring, like bn_mpn_mul_karatsuba with (a0 - a1)^2 >= 0 as
+// the middle product.
+void bn_mpn_sqr_karatsuba(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                          bn_digit_t *scratch) {
+  const size_t h = (n + 1) / 2;
+  BN_ASSERT(n >= 2);
+  const size_t a1n = n - h;
+
+  // Scratch layout: zm[2h] | da[h] | h + 1 spare digits | recursion.
+  // Once zm is known, da is reused for the middle term t[2h + 1].
+  bn_digit_t *zm = scratch;
+  bn_digit_t *da = zm + 2 * h;
+  bn_digit_t *next = da + 2 * h + 1;
+
+  bn_mpn_diff(da, ap, h, ap + h, a1n);
+  if (_bn_parallel(n)) {
+    _bn_mul_task_t high, middle;
+    _bn_mul_fork(&high, rp + 2 * h, ap + h, a1n, NULL, a1n);
+    _bn_mul_fork(&middle, zm, da, h, NULL, h);
+    bn_mpn_sqr(rp, ap, h, next);
+    _bn_join(&middle.task);
+    _bn_join(&high.task);
+  } else {
+    bn_mpn_sqr(zm, da, h, next);
+    bn_mpn_sqr(rp, ap, h, next);
+    bn_mpn_sqr(rp + 2 * h, ap + h, a1n, next);
+  }
+
+  bn_digit_t *t = da;
+  t[2 * h] = bn_mpn_add(t, rp, 2 * h, rp + 2 * h, 2 * a1n);
+  t[2 * h] -= bn_mpn_sub_n(t, t, zm, 2 * h);
+
+  // The middle term fits into the result, so any excess digits are zero.
+  size_t avail = 2 * n - h;
+  size_t tn = 2 * h + 1;
+  while (tn > avail) {
+    BN_ASSERT(t[tn - 1] == 0);
+    tn--;
+  }
+  bn_digit_t carry = bn_mpn_add(rp + h, rp + h, avail, t, tn);
+  BN_ASSERT(carry == 0);
+  (void)carry;
+}
+
+// {rp, k + 1} = |sum_i p_i * x^i| where p_i are the {pieces} pieces of size k
+// of {ap, an}. Returns 1 if the sum is negative. {tmp} holds k + 1 digits.
+int _bn_toom_eval(bn_digit_t *rp, bn_digit_t *tmp, const bn_digit_t *ap,
+                  size_t an, size_t pieces, size_t k, int x) {
+  bn_digit_t abs_x = x < 0 ? -x : x;
+  bn_digit_t w = 1; // |x|^i
+  bn_mpn_zero(rp, k + 1);
+  bn_mpn_zero(tmp, k + 1);
+  for (size_t i = 0; i < pieces && w != 0; ++i) {
+    size_t len = i == pieces - 1 ? an - i * k : k;
+    // Odd powers of negative points are accumulated separately in {tmp}.
+    bn_digit_t *acc = (x < 0 && (i & 1)) ? tmp : rp;
+    bn_digit_t carry = w == 1 ? bn_mpn_add_n(acc, acc, ap + i * k, len)
+                              : bn_mpn_addmul_1(acc, ap + i * k, len, w);
+    bn_mpn_add_1(acc + len, acc + len, k + 1 - len, carry);
+    w *= abs_x;
+  }
+  return bn_mpn_diff(rp, rp, k + 1, tmp, k + 1);
+}
+
+// Toom-Cook multiplication with {ap} split into ka and {bp} into kb pieces
+// of k digits (see _BN_TOOM_*_POINTS). Squares {ap, an} if {bp} is NULL.
+void _bn_mpn_toom(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                  const bn_digit_t *bp, size_t bn, size_t ka, size_t kb,
+                  size_t k, bn_digit_t *scratch) {
+  const bool square = bp == NULL;
+  if (square) {
+    bp = ap;
+    bn = an;
+  }
+  const _bn_toom_scheme_t *scheme;
+  switch (ka + kb - 1) {
+  case 4:
+    scheme = &_BN_TOOM_4_POINTS;
+    break;
+  case 5:
+    scheme = &_BN_TOOM_5_POINTS;
+    break;
+  default:
+    BN_ASSERT(ka + kb - 1 == 7);
+    scheme = &_BN_TOOM_7_POINTS;
+    break;
+  }
+  const int points = scheme->points;
+  const size_t rn = 2 * k + 2; // size of the evaluated products
+  const size_t acc_n = rn + 2; // fits sum_j |m[i][j] * r_j|
+
+  // Scratch layout: r[points][rn] | work[4k + 8] | recursion.
+  // The work area first holds the evaluated operands, then the
+  // interpolation accumulators.
+  bn_digit_t *r = scratch;
+  bn_digit_t *work = r + points * rn;
+  bn_digit_t *next = work + 4 * k + 8;
+  int negative[7];
+
+  // Evaluation and pointwise multiplication. In parallel, every point gets
+  // its own evaluated operands from the arena and its product is forked.
+  const bool parallel = _bn_parallel(bn);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *eval =
+      parallel ? _bn_scratch_alloc(S, (points - 1) * (2 * k + 2)) : work;
+  bn_digit_t *tmp = work + 2 * k + 2;
+  _bn_mul_task_t tasks[7];
+  for (int j = 0; j < points - 1; ++j) {
+    bn_digit_t *ea = parallel ? eval + j * (2 * k + 2) : eval;
+    bn_digit_t *eb = ea + k + 1;
+    const int negative_a = _bn_toom_eval(ea, tmp, ap, an, ka, k, scheme->x[j]);
+    negative[j] = square ? 0
+                         : negative_a ^ _bn_toom_eval(eb, tmp, bp, bn, kb, k,
+                                                      scheme->x[j]);
+    if (parallel)
+      _bn_mul_fork(&tasks[j], r + j * rn, ea, k + 1, square ? NULL : eb,
+                   k + 1);
+    else if (square)
+      bn_mpn_sqr(r + j * rn, ea, k + 1, next);
+    else
+      bn_mpn_mul(r + j * rn, ea, k + 1, eb, k + 1, next);
+  }
+  // Point at infinity: product of the top pieces
+  {
+    bn_digit_t *rinf = r + (points - 1) * rn;
+    const bn_digit_t *ta = ap + (ka - 1) * k;
+    const bn_digit_t *tb = bp + (kb - 1) * k;
+    size_t tan = an - (ka - 1) * k;
+    size_t tbn = bn - (kb - 1) * k;
+    if (square)
+      bn_mpn_sqr(rinf, ta, tan, next);
+    else if (tan >= tbn)
+      bn_mpn_mul(rinf, ta, tan, tb, tbn, next);
+    else
+      bn_mpn_mul(rinf, tb, tbn, ta, tan, next);
+    bn_mpn_zero(rinf + tan + tbn, rn - tan - tbn);
+    negative[points - 1] = 0;
+  }
+  if (parallel) {
+    for (int j = points - 1; j-- > 0;)
+      _bn_join(&tasks[j].task);
+  }
+  _bn_scratch_release(S, mark);
+
+  // Interpolation: positive and negative terms are accumulated separately.
+  bn_digit_t *pos = work;
+  bn_digit_t *neg = pos + acc_n;
+  bn_mpn_zero(rp, an + bn);
+  for (int i = 0; i < points; ++i) {
+    bn_mpn_zero(pos, 2 * acc_n);
+    for (int j = 0; j < points; ++j) {
+      int m = scheme->m[i][j];
+      if (m == 0)
+        continue;
+      bn_digit_t *acc = ((m < 0) ^ negative[j]) ? neg : pos;
+      bn_digit_t carry =
+          bn_mpn_addmul_1(acc, r + j * rn, rn, (bn_digit_t)(m < 0 ? -m : m));
+      bn_mpn_add_1(acc + rn, acc + rn, acc_n - rn, carry);
+    }
+    bn_digit_t borrow = bn_mpn_sub_n(pos, pos, neg, acc_n);
+    BN_ASSERT(borrow == 0);
+    if (scheme->divisor[i] != 1)
+      bn_mpn_divexact_1(pos, pos, acc_n, scheme->divisor[i]);
+
+    // The coefficient fits into the result, so any excess digits are zero.
+    size_t cn = bn_mpn_normalized_size(pos, acc_n);
+    BN_ASSERT(i * k + cn <= an + bn);
+    bn_digit_t carry =
+        bn_mpn_add(rp + i * k, rp + i * k, an + bn - i * k, pos, cn);
+    BN_ASSERT(carry == 0);
+    (void)borrow;
+    (void)carry;
+  }
+}
+
+void bn_mpn_mul_toom(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                     const bn_digit_t *bp, size_t bn, size_t ka, size_t kb,
+                     size_t k, bn_digit_t *scratch) {
+  _bn_mpn_toom(rp, ap, an, bp, bn, ka, kb, k, scratch);
+}
+
+void bn_mpn_sqr_toom(bn_digit_t *rp, const bn_digit_t *ap, size_t n, size_t ka,
+                     size_t k, bn_digit_t *scratch) {
+  _bn_mpn_toom(rp, ap, n, NULL, n, ka, ka, k, scratch);
+}
+
+#if BN_HAVE_NTT
+// Number-theoretic transform multiplication. The product is computed modulo
+// three primes p < 2^62 with p - 1 divisible by a large power of two, and the
+// coefficients are recombined with the CRT. A coefficient is less than
+// min(an, bn) * B^2, which is below p0 * p1 * p2 for any realistic size.
+typedef struct {
+  bn_digit_t p;    // c * 2^k + 1
+  bn_digit_t g;    // primitive root modulo p
+  bn_digit_t pinv; // -p^-1 mod B
+  bn_digit_t r1;   // B mod p, i.e. 1 in Montgomery form
+  bn_digit_t r2;   // B^2 mod p
+} _bn_ntt_prime_t;
+
+const bn_digit_t _BN_NTT_PRIMES[3][2] = {
+    {4179340454199820289ull, 3}, // 29 * 2^57 + 1
+    {2485986994308513793ull, 5}, // 69 * 2^55 + 1
+    {1945555039024054273ull, 5}, // 27 * 2^56 + 1
+};
+
+// Transforms are done depth-first, so that sub-transforms of this many
+// elements are finished while they are in the cache.
+#define _BN_NTT_BLOCK_SIZE 4096
+
+// a * b mod p, only used for precomputations
+bn_digit_t _bn_ntt_mulmod_slow(bn_digit_t a, bn_digit_t b, bn_digit_t p) {
+  bn_digit_t high, rem;
+  bn_digit_t low = bn_digit_mul(a, b, &high);
+  bn_digit_div(high, low, p, &rem);
+  return rem;
+}
+
+bn_digit_t _bn_ntt_powmod_slow(bn_digit_t a, bn_digit_t e, bn_digit_t p) {
+  bn_digit_t result = 1;
+  while (e > 0) {
+    if (e & 1)
+      result = _bn_ntt_mulmod_slow(result, a, p);
+    a = _bn_ntt_mulmod_slow(a, a, p);
+    e >>= 1;
+  }
+  return result;
+}
+
+void _bn_ntt_prime_init(_bn_ntt_prime_t *P, int i) {
+  P->p = _BN_NTT_PRIMES[i][0];
+  P->g = _BN_NTT_PRIMES[i][1];
+  P->pinv = -bn_digit_binvert(P->p);
+  bn_digit_div(1, 0, P->p, &P->r1);
+  P->r2 = _bn_ntt_mulmod_slow(P->r1, P->r1, P->p);
+}
+
+// Montgomery multiplication: a * b / B mod p for a * b < p * B
+bn_digit_t _bn_ntt_mont(bn_digit_t a, bn_digit_t b, const _bn_ntt_prime_t *P) {
+  bn_digit_t high, mp_high;
+  bn_digit_t low = bn_digit_mul(a, b, &high);
+  bn_digit_mul(low * P->pinv, P->p, &mp_high);
+  // low + (low * pinv * p mod B) is 0 mod B, and carries iff low != 0.
+  bn_digit_t t = high + mp_high + (low != 0);
+  return t >= P->p ? t - P->p : t;
+}
+
+// Fills the twiddle tables for transforms of up to n elements: for every
+// level m, {tw}[m/2 + j] = w_m^j in Montgomery form, w_m being a primitive
+// m-th root of unity. {itw} gets the inverse roots.
+void _bn_ntt_twiddles(bn_digit_t *tw, bn_digit_t *itw, size_t n,
+                      const _bn_ntt_prime_t *P) {
+  if (n < 2)
+    return;
+  bn_digit_t w = _bn_ntt_powmod_slow(P->g, (P->p - 1) / n, P->p);
+  bn_digit_t iw = _bn_ntt_powmod_slow(w, P->p - 2, P->p);
+  w = _bn_ntt_mulmod_slow(w, P->r1, P->p);
+  iw = _bn_ntt_mulmod_slow(iw, P->r1, P->p);
+  bn_digit_t t = P->r1, it = P->r1;
+  for (size_t j = 0; j < n / 2; ++j) {
+    tw[n / 2 + j] = t;
+    itw[n / 2 + j] = it;
+    t = _bn_ntt_mont(t, w, P);
+    it = _bn_ntt_mont(it, iw, P);
+  }
+  for (size_t m = n / 2; m >= 2; m /= 2) {
+    for (size_t j = 0; j < m / 2; ++j) {
+      tw[m / 2 + j] = tw[m + 2 * j];
+      itw[m / 2 + j] = itw[m + 2 * j];
+    }
+  }
+}
+
+// Forward transform (decimation in frequency), natural order in,
+// bit-reversed order out.
+void _bn_ntt_forward(bn_digit_t *a, size_t n, const bn_digit_t *tw,
+                     const _bn_ntt_prime_t *P) {
+  const bn_digit_t p = P->p;
+  for (size_t m = n; m >= 2; m /= 2) {
+    const size_t h = m / 2;
+    const bn_digit_t *w = tw + h;
+    for (size_t s = 0; s < n; s += m) {
+      for (size_t j = 0; j < h; ++j) {
+        bn_digit_t u = a[s + j], v = a[s + j + h];
+        bn_digit_t sum = u + v;
+        a[s + j] = sum >= p ? sum - p : sum;
+        a[s + j + h] = _bn_ntt_mont(u + p - v, w[j], P);
+      }
+    }
+    if (m == n && n > _BN_NTT_BLOCK_SIZE) {
+      _bn_ntt_forward(a, h, tw, P);
+      _bn_ntt_forward(a + h, h, tw, P);
+      return;
+    }
+  }
+}
+
+// Inverse transform without the 1/n scaling (decimation in time),
+// bit-reversed order in, natural order out.
+void _bn_ntt_inverse(bn_digit_t *a, size_t n, const bn_digit_t *itw,
+                     const _bn_ntt_prime_t *P) {
+  const bn_digit_t p = P->p;
+  size_t m = 2;
+  if (n > _BN_NTT_BLOCK_SIZE) {
+    _bn_ntt_inverse(a, n / 2, itw, P);
+    _bn_ntt_inverse(a + n / 2, n / 2, itw, P);
+    m = n;
+  }
+  for (; m <= n; m *= 2) {
+    const size_t h = m / 2;
+    const bn_digit_t *w = itw + h;
+    for (size_t s = 0; s < n; s += m) {
+      for (size_t j = 0; j < h; ++j) {
+        bn_digit_t u = a[s + j];
+        bn_digit_t v = _bn_ntt_mont(a[s + j + h], w[j], P);
+        bn_digit_t sum = u + v;
+        a[s + j] = sum >= p ? sum - p : sum;
+        a[s + j + h] = u >= v ? u - v : u + p - v;
+      }
+    }
+  }
+}
+
+size_t _bn_ntt_size(size_t an, size_t bn) {
+  size_t n = 1;
+  while (n < an + bn - 1)
+    n <<= 1;
+  return n;
+}
+
+size_t bn_mpn_mul_ntt_itch(size_t an, size_t bn) {
+  // residues for all three primes, second operand, twiddles
+  return 6 * _bn_ntt_size(an, bn);
+}
+
+size_t bn_mpn_sqr_ntt_itch(size_t n) {
+  // residues for all three primes, twiddles
+  return 5 * _bn_ntt_size(n, n);
+}
+
+// {fp, n} = {ap, an} mod p, zero padded
+void _bn_ntt_load(bn_digit_t *fp, const bn_digit_t *ap, size_t an, size_t n,
+                  const _bn_ntt_prime_t *P) {
+  for (size_t i = 0; i < an; ++i)
+    fp[i] = ap[i] % P->p;
+  bn_mpn_zero(fp + an, n - an);
+}
+
+// Recombines the residues {res}[3][n] into {rp, rn}.
+void _bn_ntt_crt(bn_digit_t *rp, size_t rn, const bn_digit_t *res, size_t n,
+                 const _bn_ntt_prime_t *P) {
+  const bn_digit_t p0 = P[0].p, p1 = P[1].p, p2 = P[2].p;
+  // Garner's constants in Montgomery form.
+  const bn_digit_t inv01 = _bn_ntt_mulmod_slow(
+      _bn_ntt_powmod_slow(p0 % p1, p1 - 2, p1), P[1].r1, p1);
+  const bn_digit_t inv02 = _bn_ntt_mulmod_slow(
+      _bn_ntt_powmod_slow(p0 % p2, p2 - 2, p2), P[2].r1, p2);
+  const bn_digit_t inv12 = _bn_ntt_mulmod_slow(
+      _bn_ntt_powmod_slow(p1 % p2, p2 - 2, p2), P[2].r1, p2);
+  bn_digit_t p01[2];
+  p01[0] = bn_digit_mul(p0, p1, &p01[1]);
+
+  bn_digit_t acc[4] = {0};
+  for (size_t i = 0; i < rn; ++i) {
+    if (i < n) {
+      // x = x0 + x1 * p0 + x2 * p0 * p1
+      bn_digit_t x0 = res[i];
+      bn_digit_t x1 = res[n + i] + p1 - x0 % p1;
+      x1 = _bn_ntt_mont(x1 >= p1 ? x1 - p1 : x1, inv01, &P[1]);
+      bn_digit_t x2 = res[2 * n + i] + p2 - x0 % p2;
+      x2 = _bn_ntt_mont(x2 >= p2 ? x2 - p2 : x2, inv02, &P[2]);
+      x2 = x2 + p2 - x1 % p2;
+      x2 = _bn_ntt_mont(x2 >= p2 ? x2 - p2 : x2, inv12, &P[2]);
+
+      bn_digit_t v[3], c, high;
+      v[0] = bn_digit_mul(x1, p0, &v[1]);
+      v[0] = bn_digit_add2(v[0], x0, &c);
+      v[1] += c;
+      bn_digit_t low = bn_digit_mul(x2, p01[0], &high);
+      v[0] = bn_digit_add2(v[0], low, &c);
+      v[1] = bn_digit_add3(v[1], high, c, &c);
+      v[2] = c;
+      low = bn_digit_mul(x2, p01[1], &high);
+      v[1] = bn_digit_add2(v[1], low, &c);
+      v[2] += high + c;
+
+      c = bn_mpn_add_n(acc, acc, v, 3);
+      acc[3] += c;
+    }
+    rp[i] = acc[0];
+    acc[0] = acc[1];
+    acc[1] = acc[2];
+    acc[2] = acc[3];
+    acc[3] = 0;
+  }
+  BN_ASSERT(acc[0] == 0 && acc[1] == 0 && acc[2] == 0);
+}
+
+// {fa, n} = the product of {ap, an} and {bp, bn} modulo P, {bp} NULL for a
+// square. {scratch} holds 3n digits for the twiddles and the second operand.
+void _bn_ntt_residues(bn_digit_t *fa, const bn_digit_t *ap, size_t an,
+                      const bn_digit_t *bp, size_t bn, size_t n,
+                      const _bn_ntt_prime_t *P, bn_digit_t *scratch) {
+  bn_digit_t *tw = scratch;
+  bn_digit_t *itw = tw + n;
+  bn_digit_t *fb = itw + n;
+  _bn_ntt_twiddles(tw, itw, n, P);
+  _bn_ntt_load(fa, ap, an, n, P);
+  _bn_ntt_forward(fa, n, tw, P);
+  if (bp == NULL) {
+    for (size_t i = 0; i < n; ++i)
+      fa[i] = _bn_ntt_mont(fa[i], fa[i], P);
+  } else {
+    _bn_ntt_load(fb, bp, bn, n, P);
+    _bn_ntt_forward(fb, n, tw, P);
+    for (size_t i = 0; i < n; ++i)
+      fa[i] = _bn_ntt_mont(fa[i], fb[i], P);
+  }
+  _bn_ntt_inverse(fa, n, itw, P);
+  // The pointwise products carry a factor 1 / B, the inverse transform a
+  // factor n: scale by B^2 / n in Montgomery form.
+  bn_digit_t scale = _bn_ntt_mulmod_slow(
+      _bn_ntt_powmod_slow(n % P->p, P->p - 2, P->p), P->r2, P->p);
+  for (size_t i = 0; i < n; ++i)
+    fa[i] = _bn_ntt_mont(fa[i], scale, P);
+}
+
+// _bn_ntt_residues as a task
+typedef struct {
+  _bn_task_t task;
+  bn_digit_t *fa;
+  const bn_digit_t *ap, *bp;
+  size_t an, bn, n;
+  const _bn_ntt_prime_t *P;
+} _bn_ntt_task_t;
+
+static void _bn_ntt_task_run(_bn_task_t *T) {
+  const _bn_ntt_task_t *R = (const _bn_ntt_task_t *)T;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  _bn_ntt_residues(R->fa, R->ap, R->an, R->bp, R->bn, R->n, R->P,
+                   _bn_scratch_alloc(S, 3 * R->n));
+  _bn_scratch_release(S, mark);
+}
+
+// Squares {ap, an} if {bp} is NULL, which saves one forward transform. The
+// three primes are independent; in parallel, the second and third are
+// forked.
+void _bn_mpn_ntt(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                 const bn_digit_t *bp, size_t bn, bn_digit_t *scratch) {
+  if (bp == NULL)
+    bn = an;
+  const size_t n = _bn_ntt_size(an, bn);
+  bn_digit_t *res = scratch;
+  _bn_ntt_prime_t P[3];
+  for (int k = 0; k < 3; ++k)
+    _bn_ntt_prime_init(&P[k], k);
+
+  if (_bn_parallel(bn)) {
+    _bn_ntt_task_t tasks[2];
+    for (int k = 1; k < 3; ++k) {
+      _bn_ntt_task_t *R = &tasks[k - 1];
+      R->task.run = _bn_ntt_task_run;
+      R->fa = res + k * n;
+      R->ap = ap;
+      R->an = an;
+      R->bp = bp;
+      R->bn = bn;
+      R->n = n;
+      R->P = &P[k];
+      _bn_fork(&R->task);
+    }
+    _bn_ntt_residues(res, ap, an, bp, bn, n, &P[0], res + 3 * n);
+    _bn_join(&tasks[1].task);
+    _bn_join(&tasks[0].task);
+  } else {
+    for (int k = 0; k < 3; ++k)
+      _bn_ntt_residues(res + k * n, ap, an, bp, bn, n, &P[k], res + 3 * n);
+  }
+  _bn_ntt_crt(rp, an + bn, res, n, P);
+}
+
+void bn_mpn_mul_ntt(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                    const bn_digit_t *bp, size_t bn, bn_digit_t *scratch) {
+  _bn_mpn_ntt(rp, ap, an, bp, bn, scratch);
+}
+
+void bn_mpn_sqr_ntt(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                    bn_digit_t *scratch) {
+  _bn_mpn_ntt(rp, ap, n, NULL, n, scratch);
+}
+#endif // BN_HAVE_NTT
+
+// Multiplies a long {ap} by a short {bp} in chunks of bn digits.
+void _bn_mpn_mul_unbalanced(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                            const bn_digit_t *bp, size_t bn,
+                            bn_digit_t *scratch) {
+  bn_digit_t *tmp = scratch;
+  bn_digit_t *next = scratch + 2 * bn;
+
+  bn_mpn_mul(rp, ap, bn, bp, bn, next);
+  for (size_t done = bn; done < an;) {
+    size_t chunk = an - done < bn ? an - done : bn;
+    if (chunk == bn)
+      bn_mpn_mul(tmp, ap + done, chunk, bp, bn, next);
+    else
+      bn_mpn_mul(tmp, bp, bn, ap + done, chunk, next);
+    // {rp} is valid up to done + bn here.
+    bn_digit_t carry = bn_mpn_add_n(rp + done, rp + done, tmp, bn);
+    carry = bn_mpn_add_1(rp + done + bn, tmp + bn, chunk, carry);
+    BN_ASSERT(carry == 0);
+    done += chunk;
+  }
+}
+
+void bn_mpn_mul(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                const bn_digit_t *bp, size_t bn, bn_digit_t *scratch) {
+  BN_ASSERT(an >= bn && bn >= 1);
+  _bn_mul_plan_t plan = _bn_mpn_mul_plan(an, bn);
+  switch (plan.algorithm) {
+  case BN_MUL_BASECASE:
+    bn_mpn_mul_basecase(rp, ap, an, bp, bn);
+    break;
+  case BN_MUL_KARATSUBA:
+    bn_mpn_mul_karatsuba(rp, ap, an, bp, bn, scratch);
+    break;
+  case BN_MUL_UNBALANCED:
+    _bn_mpn_mul_unbalanced(rp, ap, an, bp, bn, scratch);
+    break;
+  case BN_MUL_TOOM:
+    bn_mpn_mul_toom(rp, ap, an, bp, bn, plan.ka, plan.kb, plan.k, scratch);
+    break;
+  case BN_MUL_NTT:
+#if BN_HAVE_NTT
+    bn_mpn_mul_ntt(rp, ap, an, bp, bn, scratch);
+#endif
+    break;
+  }
+}
+
+void bn_mpn_sqr(bn_digit_t *rp, const bn_digit_t *ap, size_t n,
+                bn_digit_t *scratch) {
+  BN_ASSERT(n >= 1);
+  _bn_mul_plan_t plan = _bn_mpn_sqr_plan(n);
+  switch (plan.algorithm) {
+  case BN_MUL_BASECASE:
+  case BN_MUL_UNBALANCED:
+    bn_mpn_sqr_basecase(rp, ap, n);
+    break;
+  case BN_MUL_KARATSUBA:
+    bn_mpn_sqr_karatsuba(rp, ap, n, scratch);
+    break;
+  case BN_MUL_TOOM:
+    bn_mpn_sqr_toom(rp, ap, n, plan.ka, plan.k, scratch);
+    break;
+  case BN_MUL_NTT:
+#if BN_HAVE_NTT
+    bn_mpn_sqr_ntt(rp, ap, n, scratch);
+#endif
+    break;
+  }
+}
+
+//////////////////// DIVISION ////////////////////
+
+// bn_mpn_div_qr_basecase and bn_mpn_div_qr_dc expect a normalized divisor
+// {dp, dn}: dn >= 2 and the most significant bit of dp[dn - 1] set, and
+// dinv = bn_digit_reciprocal_3by2(dp[dn - 1], dp[dn - 2]). They write the low
+// quotient digits to {qp}, return the high quotient digit (0 or 1) and leave
+// the remainder in the low dn digits of {np}.
+
+// Schoolbook division (Knuth, TAOCP vol. 2, 4.3.1, algorithm D) of
+// {np, nn} by {dp, dn}, with nn - dn quotient digits written to {qp}.
+bn_digit_t bn_mpn_div_qr_basecase(bn_digit_t *qp, bn_digit_t *np, size_t nn,
+                                  const bn_digit_t *dp, size_t dn,
+                                  bn_digit_t dinv) {
+  BN_ASSERT(nn >= dn && dn >= 2);
+  BN_ASSERT(dp[dn - 1] >> (DIGIT_BITS - 1));
+
+  bn_digit_t *top = np + nn - dn;
+  bn_digit_t qh = bn_mpn_cmp(top, dp, dn) >= 0;
+  if (qh)
+    bn_mpn_sub_n(top, top, dp, dn);
+
+  const bn_digit_t d1 = dp[dn - 1];
+  const bn_digit_t d0 = dp[dn - 2];
+  for (size_t j = nn - dn; j-- > 0;) {
+    // D3.
+    // {np + j + 1, dn} < {dp, dn}, so {n2, n1} <= {d1, d0}. Estimate the
+    // quotient digit from the top three digits, it is at most one too large.
+    // If {n2, n1} == {d1, d0}, the quotient digit is B - 1.
+    bn_digit_t n2 = np[j + dn];
+    bn_digit_t n1 = np[j + dn - 1];
+    bn_digit_t qhat = ~(bn_digit_t)0;
+    if (n2 != d1 || n1 != d0) {
+      bn_digit_t r1, r0;
+      qhat = bn_digit_div_3by2(n2, n1, np[j + dn - 2], d1, d0, dinv, &r1, &r0);
+    }
+
+    // D4.
+    // Subtract qhat * {dp, dn} from {np + j, dn + 1}.
+    bn_digit_t borrow;
+    bn_digit_t high = bn_mpn_submul_1(np + j, dp, dn, qhat);
+    np[j + dn] = bn_digit_sub(n2, high, &borrow);
+    if (borrow) {
+      // D6.
+      // qhat was one too large, add back one divisor.
+      qhat--;
+      np[j + dn] += bn_mpn_add_n(np + j, np + j, dp, dn);
+    }
+    qp[j] = qhat;
+  }
+  return qh;
+}
+
+size_t bn_mpn_div_qr_dc_itch(size_t n) {
+  if (n < BN_BZ_DIV_THRESHOLD)
+    return 0;
+  size_t lo = n / 2, hi = n - lo;
+  size_t itch = _bn_max(bn_mpn_div_qr_dc_itch(hi), bn_mpn_div_qr_dc_itch(lo));
+  return _bn_max(itch, n + bn_mpn_mul_itch(hi, lo));
+}
+
+// Recursive division (Burnikel and Ziegler, "Fast Recursive Division") of
+// {np, 2n} by {dp, n}, with n quotient digits written to {qp}. Each half of
+// the quotient is computed by dividing the top digits of the dividend by the
+// top half of the divisor, then corrected with one multiplication by the low
+// half of the divisor, so the cost follows bn_mpn_mul. The top two digits of
+// every partial divisor are those of {dp, n}, so dinv applies to all of them.
+// {scratch} must hold bn_mpn_div_qr_dc_itch(n) digits.
+bn_digit_t bn_mpn_div_qr_dc(bn_digit_t *qp, bn_digit_t *np,
+                            const bn_digit_t *dp, size_t n, bn_digit_t dinv,
+                            bn_digit_t *scratch) {
+  if (n < BN_BZ_DIV_THRESHOLD)
+    return bn_mpn_div_qr_basecase(qp, np, 2 * n, dp, n, dinv);
+
+  const size_t lo = n / 2;
+  const size_t hi = n - lo;
+  // The recursive calls are done before tp is used, so they can share it.
+  bn_digit_t *tp = scratch;
+  bn_digit_t *next = scratch + n;
+
+  // High half: {qp + lo, hi} = {np + 2 lo, 2 hi} / {dp + lo, hi}, leaving
+  // {np + lo, n} = {np + lo, n} - {qp + lo, hi} * {dp, lo}.
+  bn_digit_t qh =
+      bn_mpn_div_qr_dc(qp + lo, np + 2 * lo, dp + lo, hi, dinv, scratch);
+  bn_mpn_mul(tp, qp + lo, hi, dp, lo, next);
+  bn_digit_t borrow = bn_mpn_sub_n(np + lo, np + lo, tp, n);
+  if (qh)
+    borrow += bn_mpn_sub_n(np + n, np + n, dp, lo);
+  while (borrow) {
+    qh -= bn_mpn_sub_1(qp + lo, qp + lo, hi, 1);
+    borrow -= bn_mpn_add_n(np + lo, np + lo, dp, n);
+  }
+
+  // Low half, the same with {np + hi, 2 lo} and the top lo divisor digits.
+  bn_digit_t ql = bn_mpn_div_qr_dc(qp, np + hi, dp + hi, lo, dinv, scratch);
+  bn_mpn_mul(tp, dp, hi, qp, lo, next);
+  borrow = bn_mpn_sub_n(np, np, tp, n);
+  if (ql)
+    borrow += bn_mpn_sub_n(np + lo, np + lo, dp, hi);
+  while (borrow) {
+    // If ql is set, this wraps {qp, lo} around and cancels it.
+    bn_mpn_sub_1(qp, qp, lo, 1);
+    borrow -= bn_mpn_add_n(np, np, dp, n);
+  }
+  return qh;
+}
+
+size_t bn_mpn_div_qr_pre_itch(size_t nn, size_t dn) {
+  if (dn == 1)
+    return 0;
+  // u[(k + 1) dn] | qtop[dn] | kernels, see bn_mpn_div_qr_pre
+  size_t k = nn / dn;
+  return (k + 2) * dn + bn_mpn_div_qr_dc_itch(dn);
+}
+
+// {qp, nn - dn + 1} = {np, nn} / {dp, dn}, {rp, dn} = {np, nn} % {dp, dn}
+// for a divisor prepared by bn_divisor_init: {dp, dn} is the divisor shifted
+// left by shift bits, dinv is bn_digit_reciprocal of its top digit if
+// dn == 1 and bn_digit_reciprocal_3by2 of the top two digits otherwise.
+// nn >= dn, the outputs must not overlap the inputs. {scratch} must hold
+// bn_mpn_div_qr_pre_itch(nn, dn) digits.
+void bn_mpn_div_qr_pre(bn_digit_t *qp, bn_digit_t *rp, const bn_digit_t *np,
+                       size_t nn, const bn_digit_t *dp, size_t dn,
+                       unsigned shift, bn_digit_t dinv, bn_digit_t *scratch) {
+  BN_ASSERT(nn >= dn && dn >= 1);
+  BN_ASSERT(dp[dn - 1] >> (DIGIT_BITS - 1));
+  if (dn == 1) {
+    rp[0] = bn_mpn_divrem_1_pre(qp, np, nn, dp[0], shift, dinv);
+    return;
+  }
+
+  // D1.
+  // Shift the dividend like the divisor. It grows by one digit, which keeps
+  // its top dn digits below the divisor, so there are qn quotient digits and
+  // no high quotient digit.
+  const size_t qn = nn - dn + 1;
+  const size_t k = nn / dn; // = ceil(qn / dn)
+  bn_digit_t *u = scratch;
+  bn_digit_t *qtop = u + (k + 1) * dn;
+  bn_digit_t *next = qtop + dn;
+  if (shift > 0) {
+    u[nn] = bn_mpn_lshift(u, np, nn, shift);
+  } else {
+    bn_mpn_copy(u, np, nn);
+    u[nn] = 0;
+  }
+
+  if (dn < BN_BZ_DIV_THRESHOLD) {
+    bn_digit_t qh = bn_mpn_div_qr_basecase(qp, u, nn + 1, dp, dn, dinv);
+    BN_ASSERT(qh == 0);
+    (void)qh;
+  } else {
+    // Divide block by block from the top, every block {u + i dn, 2 dn}
+    // gives dn quotient digits. The top block only has r of them, a short one
+    // is done by the basecase, a longer one is padded with zeros.
+    const size_t r = qn - (k - 1) * dn;
+    bn_digit_t *uq = u + (k - 1) * dn;
+    bn_digit_t qh;
+    if (r == dn) {
+      qh = bn_mpn_div_qr_dc(qp + (k - 1) * dn, uq, dp, dn, dinv, next);
+    } else if (r < BN_BZ_DIV_THRESHOLD) {
+      qh = bn_mpn_div_qr_basecase(qp + (k - 1) * dn, uq, dn + r, dp, dn, dinv);
+    } else {
+      bn_mpn_zero(uq + dn + r, dn - r);
+      qh = bn_mpn_div_qr_dc(qtop, uq, dp, dn, dinv, next);
+      bn_mpn_copy(qp + (k - 1) * dn, qtop, r);
+    }
+    BN_ASSERT(qh == 0);
+    for (size_t i = k - 1; i-- > 0;) {
+      qh = bn_mpn_div_qr_dc(qp + i * dn, u + i * dn, dp, dn, dinv, next);
+      BN_ASSERT(qh == 0);
+    }
+    (void)qh;
+  }
+
+  if (shift > 0)
+    bn_mpn_rshift(rp, u, dn, shift);
+  else
+    bn_mpn_copy(rp, u, dn);
+}
+
+size_t bn_mpn_div_qr_itch(size_t nn, size_t dn) {
+  return dn + bn_mpn_div_qr_pre_itch(nn, dn);
+}
+
+// {qp, nn - dn + 1} = {np, nn} / {dp, dn}, {rp, dn} = {np, nn} % {dp, dn}
+// with nn >= dn >= 1 and dp[dn - 1] != 0. The outputs must not overlap the
+// inputs. {scratch} must hold bn_mpn_div_qr_itch(nn, dn) digits.
+void bn_mpn_div_qr(bn_digit_t *qp, bn_digit_t *rp, const bn_digit_t *np,
+                   size_t nn, const bn_digit_t *dp, size_t dn,
+                   bn_digit_t *scratch) {
+  BN_ASSERT(nn >= dn && dn >= 1);
+  BN_ASSERT(dp[dn - 1] != 0);
+  if (dn == 1) {
+    rp[0] = bn_mpn_divrem_1(qp, np, nn, dp[0]);
+    return;
+  }
+  // Left-shift the divisor so that its MSB is set.
+  bn_digit_t *d = scratch;
+  const unsigned shift = bn_digit_count_leading_zeros(dp[dn - 1]);
+  if (shift > 0)
+    bn_mpn_lshift(d, dp, dn, shift);
+  else
+    bn_mpn_copy(d, dp, dn);
+  bn_digit_t dinv = bn_digit_reciprocal_3by2(d[dn - 1], d[dn - 2]);
+  bn_mpn_div_qr_pre(qp, rp, np, nn, d, dn, shift, dinv, scratch + dn);
+}
+
+//////////////////// RADIX POWERS ////////////////////
+
+uint8_t _BN_TO_STRING_MAX_BITS_PER_CHAR[] = {
+    0,   0,   32,  51,  64,  75,  83,  90,  96, // 0..8
+    102, 107, 111, 115, 119, 122, 126, 128,     // 9..16
+    131, 134, 136, 139, 141, 143, 145, 147,     // 17..24
+    149, 151, 153, 154, 156, 158, 159, 160,     // 25..32
+    162, 163, 165, 166,                         // 33..36
+};
+
+// radix^chars, prepared for division. The powers of a radix form a list
+// radix^chunk_chars, radix^(2 chunk_chars), radix^(4 chunk_chars), ...
+// where chunk_chars is the most characters that fit into a digit. The list is
+// shared by all threads and grows on demand.
+typedef struct _bn_radix_power {
+  size_t chars;
+  bn_digit_t *digits;
+  size_t size;
+  bn_divisor_t divisor;
+  struct _bn_radix_power *next; // the square, NULL until first needed
+} _bn_radix_power_t;
+
+static _bn_radix_power_t *_bn_radix_powers[37];
+
+static _bn_radix_power_t *_bn_radix_power_new(bn_digit_t *digits, size_t size,
+                                              size_t chars) {
+  _bn_radix_power_t *P = BN_MALLOC(sizeof(_bn_radix_power_t));
+  BN_ASSERT(P != NULL);
+  const bn_t B = _bn_view(digits, size);
+  P->chars = chars;
+  P->digits = digits;
+  P->size = size;
+  bn_divisor_init(&P->divisor, &B);
+  P->next = NULL;
+  return P;
+}
+
+static void _bn_radix_power_free(_bn_radix_power_t *P) {
+  bn_divisor_free(&P->divisor);
+  BN_FREE(P->digits);
+  BN_FREE(P);
+}
+
+// Returns radix^chunk_chars, the head of the list
+_bn_radix_power_t *_bn_radix_power_first(bn_digit_t radix) {
+  BN_ASSERT(radix >= 2 && radix <= 36);
+  _bn_radix_power_t *P = _BN_ATOMIC_LOAD_PTR(&_bn_radix_powers[radix]);
+  if (P != NULL)
+    return P;
+
+  // The largest chars with radix^chars < 2^DIGIT_BITS. The table is exact for
+  // powers of two, where radix^(DIGIT_BITS * 32 / bits) would not fit.
+  const size_t chars =
+      (DIGIT_BITS * 32 - 1) / _BN_TO_STRING_MAX_BITS_PER_CHAR[radix];
+  bn_digit_t *digits = BN_MALLOC(sizeof(bn_digit_t));
+  BN_ASSERT(digits != NULL);
+  digits[0] = bn_digit_pow(radix, chars);
+  P = _bn_radix_power_new(digits, 1, chars);
+  _bn_radix_power_t *expected = NULL;
+  if (!_BN_ATOMIC_CAS_PTR(&_bn_radix_powers[radix], expected, P)) {
+    // Another thread was first, use its power.
+    _bn_radix_power_free(P);
+    P = _BN_ATOMIC_LOAD_PTR(&_bn_radix_powers[radix]);
+  }
+  return P;
+}
+
+// Returns the square of P, the next power in the list
+_bn_radix_power_t *_bn_radix_power_next(_bn_radix_power_t *P) {
+  _bn_radix_power_t *next = _BN_ATOMIC_LOAD_PTR(&P->next);
+  if (next != NULL)
+    return next;
+
+  const size_t n = P->size;
+  bn_digit_t *digits = BN_MALLOC(2 * n * sizeof(bn_digit_t));
+  BN_ASSERT(digits != NULL);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_mpn_sqr(digits, P->digits, n, _bn_scratch_alloc(S, bn_mpn_sqr_itch(n)));
+  _bn_scratch_release(S, mark);
+  next = _bn_radix_power_new(digits, bn_mpn_normalized_size(digits, 2 * n),
+                             2 * P->chars);
+  _bn_radix_power_t *expected = NULL;
+  if (!_BN_ATOMIC_CAS_PTR(&P->next, expected, next)) {
+    _bn_radix_power_free(next);
+    next = _BN_ATOMIC_LOAD_PTR(&P->next);
+  }
+  return next;
+}
+
+//////////////////// STRING BUILDER ////////////////////
+
+typedef struct {
+  char *s;
+  size_t size;
+  size_t capacity;
+} bn_sb_t;
+void bn_sb_append_char(bn_sb_t *sb, const char c) {
+  BN_ASSERT(sb->capacity >= sb->size);
+  if (sb->size == sb->capacity) {
+    sb->capacity = sb->capacity == 0 ? 256 : 2 * sb->capacity;
+    sb->s = BN_REALLOC(sb->s, sizeof(char) * sb->capacity);
+  }
+  sb->s[sb->size++] = c;
+}
+void bn_sb_append(bn_sb_t *sb, const char *s) {
+  if (s == NULL)
+    return;
+  while (*s != '\0')
+    bn_sb_append_char(sb, *s++);
+}
+char *bn_sb_to_str(bn_sb_t *sb) {
+  if (sb->size == 0 || sb->s[sb->size - 1] != '\0') {
+    bn_sb_append_char(sb, '\0');
+  }
+  return sb->s;
+}
+void bn_sb_reverse(bn_sb_t *sb) {
+  if (sb->size == 0)
+    return;
+  size_t len = sb->s[sb->size - 1] == '\0' ? sb->size - 1 : sb->size;
+  for (size_t i = 0; i < len / 2; ++i) {
+    char c = sb->s[i];
+    sb->s[i] = sb->s[len - i - 1];
+    sb->s[len - i - 1] = c;
+  }
+}
+void bn_sb_free(bn_sb_t *sb) {
+  BN_FREE(sb->s);
+  sb->size = 0;
+  sb->capacity = 0;
+}
+
+//////////////////// BN UTILITIES ////////////////////
+
+// Makes room for capacity digits, keeping the first bn->size. Numbers stay
+// in the inline digits as long as they fit, storage on the heap is always
+// larger.
+void _bn_reserve(bn_t *bn, size_t capacity) {
+  if (capacity <= bn->capacity)
+    return;
+  if (bn->capacity > BN_INLINE_DIGITS) {
+    bn->heap = BN_REALLOC(bn->heap, capacity * sizeof(bn_digit_t));
+    BN_ASSERT(bn->heap != NULL);
+  } else if (capacity <= BN_INLINE_DIGITS) {
+    capacity = BN_INLINE_DIGITS;
+  } else {
+    bn_digit_t *digits = BN_MALLOC(capacity * sizeof(bn_digit_t));
+    BN_ASSERT(digits != NULL);
+    bn_mpn_copy(digits, bn->inline_digits, bn->size);
+    bn->heap = digits;
+  }
+  bn->capacity = capacity;
+}
+
+void bn_resize(bn_t *bn, size_t size) {
+  _bn_reserve(bn, size);
+  for (size_t i = bn->size; i < size; ++i) {
+    BN_DIGITS(bn)[i] = 0;
+  }
+  bn->size = size;
+}
+
+void bn_append_digit(bn_t *bn, bn_digit_t d) {
+  BN_ASSERT(bn->capacity >= bn->size);
+  if (bn->size == bn->capacity)
+    _bn_reserve(bn, bn->capacity == 0 ? 1 : 2 * bn->capacity);
+  BN_DIGITS(bn)[bn->size++] = d;
+}
+
+void bn_set_digit(bn_t *bn, size_t i, bn_digit_t d) {
+  if (i >= bn->size) {
+    bn_resize(bn, i+1);
+  }
+  BN_DIGITS(bn)[i] = d;
+}
+
+void bn_reverse_digits(bn_t *bn) {
+  if (bn->size == 0)
+    return;
+  for (size_t i = 0; i < bn->size / 2; ++i) {
+    bn_digit_t d = BN_DIGITS(bn)[i];
+    BN_DIGITS(bn)[i] = BN_DIGITS(bn)[bn->size - i - 1];
+    BN_DIGITS(bn)[bn->size - i - 1] = d;
+  }
+}
+
+const uint8_t CHAR_VALUE[] = {
+    255, 255, 255, 255, 255, 255, 255, 255, // 0..7
+    255, 255, 255, 255, 255, 255, 255, 255, // 8..15
+    255, 255, 255, 255, 255, 255, 255, 255, // 16..23
+    255, 255, 255, 255, 255, 255, 255, 255, // 24..31
+    255, 255, 255, 255, 255, 255, 255, 255, // 32..39
+    255, 255, 255, 255, 255, 255, 255, 255, // 40..47
+    0,   1,   2,   3,   4,   5,   6,   7,   // 48..55    '0' == 48
     8,   9,   255, 255, 255, 255, 255, 255, // 56..63    '9' == 57
     255, 10,  11,  12,  13,  14,  15,  16,  // 64..71    'A' == 65
     17,  18,  19,  20,  21,  22,  23,  24,  // 72..79
@@ -402,678 +3457,4668 @@ const uint8_t CHAR_VALUE[] = {
     33,  34,  35,  255, 255, 255, 255, 255, // 120..127  'z' == 122
 };
 
-#if defined(__GNUC__) || defined(__clang__)
-#define HAVE_BUILTIN_MUL_OVERFLOW 1
-#else
-#define HAVE_BUILTIN_MUL_OVERFLOW 0
-#endif
+// {rp, return value} = sum of parts[i] * p0^i for i < m, evaluated with
+// Horner's scheme from the most significant part. {rp} must hold m digits.
+size_t _bn_from_string_basecase(bn_digit_t *rp, const bn_digit_t *parts,
+                                size_t m, bn_digit_t p0) {
+  size_t n = 0;
+  for (size_t i = m; i-- > 0;) {
+    bn_digit_t carry = bn_mpn_mul_1(rp, rp, n, p0);
+    bn_digit_t part = parts[i];
+    for (size_t j = 0; part != 0 && j < n; ++j)
+      rp[j] = bn_digit_add2(rp[j], part, &part);
+    carry += part;
+    if (carry != 0)
+      rp[n++] = carry;
+  }
+  return n;
+}
+
+// {rp, return value} = sum of parts[i] * p0^i for i < m <= 2^(k + 1), where
+// powers[k] = p0^(2^k). Converts both halves of the parts and combines them
+// with one multiplication by powers[k]. {rp} must hold m digits.
+size_t _bn_from_string_dc(bn_digit_t *rp, const bn_digit_t *parts, size_t m,
+                          _bn_radix_power_t *const *powers, size_t k) {
+  if (k == 0 || m < BN_FROM_STRING_DC_THRESHOLD)
+    return _bn_from_string_basecase(rp, parts, m, powers[0]->digits[0]);
+  const size_t half = (size_t)1 << k;
+  if (m <= half)
+    return _bn_from_string_dc(rp, parts, m, powers, k - 1);
+
+  const _bn_radix_power_t *P = powers[k];
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *lo = _bn_scratch_alloc(S, m);
+  bn_digit_t *hi = lo + half;
+  const size_t ln = _bn_from_string_dc(lo, parts, half, powers, k - 1);
+  const size_t hn = _bn_from_string_dc(hi, parts + half, m - half, powers, k - 1);
+  size_t n = ln;
+  if (hn == 0) {
+    bn_mpn_copy(rp, lo, ln);
+  } else {
+    // hi * P + lo < (hi + 1) * P fits into hn + P->size <= m digits.
+    const bn_digit_t *ap = hi, *bp = P->digits;
+    size_t an = hn, bn = P->size;
+    if (an < bn) {
+      ap = P->digits;
+      bp = hi;
+      an = P->size;
+      bn = hn;
+    }
+    bn_mpn_mul(rp, ap, an, bp, bn, _bn_scratch_alloc(S, bn_mpn_mul_itch(an, bn)));
+    n = hn + P->size;
+    bn_digit_t carry = bn_mpn_add(rp, rp, n, lo, ln);
+    BN_ASSERT(carry == 0);
+    (void)carry;
+    n = bn_mpn_normalized_size(rp, n);
+  }
+  _bn_scratch_release(S, mark);
+  return n;
+}
+
+bn_err_t bn_from_string(bn_t *bn, const char *s, bn_digit_t radix) {
+  BN_ASSERT(bn != NULL);
+  if (s == NULL || *s == '\0') {
+    return -BN_EMPTY_STRING;
+  }
+
+  if (radix == 0) {
+    radix = 10;
+  }
+  BN_ASSERT(radix >= 2 && radix <= 36);
+
+  // handle sign
+  int sign = 1;
+  if (s[0] == '-') {
+    sign = -1;
+    ++s;
+  } else if (s[0] == '+') {
+    ++s;
+  }
+
+  // The number ends at the first character that is not a digit in radix.
+  size_t len = 0;
+  for (uint8_t c; (c = s[len]) <= 127 && CHAR_VALUE[c] < radix; ++len)
+    ;
+
+  // Parse the string into parts of chunk_chars characters, starting with the
+  // least significant part, so that the number is the sum of
+  // parts[i] * (radix^chunk_chars)^i.
+  _bn_radix_power_t *powers[8 * sizeof(size_t)];
+  powers[0] = _bn_radix_power_first(radix);
+  const size_t chunk_chars = powers[0]->chars;
+  const size_t m = (len + chunk_chars - 1) / chunk_chars;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *parts = _bn_scratch_alloc(S, m);
+  for (size_t i = 0; i < m; ++i) {
+    const size_t end = len - i * chunk_chars;
+    const size_t begin = end > chunk_chars ? end - chunk_chars : 0;
+    bn_digit_t part = 0;
+    for (size_t j = begin; j < end; ++j)
+      part = part * radix + CHAR_VALUE[(uint8_t)s[j]];
+    parts[i] = part;
+  }
+
+  bn_resize(bn, _bn_max(m, 1));
+  size_t n;
+  if (m < BN_FROM_STRING_DC_THRESHOLD) {
+    n = _bn_from_string_basecase(BN_DIGITS(bn), parts, m, powers[0]->digits[0]);
+  } else {
+    size_t k = 0;
+    while (((size_t)2 << k) < m) {
+      powers[k + 1] = _bn_radix_power_next(powers[k]);
+      ++k;
+    }
+    n = _bn_from_string_dc(BN_DIGITS(bn), parts, m, powers, k);
+  }
+  _bn_scratch_release(S, mark);
+
+  if (n == 0) {
+    BN_DIGITS(bn)[0] = 0;
+    n = 1;
+    sign = 1;
+  }
+  bn->size = n;
+  bn->sign = sign;
+  return BN_OK;
+}
+
+bn_err_t bn_from_int(bn_t *bn, int i) {
+  bn->size = 0;
+  if (i < 0) {
+    i *= -1;
+    bn->sign = -1;
+  } else {
+    bn->sign = 1;
+  }
+  bn_append_digit(bn, i);
+
+  return BN_OK;
+}
+
+bn_err_t bn_clone(bn_t *to, const bn_t *from) {
+  BN_ASSERT(from != NULL);
+  BN_ASSERT(to != NULL);
+
+  to->size = 0;
+  _bn_reserve(to, from->size);
+  bn_mpn_copy(BN_DIGITS(to), BN_DIGITS(from), from->size);
+  to->size = from->size;
+  to->sign = from->sign;
+  return BN_OK;
+}
+
+void bn_swap(bn_t *a, bn_t *b) {
+  BN_ASSERT(a != NULL);
+  BN_ASSERT(b != NULL);
+
+  const bn_t t = *a;
+  *a = *b;
+  *b = t;
+}
+
+void bn_normalize(bn_t *bn) {
+  if (bn->size == 0) return;
+  for (size_t i = bn->size - 1; i > 0; i--) {
+    if (BN_DIGITS(bn)[i] == 0)
+      bn->size--;
+    else
+      return;
+  }
+}
+
+void bn_free(bn_t *bn) {
+  if (bn->capacity > BN_INLINE_DIGITS)
+    BN_FREE(bn->heap);
+  bn->heap = NULL;
+  bn->size = 0;
+  bn->capacity = 0;
+}
+
+#include <stdio.h>
+void bn_print_digits(bn_t *bn) {
+  printf("[");
+  for (size_t i = 0; i < bn->size; ++i) {
+    if (i > 0)
+      printf(", ");
+    printf("%zu", BN_DIGITS(bn)[i]);
+  }
+  printf("]\n");
+}
+
+//////////////////// TO STRING ////////////////////
+
+const char STR_CONVERSION_CHARS[] =
+    "0123456789abcdefghijklmnopqrstuvwxyz";
+
+// Number of characters a number of n > 0 digits takes at most in radix
+size_t _bn_to_string_max_chars(size_t n, bn_digit_t radix) {
+  // The table rounds log2(radix) * 32 up, so one less is a lower bound unless
+  // radix is a power of two.
+  size_t bits_per_char = _BN_TO_STRING_MAX_BITS_PER_CHAR[radix];
+  if (radix & (radix - 1))
+    bits_per_char -= 1;
+  return (n * DIGIT_BITS * 32 + bits_per_char - 1) / bits_per_char;
+}
+
+// Writes {xp, n} < radix^width as exactly width characters, padded with
+// leading zeros. Divides off one chunk of P->chars characters at a time,
+// where P is the first cached power, which destroys {xp, n}.
+void _bn_to_string_basecase(char *s, size_t width, bn_digit_t *xp, size_t n,
+                            bn_digit_t radix, const _bn_radix_power_t *P) {
+  const bn_divisor_t *D = &P->divisor;
+  char *p = s + width;
+  n = bn_mpn_normalized_size(xp, n);
+  while (n > 1) {
+    bn_digit_t chunk =
+        bn_mpn_divrem_1_pre(xp, xp, n, D->digits[0], D->shift, D->inv);
+    BN_ASSERT((size_t)(p - s) >= P->chars);
+    for (size_t i = 0; i < P->chars; ++i) {
+      *--p = STR_CONVERSION_CHARS[chunk % radix];
+      chunk /= radix;
+    }
+    n -= xp[n - 1] == 0;
+  }
+  bn_digit_t last = n > 0 ? xp[0] : 0;
+  while (p > s) {
+    *--p = STR_CONVERSION_CHARS[last % radix];
+    last /= radix;
+  }
+  BN_ASSERT(last == 0);
+}
+
+// Writes {xp, n} < powers[k]^2 as exactly 2 * powers[k]->chars characters,
+// padded with leading zeros. Splits it by powers[k] and recurses on quotient
+// and remainder, down to the basecase.
+void _bn_to_string_dc(char *s, bn_digit_t *xp, size_t n, bn_digit_t radix,
+                      _bn_radix_power_t *const *powers, size_t k) {
+  const _bn_radix_power_t *P = powers[k];
+  n = bn_mpn_normalized_size(xp, n);
+  if (k == 0 || n < BN_TO_STRING_DC_THRESHOLD) {
+    _bn_to_string_basecase(s, 2 * P->chars, xp, n, radix, powers[0]);
+    return;
+  }
+  if (n < P->size) {
+    // The high half is all zeros.
+    memset(s, '0', P->chars);
+    _bn_to_string_dc(s + P->chars, xp, n, radix, powers, k - 1);
+    return;
+  }
+
+  const bn_divisor_t *D = &P->divisor;
+  const size_t dn = D->size;
+  const size_t qn = n - dn + 1;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *q =
+      _bn_scratch_alloc(S, qn + dn + bn_mpn_div_qr_pre_itch(n, dn));
+  bn_digit_t *r = q + qn;
+  bn_mpn_div_qr_pre(q, r, xp, n, D->digits, dn, D->shift, D->inv, r + dn);
+  _bn_to_string_dc(s, q, qn, radix, powers, k - 1);
+  _bn_to_string_dc(s + P->chars, r, dn, radix, powers, k - 1);
+  _bn_scratch_release(S, mark);
+}
+
+// Writes {xp, n} without leading zeros, returns the number of characters,
+// which is 0 for zero. Only the quotients are converted this way, so the
+// temporary max_chars of the basecase always start at the front of the output
+// and fit into a buffer for the whole number. Splits by powers[k] like
+// _bn_to_string_dc, but needs no bound on {xp, n}.
+size_t _bn_to_string_unpadded(char *s, bn_digit_t *xp, size_t n,
+                              bn_digit_t radix,
+                              _bn_radix_power_t *const *powers, size_t k) {
+  n = bn_mpn_normalized_size(xp, n);
+  if (k == 0 || n < BN_TO_STRING_DC_THRESHOLD) {
+    const size_t width = n > 0 ? _bn_to_string_max_chars(n, radix) : 0;
+    _bn_to_string_basecase(s, width, xp, n, radix, powers[0]);
+    size_t zeros = 0;
+    while (zeros < width && s[zeros] == '0')
+      ++zeros;
+    memmove(s, s + zeros, width - zeros);
+    return width - zeros;
+  }
+  const _bn_radix_power_t *P = powers[k];
+  if (n < P->size)
+    return _bn_to_string_unpadded(s, xp, n, radix, powers, k - 1);
+
+  const bn_divisor_t *D = &P->divisor;
+  const size_t dn = D->size;
+  const size_t qn = n - dn + 1;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *q =
+      _bn_scratch_alloc(S, qn + dn + bn_mpn_div_qr_pre_itch(n, dn));
+  bn_digit_t *r = q + qn;
+  bn_mpn_div_qr_pre(q, r, xp, n, D->digits, dn, D->shift, D->inv, r + dn);
+  size_t len = _bn_to_string_unpadded(s, q, qn, radix, powers, k - 1);
+  if (len == 0) {
+    len = _bn_to_string_unpadded(s, r, dn, radix, powers, k - 1);
+  } else {
+    _bn_to_string_dc(s + len, r, dn, radix, powers, k - 1);
+    len += P->chars;
+  }
+  _bn_scratch_release(S, mark);
+  return len;
+}
+
+// Writes {xp, n} in radix 2^bits as exactly len characters, picking the bits
+// of each character straight from the digits.
+void _bn_to_string_pow2(char *s, size_t len, const bn_digit_t *xp, size_t n,
+                        unsigned bits) {
+  const bn_digit_t mask = ((bn_digit_t)1 << bits) - 1;
+  size_t pos = len * bits;
+  for (size_t i = 0; i < len; ++i) {
+    pos -= bits;
+    const size_t j = pos / DIGIT_BITS;
+    const unsigned offset = pos % DIGIT_BITS;
+    bn_digit_t value = xp[j] >> offset;
+    if (offset + bits > DIGIT_BITS && j + 1 < n)
+      value |= xp[j + 1] << (DIGIT_BITS - offset);
+    s[i] = STR_CONVERSION_CHARS[value & mask];
+  }
+}
+
+size_t bn_sizeinbase(const bn_t *bn, bn_digit_t radix) {
+  BN_ASSERT(radix >= 2 && radix <= 36);
+  const size_t n =
+      bn->size > 0 ? bn_mpn_normalized_size(BN_DIGITS(bn), bn->size) : 0;
+  if (n == 0)
+    return 1;
+  if ((radix & (radix - 1)) == 0) {
+    const unsigned bits = _BN_TO_STRING_MAX_BITS_PER_CHAR[radix] / 32;
+    const size_t bit_length =
+        n * DIGIT_BITS - bn_digit_count_leading_zeros(BN_DIGITS(bn)[n - 1]);
+    return (bit_length + bits - 1) / bits;
+  }
+  return _bn_to_string_max_chars(n, radix);
+}
+
+bn_err_t bn_to_string_buf(const bn_t *bn, char *buf, size_t size,
+                          bn_digit_t radix) {
+  BN_ASSERT(radix >= 2 && radix <= 36);
+  // One character for the sign and the terminating zero each.
+  if (size < bn_sizeinbase(bn, radix) + 2)
+    return BN_BUFFER_TOO_SMALL;
+
+  const size_t n =
+      bn->size > 0 ? bn_mpn_normalized_size(BN_DIGITS(bn), bn->size) : 0;
+  char *s = buf;
+  if (n > 0 && bn->sign == -1)
+    *s++ = '-';
+
+  size_t len;
+  if (n == 0) {
+    s[0] = '0';
+    len = 1;
+  } else if ((radix & (radix - 1)) == 0) {
+    len = bn_sizeinbase(bn, radix);
+    _bn_to_string_pow2(s, len, BN_DIGITS(bn), n,
+                       _BN_TO_STRING_MAX_BITS_PER_CHAR[radix] / 32);
+  } else {
+    _bn_radix_power_t *powers[8 * sizeof(size_t)];
+    size_t k = 0;
+    powers[0] = _bn_radix_power_first(radix);
+    if (n >= BN_TO_STRING_DC_THRESHOLD) {
+      // Pick the first power whose square is above {bn}.
+      while (2 * (powers[k]->size - 1) < n) {
+        powers[k + 1] = _bn_radix_power_next(powers[k]);
+        ++k;
+      }
+    }
+    bn_scratch_t *S = _bn_scratch();
+    const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+    bn_digit_t *xp = _bn_scratch_alloc(S, n);
+    bn_mpn_copy(xp, BN_DIGITS(bn), n);
+    len = _bn_to_string_unpadded(s, xp, n, radix, powers, k);
+    _bn_scratch_release(S, mark);
+  }
+  s[len] = '\0';
+  return BN_OK;
+}
+
+bn_err_t bn_to_string_radix(const bn_t *bn, char **s, bn_digit_t radix) {
+  const size_t size = bn_sizeinbase(bn, radix) + 2;
+  *s = BN_MALLOC(size);
+  BN_ASSERT(*s != NULL);
+  return bn_to_string_buf(bn, *s, size, radix);
+}
+
+bn_err_t bn_to_string(const bn_t *bn, char **s) {
+  return bn_to_string_radix(bn, s, 10);
+}
+
+void bn_print(const bn_t *bn) {
+  char *s;
+  bn_to_string(bn, &s);
+  printf("%s", s);
+  BN_FREE(s);
+}
+
+//////////////////// BIGNUM COMPARISON ////////////////////
+
+int bn_cmp(const bn_t *a, const bn_t *b) {
+  if (a->sign < b->sign)
+    return -1;
+  if (a->sign > b->sign)
+    return 1;
+
+  int res = bn_cmp_abs(a, b);
+  if (a->sign < 0)
+    return -res;
+  return res;
+}
+int bn_cmp_abs(const bn_t *a, const bn_t *b) {
+  if (a->size == 0 && b->size == 0)
+    return 0;
+  else if (a->size == 0)
+    return -1;
+  else if (b->size == 0)
+    return 1;
+
+  // handle zero padding
+  size_t sa = a->size - 1;
+  for (; sa > 0 && BN_DIGITS(a)[sa] == 0; sa--)
+    ;
+  size_t sb = b->size - 1;
+  for (; sb > 0 && BN_DIGITS(b)[sb] == 0; sb--)
+    ;
+
+  if (sa > sb)
+    return 1;
+  if (sa < sb)
+    return -1;
+
+  // compare digit-by-digit
+  do {
+    if (BN_DIGITS(a)[sa] > BN_DIGITS(b)[sa])
+      return 1;
+    if (BN_DIGITS(a)[sa] < BN_DIGITS(b)[sa])
+      return -1;
+  } while (sa-- > 0);
+
+  return 0;
+}
+
+//////////////////// BIGNUM ARITHMETIC ////////////////////
+
+bn_err_t bn_abs(bn_t *Z, const bn_t *A) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(A != NULL);
+
+  if (Z != A) bn_clone(Z, A);
+  Z->sign = 1;
+
+  return BN_OK;
+}
+
+bn_err_t bn_add_single(bn_t *Z, const bn_t *X, bn_digit_t y) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(X->size > 0);
+
+  const bn_t Y = {.sign = 1, .size = 1, .capacity = 1, .inline_digits = {y}};
+  return bn_add(Z, X, &Y);
+}
+
+// Z = |A| + |B|, the sign of Z is left to the caller
+static void _bn_add_abs(bn_t *Z, const bn_t *A, const bn_t *B) {
+  size_t an = A->size, bn = B->size;
+  if (an < bn) {
+    const bn_t *T = A;
+    A = B;
+    B = T;
+    an = A->size;
+    bn = B->size;
+  }
+  // Z may be A or B, so their digits are only read after the resize.
+  bn_resize(Z, an + 1);
+  bn_digit_t *zp = BN_DIGITS(Z);
+  zp[an] = bn_mpn_add(zp, BN_DIGITS(A), an, BN_DIGITS(B), bn);
+  bn_normalize(Z);
+}
+
+// Z = ||A| - |B||, returns -1 if |A| < |B| and 1 otherwise. The sign of Z is
+// left to the caller.
+static int _bn_sub_abs(bn_t *Z, const bn_t *A, const bn_t *B) {
+  int sign = 1;
+  if (bn_cmp_abs(A, B) < 0) {
+    const bn_t *T = A;
+    A = B;
+    B = T;
+    sign = -1;
+  }
+  size_t an = bn_mpn_normalized_size(BN_DIGITS(A), A->size);
+  size_t bn = bn_mpn_normalized_size(BN_DIGITS(B), B->size);
+  if (an == 0) {
+    bn_resize(Z, 1);
+    BN_DIGITS(Z)[0] = 0;
+    return sign;
+  }
+  bn_resize(Z, an);
+  bn_digit_t borrow =
+      bn_mpn_sub(BN_DIGITS(Z), BN_DIGITS(A), an, BN_DIGITS(B), bn);
+  BN_ASSERT(borrow == 0);
+  (void)borrow;
+  bn_normalize(Z);
+  return sign;
+}
+
+bn_err_t bn_add(bn_t *Z, const bn_t *A, const bn_t *B) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(A != NULL);
+  BN_ASSERT(A->size > 0);
+  BN_ASSERT(B != NULL);
+  BN_ASSERT(B->size > 0);
+
+  // Z may alias A or B, read the signs first
+  int a_sign = A->sign, b_sign = B->sign;
+  if (a_sign == b_sign) {
+    _bn_add_abs(Z, A, B);
+    Z->sign = a_sign;
+  } else {
+    Z->sign = a_sign * _bn_sub_abs(Z, A, B);
+  }
+  if (Z->size == 1 && BN_DIGITS(Z)[0] == 0)
+    Z->sign = 1;
+
+  return BN_OK;
+}
+
+bn_err_t bn_sub_single(bn_t *Z, const bn_t *X, bn_digit_t y) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(X->size > 0);
+
+  const bn_t Y = {.sign = 1, .size = 1, .capacity = 1, .inline_digits = {y}};
+  return bn_sub(Z, X, &Y);
+}
+
+bn_err_t bn_sub(bn_t *Z, const bn_t *A, const bn_t *B) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(A != NULL);
+  BN_ASSERT(A->size > 0);
+  BN_ASSERT(B != NULL);
+  BN_ASSERT(B->size > 0);
+
+  // Z may alias A or B, read the signs first
+  int a_sign = A->sign, b_sign = B->sign;
+  if (a_sign != b_sign) {
+    _bn_add_abs(Z, A, B);
+    Z->sign = a_sign;
+  } else {
+    Z->sign = a_sign * _bn_sub_abs(Z, A, B);
+  }
+  if (Z->size == 1 && BN_DIGITS(Z)[0] == 0)
+    Z->sign = 1;
+
+  return BN_OK;
+}
+
+bn_err_t bn_mul_single(bn_t *Z, const bn_t *X, bn_digit_t y) {
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(X->size != 0);
+  BN_ASSERT(Z != NULL);
+
+  size_t n = X->size;
+  Z->sign = X->sign;
+  // Z may be X, so its digits are only read after the resize.
+  bn_resize(Z, n + 1);
+  BN_DIGITS(Z)[n] = bn_mpn_mul_1(BN_DIGITS(Z), BN_DIGITS(X), n, y);
+
+  bn_normalize(Z);
+  if (Z->size == 1 && BN_DIGITS(Z)[0] == 0)
+    Z->sign = 1;
+  return BN_OK;
+}
+
+bn_err_t bn_mul(bn_t *Z, const bn_t *A, const bn_t *B) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(A != NULL);
+  BN_ASSERT(A->size > 0);
+  BN_ASSERT(B != NULL);
+  BN_ASSERT(B->size > 0);
+
+  if (A == B)
+    return bn_sqr(Z, A);
+
+  // Z may be A or B.
+  const int sign = A->sign * B->sign;
+  if (B->size == 1ul) {
+    bn_err_t res = bn_mul_single(Z, A, BN_DIGITS(B)[0]);
+    if (Z->size > 1 || BN_DIGITS(Z)[0] != 0)
+      Z->sign = sign;
+    return res;
+  }
+  if (A->size == 1ul) {
+    bn_err_t res = bn_mul_single(Z, B, BN_DIGITS(A)[0]);
+    if (Z->size > 1 || BN_DIGITS(Z)[0] != 0)
+      Z->sign = sign;
+    return res;
+  }
+
+  if (A->size < B->size) {
+    const bn_t *T = A;
+    A = B;
+    B = T;
+  }
+  const size_t zn = A->size + B->size;
+
+  // The product can only be written to Z directly if it does not alias an
+  // input. Everything else lives in a single buffer: the product (if needed)
+  // followed by the scratch space of the multiplication kernels.
+  const bool alias = Z == A || Z == B;
+  const size_t itch = bn_mpn_mul_itch(A->size, B->size);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *buffer = _bn_scratch_alloc(S, (alias ? zn : 0) + itch);
+
+  if (alias) {
+    bn_mpn_mul(buffer, BN_DIGITS(A), A->size, BN_DIGITS(B), B->size,
+               buffer + zn);
+    bn_resize(Z, zn);
+    bn_mpn_copy(BN_DIGITS(Z), buffer, zn);
+  } else {
+    bn_resize(Z, zn);
+    bn_mpn_mul(BN_DIGITS(Z), BN_DIGITS(A), A->size, BN_DIGITS(B), B->size,
+               buffer);
+  }
+  _bn_scratch_release(S, mark);
+
+  Z->sign = sign;
+  bn_normalize(Z);
+  return BN_OK;
+}
+
+bn_err_t bn_sqr(bn_t *Z, const bn_t *X) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(X->size > 0);
+
+  const size_t n = X->size;
+  const size_t zn = 2 * n;
+
+  // Same buffer handling as bn_mul.
+  const bool alias = Z == X;
+  const size_t itch = bn_mpn_sqr_itch(n);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *buffer = _bn_scratch_alloc(S, (alias ? zn : 0) + itch);
+
+  if (alias) {
+    bn_mpn_sqr(buffer, BN_DIGITS(X), n, buffer + zn);
+    bn_resize(Z, zn);
+    bn_mpn_copy(BN_DIGITS(Z), buffer, zn);
+  } else {
+    bn_resize(Z, zn);
+    bn_mpn_sqr(BN_DIGITS(Z), BN_DIGITS(X), n, buffer);
+  }
+  _bn_scratch_release(S, mark);
+
+  Z->sign = 1;
+  bn_normalize(Z);
+  return BN_OK;
+}
+
+// Prepares D for B, with the shifted divisor stored in {dp, n}, where n is
+// the normalized size of B.
+static void _bn_divisor_init(bn_divisor_t *D, const bn_t *B, bn_digit_t *dp,
+                             size_t n) {
+  D->digits = dp;
+  D->size = n;
+  D->sign = B->sign;
+  D->shift = bn_digit_count_leading_zeros(BN_DIGITS(B)[n - 1]);
+  if (D->shift > 0)
+    bn_mpn_lshift(D->digits, BN_DIGITS(B), n, D->shift);
+  else
+    bn_mpn_copy(D->digits, BN_DIGITS(B), n);
+  if (n == 1)
+    D->inv = bn_digit_reciprocal(D->digits[0]);
+  else
+    D->inv = bn_digit_reciprocal_3by2(D->digits[n - 1], D->digits[n - 2]);
+}
+
+bn_err_t bn_divisor_init(bn_divisor_t *D, const bn_t *B) {
+  BN_ASSERT(D != NULL);
+  BN_ASSERT(B != NULL);
+  BN_ASSERT(B->size > 0);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(B), B->size);
+  BN_ASSERT(n > 0);
+  bn_digit_t *dp = BN_MALLOC(n * sizeof(bn_digit_t));
+  BN_ASSERT(dp != NULL);
+  _bn_divisor_init(D, B, dp, n);
+  return BN_OK;
+}
+
+void bn_divisor_free(bn_divisor_t *D) {
+  BN_FREE(D->digits);
+  D->digits = NULL;
+  D->size = 0;
+}
+
+bn_err_t bn_div_single_pre(bn_t *Q, bn_digit_t *remainder, const bn_t *A,
+                           const bn_divisor_t *D) {
+  BN_ASSERT(A != NULL);
+  BN_ASSERT(A->size > 0);
+  BN_ASSERT(D != NULL);
+  BN_ASSERT(D->size == 1);
+
+  const size_t an = A->size;
+  const bn_digit_t d = D->digits[0];
+  if (Q == NULL) {
+    *remainder = bn_mpn_mod_1_pre(BN_DIGITS(A), an, d, D->shift, D->inv);
+    return BN_OK;
+  }
+  // Q may be A, the quotient is computed in place then.
+  const int sign = A->sign * D->sign;
+  bn_resize(Q, an);
+  *remainder =
+      bn_mpn_divrem_1_pre(BN_DIGITS(Q), BN_DIGITS(A), an, d, D->shift, D->inv);
+  bn_normalize(Q);
+  Q->sign = (Q->size == 1 && BN_DIGITS(Q)[0] == 0) ? 1 : sign;
+  return BN_OK;
+}
+
+bn_err_t bn_div_single(bn_t *Q, bn_digit_t *remainder, const bn_t *A,
+                       bn_digit_t b) {
+  BN_ASSERT(b != 0);
+
+  unsigned shift = bn_digit_count_leading_zeros(b);
+  bn_digit_t d = b << shift;
+  const bn_divisor_t D = {.digits = &d,
+                          .size = 1,
+                          .shift = shift,
+                          .inv = bn_digit_reciprocal(d),
+                          .sign = 1};
+  return bn_div_single_pre(Q, remainder, A, &D);
+}
+
+bn_err_t bn_div_pre(bn_t *Q, bn_t *R, const bn_t *A, const bn_divisor_t *D) {
+  BN_ASSERT(A != NULL);
+  BN_ASSERT(A->size > 0);
+  BN_ASSERT(D != NULL);
+  BN_ASSERT(D->size > 0);
+
+  const size_t an = bn_mpn_normalized_size(BN_DIGITS(A), A->size);
+  const size_t dn = D->size;
+  // Truncating division: the remainder has the sign of the dividend.
+  const int q_sign = A->sign * D->sign;
+  const int r_sign = A->sign;
+
+  if (an < dn) {
+    // Q may be A, so R is set first.
+    if (R != NULL) {
+      if (R != A)
+        bn_clone(R, A);
+      bn_normalize(R);
+      R->sign = (R->size == 1 && BN_DIGITS(R)[0] == 0) ? 1 : r_sign;
+    }
+    if (Q != NULL) {
+      bn_resize(Q, 1);
+      BN_DIGITS(Q)[0] = 0;
+      Q->sign = 1;
+    }
+    return BN_OK;
+  }
+
+  // Q and R may alias A, so the quotient and remainder are computed into a
+  // buffer which also holds the scratch space of the division kernels.
+  const size_t qn = an - dn + 1;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *buffer =
+      _bn_scratch_alloc(S, qn + dn + bn_mpn_div_qr_pre_itch(an, dn));
+  bn_digit_t *q = buffer;
+  bn_digit_t *r = q + qn;
+  bn_mpn_div_qr_pre(q, r, BN_DIGITS(A), an, D->digits, dn, D->shift, D->inv,
+                    r + dn);
+
+  if (Q != NULL) {
+    bn_resize(Q, qn);
+    bn_mpn_copy(BN_DIGITS(Q), q, qn);
+    bn_normalize(Q);
+    Q->sign = (Q->size == 1 && BN_DIGITS(Q)[0] == 0) ? 1 : q_sign;
+  }
+  if (R != NULL) {
+    bn_resize(R, dn);
+    bn_mpn_copy(BN_DIGITS(R), r, dn);
+    bn_normalize(R);
+    R->sign = (R->size == 1 && BN_DIGITS(R)[0] == 0) ? 1 : r_sign;
+  }
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+bn_err_t bn_div(bn_t *Q, bn_t *R, const bn_t *A, const bn_t *B) {
+  BN_ASSERT(B != NULL);
+  BN_ASSERT(B->size > 0);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(B), B->size);
+  BN_ASSERT(n > 0);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_divisor_t D;
+  _bn_divisor_init(&D, B, _bn_scratch_alloc(S, n), n);
+  bn_err_t res = bn_div_pre(Q, R, A, &D);
+  _bn_scratch_release(S, mark);
+  return res;
+}
+
+//////////////////// BIGNUM BITWISE ////////////////////
+
+// Shifts act on |X| and keep the sign, so bn_rshift rounds toward zero like
+// bn_div. The other operations see negative numbers in two's complement with
+// infinitely many leading ones, as GMP does: -X = ~(X - 1).
+
+bn_err_t bn_lshift(bn_t *Z, const bn_t *X, size_t shift) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(X->size > 0);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  if (n == 0)
+    return bn_from_int(Z, 0);
+  const size_t words = shift / DIGIT_BITS;
+  const unsigned bits = shift % DIGIT_BITS;
+  const int sign = X->sign;
+  // Z may be X, so its digits are only read after the resize, and moved up
+  // from the top.
+  bn_resize(Z, n + words + 1);
+  bn_digit_t *rp = BN_DIGITS(Z);
+  const bn_digit_t *ap = BN_DIGITS(X);
+  if (bits > 0) {
+    rp[n + words] = bn_mpn_lshift(rp + words, ap, n, bits);
+  } else {
+    rp[n + words] = 0;
+    for (size_t i = n; i-- > 0;)
+      rp[i + words] = ap[i];
+  }
+  bn_mpn_zero(rp, words);
+  Z->sign = sign;
+  bn_normalize(Z);
+  return BN_OK;
+}
+
+bn_err_t bn_rshift(bn_t *Z, const bn_t *X, size_t shift) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(X->size > 0);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  const size_t words = shift / DIGIT_BITS;
+  if (words >= n)
+    return bn_from_int(Z, 0);
+  const unsigned bits = shift % DIGIT_BITS;
+  const int sign = X->sign;
+  if (Z != X)
+    bn_resize(Z, n - words);
+  // The digits move down, in place if Z is X.
+  if (bits > 0) {
+    bn_mpn_rshift(BN_DIGITS(Z), BN_DIGITS(X) + words, n - words, bits);
+  } else {
+    for (size_t i = 0; i < n - words; ++i)
+      BN_DIGITS(Z)[i] = BN_DIGITS(X)[i + words];
+  }
+  Z->size = n - words;
+  Z->sign = sign;
+  bn_normalize(Z);
+  if (Z->size == 1 && BN_DIGITS(Z)[0] == 0)
+    Z->sign = 1;
+  return BN_OK;
+}
+
+// {rp, n} = X in two's complement, for n above the size of X
+static void _bn_to_twos(bn_digit_t *rp, const bn_t *X, size_t n) {
+  const size_t xn = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  bn_mpn_copy(rp, BN_DIGITS(X), xn);
+  bn_mpn_zero(rp + xn, n - xn);
+  if (X->sign < 0 && xn > 0) {
+    bn_mpn_sub_1(rp, rp, n, 1);
+    bn_mpn_com(rp, rp, n);
+  }
+}
+
+// Z = {rp, n} in two's complement, whose top bit is the sign. Clobbers
+// {rp, n}.
+static void _bn_from_twos(bn_t *Z, bn_digit_t *rp, size_t n) {
+  const bool negative = rp[n - 1] >> (DIGIT_BITS - 1);
+  if (negative) {
+    bn_mpn_com(rp, rp, n);
+    bn_mpn_add_1(rp, rp, n, 1);
+  }
+  bn_resize(Z, n);
+  bn_mpn_copy(BN_DIGITS(Z), rp, n);
+  Z->sign = negative ? -1 : 1;
+  bn_normalize(Z);
+}
+
+typedef enum {
+  _BN_AND,
+  _BN_IOR,
+  _BN_XOR,
+} _bn_logic_t;
+
+static bn_err_t _bn_logic(bn_t *Z, const bn_t *X, const bn_t *Y,
+                          _bn_logic_t op) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(X->size > 0);
+  BN_ASSERT(Y != NULL);
+  BN_ASSERT(Y->size > 0);
+
+  // One more digit than either operand holds its sign.
+  const size_t n = _bn_max(X->size, Y->size) + 1;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *xp = _bn_scratch_alloc(S, 2 * n);
+  bn_digit_t *yp = xp + n;
+  _bn_to_twos(xp, X, n);
+  _bn_to_twos(yp, Y, n);
+  switch (op) {
+  case _BN_AND:
+    bn_mpn_and_n(xp, xp, yp, n);
+    break;
+  case _BN_IOR:
+    bn_mpn_ior_n(xp, xp, yp, n);
+    break;
+  case _BN_XOR:
+    bn_mpn_xor_n(xp, xp, yp, n);
+    break;
+  }
+  _bn_from_twos(Z, xp, n);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+bn_err_t bn_and(bn_t *Z, const bn_t *X, const bn_t *Y) {
+  return _bn_logic(Z, X, Y, _BN_AND);
+}
+
+bn_err_t bn_or(bn_t *Z, const bn_t *X, const bn_t *Y) {
+  return _bn_logic(Z, X, Y, _BN_IOR);
+}
+
+bn_err_t bn_xor(bn_t *Z, const bn_t *X, const bn_t *Y) {
+  return _bn_logic(Z, X, Y, _BN_XOR);
+}
+
+bn_err_t bn_not(bn_t *Z, const bn_t *X) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+
+  // ~X = -X - 1 = -(X + 1)
+  bn_add_single(Z, X, 1);
+  if (bn_mpn_normalized_size(BN_DIGITS(Z), Z->size) > 0)
+    Z->sign = -Z->sign;
+  return BN_OK;
+}
+
+// Digit i of X in two's complement, where X has n digits, the lowest nonzero
+// one being digit low. Below it the digits of -X are 0, at it -d, and ~d
+// above.
+static bn_digit_t _bn_twos_digit(const bn_t *X, size_t n, size_t low,
+                                 size_t i) {
+  if (X->sign > 0 || n == 0)
+    return i < n ? BN_DIGITS(X)[i] : 0;
+  if (i >= n)
+    return ~(bn_digit_t)0;
+  return i < low ? 0 : i == low ? -BN_DIGITS(X)[i] : ~BN_DIGITS(X)[i];
+}
+
+// Index of the lowest nonzero digit of X, or its size n
+static size_t _bn_low_digit(const bn_t *X, size_t n) {
+  size_t low = 0;
+  while (low < n && BN_DIGITS(X)[low] == 0)
+    low++;
+  return low;
+}
+
+bool bn_tstbit(const bn_t *X, size_t bit) {
+  BN_ASSERT(X != NULL);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  const size_t low = X->sign < 0 ? _bn_low_digit(X, n) : 0;
+  return _bn_twos_digit(X, n, low, bit / DIGIT_BITS) >> bit % DIGIT_BITS & 1;
+}
+
+bn_err_t bn_setbit(bn_t *X, size_t bit, bool value) {
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(X->size > 0);
+
+  if (bn_tstbit(X, bit) == value)
+    return BN_OK;
+  const size_t i = bit / DIGIT_BITS;
+  const bn_digit_t mask = (bn_digit_t)1 << bit % DIGIT_BITS;
+  if (X->sign > 0) {
+    bn_set_digit(X, i, i < X->size ? BN_DIGITS(X)[i] ^ mask : mask);
+    bn_normalize(X);
+    return BN_OK;
+  }
+  // Setting a bit adds 2^bit, clearing it subtracts 2^bit, whatever the sign.
+  bn_t p = {0};
+  bn_from_int(&p, 0);
+  bn_set_digit(&p, i, mask);
+  if (value)
+    bn_add(X, X, &p);
+  else
+    bn_sub(X, X, &p);
+  bn_free(&p);
+  return BN_OK;
+}
+
+size_t bn_popcount(const bn_t *X) {
+  BN_ASSERT(X != NULL);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  if (X->sign < 0 && n > 0)
+    return SIZE_MAX;
+  return bn_mpn_popcount(BN_DIGITS(X), n);
+}
+
+// Index of the first bit from start on which is not `skip`, SIZE_MAX if there
+// is none.
+static size_t _bn_scan(const bn_t *X, size_t start, bn_digit_t skip) {
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  const size_t low = X->sign < 0 ? _bn_low_digit(X, n) : 0;
+  size_t i = start / DIGIT_BITS;
+  // Above the top digit all bits are the sign.
+  if (i >= n)
+    return _bn_twos_digit(X, n, low, i) == skip ? SIZE_MAX : start;
+  bn_digit_t d = (_bn_twos_digit(X, n, low, i) ^ skip) &
+                 ~(bn_digit_t)0 << start % DIGIT_BITS;
+  while (d == 0) {
+    if (++i == n)
+      return _bn_twos_digit(X, n, low, i) == skip ? SIZE_MAX
+                                                   : i * DIGIT_BITS;
+    d = _bn_twos_digit(X, n, low, i) ^ skip;
+  }
+  return i * DIGIT_BITS + bn_digit_count_trailing_zeros(d);
+}
+
+size_t bn_scan0(const bn_t *X, size_t start) {
+  BN_ASSERT(X != NULL);
+  return _bn_scan(X, start, ~(bn_digit_t)0);
+}
+
+size_t bn_scan1(const bn_t *X, size_t start) {
+  BN_ASSERT(X != NULL);
+  return _bn_scan(X, start, 0);
+}
+
+size_t bn_bitlength(const bn_t *X) {
+  BN_ASSERT(X != NULL);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  if (n == 0)
+    return 0;
+  return n * DIGIT_BITS - bn_digit_count_leading_zeros(BN_DIGITS(X)[n - 1]);
+}
+
+//////////////////// MODULAR ARITHMETIC ////////////////////
+
+// Montgomery reduction (REDC): {rp, n} = {tp, 2n} / B^n mod {mp, n} for
+// {tp, 2n} < {mp, n} B^n and ninv = -{mp, n}^-1 mod B, clobbering {tp, 2n}.
+// Every row adds the multiple of {mp, n} which clears the lowest digit; its
+// carry is parked in that digit and all carries are added in one pass at the
+// end. rp may be tp or tp + n.
+void bn_mpn_redc_1(bn_digit_t *rp, bn_digit_t *tp, const bn_digit_t *mp,
+                   size_t n, bn_digit_t ninv) {
+  for (size_t i = 0; i < n; ++i)
+    tp[i] = bn_mpn_addmul_1(tp + i, mp, n, tp[i] * ninv);
+  // The sum is below 2 {mp, n}.
+  if (bn_mpn_add_n(rp, tp + n, tp, n) || bn_mpn_cmp(rp, mp, n) >= 0)
+    bn_mpn_sub_n(rp, rp, mp, n);
+}
+
+static bool _bn_mpn_tstbit(const bn_digit_t *ap, size_t i) {
+  return (ap[i / DIGIT_BITS] >> (i % DIGIT_BITS)) & 1;
+}
+
+// Number of bits of {ap, n} for n = 0 or ap[n - 1] != 0
+static size_t _bn_mpn_bit_length(const bn_digit_t *ap, size_t n) {
+  return n == 0 ? 0 : n * DIGIT_BITS - bn_digit_count_leading_zeros(ap[n - 1]);
+}
+
+// Z = {rp, n}
+static void _bn_from_mpn(bn_t *Z, const bn_digit_t *rp, size_t n) {
+  bn_resize(Z, n);
+  bn_mpn_copy(BN_DIGITS(Z), rp, n);
+  Z->sign = 1;
+  bn_normalize(Z);
+}
+
+// {rp, n} = X mod {np, n}, the non-negative remainder, for np[n - 1] != 0.
+static void _bn_mod_mpn(bn_digit_t *rp, const bn_t *X, const bn_digit_t *np,
+                        size_t n) {
+  const size_t xn = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  if (xn < n) {
+    bn_mpn_copy(rp, BN_DIGITS(X), xn);
+    bn_mpn_zero(rp + xn, n - xn);
+  } else {
+    bn_scratch_t *S = _bn_scratch();
+    const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+    const size_t qn = xn - n + 1;
+    bn_digit_t *q = _bn_scratch_alloc(S, qn + bn_mpn_div_qr_itch(xn, n));
+    bn_mpn_div_qr(q, rp, BN_DIGITS(X), xn, np, n, q + qn);
+    _bn_scratch_release(S, mark);
+  }
+  if (X->sign < 0 && bn_mpn_normalized_size(rp, n) > 0)
+    bn_mpn_sub_n(rp, np, rp, n);
+}
+
+// {rp, n} = X for a residue 0 <= X < {np, n}
+static void _bn_residue(bn_digit_t *rp, const bn_t *X, const bn_digit_t *np,
+                        size_t n) {
+  const size_t xn = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  BN_ASSERT(X->sign > 0 && xn <= n);
+  bn_mpn_copy(rp, BN_DIGITS(X), xn);
+  bn_mpn_zero(rp + xn, n - xn);
+  BN_ASSERT(bn_mpn_cmp(rp, np, n) < 0);
+}
+
+// Multiplication modulo a fixed N of n digits, on residues in whatever
+// representation the reduction works with. to and from convert residues into
+// and out of that representation, NULL if there is nothing to convert. rp may
+// be ap or bp, {scratch} holds itch digits.
+typedef struct _bn_modmul _bn_modmul_t;
+struct _bn_modmul {
+  size_t size;
+  size_t itch;
+  const void *ctx;
+  void (*mul)(const _bn_modmul_t *R, bn_digit_t *rp, const bn_digit_t *ap,
+              const bn_digit_t *bp, bn_digit_t *scratch);
+  void (*sqr)(const _bn_modmul_t *R, bn_digit_t *rp, const bn_digit_t *ap,
+              bn_digit_t *scratch);
+  void (*to)(const _bn_modmul_t *R, bn_digit_t *rp, const bn_digit_t *ap,
+             bn_digit_t *scratch);
+  void (*from)(const _bn_modmul_t *R, bn_digit_t *rp, const bn_digit_t *ap,
+               bn_digit_t *scratch);
+};
+
+// Montgomery multiplication, separated operand scanning: the full product
+// comes from bn_mpn_mul or bn_mpn_sqr, so large moduli get the subquadratic
+// algorithms and squares the cheaper squaring, and is then reduced by
+// bn_mpn_redc_1.
+static void _bn_mont_mul(const _bn_modmul_t *R, bn_digit_t *rp,
+                         const bn_digit_t *ap, const bn_digit_t *bp,
+                         bn_digit_t *scratch) {
+  const bn_mont_ctx_t *M = R->ctx;
+  const size_t n = M->size;
+  bn_mpn_mul(scratch, ap, n, bp, n, scratch + 2 * n);
+  bn_mpn_redc_1(rp, scratch, M->digits, n, M->ninv);
+}
+
+static void _bn_mont_sqr(const _bn_modmul_t *R, bn_digit_t *rp,
+                         const bn_digit_t *ap, bn_digit_t *scratch) {
+  const bn_mont_ctx_t *M = R->ctx;
+  const size_t n = M->size;
+  bn_mpn_sqr(scratch, ap, n, scratch + 2 * n);
+  bn_mpn_redc_1(rp, scratch, M->digits, n, M->ninv);
+}
+
+// x R = REDC(x R^2)
+static void _bn_mont_to(const _bn_modmul_t *R, bn_digit_t *rp,
+                        const bn_digit_t *ap, bn_digit_t *scratch) {
+  const bn_mont_ctx_t *M = R->ctx;
+  _bn_mont_mul(R, rp, ap, M->rr, scratch);
+}
+
+// x = REDC(x R)
+static void _bn_mont_from(const _bn_modmul_t *R, bn_digit_t *rp,
+                          const bn_digit_t *ap, bn_digit_t *scratch) {
+  const bn_mont_ctx_t *M = R->ctx;
+  const size_t n = M->size;
+  bn_mpn_copy(scratch, ap, n);
+  bn_mpn_zero(scratch + n, n);
+  bn_mpn_redc_1(rp, scratch, M->digits, n, M->ninv);
+}
+
+static void _bn_modmul_mont(_bn_modmul_t *R, const bn_mont_ctx_t *M) {
+  const size_t n = M->size;
+  R->size = n;
+  R->itch = 2 * n + _bn_max(bn_mpn_mul_itch(n, n), bn_mpn_sqr_itch(n));
+  R->ctx = M;
+  R->mul = _bn_mont_mul;
+  R->sqr = _bn_mont_sqr;
+  R->to = _bn_mont_to;
+  R->from = _bn_mont_from;
+}
+
+// Plain residues, reduced by division with a prepared divisor
+static void _bn_divmod_mul(const _bn_modmul_t *R, bn_digit_t *rp,
+                           const bn_digit_t *ap, const bn_digit_t *bp,
+                           bn_digit_t *scratch) {
+  const bn_divisor_t *D = R->ctx;
+  const size_t n = D->size;
+  bn_digit_t *q = scratch + 2 * n;
+  if (ap == bp)
+    bn_mpn_sqr(scratch, ap, n, q);
+  else
+    bn_mpn_mul(scratch, ap, n, bp, n, q);
+  bn_mpn_div_qr_pre(q, rp, scratch, 2 * n, D->digits, n, D->shift, D->inv,
+                    q + n + 1);
+}
+
+static void _bn_divmod_sqr(const _bn_modmul_t *R, bn_digit_t *rp,
+                           const bn_digit_t *ap, bn_digit_t *scratch) {
+  _bn_divmod_mul(R, rp, ap, ap, scratch);
+}
+
+static void _bn_modmul_divisor(_bn_modmul_t *R, const bn_divisor_t *D) {
+  const size_t n = D->size;
+  R->size = n;
+  R->itch = 2 * n + _bn_max(_bn_max(bn_mpn_mul_itch(n, n), bn_mpn_sqr_itch(n)),
+                            n + 1 + bn_mpn_div_qr_pre_itch(2 * n, n));
+  R->ctx = D;
+  R->mul = _bn_divmod_mul;
+  R->sqr = _bn_divmod_sqr;
+  R->to = NULL;
+  R->from = NULL;
+}
+
+size_t bn_mpn_mod_barrett_itch(size_t xn, size_t k) {
+  if (xn < k)
+    return 0;
+  // q2 | p | r | kernels, see bn_mpn_mod_barrett
+  const size_t qn = xn - k + 1;
+  const size_t itch =
+      _bn_max(bn_mpn_mul_itch(k + 1, qn),
+              qn <= k ? bn_mpn_mul_itch(k, qn) : bn_mpn_mul_itch(qn, k));
+  return (qn + k + 1) + (qn + k) + (k + 1) + itch;
+}
+
+// Barrett reduction (HAC 14.42): {rp, k} = {xp, xn} mod {mp, k} for
+// xn <= 2k, with mu = floor(B^2k / {mp, k}) in k + 1 digits. The quotient
+// estimated from the top digits of x and mu is at most a few units too small,
+// so x - q m < B^(k + 1) and only its low k + 1 digits are needed to correct
+// it. rp may be xp, {scratch} holds bn_mpn_mod_barrett_itch(xn, k) digits.
+void bn_mpn_mod_barrett(bn_digit_t *rp, const bn_digit_t *xp, size_t xn,
+                        const bn_digit_t *mp, size_t k, const bn_digit_t *mu,
+                        bn_digit_t *scratch) {
+  BN_ASSERT(xn <= 2 * k);
+  if (xn < k) {
+    bn_mpn_copy(rp, xp, xn);
+    bn_mpn_zero(rp + xn, k - xn);
+    return;
+  }
+  const size_t qn = xn - k + 1;
+  bn_digit_t *q2 = scratch;
+  bn_digit_t *p = q2 + qn + k + 1;
+  bn_digit_t *r = p + qn + k;
+  bn_digit_t *next = r + k + 1;
+
+  // q = floor(floor(x / B^(k - 1)) mu / B^(k + 1)) and p = q m mod B^(k + 1).
+  // Below the Karatsuba threshold both are short products: the rows of q are
+  // only summed from digit k - 1 on, which makes q at most one smaller still,
+  // and the rows of p stop at digit k.
+  const bn_digit_t *q = q2 + k + 1;
+  const bn_digit_t *x1 = xp + k - 1;
+  if (k < BN_KARATSUBA_THRESHOLD) {
+    bn_mpn_zero(q2 + k - 1, qn + 2);
+    for (size_t j = 0; j < qn; ++j) {
+      const size_t i = j < k - 1 ? k - 1 - j : 0;
+      q2[j + k + 1] = bn_mpn_addmul_1(q2 + i + j, mu + i, k + 1 - i, x1[j]);
+    }
+    p[k] = bn_mpn_mul_1(p, mp, k, q[0]);
+    for (size_t j = 1; j < qn && j <= k; ++j)
+      bn_mpn_addmul_1(p + j, mp, k + 1 - j, q[j]);
+  } else {
+    bn_mpn_mul(q2, mu, k + 1, x1, qn, next);
+    if (qn <= k)
+      bn_mpn_mul(p, mp, k, q, qn, next);
+    else
+      bn_mpn_mul(p, q, qn, mp, k, next);
+  }
+  bn_mpn_copy(r, xp, k);
+  r[k] = xn > k ? xp[k] : 0;
+  bn_mpn_sub_n(r, r, p, k + 1);
+  while (r[k] != 0 || bn_mpn_cmp(r, mp, k) >= 0)
+    r[k] -= bn_mpn_sub_n(r, r, mp, k);
+  bn_mpn_copy(rp, r, k);
+}
+
+static void _bn_barrett_mul(const _bn_modmul_t *R, bn_digit_t *rp,
+                            const bn_digit_t *ap, const bn_digit_t *bp,
+                            bn_digit_t *scratch) {
+  const bn_barrett_ctx_t *C = R->ctx;
+  const size_t k = C->size;
+  if (ap == bp)
+    bn_mpn_sqr(scratch, ap, k, scratch + 2 * k);
+  else
+    bn_mpn_mul(scratch, ap, k, bp, k, scratch + 2 * k);
+  bn_mpn_mod_barrett(rp, scratch, 2 * k, C->digits, k, C->mu,
+                     scratch + 2 * k);
+}
+
+static void _bn_barrett_sqr(const _bn_modmul_t *R, bn_digit_t *rp,
+                            const bn_digit_t *ap, bn_digit_t *scratch) {
+  _bn_barrett_mul(R, rp, ap, ap, scratch);
+}
+
+static void _bn_modmul_barrett(_bn_modmul_t *R, const bn_barrett_ctx_t *C) {
+  const size_t k = C->size;
+  R->size = k;
+  R->itch = 2 * k + _bn_max(_bn_max(bn_mpn_mul_itch(k, k), bn_mpn_sqr_itch(k)),
+                            bn_mpn_mod_barrett_itch(2 * k, k));
+  R->ctx = C;
+  R->mul = _bn_barrett_mul;
+  R->sqr = _bn_barrett_sqr;
+  R->to = NULL;
+  R->from = NULL;
+}
+
+struct _bn_solinas_term {
+  uint32_t from; // chunk j >= k/32 of the number to reduce
+  uint32_t to;   // chunk i < k/32 it is added to
+  int32_t coef;
+};
+typedef struct _bn_solinas_term _bn_solinas_term_t;
+
+#define _BN_CHUNKS_PER_DIGIT (DIGIT_BITS / 32)
+// At most this many terms per chunk of N, and bound of the sums of the
+// absolute coefficients which go into one chunk, so the carries of the layers
+// of _bn_mpn_mod_solinas stay within a digit.
+#define _BN_SOLINAS_MAX_TERMS 8
+#define _BN_SOLINAS_MAX_COEF ((int64_t)1 << 20)
+
+// 32-bit chunk i of {ap, n}
+static uint32_t _bn_mpn_chunk(const bn_digit_t *ap, size_t i) {
+  return (uint32_t)(ap[i / _BN_CHUNKS_PER_DIGIT] >>
+                    (i % _BN_CHUNKS_PER_DIGIT * 32));
+}
+
+// Scratch digits of _bn_mpn_mod_special for a modulus of n digits, which
+// also covers the chunks and the packed layer of the Solinas reduction.
+static size_t _bn_mpn_mod_special_itch(size_t n) { return 4 * n + 4; }
+
+// Whether c 2^s fits a digit, for the s spare bits of the top digit of the
+// pseudo-Mersenne N, so that B^n = c 2^s mod N is folded by digits
+static bool _bn_pmersenne_digit_fold(const bn_special_ctx_t *C) {
+  const unsigned s = (unsigned)(C->size * DIGIT_BITS - C->bits);
+  return C->size >= 2 && _bn_mpn_bit_length(&C->c, 1) + s <= DIGIT_BITS;
+}
+
+// v = lo + hi 2^k = lo + hi c mod N. A product of at most 2n digits is
+// folded by digits with a fixed schedule: one addmul_1 of the high digits by
+// c 2^s into the low ones, then one two-digit addition of its carry and the
+// bits above 2^k times c, which only leaves bits above 2^k when the low part
+// was already close to it. Other moduli fold bitwise, and every fold shortens
+// v by k - log2(c) >= k/2 bits, so after two of them v is at most a carry
+// above 2^k, and after three below.
+static void _bn_mpn_mod_pmersenne(bn_digit_t *rp, const bn_digit_t *xp,
+                                  size_t xn, const bn_special_ctx_t *C,
+                                  bn_digit_t *scratch) {
+  const size_t n = C->size;
+  const size_t kd = C->bits / DIGIT_BITS;
+  const unsigned kb = C->bits % DIGIT_BITS;
+  const unsigned s = (unsigned)(n * DIGIT_BITS - C->bits);
+
+  if (xn <= 2 * n && _bn_pmersenne_digit_fold(C)) {
+    const bn_digit_t c2 = C->c << s;
+    const size_t ln = xn < n ? xn : n;
+    if (rp != xp)
+      bn_mpn_copy(rp, xp, ln);
+    bn_mpn_zero(rp + ln, n - ln);
+    bn_digit_t cy = 0, t[2];
+    if (xn > n) {
+      cy = bn_mpn_addmul_1(rp, xp + n, xn - n, c2);
+      if (xn < 2 * n)
+        cy = bn_mpn_add_1(rp + xn - n, rp + xn - n, 2 * n - xn, cy);
+    }
+    // The carry is at most c 2^s and the bits above 2^k below 2^s, so both
+    // folded together are below B^2 - B.
+    t[0] = bn_digit_mul(cy, c2, &t[1]);
+    if (s > 0) {
+      const bn_digit_t top = (rp[n - 1] >> kb) * C->c;
+      rp[n - 1] &= ((bn_digit_t)1 << kb) - 1;
+      t[0] += top;
+      t[1] += t[0] < top;
+    }
+    for (bn_digit_t carry = bn_mpn_add(rp, rp, n, t, 2); carry != 0;)
+      carry = bn_mpn_add_1(rp, rp, n, c2);
+    if (s > 0) {
+      for (bn_digit_t top; (top = rp[n - 1] >> kb) != 0;) {
+        rp[n - 1] &= ((bn_digit_t)1 << kb) - 1;
+        bn_mpn_add_1(rp, rp, n, top * C->c);
+      }
+    }
+    // v < 2^k = N + c <= 2N
+    if (bn_mpn_cmp(rp, C->digits, n) >= 0)
+      bn_mpn_sub_n(rp, rp, C->digits, n);
+    return;
+  }
+
+  bn_digit_t *v = scratch;       // 2n + 2 digits
+  bn_digit_t *h = v + 2 * n + 2; // n + 2 digits
+  size_t vn = bn_mpn_normalized_size(xp, xn);
+  bn_mpn_copy(v, xp, vn);
+  while (vn > kd + 1 || (vn == kd + 1 && v[kd] >> kb != 0)) {
+    size_t hn = vn - kd;
+    if (kb > 0) {
+      bn_mpn_rshift(h, v + kd, hn, kb);
+      v[kd] &= ((bn_digit_t)1 << kb) - 1;
+    } else {
+      bn_mpn_copy(h, v + kd, hn);
+    }
+    h[hn] = bn_mpn_mul_1(h, h, hn, C->c);
+    hn++;
+    // lo is the low n digits of v.
+    if (hn <= n) {
+      v[n] = bn_mpn_add(v, v, n, h, hn);
+      vn = n + 1;
+    } else {
+      v[hn] = bn_mpn_add(v, h, hn, v, n);
+      vn = hn + 1;
+    }
+    vn = bn_mpn_normalized_size(v, vn);
+  }
+  // v < 2^k = N + c <= 2N
+  bn_mpn_zero(v + vn, n - vn);
+  if (bn_mpn_cmp(v, C->digits, n) >= 0)
+    bn_mpn_sub_n(v, v, C->digits, n);
+  bn_mpn_copy(rp, v, n);
+}
+
+// The chunks of x above 2^k are read once, then every layer packs its
+// chunks into n digits which are added or subtracted with its coefficient in
+// one pass. That leaves v = lo + h 2^k = lo + h c with a small signed h,
+// which is folded by one addmul_1 or submul_1 of c until h is 0.
+static void _bn_mpn_mod_solinas(bn_digit_t *rp, const bn_digit_t *xp,
+                                size_t xn, const bn_special_ctx_t *C,
+                                bn_digit_t *scratch) {
+  const size_t n = C->size;
+  const size_t K = C->bits / 32;
+  const size_t m = n * _BN_CHUNKS_PER_DIGIT;
+  const size_t xc = xn * _BN_CHUNKS_PER_DIGIT;
+  const unsigned kb = C->bits % DIGIT_BITS;
+  const bn_digit_t mask = ((bn_digit_t)1 << kb) - 1;
+  uint32_t *hi = (uint32_t *)scratch; // K + 1 chunks, the last one 0
+  bn_digit_t *t = scratch + n + 1;    // n digits
+
+  for (size_t j = 0; j <= K; ++j)
+    hi[j] = K + j < xc && j < K ? _bn_mpn_chunk(xp, K + j) : 0;
+  const size_t ln = xn < n ? xn : n;
+  if (rp != xp)
+    bn_mpn_copy(rp, xp, ln);
+  bn_mpn_zero(rp + ln, n - ln);
+  if (kb > 0)
+    rp[n - 1] &= mask;
+
+  // v = {rp, n} + (up - down) B^n
+  bn_digit_t up = 0, down = 0;
+  const int32_t *layer = C->layers;
+  for (size_t l = 0; l < C->nlayers; ++l, layer += m + 1) {
+    const int32_t coef = layer[0];
+    for (size_t i = 0; i < n; ++i) {
+      const int32_t *from = layer + 1 + i * _BN_CHUNKS_PER_DIGIT;
+      bn_digit_t d = hi[from[0]];
+      for (size_t c = 1; c < _BN_CHUNKS_PER_DIGIT; ++c)
+        d |= (bn_digit_t)hi[from[c]] << (c * 32);
+      t[i] = d;
+    }
+    if (coef == 1)
+      up += bn_mpn_add_n(rp, rp, t, n);
+    else if (coef == -1)
+      down += bn_mpn_sub_n(rp, rp, t, n);
+    else if (coef > 0)
+      up += bn_mpn_addmul_1(rp, t, n, (bn_digit_t)coef);
+    else
+      down += bn_mpn_submul_1(rp, t, n, (bn_digit_t)-(int64_t)coef);
+  }
+  for (;;) {
+    // h = floor(v / 2^k), which is below 2^53 in absolute value
+    int64_t h = (int64_t)up - (int64_t)down;
+    if (kb > 0) {
+      h = h * ((int64_t)1 << (DIGIT_BITS - kb)) + (int64_t)(rp[n - 1] >> kb);
+      rp[n - 1] &= mask;
+    }
+    if (h == 0)
+      break;
+    up = down = 0;
+    if (h > 0)
+      up = bn_mpn_addmul_1(rp, C->cp, n, (bn_digit_t)h);
+    else
+      down = bn_mpn_submul_1(rp, C->cp, n, (bn_digit_t)-h);
+  }
+  // v < 2^k = N + c <= 2N
+  if (bn_mpn_cmp(rp, C->digits, n) >= 0)
+    bn_mpn_sub_n(rp, rp, C->digits, n);
+}
+
+// {rp, n} = {xp, xn} mod N for {xp, xn} < 2^2k. rp may be xp, {scratch}
+// holds _bn_mpn_mod_special_itch(n) digits.
+static void _bn_mpn_mod_special(bn_digit_t *rp, const bn_digit_t *xp,
+                                size_t xn, const bn_special_ctx_t *C,
+                                bn_digit_t *scratch) {
+  if (C->form == BN_FORM_PSEUDO_MERSENNE)
+    _bn_mpn_mod_pmersenne(rp, xp, xn, C, scratch);
+  else
+    _bn_mpn_mod_solinas(rp, xp, xn, C, scratch);
+}
+
+// Builds the terms of the Solinas form of N = {np, n} of k bits into terms,
+// which holds _BN_SOLINAS_MAX_TERMS * k/32 of them. Returns their number, or
+// 0 if N does not have that form. {rows} holds 2 k/32 64-bit integers.
+//
+// With c = 2^k - N in chunks c_i between -2^31 and 2^31, 2^k = sum c_i 2^32i
+// mod N, and the row of 2^32j follows from that of 2^32(j - 1) by shifting it
+// up one chunk and replacing the chunk which reaches 2^k by its multiple of
+// the row of 2^k.
+static size_t _bn_solinas_terms(_bn_solinas_term_t *terms,
+                                const bn_digit_t *np, size_t k,
+                                int64_t *rows) {
+  if (k % 32 != 0)
+    return 0;
+  const size_t K = k / 32;
+  int64_t *cb = rows;
+  int64_t *row = rows + K;
+
+  // Balanced chunks of c = 2^k - N
+  int64_t borrow = 0, carry = 0;
+  for (size_t i = 0; i < K; ++i) {
+    int64_t ci = -(int64_t)_bn_mpn_chunk(np, i) - borrow;
+    borrow = ci < 0;
+    ci += borrow ? (int64_t)1 << 32 : 0;
+    ci += carry;
+    carry = ci >= (int64_t)1 << 31;
+    cb[i] = ci - (carry ? (int64_t)1 << 32 : 0);
+    if (cb[i] > _BN_SOLINAS_MAX_COEF || cb[i] < -_BN_SOLINAS_MAX_COEF)
+      return 0;
+  }
+  if (carry)
+    return 0;
+
+  size_t nterms = 0;
+  const size_t max = _BN_SOLINAS_MAX_TERMS * K;
+  for (size_t i = 0; i < K; ++i)
+    row[i] = cb[i];
+  for (size_t j = K; j < 2 * K; ++j) {
+    if (j > K) {
+      const int64_t top = row[K - 1];
+      for (size_t i = K; i-- > 0;) {
+        row[i] = (i > 0 ? row[i - 1] : 0) + top * cb[i];
+        if (row[i] > _BN_SOLINAS_MAX_COEF || row[i] < -_BN_SOLINAS_MAX_COEF)
+          return 0;
+      }
+    }
+    for (size_t i = 0; i < K; ++i) {
+      if (row[i] == 0)
+        continue;
+      if (nterms == max)
+        return 0;
+      terms[nterms].from = (uint32_t)j;
+      terms[nterms].to = (uint32_t)i;
+      terms[nterms].coef = (int32_t)row[i];
+      nterms++;
+    }
+  }
+  // Bound the accumulators.
+  for (size_t i = 0; i < K; ++i)
+    row[i] = 0;
+  for (size_t t = 0; t < nterms; ++t) {
+    const int64_t c = terms[t].coef;
+    row[terms[t].to] += c < 0 ? -c : c;
+    if (row[terms[t].to] > _BN_SOLINAS_MAX_COEF)
+      return 0;
+  }
+  return nterms;
+}
+
+// Packs the terms into layers of m + 1 entries, see bn_special_ctx_t. Terms
+// of the same coefficient share layers: the j-th one which goes into a chunk
+// lands in the j-th layer of its coefficient. Only counts the layers if
+// layers is NULL, else they have to be filled with K. {count} holds K
+// integers.
+static size_t _bn_solinas_layers(int32_t *layers,
+                                 const _bn_solinas_term_t *terms,
+                                 size_t nterms, size_t K, size_t m,
+                                 int64_t *count) {
+  size_t nlayers = 0;
+  for (size_t t = 0; t < nterms; ++t) {
+    const int32_t coef = terms[t].coef;
+    size_t u = 0;
+    while (terms[u].coef != coef)
+      u++;
+    if (u < t)
+      continue;
+    for (size_t i = 0; i < K; ++i)
+      count[i] = 0;
+    int64_t most = 0;
+    for (; u < nterms; ++u) {
+      if (terms[u].coef != coef)
+        continue;
+      const int64_t l = count[terms[u].to]++;
+      if (layers != NULL)
+        layers[(nlayers + (size_t)l) * (m + 1) + 1 + terms[u].to] =
+            (int32_t)(terms[u].from - K);
+      most = l + 1 > most ? l + 1 : most;
+    }
+    for (; most > 0; --most, ++nlayers)
+      if (layers != NULL)
+        layers[nlayers * (m + 1)] = coef;
+  }
+  return nlayers;
+}
+
+// Finds the form of N = {np, n}, with np[n - 1] != 0, and fills in C with
+// digits = np. The c and layers of the Solinas form are allocated in the
+// arena S, which the caller releases.
+static bn_form_t _bn_special_form(bn_special_ctx_t *C, const bn_digit_t *np,
+                                  size_t n, bn_scratch_t *S) {
+  const size_t k = _bn_mpn_bit_length(np, n);
+  C->digits = (bn_digit_t *)np;
+  C->size = n;
+  C->bits = k;
+  C->form = BN_FORM_GENERIC;
+  C->c = 0;
+  C->cp = NULL;
+  C->layers = NULL;
+  C->nlayers = 0;
+
+  // c < B if all digits of N but the lowest are all ones, then
+  // c = 2^k - N = -N mod B.
+  const size_t kd = (k - 1) / DIGIT_BITS;
+  bool single = true;
+  for (size_t i = 1; i <= kd; ++i) {
+    const bn_digit_t mask =
+        i == kd && k % DIGIT_BITS ? ((bn_digit_t)1 << k % DIGIT_BITS) - 1
+                                  : ~(bn_digit_t)0;
+    single &= np[i] == mask;
+  }
+  if (single && np[0] != 0) {
+    bn_digit_t c = -np[0];
+    if (kd == 0 && k < DIGIT_BITS)
+      c &= ((bn_digit_t)1 << k) - 1;
+    if (2 * _bn_mpn_bit_length(&c, 1) <= k) {
+      C->form = BN_FORM_PSEUDO_MERSENNE;
+      C->c = c;
+      return C->form;
+    }
+  }
+
+  const size_t K = k / 32;
+  const size_t m = n * _BN_CHUNKS_PER_DIGIT;
+  _bn_solinas_term_t *terms = (_bn_solinas_term_t *)_bn_scratch_alloc(
+      S, (_BN_SOLINAS_MAX_TERMS * K * sizeof(_bn_solinas_term_t) +
+          sizeof(bn_digit_t) - 1) /
+             sizeof(bn_digit_t));
+  int64_t *rows = (int64_t *)_bn_scratch_alloc(
+      S, (2 * K * sizeof(int64_t) + sizeof(bn_digit_t) - 1) /
+             sizeof(bn_digit_t));
+  const size_t nterms = _bn_solinas_terms(terms, np, k, rows);
+  if (nterms > 0) {
+    // c = B^n - N mod 2^k
+    bn_digit_t *cp = _bn_scratch_alloc(S, n);
+    bn_mpn_zero(cp, n);
+    bn_mpn_sub_n(cp, cp, np, n);
+    if (k % DIGIT_BITS != 0)
+      cp[n - 1] &= ((bn_digit_t)1 << k % DIGIT_BITS) - 1;
+    const size_t nlayers = _bn_solinas_layers(NULL, terms, nterms, K, m, rows);
+    const size_t size = nlayers * (m + 1);
+    int32_t *layers = (int32_t *)_bn_scratch_alloc(
+        S, (size * sizeof(int32_t) + sizeof(bn_digit_t) - 1) /
+               sizeof(bn_digit_t));
+    for (size_t i = 0; i < size; ++i)
+      layers[i] = (int32_t)K;
+    _bn_solinas_layers(layers, terms, nterms, K, m, rows);
+    C->form = BN_FORM_SOLINAS;
+    C->cp = cp;
+    C->layers = layers;
+    C->nlayers = nlayers;
+  }
+  return C->form;
+}
+
+static void _bn_special_mul(const _bn_modmul_t *R, bn_digit_t *rp,
+                            const bn_digit_t *ap, const bn_digit_t *bp,
+                            bn_digit_t *scratch) {
+  const bn_special_ctx_t *C = R->ctx;
+  const size_t n = C->size;
+  if (ap == bp)
+    bn_mpn_sqr(scratch, ap, n, scratch + 2 * n);
+  else
+    bn_mpn_mul(scratch, ap, n, bp, n, scratch + 2 * n);
+  _bn_mpn_mod_special(rp, scratch, 2 * n, C, scratch + 2 * n);
+}
+
+static void _bn_special_sqr(const _bn_modmul_t *R, bn_digit_t *rp,
+                            const bn_digit_t *ap, bn_digit_t *scratch) {
+  _bn_special_mul(R, rp, ap, ap, scratch);
+}
+
+static void _bn_modmul_special(_bn_modmul_t *R, const bn_special_ctx_t *C) {
+  const size_t n = C->size;
+  R->size = n;
+  R->itch = 2 * n + _bn_max(_bn_max(bn_mpn_mul_itch(n, n), bn_mpn_sqr_itch(n)),
+                            _bn_mpn_mod_special_itch(n));
+  R->ctx = C;
+  R->mul = _bn_special_mul;
+  R->sqr = _bn_special_sqr;
+  R->to = NULL;
+  R->from = NULL;
+}
+
+// Window size for an exponent of the given number of bits, trading the
+// table of 2^(k - 1) odd powers against one multiplication per window.
+static unsigned _bn_modexp_window_bits(size_t bits) {
+  return bits > 671 ? 6 : bits > 239 ? 5 : bits > 79 ? 4 : bits > 23 ? 3 : 2;
+}
+
+static size_t _bn_modexp_itch(const _bn_modmul_t *R, size_t bits) {
+  const size_t powers = (size_t)1 << (_bn_modexp_window_bits(bits) - 1);
+  return (powers + 1) * R->size + R->itch;
+}
+
+// Sliding-window exponentiation (HAC 14.85): {rp, n} = {bp, n}^{ep, en} in
+// the representation of R, for ep[en - 1] != 0. The exponent is cut into
+// windows of at most k bits which start and end with a one bit, so only the
+// odd powers b, b^3, ..., b^(2^k - 1) are tabulated. {scratch} holds
+// _bn_modexp_itch(R, bits) digits for the bit length of the exponent.
+static void _bn_modexp_window(const _bn_modmul_t *R, bn_digit_t *rp,
+                              const bn_digit_t *bp, const bn_digit_t *ep,
+                              size_t en, bn_digit_t *scratch) {
+  const size_t n = R->size;
+  const size_t bits = _bn_mpn_bit_length(ep, en);
+  const unsigned k = _bn_modexp_window_bits(bits);
+  const size_t powers = (size_t)1 << (k - 1);
+  bn_digit_t *table = scratch;
+  bn_digit_t *b2 = table + powers * n;
+  bn_digit_t *next = b2 + n;
+
+  bn_mpn_copy(table, bp, n);
+  R->sqr(R, b2, bp, next);
+  for (size_t i = 1; i < powers; ++i)
+    R->mul(R, table + i * n, table + (i - 1) * n, b2, next);
+
+  // The top bit is set, so the first window starts there and its power is
+  // the initial value.
+  bool first = true;
+  for (size_t i = bits; i > 0;) {
+    if (!_bn_mpn_tstbit(ep, i - 1)) {
+      R->sqr(R, rp, rp, next);
+      i--;
+      continue;
+    }
+    // The window is bits [l, i) of the exponent.
+    size_t l = i > k ? i - k : 0;
+    while (!_bn_mpn_tstbit(ep, l))
+      l++;
+    size_t w = 0;
+    for (size_t j = i; j-- > l;)
+      w = 2 * w + _bn_mpn_tstbit(ep, j);
+    const bn_digit_t *power = table + (w >> 1) * n;
+    if (first) {
+      bn_mpn_copy(rp, power, n);
+      first = false;
+    } else {
+      for (size_t j = l; j < i; ++j)
+        R->sqr(R, rp, rp, next);
+      R->mul(R, rp, rp, power, next);
+    }
+    i = l;
+  }
+}
+
+// Z = X^E mod {np, n} with the multiplication of R
+static void _bn_modexp(bn_t *Z, const bn_t *X, const bn_t *E,
+                       const bn_digit_t *np, const _bn_modmul_t *R) {
+  BN_ASSERT(E->sign > 0);
+  const size_t n = R->size;
+  const size_t en = bn_mpn_normalized_size(BN_DIGITS(E), E->size);
+  const size_t bits = _bn_mpn_bit_length(BN_DIGITS(E), en);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *b = _bn_scratch_alloc(S, 2 * n + _bn_modexp_itch(R, bits));
+  bn_digit_t *r = b + n;
+  bn_digit_t *next = r + n;
+
+  if (en == 0) {
+    // X^0 = 1, which is 0 modulo 1
+    bn_mpn_zero(r, n);
+    r[0] = n > 1 || np[0] != 1;
+  } else {
+    _bn_mod_mpn(b, X, np, n);
+    if (R->to != NULL)
+      R->to(R, b, b, next);
+    _bn_modexp_window(R, r, b, BN_DIGITS(E), en, next);
+    if (R->from != NULL)
+      R->from(R, r, r, next);
+  }
+  // Z may be X or E, which are not needed anymore.
+  _bn_from_mpn(Z, r, n);
+  _bn_scratch_release(S, mark);
+}
+
+// Prepares M for the odd modulus {np, n}, with {dp, 2n} holding N and
+// R^2 mod N.
+static void _bn_mont_ctx_init(bn_mont_ctx_t *M, const bn_digit_t *np, size_t n,
+                              bn_digit_t *dp) {
+  M->digits = dp;
+  M->rr = dp + n;
+  M->size = n;
+  bn_mpn_copy(M->digits, np, n);
+  M->ninv = -bn_digit_binvert(np[0]);
+
+  // R^2 mod N = B^2n mod N
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *u = _bn_scratch_alloc(
+      S, 2 * n + 1 + n + 2 + bn_mpn_div_qr_itch(2 * n + 1, n));
+  bn_digit_t *q = u + 2 * n + 1;
+  bn_mpn_zero(u, 2 * n);
+  u[2 * n] = 1;
+  bn_mpn_div_qr(q, M->rr, u, 2 * n + 1, M->digits, n, q + n + 2);
+  _bn_scratch_release(S, mark);
+}
+
+bn_err_t bn_mont_ctx_init(bn_mont_ctx_t *M, const bn_t *N) {
+  BN_ASSERT(M != NULL);
+  BN_ASSERT(N != NULL);
+  BN_ASSERT(N->sign > 0);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(N), N->size);
+  BN_ASSERT(n > 0);
+  if (!(BN_DIGITS(N)[0] & 1))
+    return BN_EVEN_MODULUS;
+  bn_digit_t *dp = BN_MALLOC(2 * n * sizeof(bn_digit_t));
+  BN_ASSERT(dp != NULL);
+  _bn_mont_ctx_init(M, BN_DIGITS(N), n, dp);
+  return BN_OK;
+}
+
+void bn_mont_ctx_free(bn_mont_ctx_t *M) {
+  BN_FREE(M->digits);
+  M->digits = NULL;
+  M->rr = NULL;
+  M->size = 0;
+}
+
+bn_err_t bn_mont_to(bn_t *Z, const bn_t *X, const bn_mont_ctx_t *M) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(M != NULL);
+
+  _bn_modmul_t R;
+  _bn_modmul_mont(&R, M);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *a = _bn_scratch_alloc(S, M->size + R.itch);
+  _bn_mod_mpn(a, X, M->digits, M->size);
+  R.to(&R, a, a, a + M->size);
+  _bn_from_mpn(Z, a, M->size);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+bn_err_t bn_mont_from(bn_t *Z, const bn_t *X, const bn_mont_ctx_t *M) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(M != NULL);
+
+  _bn_modmul_t R;
+  _bn_modmul_mont(&R, M);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *a = _bn_scratch_alloc(S, M->size + R.itch);
+  _bn_residue(a, X, M->digits, M->size);
+  R.from(&R, a, a, a + M->size);
+  _bn_from_mpn(Z, a, M->size);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+bn_err_t bn_mont_mul(bn_t *Z, const bn_t *X, const bn_t *Y,
+                     const bn_mont_ctx_t *M) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(Y != NULL);
+  BN_ASSERT(M != NULL);
+
+  _bn_modmul_t R;
+  _bn_modmul_mont(&R, M);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *a = _bn_scratch_alloc(S, 2 * M->size + R.itch);
+  bn_digit_t *b = a + M->size;
+  _bn_residue(a, X, M->digits, M->size);
+  _bn_residue(b, Y, M->digits, M->size);
+  R.mul(&R, a, a, b, b + M->size);
+  _bn_from_mpn(Z, a, M->size);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+bn_err_t bn_mont_sqr(bn_t *Z, const bn_t *X, const bn_mont_ctx_t *M) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(M != NULL);
+
+  _bn_modmul_t R;
+  _bn_modmul_mont(&R, M);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *a = _bn_scratch_alloc(S, M->size + R.itch);
+  _bn_residue(a, X, M->digits, M->size);
+  R.sqr(&R, a, a, a + M->size);
+  _bn_from_mpn(Z, a, M->size);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+bn_err_t bn_mod(bn_t *Z, const bn_t *X, const bn_t *N) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(N != NULL);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(N), N->size);
+  BN_ASSERT(n > 0);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *r = _bn_scratch_alloc(S, n);
+  _bn_mod_mpn(r, X, BN_DIGITS(N), n);
+  _bn_from_mpn(Z, r, n);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+// Prepares C for the modulus {np, k}, with {dp, 2k + 1} holding N and mu.
+static void _bn_barrett_ctx_init(bn_barrett_ctx_t *C, const bn_digit_t *np,
+                                 size_t k, bn_digit_t *dp) {
+  C->digits = dp;
+  C->mu = dp + k;
+  C->size = k;
+  bn_mpn_copy(C->digits, np, k);
+
+  // mu = floor(B^2k / N) <= B^(k + 1), as N >= B^(k - 1)
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *u = _bn_scratch_alloc(
+      S, 2 * k + 1 + k + 2 + k + bn_mpn_div_qr_itch(2 * k + 1, k));
+  bn_digit_t *q = u + 2 * k + 1;
+  bn_digit_t *r = q + k + 2;
+  bn_mpn_zero(u, 2 * k);
+  u[2 * k] = 1;
+  bn_mpn_div_qr(q, r, u, 2 * k + 1, C->digits, k, r + k);
+  if (q[k + 1] == 0) {
+    bn_mpn_copy(C->mu, q, k + 1);
+  } else {
+    // N = B^(k - 1). B^(k + 1) - 1 only makes the quotient estimates one
+    // smaller, which the reduction corrects like its other errors.
+    for (size_t i = 0; i <= k; ++i)
+      C->mu[i] = ~(bn_digit_t)0;
+  }
+  _bn_scratch_release(S, mark);
+}
+
+bn_err_t bn_barrett_ctx_init(bn_barrett_ctx_t *C, const bn_t *N) {
+  BN_ASSERT(C != NULL);
+  BN_ASSERT(N != NULL);
+  BN_ASSERT(N->sign > 0);
+
+  const size_t k = bn_mpn_normalized_size(BN_DIGITS(N), N->size);
+  BN_ASSERT(k > 0);
+  bn_digit_t *dp = BN_MALLOC((2 * k + 1) * sizeof(bn_digit_t));
+  BN_ASSERT(dp != NULL);
+  _bn_barrett_ctx_init(C, BN_DIGITS(N), k, dp);
+  return BN_OK;
+}
+
+void bn_barrett_ctx_free(bn_barrett_ctx_t *C) {
+  BN_FREE(C->digits);
+  C->digits = NULL;
+  C->mu = NULL;
+  C->size = 0;
+}
+
+bn_err_t bn_mod_barrett(bn_t *Z, const bn_t *X, const bn_barrett_ctx_t *C) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(C != NULL);
+
+  const size_t k = C->size;
+  const size_t xn = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  if (xn > 2 * k) {
+    bn_digit_t *r = _bn_scratch_alloc(S, k);
+    _bn_mod_mpn(r, X, C->digits, k);
+    _bn_from_mpn(Z, r, k);
+  } else {
+    bn_digit_t *r = _bn_scratch_alloc(S, k + bn_mpn_mod_barrett_itch(xn, k));
+    bn_mpn_mod_barrett(r, BN_DIGITS(X), xn, C->digits, k, C->mu, r + k);
+    if (X->sign < 0 && bn_mpn_normalized_size(r, k) > 0)
+      bn_mpn_sub_n(r, C->digits, r, k);
+    _bn_from_mpn(Z, r, k);
+  }
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+bn_err_t bn_mulmod_barrett(bn_t *Z, const bn_t *X, const bn_t *Y,
+                           const bn_barrett_ctx_t *C) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(Y != NULL);
+  BN_ASSERT(C != NULL);
+
+  _bn_modmul_t R;
+  _bn_modmul_barrett(&R, C);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *a = _bn_scratch_alloc(S, 2 * C->size + R.itch);
+  bn_digit_t *b = a + C->size;
+  _bn_residue(a, X, C->digits, C->size);
+  _bn_residue(b, Y, C->digits, C->size);
+  R.mul(&R, a, a, b, b + C->size);
+  _bn_from_mpn(Z, a, C->size);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+bn_err_t bn_sqrmod_barrett(bn_t *Z, const bn_t *X,
+                           const bn_barrett_ctx_t *C) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(C != NULL);
+
+  _bn_modmul_t R;
+  _bn_modmul_barrett(&R, C);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *a = _bn_scratch_alloc(S, C->size + R.itch);
+  _bn_residue(a, X, C->digits, C->size);
+  R.sqr(&R, a, a, a + C->size);
+  _bn_from_mpn(Z, a, C->size);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+bn_form_t bn_modulus_form(const bn_t *N) {
+  BN_ASSERT(N != NULL);
+  BN_ASSERT(N->sign > 0);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(N), N->size);
+  BN_ASSERT(n > 0);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_special_ctx_t C;
+  const bn_form_t form = _bn_special_form(&C, BN_DIGITS(N), n, S);
+  _bn_scratch_release(S, mark);
+  return form;
+}
+
+bn_err_t bn_special_ctx_init(bn_special_ctx_t *C, const bn_t *N) {
+  BN_ASSERT(C != NULL);
+  BN_ASSERT(N != NULL);
+  BN_ASSERT(N->sign > 0);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(N), N->size);
+  BN_ASSERT(n > 0);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_err_t res = BN_NO_SPECIAL_FORM;
+  if (_bn_special_form(C, BN_DIGITS(N), n, S) != BN_FORM_GENERIC) {
+    // N followed by c and the layers
+    const size_t cn = C->cp != NULL ? n : 0;
+    const size_t size = C->nlayers * (n * _BN_CHUNKS_PER_DIGIT + 1);
+    bn_digit_t *dp = BN_MALLOC((n + cn) * sizeof(bn_digit_t) +
+                               size * sizeof(int32_t));
+    BN_ASSERT(dp != NULL);
+    bn_mpn_copy(dp, BN_DIGITS(N), n);
+    bn_mpn_copy(dp + n, C->cp, cn);
+    int32_t *layers = (int32_t *)(dp + n + cn);
+    for (size_t i = 0; i < size; ++i)
+      layers[i] = C->layers[i];
+    C->digits = dp;
+    C->cp = cn > 0 ? dp + n : NULL;
+    C->layers = size > 0 ? layers : NULL;
+    res = BN_OK;
+  }
+  _bn_scratch_release(S, mark);
+  return res;
+}
+
+void bn_special_ctx_free(bn_special_ctx_t *C) {
+  BN_FREE(C->digits);
+  C->digits = NULL;
+  C->cp = NULL;
+  C->layers = NULL;
+  C->size = 0;
+  C->nlayers = 0;
+}
+
+bn_err_t bn_mod_special(bn_t *Z, const bn_t *X, const bn_special_ctx_t *C) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(C != NULL);
+
+  const size_t n = C->size;
+  const size_t xn = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *r = _bn_scratch_alloc(S, n + _bn_mpn_mod_special_itch(n));
+  if (_bn_mpn_bit_length(BN_DIGITS(X), xn) > 2 * C->bits) {
+    _bn_mod_mpn(r, X, C->digits, n);
+  } else {
+    _bn_mpn_mod_special(r, BN_DIGITS(X), xn, C, r + n);
+    if (X->sign < 0 && bn_mpn_normalized_size(r, n) > 0)
+      bn_mpn_sub_n(r, C->digits, r, n);
+  }
+  _bn_from_mpn(Z, r, n);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+bn_err_t bn_mulmod_special(bn_t *Z, const bn_t *X, const bn_t *Y,
+                           const bn_special_ctx_t *C) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(Y != NULL);
+  BN_ASSERT(C != NULL);
+
+  _bn_modmul_t R;
+  _bn_modmul_special(&R, C);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *a = _bn_scratch_alloc(S, 2 * C->size + R.itch);
+  bn_digit_t *b = a + C->size;
+  _bn_residue(a, X, C->digits, C->size);
+  _bn_residue(b, Y, C->digits, C->size);
+  R.mul(&R, a, a, b, b + C->size);
+  _bn_from_mpn(Z, a, C->size);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+bn_err_t bn_sqrmod_special(bn_t *Z, const bn_t *X,
+                           const bn_special_ctx_t *C) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(C != NULL);
+
+  _bn_modmul_t R;
+  _bn_modmul_special(&R, C);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *a = _bn_scratch_alloc(S, C->size + R.itch);
+  _bn_residue(a, X, C->digits, C->size);
+  R.sqr(&R, a, a, a + C->size);
+  _bn_from_mpn(Z, a, C->size);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
 
-bn_err_t bn_from_string(bn_t *bn, const char *s, bn_digit_t radix) {
-  BN_ASSERT(bn != NULL);
-  if (s == NULL || *s == '\0') {
-    return -BN_EMPTY_STRING;
+bn_err_t bn_modexp_special(bn_t *Z, const bn_t *X, const bn_t *E,
+                           const bn_special_ctx_t *C) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(E != NULL);
+  BN_ASSERT(C != NULL);
+
+  _bn_modmul_t R;
+  _bn_modmul_special(&R, C);
+  _bn_modexp(Z, X, E, C->digits, &R);
+  return BN_OK;
+}
+
+bn_err_t bn_modexp_mont(bn_t *Z, const bn_t *X, const bn_t *E,
+                        const bn_mont_ctx_t *M) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(E != NULL);
+  BN_ASSERT(M != NULL);
+
+  _bn_modmul_t R;
+  _bn_modmul_mont(&R, M);
+  _bn_modexp(Z, X, E, M->digits, &R);
+  return BN_OK;
+}
+
+// Multiplication modulo a fixed N, the fastest one for its form and size,
+// with the context it works with
+typedef struct {
+  _bn_modmul_t R;
+  union {
+    bn_special_ctx_t P;
+    bn_mont_ctx_t M;
+    bn_barrett_ctx_t C;
+    bn_divisor_t D;
+  } ctx;
+} _bn_modmul_any_t;
+
+// Picks the multiplication modulo {np, n}, whose context lives in the arena
+// and refers to np, which has to outlive it.
+static void _bn_modmul_any(_bn_modmul_any_t *A, const bn_digit_t *np,
+                           size_t n) {
+  bn_scratch_t *S = _bn_scratch();
+  const bn_form_t form = _bn_special_form(&A->ctx.P, np, n, S);
+  // Folding beats Barrett reduction and division for any size, but beats
+  // Montgomery reduction only for the sizes measured in the thresholds: the
+  // pseudo-Mersenne fold is one addmul_1 pass, the Solinas one a pass per
+  // layer, against the n passes of bn_mpn_redc_1.
+  bool fold = form != BN_FORM_GENERIC && !(np[0] & 1);
+  if (form == BN_FORM_PSEUDO_MERSENNE)
+    fold |= n >= BN_PMERSENNE_FOLD_THRESHOLD &&
+            _bn_pmersenne_digit_fold(&A->ctx.P);
+  else if (form == BN_FORM_SOLINAS)
+    fold |= n >= BN_SOLINAS_FOLD_THRESHOLD;
+  if (fold) {
+    _bn_modmul_special(&A->R, &A->ctx.P);
+  } else if (np[0] & 1) {
+    _bn_mont_ctx_init(&A->ctx.M, np, n, _bn_scratch_alloc(S, 2 * n));
+    _bn_modmul_mont(&A->R, &A->ctx.M);
+  } else if (n < BN_KARATSUBA_THRESHOLD) {
+    // Montgomery reduction needs an odd modulus. Barrett reduction with
+    // short products beats division while the products are schoolbook.
+    _bn_barrett_ctx_init(&A->ctx.C, np, n, _bn_scratch_alloc(S, 2 * n + 1));
+    _bn_modmul_barrett(&A->R, &A->ctx.C);
+  } else {
+    const bn_t N = _bn_view(np, n);
+    _bn_divisor_init(&A->ctx.D, &N, _bn_scratch_alloc(S, n), n);
+    _bn_modmul_divisor(&A->R, &A->ctx.D);
   }
+}
 
-  if (radix == 0) {
-    radix = 10;
+bn_err_t bn_modexp(bn_t *Z, const bn_t *X, const bn_t *E, const bn_t *N) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(E != NULL);
+  BN_ASSERT(N != NULL);
+  BN_ASSERT(N->sign > 0);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(N), N->size);
+  BN_ASSERT(n > 0);
+  // The contexts live in the arena, copies of N in case Z is N.
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *np = _bn_scratch_alloc(S, n);
+  bn_mpn_copy(np, BN_DIGITS(N), n);
+  _bn_modmul_any_t A;
+  _bn_modmul_any(&A, np, n);
+  _bn_modexp(Z, X, E, np, &A.R);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+//////////////////// GCD ////////////////////
+
+// The GCD follows GMP's mpn_gcd. Reducing a pair (a; b) by a matrix M of
+// non-negative entries and determinant 1 means (a; b) = M (a'; b'), which
+// keeps the GCD; a Euclid step a' = a - q b is M = (1, q; 0, 1). Lehmer steps
+// compute such a matrix of single digits from the top two digits of a and b
+// (hgcd2) and apply it to the whole numbers. The half GCD (hgcd) finds a
+// matrix of many digits which reduces the top half of the numbers, by
+// recursing on the top quarter twice, so that the GCD takes O(M(n) log n).
+// Reduced numbers never drop below the size the matrix is valid for, which
+// is what the stopping rules of hgcd2 and hgcd are about.
+
+bn_digit_t bn_mpn_gcd_11(bn_digit_t a, bn_digit_t b) {
+  if (a == 0)
+    return b;
+  if (b == 0)
+    return a;
+  // Odd a and b: b - a is even and its twos can go.
+  const int shift = bn_digit_count_trailing_zeros(a | b);
+  a >>= bn_digit_count_trailing_zeros(a);
+  do {
+    b >>= bn_digit_count_trailing_zeros(b);
+    if (a > b) {
+      const bn_digit_t t = a;
+      a = b;
+      b = t;
+    }
+    b -= a;
+  } while (b != 0);
+  return a << shift;
+}
+
+// (*h, *l) >>= shift for 0 <= shift < DIGIT_BITS
+static void _bn_dd_rshift(bn_digit_t *h, bn_digit_t *l, int shift) {
+  if (shift > 0) {
+    *l = *l >> shift | *h << (DIGIT_BITS - shift);
+    *h >>= shift;
   }
+}
 
-  bn->size = 0;
+// Trailing zeros of (h, l) != 0
+static int _bn_dd_ctz(bn_digit_t h, bn_digit_t l) {
+  return l != 0 ? bn_digit_count_trailing_zeros(l)
+                : (int)DIGIT_BITS + bn_digit_count_trailing_zeros(h);
+}
 
-#if !HAVE_BUILTIN_MUL_OVERFLOW
-  const bn_digit_t MAX_MULTIPLIER = (~(bn_digit_t)0) / radix;
-#endif
+// (*h, *l) -= (bh, bl)
+static void _bn_dd_sub(bn_digit_t *h, bn_digit_t *l, bn_digit_t bh,
+                       bn_digit_t bl) {
+  bn_digit_t borrow;
+  *l = bn_digit_sub(*l, bl, &borrow);
+  *h = *h - bh - borrow;
+}
+
+void bn_mpn_gcd_22(bn_digit_t *rp, const bn_digit_t *ap,
+                   const bn_digit_t *bp) {
+  bn_digit_t ah = ap[1], al = ap[0], bh = bp[1], bl = bp[0];
+  if ((ah | al) == 0 || (bh | bl) == 0) {
+    rp[0] = al | bl;
+    rp[1] = ah | bh;
+    return;
+  }
+  const int shift = _bn_dd_ctz(ah | bh, al | bl);
+  int z = _bn_dd_ctz(ah, al);
+  if (z >= (int)DIGIT_BITS) {
+    al = ah >> (z - DIGIT_BITS);
+    ah = 0;
+  } else {
+    _bn_dd_rshift(&ah, &al, z);
+  }
+  // Binary GCD on two digits until both fit into one
+  while (ah != 0 || bh != 0) {
+    if ((bh | bl) == 0) {
+      bh = ah;
+      bl = al;
+      break;
+    }
+    z = _bn_dd_ctz(bh, bl);
+    if (z >= (int)DIGIT_BITS) {
+      bl = bh >> (z - DIGIT_BITS);
+      bh = 0;
+    } else {
+      _bn_dd_rshift(&bh, &bl, z);
+    }
+    if (ah > bh || (ah == bh && al > bl)) {
+      bn_digit_t t = ah;
+      ah = bh;
+      bh = t;
+      t = al;
+      al = bl;
+      bl = t;
+    }
+    _bn_dd_sub(&bh, &bl, ah, al);
+  }
+  if (ah == 0 && bh == 0) {
+    al = bn_mpn_gcd_11(al, bl);
+  } else {
+    // b was zero, a is the GCD of the odd parts.
+    al = bl;
+    ah = bh;
+  }
+  // (ah, al) << shift
+  if (shift >= (int)DIGIT_BITS) {
+    ah = al << (shift - DIGIT_BITS);
+    al = 0;
+  } else if (shift > 0) {
+    ah = ah << shift | al >> (DIGIT_BITS - shift);
+    al <<= shift;
+  }
+  rp[0] = al;
+  rp[1] = ah;
+}
 
-  size_t slen = strlen(s);
-  size_t idx = 0;
+// {rp, an + bn} = {ap, an} * {bp, bn} for an, bn >= 1 in either order
+static void _bn_mpn_mul_any(bn_digit_t *rp, const bn_digit_t *ap, size_t an,
+                            const bn_digit_t *bp, size_t bn) {
+  if (an < bn) {
+    const bn_digit_t *t = ap;
+    ap = bp;
+    bp = t;
+    const size_t tn = an;
+    an = bn;
+    bn = tn;
+  }
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_mpn_mul(rp, ap, an, bp, bn, _bn_scratch_alloc(S, bn_mpn_mul_itch(an, bn)));
+  _bn_scratch_release(S, mark);
+}
 
-  // handle sign
-  if (s[0] == '-') {
-    bn->sign = -1;
-    idx = 1;
-  } else if (s[0] == '+') {
-    bn->sign = 1;
-    idx = 1;
+// Quotient of (nh, nl) / (dh, dl) for (nh, nl) > (dh, dl) and nh > dh, one
+// bit at a time since it is small. The remainder is left in (*rh, *rl).
+static bn_digit_t _bn_div2(bn_digit_t *rh, bn_digit_t *rl, bn_digit_t nh,
+                           bn_digit_t nl, bn_digit_t dh, bn_digit_t dl) {
+  int count = bn_digit_count_leading_zeros(dh) -
+              bn_digit_count_leading_zeros(nh);
+  if (count > 0) {
+    dh = dh << count | dl >> (DIGIT_BITS - count);
+    dl <<= count;
+  }
+  bn_digit_t q = 0;
+  for (; count >= 0; --count) {
+    const bool bit = nh == dh ? nl >= dl : nh > dh;
+    q = 2 * q + bit;
+    if (bit)
+      _bn_dd_sub(&nh, &nl, dh, dl);
+    dl = dh << (DIGIT_BITS - 1) | dl >> 1;
+    dh >>= 1;
+  }
+  *rh = nh;
+  *rl = nl;
+  return q;
+}
+
+// Matrix of single digits, (a; b) = (u00, u01; u10, u11) (a'; b')
+typedef struct {
+  bn_digit_t u[2][2];
+} _bn_hgcd_matrix1_t;
+
+// hgcd2: Euclid on the double digits (ah, al) and (bh, bl), one of which has
+// its top bit set, as long as the quotients are sure to be those of the full
+// numbers the digits are the top of. Returns false if not even one step is.
+static bool _bn_hgcd2(bn_digit_t ah, bn_digit_t al, bn_digit_t bh,
+                      bn_digit_t bl, _bn_hgcd_matrix1_t *M) {
+  bn_digit_t u00, u01, u10, u11, q;
+  if (ah < 2 || bh < 2)
+    return false;
+  if (ah > bh || (ah == bh && al > bl)) {
+    _bn_dd_sub(&ah, &al, bh, bl);
+    if (ah < 2)
+      return false;
+    u00 = u01 = u11 = 1;
+    u10 = 0;
   } else {
-    bn->sign = 1;
+    _bn_dd_sub(&bh, &bl, ah, al);
+    if (bh < 2)
+      return false;
+    u00 = u10 = u11 = 1;
+    u01 = 0;
   }
 
-  // Parse string into parts
-  bn_t parts = {0};
-  bool done = false;
-  bn_digit_t max_multiplier = 0;
-  bn_digit_t last_multiplier = 0;
-  do {
-    bn_digit_t multiplier = 1;
-    bn_digit_t part = 0;
-    while (true) {
-      bn_digit_t d; // Numeric value of current character
-      uint32_t c = s[idx];
-      if (c > 127 || (d = CHAR_VALUE[c]) >= radix) {
-        done = true;
+  // Double digits until the larger one fits into one and a half digits. A
+  // quotient q whose remainder would be too small to be trusted is taken as
+  // q - 1, the remainder plus b, and ends the loop.
+  bool single = false, b_first = ah < bh;
+  for (;;) {
+    if (!b_first) {
+      if (ah == bh)
+        goto done;
+      if (ah < HALF_DIGIT_BASE) {
+        single = true;
         break;
       }
+      _bn_dd_sub(&ah, &al, bh, bl);
+      if (ah < 2)
+        goto done;
+      if (ah <= bh) {
+        u01 += u00;
+        u11 += u10;
+      } else {
+        q = _bn_div2(&ah, &al, ah, al, bh, bl);
+        if (ah < 2) {
+          u01 += q * u00;
+          u11 += q * u10;
+          goto done;
+        }
+        q++;
+        u01 += q * u00;
+        u11 += q * u10;
+      }
+    }
+    b_first = false;
+    if (ah == bh)
+      goto done;
+    if (bh < HALF_DIGIT_BASE)
+      break;
+    _bn_dd_sub(&bh, &bl, ah, al);
+    if (bh < 2)
+      goto done;
+    if (bh <= ah) {
+      u00 += u01;
+      u10 += u11;
+    } else {
+      q = _bn_div2(&bh, &bl, bh, bl, ah, al);
+      if (bh < 2) {
+        u00 += q * u01;
+        u10 += q * u11;
+        goto done;
+      }
+      q++;
+      u00 += q * u01;
+      u10 += q * u11;
+    }
+  }
 
-#if HAVE_BUILTIN_MUL_OVERFLOW
-      bn_digit_t new_multiplier;
-      if (__builtin_mul_overflow(multiplier, radix, &new_multiplier))
+  // The top one and a half digits in a single one, with the bound raised
+  // accordingly. single tells if a was next, as above.
+  ah = ah << HALF_DIGIT_BITS | al >> HALF_DIGIT_BITS;
+  bh = bh << HALF_DIGIT_BITS | bl >> HALF_DIGIT_BITS;
+  for (;;) {
+    if (single) {
+      ah -= bh;
+      if (ah < 2 * HALF_DIGIT_BASE)
         break;
-      multiplier = new_multiplier;
-#else
-      if (multiplier > MAX_MULTIPLIER)
+      if (ah <= bh) {
+        u01 += u00;
+        u11 += u10;
+      } else {
+        q = ah / bh;
+        ah -= q * bh;
+        if (ah < 2 * HALF_DIGIT_BASE) {
+          u01 += q * u00;
+          u11 += q * u10;
+          break;
+        }
+        q++;
+        u01 += q * u00;
+        u11 += q * u10;
+      }
+    }
+    single = true;
+    bh -= ah;
+    if (bh < 2 * HALF_DIGIT_BASE)
+      break;
+    if (bh <= ah) {
+      u00 += u01;
+      u10 += u11;
+    } else {
+      q = bh / ah;
+      bh -= q * ah;
+      if (bh < 2 * HALF_DIGIT_BASE) {
+        u00 += q * u01;
+        u10 += q * u11;
         break;
-      multiplier *= radix;
-#endif
+      }
+      q++;
+      u00 += q * u01;
+      u10 += q * u11;
+    }
+  }
 
-      part = part * radix + d;
+done:
+  M->u[0][0] = u00;
+  M->u[0][1] = u01;
+  M->u[1][0] = u10;
+  M->u[1][1] = u11;
+  return true;
+}
 
-      if (++idx == slen) {
-        done = true;
-        break;
-      }
+// Top two digits of {ap, n} and {bp, n}, n >= 2, shifted together until one
+// of them has its top bit set
+static void _bn_gcd_top2(bn_digit_t *top, const bn_digit_t *ap,
+                         const bn_digit_t *bp, size_t n) {
+  const int shift = bn_digit_count_leading_zeros(ap[n - 1] | bp[n - 1]);
+  const bn_digit_t *xp[2] = {ap, bp};
+  for (int i = 0; i < 2; ++i) {
+    const bn_digit_t *x = xp[i];
+    top[2 * i] = x[n - 1];
+    top[2 * i + 1] = x[n - 2];
+    if (shift > 0) {
+      top[2 * i] = x[n - 1] << shift | x[n - 2] >> (DIGIT_BITS - shift);
+      top[2 * i + 1] = x[n - 2] << shift;
+      if (n > 2)
+        top[2 * i + 1] |= x[n - 3] >> (DIGIT_BITS - shift);
+    }
+  }
+}
+
+// (a; b) = M^-1 (a; b) for {ap, n} and {bp, n}: a = u11 a - u01 b and
+// b = u00 b - u10 a. Returns the new size of both.
+static size_t _bn_hgcd_matrix1_reduce(const _bn_hgcd_matrix1_t *M,
+                                      bn_digit_t *ap, bn_digit_t *bp,
+                                      size_t n) {
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *tp = _bn_scratch_alloc(S, n);
+  bn_mpn_copy(tp, ap, n);
+  bn_digit_t h = bn_mpn_mul_1(ap, tp, n, M->u[1][1]);
+  h -= bn_mpn_submul_1(ap, bp, n, M->u[0][1]);
+  BN_ASSERT(h == 0);
+  h = bn_mpn_mul_1(bp, bp, n, M->u[0][0]);
+  h -= bn_mpn_submul_1(bp, tp, n, M->u[1][0]);
+  BN_ASSERT(h == 0);
+  (void)h;
+  _bn_scratch_release(S, mark);
+  return n - ((ap[n - 1] | bp[n - 1]) == 0);
+}
+
+// (r, b) = (a, b) M for the row vector (a, b) of {ap, n} and {bp, n}:
+// r = u00 a + u10 b and b = u01 a + u11 b, into {rp, n + 1} and {bp, n + 1}.
+// Returns their size.
+static size_t _bn_hgcd_matrix1_mul_vector(const _bn_hgcd_matrix1_t *M,
+                                          bn_digit_t *rp, const bn_digit_t *ap,
+                                          bn_digit_t *bp, size_t n) {
+  bn_digit_t rh = bn_mpn_mul_1(rp, ap, n, M->u[0][0]);
+  rh += bn_mpn_addmul_1(rp, bp, n, M->u[1][0]);
+  bn_digit_t bh = bn_mpn_mul_1(bp, bp, n, M->u[1][1]);
+  bh += bn_mpn_addmul_1(bp, ap, n, M->u[0][1]);
+  rp[n] = rh;
+  bp[n] = bh;
+  return n + ((rh | bh) != 0);
+}
+
+// Matrix of the half GCD, with entries of n digits each. The digits from n
+// up to alloc are zero.
+typedef struct {
+  size_t alloc;
+  size_t n;
+  bn_digit_t *p[2][2];
+} _bn_hgcd_matrix_t;
+
+// Digits of the entries of the matrix for hgcd on n digits
+static size_t _bn_hgcd_matrix_itch(size_t n) { return 4 * ((n + 1) / 2 + 2); }
+
+// M = I, for hgcd on n digits, with {dp, _bn_hgcd_matrix_itch(n)} holding the
+// entries
+static void _bn_hgcd_matrix_init(_bn_hgcd_matrix_t *M, size_t n,
+                                 bn_digit_t *dp) {
+  const size_t s = (n + 1) / 2 + 2;
+  bn_mpn_zero(dp, 4 * s);
+  M->alloc = s;
+  M->n = 1;
+  M->p[0][0] = dp;
+  M->p[0][1] = dp + s;
+  M->p[1][0] = dp + 2 * s;
+  M->p[1][1] = dp + 3 * s;
+  M->p[0][0][0] = M->p[1][1][0] = 1;
+}
+
+// M = M (1, 0; q, 1) for col = 0 and M = M (1, q; 0, 1) for col = 1, that is
+// column col plus q times the other one.
+static void _bn_hgcd_matrix_update_q(_bn_hgcd_matrix_t *M,
+                                     const bn_digit_t *qp, size_t qn,
+                                     unsigned col) {
+  if (qn == 1) {
+    const bn_digit_t q = qp[0];
+    const bn_digit_t c0 =
+        bn_mpn_addmul_1(M->p[0][col], M->p[0][1 - col], M->n, q);
+    const bn_digit_t c1 =
+        bn_mpn_addmul_1(M->p[1][col], M->p[1][1 - col], M->n, q);
+    M->p[0][col][M->n] = c0;
+    M->p[1][col][M->n] = c1;
+    M->n += (c0 | c1) != 0;
+    return;
+  }
+  // The other column may be shorter than M->n digits.
+  size_t n = M->n;
+  while (n + qn > M->n && (M->p[0][1 - col][n - 1] | M->p[1][1 - col][n - 1]) == 0)
+    n--;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *tp = _bn_scratch_alloc(S, n + qn);
+  bn_digit_t c[2];
+  for (unsigned row = 0; row < 2; ++row) {
+    _bn_mpn_mul_any(tp, M->p[row][1 - col], n, qp, qn);
+    c[row] = bn_mpn_add(M->p[row][col], tp, n + qn, M->p[row][col], M->n);
+  }
+  _bn_scratch_release(S, mark);
+  n += qn;
+  if (c[0] | c[1]) {
+    M->p[0][col][n] = c[0];
+    M->p[1][col][n] = c[1];
+    n++;
+  } else {
+    n -= (M->p[0][col][n - 1] | M->p[1][col][n - 1]) == 0;
+  }
+  M->n = n;
+}
+
+// M = M M1 for a matrix M1 of single digits
+static void _bn_hgcd_matrix_mul_1(_bn_hgcd_matrix_t *M,
+                                  const _bn_hgcd_matrix1_t *M1) {
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *tp = _bn_scratch_alloc(S, M->n);
+  bn_mpn_copy(tp, M->p[0][0], M->n);
+  const size_t n0 =
+      _bn_hgcd_matrix1_mul_vector(M1, M->p[0][0], tp, M->p[0][1], M->n);
+  bn_mpn_copy(tp, M->p[1][0], M->n);
+  const size_t n1 =
+      _bn_hgcd_matrix1_mul_vector(M1, M->p[1][0], tp, M->p[1][1], M->n);
+  M->n = _bn_max(n0, n1);
+  _bn_scratch_release(S, mark);
+}
+
+// M = M M1
+static void _bn_hgcd_matrix_mul(_bn_hgcd_matrix_t *M,
+                                const _bn_hgcd_matrix_t *M1) {
+  const size_t n = M->n + M1->n;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *tp = _bn_scratch_alloc(S, 3 * (n + 1));
+  bn_digit_t *t0 = tp + n, *t1 = t0 + n + 1;
+  for (unsigned row = 0; row < 2; ++row) {
+    // Row (x, y) times M1 is (x m00 + y m10, x m01 + y m11).
+    for (unsigned col = 0; col < 2; ++col) {
+      bn_digit_t *t = col == 0 ? t0 : t1;
+      _bn_mpn_mul_any(t, M->p[row][0], M->n, M1->p[0][col], M1->n);
+      _bn_mpn_mul_any(tp, M->p[row][1], M->n, M1->p[1][col], M1->n);
+      t[n] = bn_mpn_add_n(t, t, tp, n);
     }
+    bn_mpn_copy(M->p[row][0], t0, n + 1);
+    bn_mpn_copy(M->p[row][1], t1, n + 1);
+  }
+  _bn_scratch_release(S, mark);
+  size_t m = n + 1;
+  while (m > 1 && (M->p[0][0][m - 1] | M->p[0][1][m - 1] |
+                   M->p[1][0][m - 1] | M->p[1][1][m - 1]) == 0)
+    m--;
+  M->n = m;
+}
+
+// (a; b) = M^-1 (a; b) for {ap, n} and {bp, n}, whose top n - p digits are
+// already reduced: the low p digits are multiplied by M^-1 = (m11, -m01;
+// -m10, m00) and added in. a and b need room for n + 1 digits. Returns their
+// new size.
+static size_t _bn_hgcd_matrix_adjust(const _bn_hgcd_matrix_t *M, size_t n,
+                                     bn_digit_t *ap, bn_digit_t *bp, size_t p) {
+  BN_ASSERT(p + M->n < n);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *t0 = _bn_scratch_alloc(S, 2 * (p + M->n));
+  bn_digit_t *t1 = t0 + p + M->n;
+
+  // Both products of a first, before it is overwritten
+  _bn_mpn_mul_any(t0, M->p[1][1], M->n, ap, p);
+  _bn_mpn_mul_any(t1, M->p[1][0], M->n, ap, p);
+
+  bn_mpn_copy(ap, t0, p);
+  bn_digit_t ah = bn_mpn_add(ap + p, ap + p, n - p, t0 + p, M->n);
+  _bn_mpn_mul_any(t0, M->p[0][1], M->n, bp, p);
+  ah -= bn_mpn_sub(ap, ap, n, t0, p + M->n);
+
+  _bn_mpn_mul_any(t0, M->p[0][0], M->n, bp, p);
+  bn_mpn_copy(bp, t0, p);
+  bn_digit_t bh = bn_mpn_add(bp + p, bp + p, n - p, t0 + p, M->n);
+  bh -= bn_mpn_sub(bp, bp, n, t1, p + M->n);
+  _bn_scratch_release(S, mark);
+
+  if (ah > 0 || bh > 0) {
+    ap[n] = ah;
+    bp[n] = bh;
+    n++;
+  } else if ((ap[n - 1] | bp[n - 1]) == 0) {
+    // The subtraction takes off at most one digit.
+    n--;
+  }
+  return n;
+}
+
+// One subtraction and one division of hgcd, with a and b kept above s
+// digits, and so |a - b|: the step is undone or its quotient taken one less
+// otherwise. Returns the new size, 0 if no step could be taken.
+static size_t _bn_hgcd_subdiv_step(bn_digit_t *ap, bn_digit_t *bp, size_t n,
+                                   size_t s, _bn_hgcd_matrix_t *M) {
+  static const bn_digit_t one = 1;
+  size_t an = bn_mpn_normalized_size(ap, n);
+  size_t bn = bn_mpn_normalized_size(bp, n);
+  unsigned swapped = 0;
+#define _BN_GCD_SWAP()                                                         \
+  do {                                                                         \
+    bn_digit_t *t = ap;                                                        \
+    ap = bp;                                                                   \
+    bp = t;                                                                    \
+    const size_t tn = an;                                                      \
+    an = bn;                                                                   \
+    bn = tn;                                                                   \
+    swapped ^= 1;                                                              \
+  } while (0)
 
-    if (done) {
-      last_multiplier = multiplier;
+  // a < b, then b -= a
+  const int c = bn_mpn_cmp2(ap, an, bp, bn);
+  if (c == 0)
+    return 0;
+  if (c > 0)
+    _BN_GCD_SWAP();
+  if (an <= s)
+    return 0;
+  bn_mpn_sub(bp, bp, bn, ap, an);
+  bn = bn_mpn_normalized_size(bp, bn);
+  if (bn <= s) {
+    const bn_digit_t carry = bn_mpn_add(bp, ap, an, bp, bn);
+    if (carry)
+      bp[an] = carry;
+    return 0;
+  }
+  _bn_hgcd_matrix_update_q(M, &one, 1, swapped);
+
+  // a < b again, then b = b mod a
+  const int d = bn_mpn_cmp2(ap, an, bp, bn);
+  if (d == 0)
+    return an;
+  if (d > 0)
+    _BN_GCD_SWAP();
+#undef _BN_GCD_SWAP
+  const size_t qn = bn - an + 1;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *qp = _bn_scratch_alloc(S, qn + an + bn_mpn_div_qr_itch(bn, an));
+  bn_digit_t *rp = qp + qn;
+  bn_mpn_div_qr(qp, rp, bp, bn, ap, an, rp + an);
+  bn_mpn_copy(bp, rp, an);
+  bn = bn_mpn_normalized_size(bp, an);
+  if (bn <= s) {
+    // The quotient is one too large.
+    if (bn > 0) {
+      const bn_digit_t carry = bn_mpn_add(bp, ap, an, bp, bn);
+      if (carry)
+        bp[an++] = carry;
     } else {
-      BN_ASSERT(max_multiplier == 0 || max_multiplier == multiplier);
-      max_multiplier = multiplier;
+      bn_mpn_copy(bp, ap, an);
     }
-    bn_append_digit(&parts, part);
-  } while (!done);
+    bn_mpn_sub_1(qp, qp, qn, 1);
+  }
+  // The subtraction above may have been all of it.
+  const size_t qsize = bn_mpn_normalized_size(qp, qn);
+  if (qsize > 0)
+    _bn_hgcd_matrix_update_q(M, qp, qsize, swapped);
+  _bn_scratch_release(S, mark);
+  return an;
+}
+
+// One step of hgcd on {ap, n} and {bp, n} down to s digits: a Lehmer step if
+// hgcd2 gets anywhere, a subtraction and a division otherwise.
+static size_t _bn_hgcd_step(bn_digit_t *ap, bn_digit_t *bp, size_t n,
+                            size_t s, _bn_hgcd_matrix_t *M) {
+  bn_digit_t top[4];
+  const bn_digit_t mask = ap[n - 1] | bp[n - 1];
+  bool lehmer = true;
+  if (n == s + 1) {
+    // Without the digits below, which would be shifted out again
+    lehmer = mask >= 4;
+    top[0] = ap[n - 1];
+    top[1] = ap[n - 2];
+    top[2] = bp[n - 1];
+    top[3] = bp[n - 2];
+  } else {
+    _bn_gcd_top2(top, ap, bp, n);
+  }
+  _bn_hgcd_matrix1_t M1;
+  if (lehmer && _bn_hgcd2(top[0], top[1], top[2], top[3], &M1)) {
+    _bn_hgcd_matrix_mul_1(M, &M1);
+    return _bn_hgcd_matrix1_reduce(&M1, ap, bp, n);
+  }
+  if (n == 0 || mask == 0)
+    return 0;
+  return _bn_hgcd_subdiv_step(ap, bp, n, s, M);
+}
 
-  // For every part, multiply the accumulator with the multiplier and add the
-  // part
-  bn_append_digit(bn, parts.digits[0]);
+// Half GCD: reduces {ap, n} and {bp, n}, one of them with a nonzero top
+// digit, until |a - b| fits into s = n / 2 + 1 digits, with a and b staying
+// above s digits. M starts as the identity and ends as the matrix of the
+// reduction, with entries of at most about n / 2 digits. a and b need room
+// for n + 1 digits. Returns their new size, 0 if no reduction is possible.
+static size_t _bn_hgcd(bn_digit_t *ap, bn_digit_t *bp, size_t n,
+                       _bn_hgcd_matrix_t *M) {
+  const size_t s = n / 2 + 1;
+  bool success = false;
+  size_t nn;
+  if (n <= s)
+    return 0;
 
-  if (parts.size > 1) {
-    for (size_t i = 1; i < parts.size - 1; ++i) {
-      bn_mul_single(bn, bn, max_multiplier);
-      bn_add_single(bn, bn, parts.digits[i]);
+  if (n >= BN_HGCD_THRESHOLD) {
+    // The top half n - p of the numbers reduces to about a quarter, which
+    // reduces the whole numbers to about 3n / 4 digits.
+    const size_t n2 = 3 * n / 4 + 1;
+    size_t p = n / 2;
+    nn = _bn_hgcd(ap + p, bp + p, n - p, M);
+    if (nn > 0) {
+      n = _bn_hgcd_matrix_adjust(M, p + nn, ap, bp, p);
+      success = true;
+    }
+    while (n > n2) {
+      nn = _bn_hgcd_step(ap, bp, n, s, M);
+      if (nn == 0)
+        return success ? n : 0;
+      n = nn;
+      success = true;
+    }
+    // Then the top of what is left, to about s digits
+    if (n > s + 2) {
+      p = 2 * s - n + 1;
+      bn_scratch_t *S = _bn_scratch();
+      const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+      _bn_hgcd_matrix_t M1;
+      _bn_hgcd_matrix_init(&M1, n - p,
+                           _bn_scratch_alloc(S, _bn_hgcd_matrix_itch(n - p)));
+      nn = _bn_hgcd(ap + p, bp + p, n - p, &M1);
+      if (nn > 0) {
+        n = _bn_hgcd_matrix_adjust(&M1, p + nn, ap, bp, p);
+        _bn_hgcd_matrix_mul(M, &M1);
+        success = true;
+      }
+      _bn_scratch_release(S, mark);
     }
-    bn_mul_single(bn, bn, last_multiplier);
-    bn_add_single(bn, bn, parts.digits[parts.size - 1]);
   }
 
-  bn_free(&parts);
-  return BN_OK;
+  for (;;) {
+    nn = _bn_hgcd_step(ap, bp, n, s, M);
+    if (nn == 0)
+      return success ? n : 0;
+    n = nn;
+    success = true;
+  }
 }
 
-bn_err_t bn_from_int(bn_t *bn, int i) {
-  bn->size = 0;
-  if (i < 0) {
-    i *= -1;
-    bn->sign = -1;
+// Cofactors of A along the reduction of (|A|, |B|) to (a, b): a = sign u0 A
+// and b = -sign u1 A modulo B. Both have un digits, the digits after them
+// are zero.
+typedef struct {
+  bn_digit_t *u0, *u1;
+  size_t un;
+  int sign;
+} _bn_gcd_cofactors_t;
+
+static void _bn_gcd_cofactors_swap(_bn_gcd_cofactors_t *U) {
+  bn_digit_t *t = U->u0;
+  U->u0 = U->u1;
+  U->u1 = t;
+  U->sign = -U->sign;
+}
+
+static void _bn_gcd_cofactors_normalize(_bn_gcd_cofactors_t *U, size_t n) {
+  while (n > 1 && (U->u0[n - 1] | U->u1[n - 1]) == 0)
+    n--;
+  U->un = n;
+}
+
+// u0 += q u1, for a -= q b
+static void _bn_gcd_cofactors_addmul(_bn_gcd_cofactors_t *U,
+                                     const bn_digit_t *qp, size_t qn) {
+  const size_t n = U->un + qn;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *tp = _bn_scratch_alloc(S, n);
+  _bn_mpn_mul_any(tp, U->u1, U->un, qp, qn);
+  U->u0[n] = bn_mpn_add(U->u0, tp, n, U->u0, U->un);
+  _bn_scratch_release(S, mark);
+  _bn_gcd_cofactors_normalize(U, n + 1);
+}
+
+// (u1, u0) = (u1, u0) M1, for (a; b) = M1^-1 (a; b)
+static void _bn_gcd_cofactors_mul_1(_bn_gcd_cofactors_t *U,
+                                    const _bn_hgcd_matrix1_t *M1) {
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *tp = _bn_scratch_alloc(S, U->un + 1);
+  const size_t n =
+      _bn_hgcd_matrix1_mul_vector(M1, tp, U->u1, U->u0, U->un);
+  bn_mpn_copy(U->u1, tp, U->un + 1);
+  _bn_scratch_release(S, mark);
+  _bn_gcd_cofactors_normalize(U, n);
+}
+
+// (u1, u0) = (u1, u0) M, for (a; b) = M^-1 (a; b)
+static void _bn_gcd_cofactors_mul(_bn_gcd_cofactors_t *U,
+                                  const _bn_hgcd_matrix_t *M) {
+  const size_t n = U->un + M->n;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *tp = _bn_scratch_alloc(S, 3 * (n + 1));
+  bn_digit_t *t0 = tp + n, *t1 = t0 + n + 1;
+  for (unsigned col = 0; col < 2; ++col) {
+    bn_digit_t *t = col == 0 ? t0 : t1;
+    _bn_mpn_mul_any(t, U->u1, U->un, M->p[0][col], M->n);
+    _bn_mpn_mul_any(tp, U->u0, U->un, M->p[1][col], M->n);
+    t[n] = bn_mpn_add_n(t, t, tp, n);
+  }
+  bn_mpn_copy(U->u1, t0, n + 1);
+  bn_mpn_copy(U->u0, t1, n + 1);
+  _bn_scratch_release(S, mark);
+  _bn_gcd_cofactors_normalize(U, n + 1);
+}
+
+// One step of Euclid on {*ap, n} and {*bp, n}: the larger one is replaced by
+// its remainder modulo the smaller one. Returns the new size of both. When
+// the GCD is found it is in *ap and *bp is zero; the pointers are swapped as
+// needed.
+static size_t _bn_gcd_step(bn_digit_t **ap, bn_digit_t **bp, size_t n,
+                           _bn_gcd_cofactors_t *U) {
+  bn_digit_t *a = *ap, *b = *bp;
+  size_t an = bn_mpn_normalized_size(a, n);
+  size_t bn = bn_mpn_normalized_size(b, n);
+  if (bn_mpn_cmp2(a, an, b, bn) < 0) {
+    *ap = b;
+    *bp = a;
+    if (U != NULL)
+      _bn_gcd_cofactors_swap(U);
+    return _bn_gcd_step(ap, bp, n, U);
+  }
+  if (bn == 0)
+    return an;
+
+  const size_t qn = an - bn + 1;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *qp = _bn_scratch_alloc(S, qn + bn + bn_mpn_div_qr_itch(an, bn));
+  bn_digit_t *rp = qp + qn;
+  bn_mpn_div_qr(qp, rp, a, an, b, bn, rp + bn);
+  bn_mpn_copy(a, rp, bn);
+  if (U != NULL)
+    _bn_gcd_cofactors_addmul(U, qp, bn_mpn_normalized_size(qp, qn));
+  _bn_scratch_release(S, mark);
+
+  if (bn_mpn_normalized_size(a, bn) == 0) {
+    *ap = b;
+    *bp = a;
+    if (U != NULL)
+      _bn_gcd_cofactors_swap(U);
+  }
+  return bn;
+}
+
+// gcd({*ap, n}, {*bp, n}) for a and b not both zero, in {*ap, return value},
+// with the cofactor of A in U if it is not NULL. The spans need room for
+// n + 1 digits and are clobbered; the pointers may be swapped.
+static size_t _bn_gcd_core(bn_digit_t **ap, bn_digit_t **bp, size_t n,
+                           _bn_gcd_cofactors_t *U) {
+  if (bn_mpn_normalized_size(*ap, n) != bn_mpn_normalized_size(*bp, n))
+    n = _bn_gcd_step(ap, bp, n, U);
+
+  bn_scratch_t *S = _bn_scratch();
+  while (n >= BN_GCD_DC_THRESHOLD && bn_mpn_normalized_size(*bp, n) != 0) {
+    // The half GCD of the top third reduces the numbers by a third.
+    const size_t p = 2 * n / 3;
+    const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+    _bn_hgcd_matrix_t M;
+    _bn_hgcd_matrix_init(&M, n - p,
+                         _bn_scratch_alloc(S, _bn_hgcd_matrix_itch(n - p)));
+    const size_t nn = _bn_hgcd(*ap + p, *bp + p, n - p, &M);
+    if (nn > 0) {
+      n = _bn_hgcd_matrix_adjust(&M, p + nn, *ap, *bp, p);
+      if (U != NULL)
+        _bn_gcd_cofactors_mul(U, &M);
+    } else {
+      n = _bn_gcd_step(ap, bp, n, U);
+    }
+    _bn_scratch_release(S, mark);
+  }
+
+  // Lehmer, down to two digits or to one with the cofactors
+  while (n > (U != NULL ? 1u : 2u) && bn_mpn_normalized_size(*bp, n) != 0) {
+    bn_digit_t top[4];
+    _bn_hgcd_matrix1_t M1;
+    _bn_gcd_top2(top, *ap, *bp, n);
+    if (_bn_hgcd2(top[0], top[1], top[2], top[3], &M1)) {
+      n = _bn_hgcd_matrix1_reduce(&M1, *ap, *bp, n);
+      if (U != NULL)
+        _bn_gcd_cofactors_mul_1(U, &M1);
+    } else {
+      n = _bn_gcd_step(ap, bp, n, U);
+    }
+  }
+
+  if (U != NULL) {
+    while (bn_mpn_normalized_size(*bp, n) != 0)
+      n = _bn_gcd_step(ap, bp, n, U);
+  } else if (n == 2) {
+    bn_digit_t g[2];
+    bn_mpn_gcd_22(g, *ap, *bp);
+    bn_mpn_copy(*ap, g, 2);
   } else {
-    bn->sign = 1;
+    (*ap)[0] = bn_mpn_gcd_11((*ap)[0], (*bp)[0]);
   }
-  bn_append_digit(bn, i);
+  return bn_mpn_normalized_size(*ap, n);
+}
+
+bn_err_t bn_gcd(bn_t *G, const bn_t *A, const bn_t *B) {
+  BN_ASSERT(G != NULL);
+  BN_ASSERT(A != NULL);
+  BN_ASSERT(B != NULL);
 
+  const size_t an = bn_mpn_normalized_size(BN_DIGITS(A), A->size);
+  const size_t bn = bn_mpn_normalized_size(BN_DIGITS(B), B->size);
+  const size_t n = _bn_max(_bn_max(an, bn), 1);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *a = _bn_scratch_alloc(S, 2 * (n + 1));
+  bn_digit_t *b = a + n + 1;
+  bn_mpn_copy(a, BN_DIGITS(A), an);
+  bn_mpn_zero(a + an, n + 1 - an);
+  bn_mpn_copy(b, BN_DIGITS(B), bn);
+  bn_mpn_zero(b + bn, n + 1 - bn);
+  size_t gn = 1;
+  if (an != 0 || bn != 0)
+    gn = _bn_gcd_core(&a, &b, n, NULL);
+  _bn_from_mpn(G, a, gn);
+  _bn_scratch_release(S, mark);
   return BN_OK;
 }
 
-bn_err_t bn_clone(bn_t *to, const bn_t *from) {
-  BN_ASSERT(from != NULL);
-  BN_ASSERT(to != NULL);
+// G = gcd(A, B) and S with G = S A mod B, the cofactor of the smallest
+// absolute value
+static void _bn_gcdext(bn_t *G, bn_t *S, const bn_t *A, const bn_t *B) {
+  const size_t an = bn_mpn_normalized_size(BN_DIGITS(A), A->size);
+  const size_t bn = bn_mpn_normalized_size(BN_DIGITS(B), B->size);
+  const size_t n = _bn_max(_bn_max(an, bn), 1);
+  // Cofactors are at most B, their products with quotients and matrices
+  // have at most twice as many digits.
+  const size_t un = 2 * n + 4;
+  bn_scratch_t *Sc = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(Sc);
+  bn_digit_t *a = _bn_scratch_alloc(Sc, 2 * (n + 1) + 2 * un);
+  bn_digit_t *b = a + n + 1;
+  _bn_gcd_cofactors_t U = {b + n + 1, b + n + 1 + un, 1, 1};
+  bn_mpn_copy(a, BN_DIGITS(A), an);
+  bn_mpn_zero(a + an, n + 1 - an);
+  bn_mpn_copy(b, BN_DIGITS(B), bn);
+  bn_mpn_zero(b + bn, n + 1 - bn);
+  bn_mpn_zero(U.u0, 2 * un);
+  U.u0[0] = 1;
+
+  size_t gn = 1;
+  if (an != 0 || bn != 0)
+    gn = _bn_gcd_core(&a, &b, n, &U);
+  if (an == 0)
+    U.u0[0] = 0;
+  const int sign = U.sign * A->sign;
+  _bn_from_mpn(G, a, gn);
+  _bn_from_mpn(S, U.u0, U.un);
+  _bn_scratch_release(Sc, mark);
+  if (bn_mpn_normalized_size(BN_DIGITS(S), S->size) != 0)
+    S->sign = sign;
+
+  // The cofactor modulo B / G, in (-B / 2G, B / 2G), or sign(A) for B = 2G
+  if (bn != 0) {
+    bn_t m = {0}, t = {0};
+    bn_div(&m, NULL, B, G);
+    m.sign = 1;
+    bn_mod(S, S, &m);
+    bn_add(&t, S, S);
+    const int c = bn_cmp(&t, &m);
+    if (c > 0 || (c == 0 && A->sign < 0))
+      bn_sub(S, S, &m);
+    bn_free(&m);
+    bn_free(&t);
+  }
+}
 
-  to->size = 0;
-  to->sign = from->sign;
-  for (size_t i = 0; i < from->size; ++i) {
-    bn_append_digit(to, from->digits[i]);
+bn_err_t bn_gcdext(bn_t *G, bn_t *S, bn_t *T, const bn_t *A, const bn_t *B) {
+  BN_ASSERT(G != NULL);
+  BN_ASSERT(A != NULL);
+  BN_ASSERT(B != NULL);
+  BN_ASSERT(G != S && G != T && (S != T || S == NULL));
+
+  bn_t g = {0}, s = {0};
+  _bn_gcdext(&g, &s, A, B);
+  if (T != NULL) {
+    // T = (G - S A) / B, or 0 if B is
+    bn_t t = {0};
+    if (bn_mpn_normalized_size(BN_DIGITS(B), B->size) == 0) {
+      bn_from_int(&t, 0);
+    } else {
+      bn_mul(&t, &s, A);
+      bn_sub(&t, &g, &t);
+      bn_div(&t, NULL, &t, B);
+    }
+    bn_clone(T, &t);
+    bn_free(&t);
   }
+  bn_clone(G, &g);
+  if (S != NULL)
+    bn_clone(S, &s);
+  bn_free(&g);
+  bn_free(&s);
   return BN_OK;
 }
 
-void bn_normalize(bn_t *bn) {
-  if (bn->size == 0) return;
-  for (size_t i = bn->size - 1; i > 0; i--) {
-    if (bn->digits[i] == 0)
-      bn->size--;
+bn_err_t bn_invmod(bn_t *Z, const bn_t *A, const bn_t *N) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(A != NULL);
+  BN_ASSERT(N != NULL);
+  BN_ASSERT(bn_mpn_normalized_size(BN_DIGITS(N), N->size) > 0);
+
+  bn_t x = {0}, g = {0}, s = {0};
+  bn_mod(&x, A, N);
+  _bn_gcdext(&g, &s, &x, N);
+  bn_err_t err = BN_OK;
+  if (g.size != 1 || BN_DIGITS(&g)[0] != 1) {
+    // Everything is invertible modulo 1, with 0 as the inverse.
+    if (bn_cmp_abs(N, &g) == 0 && BN_DIGITS(&g)[0] == 1 && g.size == 1)
+      bn_from_int(Z, 0);
     else
-      return;
+      err = BN_NOT_INVERTIBLE;
+  } else {
+    bn_mod(Z, &s, N);
   }
+  bn_free(&x);
+  bn_free(&g);
+  bn_free(&s);
+  return err;
 }
 
-void bn_free(bn_t *bn) {
-  free(bn->digits);
-  bn->size = 0;
-  bn->capacity = 0;
+// Whether {ap, n} is invertible modulo N, v is a temporary
+static bool _bn_invmod_coprime(bn_t *v, const bn_digit_t *ap, size_t n,
+                               const bn_t *N) {
+  _bn_from_mpn(v, ap, n);
+  bn_gcd(v, v, N);
+  return v->size == 1 && BN_DIGITS(v)[0] == 1;
 }
 
-#include <stdio.h>
-void bn_print_digits(bn_t *bn) {
-  printf("[");
-  for (size_t i = 0; i < bn->size; ++i) {
-    if (i > 0)
-      printf(", ");
-    printf("%zu", bn->digits[i]);
+// Finds the x[i] of {x, count * n} which are not invertible modulo N, sets
+// skip[i] and replaces them by 1. Node k < count of a product tree over them
+// is the product of nodes 2k and 2k + 1 and goes to {tree + kn, n}, node
+// count + i is x[i]. The tree is searched from the root down, into the
+// subtrees whose product shares a factor with N.
+static void _bn_invmod_batch_skip(bn_digit_t *x, bool *skip, size_t count,
+                                  size_t n, const bn_t *N,
+                                  const _bn_modmul_t *R, bn_digit_t *tree,
+                                  bn_digit_t *next) {
+#define _BN_NODE(k) ((k) < count ? tree + (k) * n : x + ((k) - count) * n)
+  for (size_t k = count - 1; k > 0; --k)
+    R->mul(R, tree + k * n, _BN_NODE(2 * k), _BN_NODE(2 * k + 1), next);
+  bn_t v = {0};
+  size_t stack[2 * 64], top = 0; // a pending sibling per level
+  stack[top++] = 1;
+  while (top > 0) {
+    const size_t k = stack[--top];
+    if (_bn_invmod_coprime(&v, _BN_NODE(k), n, N))
+      continue;
+    if (k >= count) {
+      skip[k - count] = true;
+      bn_mpn_zero(x + (k - count) * n, n);
+      x[(k - count) * n] = 1;
+    } else {
+      stack[top++] = 2 * k;
+      stack[top++] = 2 * k + 1;
+    }
   }
-  printf("]\n");
+  bn_free(&v);
+#undef _BN_NODE
 }
 
-//////////////////// TO STRING ////////////////////
+// Z[i] = X[i]^-1 mod {np, n} by Montgomery's trick: with the prefix products
+// c[i] = x[0] ... x[i] only c[count - 1] is inverted, and going back
+// x[i]^-1 = c[count - 1]^-1 x[count - 1] ... x[i + 1] c[i - 1]. The residues
+// stay plain even if R multiplies in Montgomery form, x y / B^n: c[i] then
+// carries B^-ni, its inverse B^n(count - 1), and each multiplication on the way
+// back takes one B^n off again. Zero residues are skipped.
+//
+// If c[count - 1] is not invertible, bisection finds the first c[j] which
+// shares a factor with the modulus, as all later ones do too. x[j] is then the
+// one not invertible: the chain before it is inverted through c[j - 1] and a
+// new chain starts after it. Should that fail as well, a product tree finds
+// all the remaining x[i] which are not invertible at once, and they are
+// skipped.
+static bn_err_t _bn_invmod_batch(bn_t *Z, const bn_t *X, size_t count,
+                                 const bn_digit_t *np, const _bn_modmul_t *R) {
+  const size_t n = R->size;
+  bn_t N = {0};
+  _bn_from_mpn(&N, np, n);
+  if (n == 1 && np[0] == 1) {
+    // Everything is invertible modulo 1, with 0 as the inverse.
+    for (size_t i = 0; i < count; ++i)
+      bn_from_int(&Z[i], 0);
+    bn_free(&N);
+    return BN_OK;
+  }
 
-uint8_t _BN_TO_STRING_MAX_BITS_PER_CHAR[] = {
-    0,   0,   32,  51,  64,  75,  83,  90,  96, // 0..8
-    102, 107, 111, 115, 119, 122, 126, 128,     // 9..16
-    131, 134, 136, 139, 141, 143, 145, 147,     // 17..24
-    149, 151, 153, 154, 156, 158, 159, 160,     // 25..32
-    162, 163, 165, 166,                         // 33..36
-};
-const char STR_CONVERSION_CHARS[] =
-    "0123456789abcdefghijklmnopqrstuvwxyz";
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *x = _bn_scratch_alloc(S, 2 * count * n + 2 * n + R->itch);
+  bn_digit_t *c = x + count * n;
+  bn_digit_t *u = c + count * n;
+  bn_digit_t *t = u + n;
+  bn_digit_t *next = t + n;
+  bool *skip = (bool *)_bn_scratch_alloc(
+      S, (count + sizeof(bn_digit_t) - 1) / sizeof(bn_digit_t));
+  for (size_t i = 0; i < count; ++i) {
+    bn_digit_t *xi = x + i * n;
+    _bn_mod_mpn(xi, &X[i], np, n);
+    skip[i] = bn_mpn_normalized_size(xi, n) == 0;
+    if (skip[i])
+      xi[0] = 1;
+  }
+
+  bn_t v = {0};
+  bool restarted = false, searched = false;
+  for (size_t start = 0; start < count;) {
+    bn_mpn_copy(c + start * n, x + start * n, n);
+    for (size_t i = start + 1; i < count; ++i)
+      R->mul(R, c + i * n, c + (i - 1) * n, x + i * n, next);
+
+    // The chain [start, end) is inverted, x[end] is not invertible.
+    size_t end = count;
+    _bn_from_mpn(&v, c + (count - 1) * n, n);
+    if (bn_invmod(&v, &v, &N) != BN_OK) {
+      BN_ASSERT(!searched);
+      if (restarted) {
+        _bn_invmod_batch_skip(x + start * n, skip + start, count - start, n,
+                              &N, R, c, next);
+        searched = true;
+        continue;
+      }
+      size_t lo = start, hi = count - 1;
+      while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (_bn_invmod_coprime(&v, c + mid * n, n, &N))
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      end = lo;
+      skip[end] = true;
+      restarted = true;
+      if (end > start) {
+        _bn_from_mpn(&v, c + (end - 1) * n, n);
+        const bn_err_t inverted = bn_invmod(&v, &v, &N);
+        BN_ASSERT(inverted == BN_OK);
+        (void)inverted;
+      }
+    }
+    if (end > start) {
+      _bn_residue(u, &v, np, n);
+      for (size_t i = end - 1; i > start; --i) {
+        R->mul(R, t, u, c + (i - 1) * n, next);
+        R->mul(R, u, u, x + i * n, next);
+        _bn_from_mpn(&Z[i], t, n);
+      }
+      _bn_from_mpn(&Z[start], u, n);
+    }
+    start = end + 1;
+  }
+  bn_err_t err = BN_OK;
+  for (size_t i = 0; i < count; ++i) {
+    if (skip[i]) {
+      bn_from_int(&Z[i], 0);
+      err = BN_NOT_INVERTIBLE;
+    }
+  }
+  _bn_scratch_release(S, mark);
+  bn_free(&v);
+  bn_free(&N);
+  return err;
+}
+
+bn_err_t bn_invmod_batch(bn_t *Z, const bn_t *X, size_t count,
+                         const bn_t *N) {
+  BN_ASSERT(count == 0 || (Z != NULL && X != NULL));
+  BN_ASSERT(N != NULL);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(N), N->size);
+  BN_ASSERT(n > 0);
+  if (count == 0)
+    return BN_OK;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *np = _bn_scratch_alloc(S, n);
+  bn_mpn_copy(np, BN_DIGITS(N), n);
+  _bn_modmul_any_t A;
+  _bn_modmul_any(&A, np, n);
+  const bn_err_t err = _bn_invmod_batch(Z, X, count, np, &A.R);
+  _bn_scratch_release(S, mark);
+  return err;
+}
+
+bn_err_t bn_invmod_batch_mont(bn_t *Z, const bn_t *X, size_t count,
+                              const bn_mont_ctx_t *M) {
+  BN_ASSERT(count == 0 || (Z != NULL && X != NULL));
+  BN_ASSERT(M != NULL);
+
+  if (count == 0)
+    return BN_OK;
+  _bn_modmul_t R;
+  _bn_modmul_mont(&R, M);
+  return _bn_invmod_batch(Z, X, count, M->digits, &R);
+}
+
+bn_err_t bn_invmod_batch_barrett(bn_t *Z, const bn_t *X, size_t count,
+                                 const bn_barrett_ctx_t *C) {
+  BN_ASSERT(count == 0 || (Z != NULL && X != NULL));
+  BN_ASSERT(C != NULL);
+
+  if (count == 0)
+    return BN_OK;
+  _bn_modmul_t R;
+  _bn_modmul_barrett(&R, C);
+  return _bn_invmod_batch(Z, X, count, C->digits, &R);
+}
 
-void _bn_to_string_last(bn_digit_t digit, bn_digit_t radix,
-                               bn_sb_t *sb) {
-  while (digit != 0) {
-    if (radix <= 10)
-      bn_sb_append_char(sb, '0' + (digit % radix));
+//////////////////// ROOTS ////////////////////
+
+#define _BN_DIGIT_BASE_DOUBLE ((double)HALF_DIGIT_BASE * (double)HALF_DIGIT_BASE)
+
+// {sp, 1} = floor(sqrt({ap, 2})) for ap[1] >= B / 4, with the remainder in
+// ap[0] and the returned bit above it. The root is estimated with doubles:
+// y = 1 / sqrt(a) by Newton iteration y = y (3 - a y^2) / 2 from a quadratic
+// fit, which needs no division, and s = a y. For 64-bit digits 53 bits of
+// precision leave s a few thousand units off, so s is corrected once by
+// (a - s^2) / 2s, again in doubles, and then by single units.
+static bn_digit_t _bn_mpn_sqrtrem2(bn_digit_t *sp, bn_digit_t *ap) {
+  const bn_digit_t a1 = ap[1], a0 = ap[0];
+  BN_ASSERT(a1 >= HALF_DIGIT_BASE * (HALF_DIGIT_BASE / 4));
+  // t = a / B^2 in [1/4, 1)
+  const double t =
+      ((double)a1 + (double)a0 / _BN_DIGIT_BASE_DOUBLE) / _BN_DIGIT_BASE_DOUBLE;
+  double y = 2.9259 + t * (-3.1111 + t * 1.1852);
+  for (int i = 0; i < 4; ++i)
+    y = y * (1.5 - 0.5 * t * y * y);
+  // sqrt(a) = B t y, below B
+  double s = _BN_DIGIT_BASE_DOUBLE * t * y;
+  bn_digit_t root = s >= _BN_DIGIT_BASE_DOUBLE ? ~(bn_digit_t)0 : (bn_digit_t)s;
+
+  bn_digit_t h, l = bn_digit_mul(root, root, &h), borrow;
+  if (h > a1 || (h == a1 && l > a0)) {
+    l = bn_digit_sub(l, a0, &borrow);
+    h = h - a1 - borrow;
+    s -= ((double)h * _BN_DIGIT_BASE_DOUBLE + (double)l) * y /
+         (2 * _BN_DIGIT_BASE_DOUBLE);
+  } else {
+    l = bn_digit_sub(a0, l, &borrow);
+    h = a1 - h - borrow;
+    s += ((double)h * _BN_DIGIT_BASE_DOUBLE + (double)l) * y /
+         (2 * _BN_DIGIT_BASE_DOUBLE);
+  }
+  root = s >= _BN_DIGIT_BASE_DOUBLE ? ~(bn_digit_t)0
+         : s < 0                     ? 0
+                                     : (bn_digit_t)s;
+  for (;;) {
+    l = bn_digit_mul(root, root, &h);
+    if (h > a1 || (h == a1 && l > a0))
+      root--;
     else
-      bn_sb_append_char(sb, STR_CONVERSION_CHARS[digit % radix]);
-    digit /= radix;
+      break;
+  }
+  for (;;) {
+    // (root + 1)^2 = root^2 + 2 root + 1 <= a
+    if (root == ~(bn_digit_t)0)
+      break;
+    bn_digit_t nh = h, carry;
+    bn_digit_t nl = bn_digit_add2(l, root, &carry);
+    nh += carry;
+    nl = bn_digit_add2(nl, root + 1, &carry);
+    nh += carry;
+    if (nh > a1 || (nh == a1 && nl > a0))
+      break;
+    root++;
+    h = nh;
+    l = nl;
   }
+  // a - root^2 <= 2 root, one digit and a bit
+  l = bn_digit_sub(a0, l, &borrow);
+  h = a1 - h - borrow;
+  sp[0] = root;
+  ap[0] = l;
+  return h;
 }
-void _bn_to_string_middle(bn_digit_t digit, bn_digit_t radix,
-                                 int chunk_chars, bn_sb_t *sb) {
-  for (int i = 0; i < chunk_chars; ++i) {
-    bn_sb_append_char(sb, STR_CONVERSION_CHARS[digit % radix]);
-    digit /= radix;
+
+// Karatsuba square root (Zimmermann): {sp, n} = floor(sqrt({ap, 2n})) for
+// ap[2n - 1] >= B / 4, with the remainder in {ap, n} plus the returned bit
+// times B^n. With a = a3 b^3 + a2 b^2 + a1 b + a0 for b = B^l, the root s' and
+// remainder r' of a3 b + a2 give q = (r' b + a1) / 2s', and s = s' b + q is
+// the root, or one more than it, with the remainder (r' b + a1) mod 2s' b +
+// a0 - q^2.
+static bn_digit_t _bn_mpn_dc_sqrtrem(bn_digit_t *sp, bn_digit_t *ap,
+                                     size_t n) {
+  if (n == 1)
+    return _bn_mpn_sqrtrem2(sp, ap);
+  const size_t l = n / 2;
+  const size_t h = n - l;
+  bn_digit_t c = _bn_mpn_dc_sqrtrem(sp + l, ap + 2 * l, h);
+  // A remainder r' >= B^h makes the quotient at least b: r' - s' is left
+  // and the quotient gets the extra b.
+  if (c)
+    c = bn_mpn_sub_n(ap + 2 * l, ap + 2 * l, sp + l, h);
+
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *q = _bn_scratch_alloc(
+      S, (l + 1) + h + _bn_max(bn_mpn_div_qr_itch(n, h), bn_mpn_sqr_itch(l)));
+  bn_digit_t *r = q + l + 1;
+  bn_mpn_div_qr(q, r, ap + l, n, sp + l, h, r + h);
+  bn_mpn_copy(ap + l, r, h);
+  bn_digit_t qh = q[l] + c;
+
+  // q / 2 and u = r + (q odd) s'
+  const bool odd = q[0] & 1;
+  bn_mpn_rshift(sp, q, l, 1);
+  sp[l - 1] |= qh << (DIGIT_BITS - 1);
+  qh >>= 1;
+  int top = odd ? (int)bn_mpn_add_n(ap + l, ap + l, sp + l, h) : 0;
+
+  // u b + a0 - q^2, where q = b if qh is set
+  bn_mpn_sqr(q, sp, l, q + 2 * l);
+  bn_digit_t borrow = bn_mpn_sub_n(ap, ap, q, 2 * l) + qh;
+  if (n > 2 * l)
+    borrow = bn_mpn_sub_1(ap + 2 * l, ap + 2 * l, 1, borrow);
+  top -= (int)borrow;
+  _bn_scratch_release(S, mark);
+  // s may be B^n, then the remainder is negative.
+  bn_digit_t carry = bn_mpn_add_1(sp + l, sp + l, h, qh);
+
+  if (top < 0) {
+    // s - 1 with the remainder r + 2s - 1
+    top += (int)(bn_mpn_addmul_1(ap, sp, n, 2) + 2 * carry);
+    top -= (int)bn_mpn_sub_1(ap, ap, n, 1);
+    carry -= bn_mpn_sub_1(sp, sp, n, 1);
   }
-  BN_ASSERT(digit == 0);
+  BN_ASSERT(carry == 0 && top >= 0);
+  return (bn_digit_t)top;
 }
 
-bn_err_t bn_to_string(const bn_t *bn, char **s) {
-  bn_sb_t sb = {0};
-  bn_digit_t radix = 10;
+size_t bn_mpn_sqrtrem(bn_digit_t *sp, bn_digit_t *rp, const bn_digit_t *ap,
+                      size_t n) {
+  BN_ASSERT(n > 0 && ap[n - 1] != 0);
+  // Normalized to an even number of digits with one of the top two bits
+  // set, a times 4^k
+  const size_t sn = (n + 1) / 2;
+  const unsigned shift = bn_digit_count_leading_zeros(ap[n - 1]) & ~1u;
+  const size_t k = shift / 2 + (n & 1) * (DIGIT_BITS / 2);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *tp = _bn_scratch_alloc(S, 2 * sn + sn);
+  bn_digit_t *s = tp + 2 * sn;
+  tp[0] = 0;
+  if (shift > 0)
+    bn_mpn_lshift(tp + (n & 1), ap, n, shift);
+  else
+    bn_mpn_copy(tp + (n & 1), ap, n);
+  const bn_digit_t c = _bn_mpn_dc_sqrtrem(s, tp, sn);
+
+  size_t rn;
+  if (k == 0) {
+    bn_mpn_copy(sp, s, sn);
+    tp[sn] = c;
+    rn = bn_mpn_normalized_size(tp, sn + 1);
+  } else {
+    // floor(sqrt(a 4^k)) / 2^k = floor(sqrt(a)), whose remainder is not
+    // that of a 4^k shifted.
+    if (k >= DIGIT_BITS) {
+      bn_mpn_copy(sp, s + 1, sn - 1);
+      sp[sn - 1] = 0;
+      if (k > DIGIT_BITS)
+        bn_mpn_rshift(sp, sp, sn - 1, k - DIGIT_BITS);
+    } else {
+      bn_mpn_rshift(sp, s, sn, k);
+    }
+    if (rp == NULL) {
+      _bn_scratch_release(S, mark);
+      return 0;
+    }
+    bn_mpn_sqr(tp, sp, sn, _bn_scratch_alloc(S, bn_mpn_sqr_itch(sn)));
+    bn_mpn_sub(tp, ap, n, tp, n);
+    rn = bn_mpn_normalized_size(tp, n);
+  }
+  if (rp != NULL)
+    bn_mpn_copy(rp, tp, rn);
+  _bn_scratch_release(S, mark);
+  return rn;
+}
+
+// Squares modulo 64, 63, 65 and 11, bit i set if i is one
+#define _BN_SQUARES_MOD_64 0x0202021202030213ull
+#define _BN_SQUARES_MOD_63 0x0402483012450293ull
+#define _BN_SQUARES_MOD_65 0x218A019866014613ull // and 64
+#define _BN_SQUARES_MOD_11 0x23Bull
+
+// False if {ap, n} cannot be a square by its residues. 45045 = 63 65 11
+// fits into a digit, so one division by it gives all three odd residues.
+static bool _bn_mpn_maybe_square(const bn_digit_t *ap, size_t n) {
+  if (!(_BN_SQUARES_MOD_64 >> (ap[0] & 63) & 1))
+    return false;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  const bn_digit_t r =
+      bn_mpn_divrem_1(_bn_scratch_alloc(S, n), ap, n, 63 * 65 * 11);
+  _bn_scratch_release(S, mark);
+  return (_BN_SQUARES_MOD_63 >> (r % 63) & 1) &&
+         (r % 65 == 64 || (_BN_SQUARES_MOD_65 >> (r % 65) & 1)) &&
+         (_BN_SQUARES_MOD_11 >> (r % 11) & 1);
+}
 
-  BN_ASSERT(radix <= 36);
+static bool _bn_is_zero(const bn_t *X) {
+  return bn_mpn_normalized_size(BN_DIGITS(X), X->size) == 0;
+}
 
-  if (bn->size == 0) {
-    bn_sb_append_char(&sb, '0');
-    goto end;
-  }
-  if (bn->size == 1) {
-    _bn_to_string_last(bn->digits[0], radix, &sb);
-    goto end;
+bn_err_t bn_sqrtrem(bn_t *Z, bn_t *R, const bn_t *X) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(Z != R);
+
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  BN_ASSERT(X->sign > 0 || n == 0);
+  if (n == 0) {
+    bn_from_int(Z, 0);
+    if (R != NULL)
+      bn_from_int(R, 0);
+    return BN_OK;
   }
+  const size_t sn = (n + 1) / 2;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *sp = _bn_scratch_alloc(S, sn + n);
+  bn_digit_t *rp = sp + sn;
+  rp[0] = 0;
+  const size_t rn = bn_mpn_sqrtrem(sp, R != NULL ? rp : NULL, BN_DIGITS(X), n);
+  if (R != NULL)
+    _bn_from_mpn(R, rp, _bn_max(rn, 1));
+  _bn_from_mpn(Z, sp, sn);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
 
-  size_t max_bits_per_char = _BN_TO_STRING_MAX_BITS_PER_CHAR[radix];
-  size_t chunk_chars = DIGIT_BITS * 32 / max_bits_per_char;
-  size_t chunk_divisor = bn_digit_pow(radix, chunk_chars);
-  BN_ASSERT(chunk_divisor != 0);
+bn_err_t bn_sqrt(bn_t *Z, const bn_t *X) { return bn_sqrtrem(Z, NULL, X); }
 
-  bn_t rest = {0};
-  const bn_t *dividend = bn;
-  // process middle digits
-  do {
-    bn_digit_t chunk;
-    bn_div_single(&rest, &chunk, dividend, chunk_divisor);
-    _bn_to_string_middle(chunk, radix, chunk_chars, &sb);
-    dividend = &rest;
-  } while (rest.size > 1);
+bool bn_is_perfect_square(const bn_t *X) {
+  BN_ASSERT(X != NULL);
 
-  // process last digit
-  bn_digit_t d = rest.digits[0];
-  _bn_to_string_last(d, radix, &sb);
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  if (n == 0)
+    return true;
+  if (X->sign < 0 || !_bn_mpn_maybe_square(BN_DIGITS(X), n))
+    return false;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *sp = _bn_scratch_alloc(S, (n + 1) / 2 + n);
+  const size_t rn = bn_mpn_sqrtrem(sp, sp + (n + 1) / 2, BN_DIGITS(X), n);
+  _bn_scratch_release(S, mark);
+  return rn == 0;
+}
 
-  bn_free(&rest);
+// Z = floor(X^(1/k)) for X > 0 and k >= 2, returns if X = Z^k. Newton's
+// iteration x = ((k - 1) x + X / x^(k - 1)) / k decreases from any x above
+// the root until it reaches it. The root y of X / 2^kj for half of the bits
+// of the root gives (y + 1) 2^j above it, with half of the bits right, from
+// which a step or two get the rest. That converges quadratically once x is
+// within 1/k of the root, so roots of less than 2 log2(k) bits, which would
+// take about k steps from there, are found bit by bit.
+static bool _bn_root_newton(bn_t *Z, const bn_t *X, unsigned long k) {
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  const size_t bits = _bn_mpn_bit_length(BN_DIGITS(X), n);
+  // Bits of the root, at most
+  const size_t rbits = (bits - 1) / k + 1;
+  size_t kbits = 0;
+  for (unsigned long m = k; m != 0; m >>= 1)
+    kbits++;
+  bn_t x = {0}, p = {0}, q = {0}, r = {0};
+  bool exact;
+  if (rbits <= _bn_max(2 * kbits, 8)) {
+    bn_from_int(&x, 0);
+    for (size_t i = rbits; i-- > 0;) {
+      bn_setbit(&x, i, true);
+      bn_pow_ui(&p, &x, k);
+      const int c = bn_cmp(&p, X);
+      exact = c == 0;
+      if (c > 0)
+        BN_DIGITS(&x)[i / DIGIT_BITS] ^= (bn_digit_t)1 << i % DIGIT_BITS;
+      else if (exact)
+        break;
+    }
+    bn_normalize(&x);
+  } else {
+    const size_t j = rbits / 2;
+    bn_rshift(&x, X, k * j);
+    _bn_root_newton(&x, &x, k);
+    bn_add_single(&x, &x, 1);
+    bn_lshift(&x, &x, j);
+    for (;;) {
+      bn_pow_ui(&p, &x, k - 1);
+      bn_div(&q, &r, X, &p);
+      // X = x^k if the quotient is x with nothing left
+      exact = _bn_is_zero(&r) && bn_cmp(&q, &x) == 0;
+      bn_mul_single(&p, &x, k - 1);
+      bn_add(&p, &p, &q);
+      bn_digit_t rem;
+      bn_div_single(&p, &rem, &p, k);
+      if (bn_cmp(&p, &x) >= 0)
+        break;
+      bn_clone(&x, &p);
+    }
+  }
+  bn_clone(Z, &x);
+  bn_free(&x);
+  bn_free(&p);
+  bn_free(&q);
+  bn_free(&r);
+  return exact;
+}
 
-end:
-  // handle sign
-  if (bn->sign == -1)
-    bn_sb_append_char(&sb, '-');
-  // reverse the string
-  bn_sb_reverse(&sb);
-  *s = bn_sb_to_str(&sb);
+bn_err_t bn_rootrem(bn_t *Z, bn_t *R, const bn_t *X, unsigned long k) {
+  BN_ASSERT(Z != NULL);
+  BN_ASSERT(X != NULL);
+  BN_ASSERT(Z != R);
+  BN_ASSERT(k > 0);
+
+  const int sign = _bn_is_zero(X) ? 1 : X->sign;
+  BN_ASSERT(sign > 0 || k % 2 == 1);
+  bn_t x = {0}, z = {0};
+  bn_abs(&x, X);
+  if (_bn_is_zero(&x) || k == 1) {
+    bn_clone(&z, &x);
+  } else if (k == 2) {
+    bn_sqrt(&z, &x);
+  } else {
+    _bn_root_newton(&z, &x, k);
+  }
+  if (R != NULL) {
+    // R = X - Z^k, with the sign of X
+    bn_t p = {0};
+    bn_pow_ui(&p, &z, k);
+    bn_sub(R, &x, &p);
+    if (!_bn_is_zero(R))
+      R->sign = sign;
+    bn_free(&p);
+  }
+  bn_clone(Z, &z);
+  if (!_bn_is_zero(Z))
+    Z->sign = sign;
+  bn_free(&x);
+  bn_free(&z);
   return BN_OK;
 }
 
-void bn_print(const bn_t *bn) {
-  char *s;
-  bn_to_string(bn, &s);
-  printf("%s", s);
-  free(s);
+bn_err_t bn_root(bn_t *Z, const bn_t *X, unsigned long k) {
+  return bn_rootrem(Z, NULL, X, k);
 }
 
-//////////////////// BIGNUM COMPARISON ////////////////////
-
-int bn_cmp(const bn_t *a, const bn_t *b) {
-  if (a->sign < b->sign)
-    return -1;
-  if (a->sign > b->sign)
-    return 1;
-
-  int res = bn_cmp_abs(a, b);
-  if (a->sign < 0)
-    return -res;
-  return res;
+static bool _bn_is_prime_ui(uint64_t q) {
+  if (q < 4)
+    return q >= 2;
+  if (q % 2 == 0)
+    return false;
+  for (uint64_t d = 3; d <= q / d; d += 2)
+    if (q % d == 0)
+      return false;
+  return true;
 }
-int bn_cmp_abs(const bn_t *a, const bn_t *b) {
-  if (a->size == 0 && b->size == 0)
-    return 0;
-  else if (a->size == 0)
-    return -1;
-  else if (b->size == 0)
-    return 1;
-
-  // handle zero padding
-  size_t sa = a->size - 1;
-  for (; sa > 0 && a->digits[sa] == 0; sa--)
-    ;
-  size_t sb = b->size - 1;
-  for (; sb > 0 && b->digits[sb] == 0; sb--)
-    ;
-
-  if (sa > sb)
-    return 1;
-  if (sa < sb)
-    return -1;
-
-  // compare digit-by-digit
-  do {
-    if (a->digits[sa] > b->digits[sa])
-      return 1;
-    if (a->digits[sa] < b->digits[sa])
-      return -1;
-  } while (sa-- > 0);
 
-  return 0;
+// False if {ap, n} cannot be a p-th power for the odd prime p by its residues
+// modulo up to four primes q = 2ip + 1, where p-th powers are 0 and the r with
+// r^((q - 1) / p) = 1. Other numbers pass each with probability 1/p.
+static bool _bn_mpn_maybe_power(const bn_digit_t *ap, size_t n,
+                                unsigned long p) {
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *qp = _bn_scratch_alloc(S, n);
+  bool maybe = true;
+  int tests = 0;
+  for (uint64_t q = 2 * (uint64_t)p + 1; q <= 0xFFFFFFFF && tests < 4 && maybe;
+       q += 2 * (uint64_t)p) {
+    if (!_bn_is_prime_ui(q))
+      continue;
+    tests++;
+    uint64_t r = bn_mpn_divrem_1(qp, ap, n, (bn_digit_t)q), e = (q - 1) / p;
+    uint64_t power = 1;
+    for (; e != 0 && r != 0; e >>= 1, r = r * r % q)
+      if (e & 1)
+        power = power * r % q;
+    maybe = r == 0 || power == 1;
+  }
+  _bn_scratch_release(S, mark);
+  return maybe;
 }
 
-//////////////////// BIGNUM ARITHMETIC ////////////////////
-
-bn_err_t bn_abs(bn_t *Z, const bn_t *A) {
-  BN_ASSERT(Z != NULL);
-  BN_ASSERT(A != NULL);
-
-  if (Z != A) bn_clone(Z, A);
-  Z->sign = 1;
+// m 2^e with the top bit of m set, for powers of a low precision. Products
+// are rounded down.
+typedef struct {
+  bn_digit_t m;
+  int64_t e;
+} _bn_approx_t;
+
+static _bn_approx_t _bn_approx_mul(_bn_approx_t a, _bn_approx_t b) {
+  bn_digit_t hi;
+  const bn_digit_t lo = bn_digit_mul(a.m, b.m, &hi);
+  _bn_approx_t r = {hi, a.e + b.e + DIGIT_BITS};
+  if (!(hi >> (DIGIT_BITS - 1))) {
+    r.m = hi << 1 | lo >> (DIGIT_BITS - 1);
+    r.e--;
+  }
+  return r;
+}
 
-  return BN_OK;
+// y^p, low by a relative error of less than (2 log2(p) + 1) 2^(1 - DIGIT_BITS)
+static _bn_approx_t _bn_approx_pow(bn_digit_t y, unsigned long p) {
+  const unsigned shift = bn_digit_count_leading_zeros(y);
+  const _bn_approx_t base = {y << shift, -(int64_t)shift};
+  _bn_approx_t r = base;
+  unsigned long top = 1;
+  while (top <= p / 2)
+    top <<= 1;
+  for (top >>= 1; top != 0; top >>= 1) {
+    r = _bn_approx_mul(r, r);
+    if (p & top)
+      r = _bn_approx_mul(r, base);
+  }
+  return r;
 }
 
-bn_err_t bn_add_and_return_carry_inplace(bn_t *Z, bn_t *X) {
-  bn_normalize(X);
-  if (X->size == 0) return 0;
-  bn_digit_t carry = 0;
-  size_t i = 0;
-  for (; i < X->size; ++i) {
-    bn_digit_t z = Z->size > i ? Z->digits[i] : 0;
-    bn_set_digit(Z, i, bn_digit_add3(z, X->digits[i], carry, &carry));
+// Whether the normalized {ap, n} of {bits} bits is a p-th power whose root has
+// at most rbits <= DIGIT_BITS - 16 bits. The root y is searched with powers of
+// the low precision, against the top digit of {ap, n}. Up to that size y or
+// y + 1 is the root of a p-th power, so only their p-th powers modulo B need
+// to match the low digit before a full power is compared.
+static bool _bn_mpn_is_small_power(const bn_digit_t *ap, size_t n, size_t bits,
+                                   unsigned long p, size_t rbits) {
+  const unsigned shift = (unsigned)(n * DIGIT_BITS - bits);
+  _bn_approx_t x = {ap[n - 1] << shift, (int64_t)(n - 1) * DIGIT_BITS - shift};
+  if (shift != 0 && n > 1)
+    x.m |= ap[n - 2] >> (DIGIT_BITS - shift);
+
+  bn_digit_t lo = 1, hi = (bn_digit_t)1 << rbits; // y in [lo, hi)
+  while (hi - lo > 1) {
+    const bn_digit_t mid = lo + (hi - lo) / 2;
+    const _bn_approx_t y = _bn_approx_pow(mid, p);
+    if (y.e < x.e || (y.e == x.e && y.m <= x.m))
+      lo = mid;
+    else
+      hi = mid;
   }
-  for (; i < Z->size; ++i) {
-    bn_set_digit(Z, i, bn_digit_add2(Z->digits[i], carry, &carry));
+  bool power = false;
+  for (bn_digit_t y = lo; y <= lo + 1 && !power; ++y) {
+    bn_digit_t low = 1, base = y;
+    for (unsigned long e = p; e != 0; e >>= 1, base *= base)
+      if (e & 1)
+        low *= base;
+    if (low != ap[0])
+      continue;
+    bn_t z = {0};
+    bn_from_int(&z, 1);
+    BN_DIGITS(&z)[0] = y;
+    bn_pow_ui(&z, &z, p);
+    power = z.size == n && bn_mpn_cmp(BN_DIGITS(&z), ap, n) == 0;
+    bn_free(&z);
   }
-  return carry;
+  return power;
 }
 
-bn_err_t bn_add_single(bn_t *Z, const bn_t *X, bn_digit_t y) {
-  BN_ASSERT(Z != NULL);
+bool bn_is_perfect_power(const bn_t *X) {
   BN_ASSERT(X != NULL);
-  BN_ASSERT(X->size > 0);
 
-  const bn_t Y = {.sign=1, .size=1, .capacity=1, .digits=&y};
-  return bn_add(Z, X, &Y);
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(X), X->size);
+  // 0, 1 and -1 are powers of any exponent.
+  if (n == 0 || (n == 1 && BN_DIGITS(X)[0] == 1))
+    return true;
+  if (X->sign > 0 && bn_is_perfect_square(X))
+    return true;
+  // An exponent divides that of every prime factor, as of 2.
+  size_t twos = 0;
+  while (BN_DIGITS(X)[twos / DIGIT_BITS] == 0)
+    twos += DIGIT_BITS;
+  twos += bn_digit_count_trailing_zeros(BN_DIGITS(X)[twos / DIGIT_BITS]);
+
+  bn_t x = {0}, z = {0};
+  bn_abs(&x, X);
+  const size_t bits = _bn_mpn_bit_length(BN_DIGITS(X), n);
+  bool power = false;
+  // Prime exponents are enough, composite ones are powers of them. Roots of a
+  // few bits are found in low precision. Larger ones are only computed in
+  // full for the exponents which pass the residue tests.
+  for (unsigned long p = 3; p < bits && !power; p += 2) {
+    if ((twos != 0 && twos % p != 0) || !_bn_is_prime_ui(p))
+      continue;
+    const size_t rbits = (bits - 1) / p + 1;
+    if (rbits <= DIGIT_BITS - 16)
+      power = _bn_mpn_is_small_power(BN_DIGITS(&x), n, bits, p, rbits);
+    else if (_bn_mpn_maybe_power(BN_DIGITS(&x), n, p))
+      power = _bn_root_newton(&z, &x, p);
+  }
+  bn_free(&x);
+  bn_free(&z);
+  return power;
 }
 
-bn_err_t bn_add(bn_t *Z, const bn_t *A, const bn_t *B) {
+//////////////////// PRODUCTS ////////////////////
+
+// Long products are multiplied as balanced trees, so that the large products
+// are of operands of the same size and land in the fast tiers of bn_mpn_mul.
+// Factors of less than a digit are packed into full digits first.
+
+bn_err_t bn_pow_ui(bn_t *Z, const bn_t *X, unsigned long e) {
   BN_ASSERT(Z != NULL);
-  BN_ASSERT(A != NULL);
-  BN_ASSERT(A->size > 0);
-  BN_ASSERT(B != NULL);
-  BN_ASSERT(B->size > 0);
+  BN_ASSERT(X != NULL);
 
-  // handle signs
-  if (A->sign == -1 && B->sign == -1) {
-    // both negative
-    Z->sign = -1;
-  } else if (A->sign == -1) {
-    // a is negative, b is positive
-    bn_t Atmp = { .sign = 1, .size = A->size, .capacity = A->capacity, .digits = A->digits };
-    bn_err_t res = bn_sub(Z, &Atmp, B);
-    Z->sign *= -1;
-    return res;
-  } else if (B->sign == -1) {
-    // a is positive, b is negative
-    bn_t Btmp = {.sign = 1, .size = B->size, .capacity = B->capacity, .digits = B->digits};
-    bn_err_t res = bn_sub(Z, A, &Btmp);
-    return res;
-  } else {
-    Z->sign = 1;
+  const int sign = X->sign < 0 && e % 2 == 1 ? -1 : 1;
+  if (e == 0 || _bn_is_zero(X)) {
+    bn_from_int(Z, e == 0);
+    return BN_OK;
   }
-
-  const bn_t *dA = A, *dB = B;
-  if (A->size < B->size) {
-    dA = B;
-    dB = A;
+  // X = x 2^twos with x odd, the twos are shifted in at the end.
+  size_t twos = 0;
+  while (BN_DIGITS(X)[twos / DIGIT_BITS] == 0)
+    twos += DIGIT_BITS;
+  twos += bn_digit_count_trailing_zeros(BN_DIGITS(X)[twos / DIGIT_BITS]);
+  BN_ASSERT(twos <= SIZE_MAX / e);
+
+  bn_t x = {0}, r = {0};
+  bn_abs(&x, X);
+  bn_rshift(&x, &x, twos);
+  bn_clone(&r, &x);
+  unsigned long bit = 1;
+  while (bit <= e / 2)
+    bit <<= 1;
+  for (bit >>= 1; bit > 0; bit >>= 1) {
+    bn_sqr(&r, &r);
+    if (e & bit)
+      bn_mul(&r, &r, &x);
   }
-  bn_digit_t carry = 0;
-  size_t i = 0;
-  for (; i < dB->size; ++i)
-    bn_set_digit(Z, i, bn_digit_add3(dA->digits[i], dB->digits[i], carry, &carry));
-  for (; i < dA->size; ++i)
-    bn_set_digit(Z, i, bn_digit_add2(dA->digits[i], carry, &carry));
-  if (carry > 0)
-    bn_set_digit(Z, i, carry);
-
+  bn_lshift(Z, &r, twos * e);
+  Z->sign = sign;
+  bn_free(&x);
+  bn_free(&r);
   return BN_OK;
 }
 
-bn_digit_t bn_sub_and_return_borrow_inplace(bn_t *Z, const bn_t *X) {
-  if (X->size == 0) return 0;
-  bn_digit_t borrow = 0;
-  size_t i = 0;
-  for (; i < X->size; ++i) {
-    bn_digit_t z = Z->size > i ? Z->digits[i] : 0;
-    bn_set_digit(Z, i, bn_digit_sub2(z, X->digits[i], borrow, &borrow));
+// {rp, return value} = fp[0] ... fp[count - 1] for count >= 1 nonzero
+// factors, where rp has room for count digits. Fewer than
+// BN_KARATSUBA_THRESHOLD factors are multiplied into a running product:
+// below that, a tree of schoolbook products takes as many digit products.
+static size_t _bn_mpn_prod(bn_digit_t *rp, const bn_digit_t *fp,
+                           size_t count) {
+  if (count < BN_KARATSUBA_THRESHOLD) {
+    size_t n = 1;
+    rp[0] = fp[0];
+    for (size_t i = 1; i < count; ++i) {
+      const bn_digit_t carry = bn_mpn_mul_1(rp, rp, n, fp[i]);
+      if (carry != 0)
+        rp[n++] = carry;
+    }
+    return n;
   }
-  for (; i < Z->size; ++i) {
-    bn_set_digit(Z, i, bn_digit_sub(Z->digits[i], borrow, &borrow));
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  const size_t h = count / 2;
+  bn_digit_t *ap = _bn_scratch_alloc(S, count);
+  bn_digit_t *bp = ap + h;
+  size_t an = _bn_mpn_prod(ap, fp, h);
+  size_t bn = _bn_mpn_prod(bp, fp + h, count - h);
+  if (an < bn) {
+    bn_digit_t *tp = ap;
+    ap = bp;
+    bp = tp;
+    const size_t tn = an;
+    an = bn;
+    bn = tn;
   }
-  return borrow;
+  bn_digit_t *scratch = _bn_scratch_alloc(S, bn_mpn_mul_itch(an, bn));
+  bn_mpn_mul(rp, ap, an, bp, bn, scratch);
+  _bn_scratch_release(S, mark);
+  return bn_mpn_normalized_size(rp, an + bn);
 }
 
-bn_err_t bn_sub_single(bn_t *Z, const bn_t *X, bn_digit_t y) {
-  BN_ASSERT(Z != NULL);
-  BN_ASSERT(X != NULL);
-  BN_ASSERT(X->size > 0);
+// Z = fp[0] ... fp[count - 1] for nonzero factors, which are packed in place
+// into products of a digit.
+static void _bn_prod(bn_t *Z, bn_digit_t *fp, size_t count) {
+  if (count == 0) {
+    bn_from_int(Z, 1);
+    return;
+  }
+  size_t m = 0;
+  bn_digit_t f = fp[0];
+  for (size_t i = 1; i < count; ++i) {
+    bn_digit_t high;
+    const bn_digit_t low = bn_digit_mul(f, fp[i], &high);
+    if (high == 0) {
+      f = low;
+    } else {
+      fp[m++] = f;
+      f = fp[i];
+    }
+  }
+  fp[m++] = f;
 
-  const bn_t Y = {.sign=1, .size=1, .capacity=1, .digits=&y};
-  return bn_sub(Z, X, &Y);
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  bn_digit_t *rp = _bn_scratch_alloc(S, m);
+  _bn_from_mpn(Z, rp, _bn_mpn_prod(rp, fp, m));
+  _bn_scratch_release(S, mark);
 }
 
-bn_err_t bn_sub(bn_t *Z, const bn_t *A, const bn_t *B) {
-  BN_ASSERT(Z != NULL);
-  BN_ASSERT(A != NULL);
-  BN_ASSERT(A->size > 0);
-  BN_ASSERT(B != NULL);
-  BN_ASSERT(B->size > 0);
-
-  // handle sign
-  if (A->sign == -1 && B->sign == -1) {
-    // A is negative, B is negative
-    Z->sign = -1;
-  } else if (A->sign == -1 && B->sign == 1) {
-    // A is negative, B is positive
-    bn_t neg_b = {0};
-    bn_clone(&neg_b, B);
-    neg_b.sign = -1;
-    bn_err_t res = bn_add(Z, A, &neg_b);
-    bn_free(&neg_b);
-    return res;
-  } else if (A->sign == 1 && B->sign == -1) {
-    // A is positive, B is negative
-    bn_t abs_b = {0};
-    bn_clone(&abs_b, B);
-    abs_b.sign = 1;
-    bn_err_t res = bn_add(Z, A, &abs_b);
-    bn_free(&abs_b);
-    return res;
-  } else {
-    Z->sign = 1;
+// Returns the primes up to n in ascending order, taken from S, and their
+// count in *count. The sieve holds the odd numbers, bit i is set when 2i + 1
+// is not a prime.
+static bn_digit_t *_bn_primes(bn_scratch_t *S, unsigned long n,
+                              size_t *count) {
+  const size_t m = n / 2 + n % 2;
+  bn_digit_t *sieve = _bn_scratch_alloc(S, m / DIGIT_BITS + 1);
+  bn_mpn_zero(sieve, m / DIGIT_BITS + 1);
+  sieve[0] = 1;
+  for (size_t i = 1, p = 3; p <= n / p; ++i, p += 2) {
+    if (sieve[i / DIGIT_BITS] >> i % DIGIT_BITS & 1)
+      continue;
+    for (size_t j = p * p / 2; j < m; j += p)
+      sieve[j / DIGIT_BITS] |= (bn_digit_t)1 << j % DIGIT_BITS;
   }
+  size_t c = n >= 2;
+  for (size_t i = 0; i < m; ++i)
+    c += !(sieve[i / DIGIT_BITS] >> i % DIGIT_BITS & 1);
+  bn_digit_t *primes = _bn_scratch_alloc(S, _bn_max(c, 1));
+  c = 0;
+  if (n >= 2)
+    primes[c++] = 2;
+  for (size_t i = 0; i < m; ++i)
+    if (!(sieve[i / DIGIT_BITS] >> i % DIGIT_BITS & 1))
+      primes[c++] = 2 * i + 1;
+  *count = c;
+  return primes;
+}
 
-  int cmp = bn_cmp_abs(A, B);
-  if (cmp == 0)
-    return bn_from_int(Z, 0);
-  const bn_t *left = A;
-  const bn_t *right = B;
-  if (cmp < 0) {
-    left = B;
-    right = A;
-    Z->sign *= -1;
+// The odd parts of n! up to this n are multiplied out directly.
+#define _BN_FAC_ODD_BASE 64
+
+// Z = the odd part of n!, for the odd primes primes[1 .. count) up to n and
+// room for _bn_max(count, _BN_FAC_ODD_BASE) factors in fp. n! is floor(n/2)!^2
+// times the swing n! / floor(n/2)!^2, in which a prime p appears once for
+// every odd floor(n / p^i), i >= 1. The factor of p is at most n.
+static void _bn_fac_odd(bn_t *Z, unsigned long n, const bn_digit_t *primes,
+                        size_t count, bn_digit_t *fp) {
+  size_t m = 0;
+  if (n < _BN_FAC_ODD_BASE) {
+    for (unsigned long i = 3; i <= n; ++i)
+      if (i >> bn_digit_count_trailing_zeros(i) > 1)
+        fp[m++] = i >> bn_digit_count_trailing_zeros(i);
+    _bn_prod(Z, fp, m);
+    return;
+  }
+  _bn_fac_odd(Z, n / 2, primes, count, fp);
+  for (size_t i = 1; i < count && primes[i] <= n; ++i) {
+    const bn_digit_t p = primes[i];
+    bn_digit_t f = 1;
+    for (unsigned long q = n / p; q > 0; q /= p)
+      if (q % 2 == 1)
+        f *= p;
+    if (f > 1)
+      fp[m++] = f;
   }
+  bn_t s = {0};
+  _bn_prod(&s, fp, m);
+  bn_sqr(Z, Z);
+  bn_mul(Z, Z, &s);
+  bn_free(&s);
+}
 
-  size_t i = 0;
-  bn_digit_t borrow = 0;
-  for (; i < right->size; ++i)
-    bn_set_digit(Z, i, bn_digit_sub2(left->digits[i], right->digits[i], borrow, &borrow));
-  for (; i < left->size; ++i)
-    bn_set_digit(Z, i, bn_digit_sub(left->digits[i], borrow, &borrow));
-  BN_ASSERT(borrow == 0);
+bn_err_t bn_fac_ui(bn_t *Z, unsigned long n) {
+  BN_ASSERT(Z != NULL);
 
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  size_t count = 0;
+  const bn_digit_t *primes =
+      _bn_primes(S, n < _BN_FAC_ODD_BASE ? 0 : n, &count);
+  bn_digit_t *fp = _bn_scratch_alloc(S, _bn_max(count, _BN_FAC_ODD_BASE));
+  _bn_fac_odd(Z, n, primes, count, fp);
+  // n! has n - popcount(n) factors of two.
+  size_t twos = n;
+  for (unsigned long m = n; m != 0; m >>= 1)
+    twos -= m & 1;
+  bn_lshift(Z, Z, twos);
+  _bn_scratch_release(S, mark);
   return BN_OK;
 }
 
-bn_err_t bn_mul_single(bn_t *Z, const bn_t *X, bn_digit_t y) {
-  BN_ASSERT(X != NULL);
-  BN_ASSERT(X->size != 0);
+bn_err_t bn_bin_uiui(bn_t *Z, unsigned long n, unsigned long k) {
   BN_ASSERT(Z != NULL);
 
-  bn_digit_t carry = 0;
-  bn_digit_t high = 0;
-  Z->sign = X->sign;
-  size_t i = 0;
-  for (; i < X->size; ++i) {
-    bn_digit_t new_high;
-    bn_digit_t low = bn_digit_mul(X->digits[i], y, &new_high);
-    bn_set_digit(Z, i, bn_digit_add3(low, high, carry, &carry));
-    high = new_high;
+  if (k > n) {
+    bn_from_int(Z, 0);
+    return BN_OK;
   }
-  carry += high;
-  if (carry > 0) {
-    bn_set_digit(Z, i, carry);
+  if (k > n - k)
+    k = n - k;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  if (k == 0 || k / 64 < n / k) {
+    // (n - k + 1) ... n / k!, which takes less than the sieve up to n while
+    // k^2 is below 64 n or so
+    bn_digit_t *fp = _bn_scratch_alloc(S, _bn_max(k, 1));
+    for (unsigned long i = 0; i < k; ++i)
+      fp[i] = n - i;
+    bn_t d = {0};
+    _bn_prod(Z, fp, k);
+    bn_fac_ui(&d, k);
+    bn_div(Z, NULL, Z, &d);
+    bn_free(&d);
+  } else {
+    // The power of a prime p dividing C(n, k) is the number of carries when
+    // adding k and n - k in base p, its factor is at most n.
+    size_t count = 0;
+    bn_digit_t *primes = _bn_primes(S, n, &count);
+    size_t m = 0;
+    for (size_t i = 0; i < count; ++i) {
+      const bn_digit_t p = primes[i];
+      bn_digit_t f = 1;
+      for (unsigned long a = n, b = k, c = n - k; a >= p;) {
+        a /= p;
+        b /= p;
+        c /= p;
+        if (a > b + c)
+          f *= p;
+      }
+      if (f > 1)
+        primes[m++] = f;
+    }
+    _bn_prod(Z, primes, m);
   }
-
-  bn_normalize(Z);
+  _bn_scratch_release(S, mark);
   return BN_OK;
 }
 
-bn_err_t bn_mul(bn_t *Z, const bn_t *A, const bn_t *B) {
+bn_err_t bn_primorial_ui(bn_t *Z, unsigned long n) {
   BN_ASSERT(Z != NULL);
-  BN_ASSERT(A != NULL);
-  BN_ASSERT(A->size > 0);
-  BN_ASSERT(B != NULL);
-  BN_ASSERT(B->size > 0);
 
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  size_t count = 0;
+  bn_digit_t *primes = _bn_primes(S, n, &count);
+  _bn_prod(Z, primes, count);
+  _bn_scratch_release(S, mark);
+  return BN_OK;
+}
+
+//////////////////// BATCH ////////////////////
 
-  if (B->size == 1ul) {
-    bn_err_t res = bn_mul_single(Z, A, B->digits[0]);
-    Z->sign = A->sign * B->sign;
-    return res;
-  }
+// The batch functions run independent operations of the same size in
+// lockstep, one per SIMD lane. Numbers are split into limbs a few bits
+// shorter than the lane multiplier takes, so that products are accumulated
+// without carrying. Limb j of lane l is at index j L + l of a lane vector of
+// m limbs and L lanes.
+//
+// Montgomery multiplication in lanes works with R = 2^(bits m) and 4N < R:
+// operands below 2N give a result below 2N without the final subtraction,
+// which is done once, when converting back.
 
-  Z->sign = A->sign * B->sign;
-  bn_t Ztmp = {0};
-  bn_resize(&Ztmp, A->size + B->size);
+#if BN_HAVE_X86_64_ASM
+#include <immintrin.h>
+
+typedef struct {
+  bn_batch_t batch;
+  unsigned lanes;   // L
+  unsigned bits;    // limb size
+  size_t max_limbs; // largest m mont_mul and mul can take
+  // {rp, m} = {ap, m} {bp, m} / R mod {np, m}, below 2N for inputs below 2N.
+  // {ninv} is -N^-1 mod 2^bits, {tp} holds m vectors. rp may be ap or bp.
+  void (*mont_mul)(uint64_t *rp, const uint64_t *ap, const uint64_t *bp,
+                   const uint64_t *np, const uint64_t *ninv, size_t m,
+                   uint64_t *tp);
+  // {rp, 2m} = {ap, m} {bp, m}, {rp} must not overlap the inputs.
+  void (*mul)(uint64_t *rp, const uint64_t *ap, const uint64_t *bp, size_t m);
+} _bn_lanes_t;
+
+#define _BN_AVX2 __attribute__((target("avx2")))
+#define _BN_IFMA __attribute__((target("avx512f,avx512ifma")))
+
+// AVX2: 4 lanes of 28-bit limbs, multiplied by VPMULUDQ into 56-bit
+// products. The accumulators are normalized every 64 rows, before they could
+// overflow.
+
+_BN_AVX2 static void _bn_lanes_normalize_avx2(uint64_t *tp, size_t n) {
+  const __m256i mask = _mm256_set1_epi64x(((int64_t)1 << 28) - 1);
+  __m256i carry = _mm256_setzero_si256();
+  for (size_t j = 0; j < n; ++j) {
+    const __m256i x =
+        _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(tp + 4 * j)),
+                         carry);
+    _mm256_storeu_si256((__m256i *)(tp + 4 * j), _mm256_and_si256(x, mask));
+    carry = _mm256_srli_epi64(x, 28);
+  }
+}
 
-  for (size_t i = 0; i < A->size; ++i) {
-    for (size_t j = 0; j < B->size; ++j) {
-      bn_digit_t res, carry;
-      res = bn_digit_mul(A->digits[i], B->digits[j], &carry);
-      Ztmp.digits[i + j] += res;
-      Ztmp.digits[i + j + 1] += carry;
+_BN_AVX2 static void _bn_lanes_mont_mul_avx2(uint64_t *rp, const uint64_t *ap,
+                                             const uint64_t *bp,
+                                             const uint64_t *np,
+                                             const uint64_t *ninv, size_t m,
+                                             uint64_t *tp) {
+  const __m256i mask = _mm256_set1_epi64x(((int64_t)1 << 28) - 1);
+  const __m256i k = _mm256_loadu_si256((const __m256i *)ninv);
+#define _BN_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+  for (size_t j = 0; j < m; ++j)
+    _mm256_storeu_si256((__m256i *)(tp + 4 * j), _mm256_setzero_si256());
+  for (size_t i = 0; i < m; ++i) {
+    // t = (t + a_i b + q N) / 2^28 with q making the low limb zero. The
+    // division is the shift by one limb in the stores.
+    const __m256i a = _BN_LOAD(ap + 4 * i);
+    __m256i x = _mm256_add_epi64(_BN_LOAD(tp), _mm256_mul_epu32(a, _BN_LOAD(bp)));
+    const __m256i q = _mm256_and_si256(_mm256_mul_epu32(x, k), mask);
+    x = _mm256_add_epi64(x, _mm256_mul_epu32(q, _BN_LOAD(np)));
+    __m256i carry = _mm256_srli_epi64(x, 28);
+    for (size_t j = 1; j < m; ++j) {
+      x = _mm256_add_epi64(_BN_LOAD(tp + 4 * j),
+                           _mm256_mul_epu32(a, _BN_LOAD(bp + 4 * j)));
+      x = _mm256_add_epi64(x, _mm256_mul_epu32(q, _BN_LOAD(np + 4 * j)));
+      _mm256_storeu_si256((__m256i *)(tp + 4 * (j - 1)),
+                          _mm256_add_epi64(x, carry));
+      carry = _mm256_setzero_si256();
     }
+    _mm256_storeu_si256((__m256i *)(tp + 4 * (m - 1)), carry);
+    if (i % 64 == 63)
+      _bn_lanes_normalize_avx2(tp, m);
   }
+#undef _BN_LOAD
+  _bn_lanes_normalize_avx2(tp, m);
+  memcpy(rp, tp, 4 * m * sizeof(uint64_t));
+}
 
-  bn_normalize(&Ztmp);
-  Z->size = 0;
-  for (size_t i = 0; i < Ztmp.size; ++i) bn_append_digit(Z, Ztmp.digits[i]);
-  bn_free(&Ztmp);
-  return BN_OK;
+_BN_AVX2 static void _bn_lanes_mul_avx2(uint64_t *rp, const uint64_t *ap,
+                                        const uint64_t *bp, size_t m) {
+  for (size_t j = 0; j < 2 * m; ++j)
+    _mm256_storeu_si256((__m256i *)(rp + 4 * j), _mm256_setzero_si256());
+  for (size_t i = 0; i < m; ++i) {
+    const __m256i a = _mm256_loadu_si256((const __m256i *)(ap + 4 * i));
+    uint64_t *r = rp + 4 * i;
+    for (size_t j = 0; j < m; ++j) {
+      const __m256i b = _mm256_loadu_si256((const __m256i *)(bp + 4 * j));
+      const __m256i x = _mm256_loadu_si256((const __m256i *)(r + 4 * j));
+      _mm256_storeu_si256((__m256i *)(r + 4 * j),
+                          _mm256_add_epi64(x, _mm256_mul_epu32(a, b)));
+    }
+  }
+  _bn_lanes_normalize_avx2(rp, 2 * m);
 }
 
-bn_err_t bn_div_single(bn_t *Q, bn_digit_t *remainder, const bn_t *A, bn_digit_t b) {
-  BN_ASSERT(b != 0);
-  BN_ASSERT(A->size > 0);
+// AVX-512 IFMA: 8 lanes of 52-bit limbs. VPMADD52LUQ and VPMADD52HUQ add the
+// low and high 52 bits of a product to an accumulator, which has room for
+// thousands of them.
+
+_BN_IFMA static void _bn_lanes_normalize_ifma(uint64_t *tp, size_t n) {
+  const __m512i mask = _mm512_set1_epi64(((int64_t)1 << 52) - 1);
+  __m512i carry = _mm512_setzero_si512();
+  for (size_t j = 0; j < n; ++j) {
+    const __m512i x = _mm512_add_epi64(_mm512_loadu_si512(tp + 8 * j), carry);
+    _mm512_storeu_si512(tp + 8 * j, _mm512_and_si512(x, mask));
+    carry = _mm512_srli_epi64(x, 52);
+  }
+}
 
-  *remainder = 0;
-  if (Q == NULL) {
-    for (int i = A->size - 1; i >= 0; i--) {
-      bn_digit_div(*remainder, A->digits[i], b, remainder);
+_BN_IFMA static void _bn_lanes_mont_mul_ifma(uint64_t *rp, const uint64_t *ap,
+                                             const uint64_t *bp,
+                                             const uint64_t *np,
+                                             const uint64_t *ninv, size_t m,
+                                             uint64_t *tp) {
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i k = _mm512_loadu_si512(ninv);
+  for (size_t j = 0; j < m; ++j)
+    _mm512_storeu_si512(tp + 8 * j, zero);
+  for (size_t i = 0; i < m; ++i) {
+    // Like the AVX2 version, with the high halves of the products of column
+    // j - 1 added to column j.
+    const __m512i a = _mm512_loadu_si512(ap + 8 * i);
+    __m512i b = _mm512_loadu_si512(bp);
+    __m512i n = _mm512_loadu_si512(np);
+    __m512i x = _mm512_madd52lo_epu64(_mm512_loadu_si512(tp), a, b);
+    const __m512i q = _mm512_madd52lo_epu64(zero, x, k);
+    x = _mm512_madd52lo_epu64(x, q, n);
+    __m512i high = _mm512_add_epi64(_mm512_madd52hi_epu64(zero, a, b),
+                                    _mm512_madd52hi_epu64(zero, q, n));
+    high = _mm512_add_epi64(high, _mm512_srli_epi64(x, 52));
+    for (size_t j = 1; j < m; ++j) {
+      b = _mm512_loadu_si512(bp + 8 * j);
+      n = _mm512_loadu_si512(np + 8 * j);
+      x = _mm512_madd52lo_epu64(_mm512_loadu_si512(tp + 8 * j), a, b);
+      x = _mm512_madd52lo_epu64(x, q, n);
+      _mm512_storeu_si512(tp + 8 * (j - 1), _mm512_add_epi64(x, high));
+      high = _mm512_add_epi64(_mm512_madd52hi_epu64(zero, a, b),
+                              _mm512_madd52hi_epu64(zero, q, n));
     }
-  } else {
-    bn_t Qtmp = {0};
+    _mm512_storeu_si512(tp + 8 * (m - 1), high);
+  }
+  _bn_lanes_normalize_ifma(tp, m);
+  memcpy(rp, tp, 8 * m * sizeof(uint64_t));
+}
 
-    if (A->digits[A->size - 1] >= b) {
-      for (int i = A->size - 1; i >= 0; i--) {
-        bn_append_digit(&Qtmp, bn_digit_div(*remainder, A->digits[i], b, remainder));
-      }
-    } else {
-      *remainder = A->digits[A->size - 1];
-      for (int i = A->size - 2; i >= 0; i--) {
-        bn_append_digit(&Qtmp, bn_digit_div(*remainder, A->digits[i], b, remainder));
-      }
+_BN_IFMA static void _bn_lanes_mul_ifma(uint64_t *rp, const uint64_t *ap,
+                                        const uint64_t *bp, size_t m) {
+  const __m512i zero = _mm512_setzero_si512();
+  for (size_t j = 0; j < m; ++j)
+    _mm512_storeu_si512(rp + 8 * j, zero);
+  for (size_t i = 0; i < m; ++i) {
+    const __m512i a = _mm512_loadu_si512(ap + 8 * i);
+    uint64_t *r = rp + 8 * i;
+    __m512i high = zero;
+    for (size_t j = 0; j < m; ++j) {
+      const __m512i b = _mm512_loadu_si512(bp + 8 * j);
+      const __m512i x =
+          _mm512_madd52lo_epu64(_mm512_loadu_si512(r + 8 * j), a, b);
+      _mm512_storeu_si512(r + 8 * j, _mm512_add_epi64(x, high));
+      high = _mm512_madd52hi_epu64(zero, a, b);
     }
-    int64_t i = Qtmp.size - 1;
-    for (; i >= 0; i--) if (Qtmp.digits[i]) break;
-    size_t j = 0;
-    for (; i >= 0; i--) bn_set_digit(Q, j++, Qtmp.digits[i]);
-    // copy sign
-    Q->sign = A->sign;
-    bn_free(&Qtmp);
+    _mm512_storeu_si512(r + 8 * m, high);
   }
-  return BN_OK;
+  _bn_lanes_normalize_ifma(rp, 2 * m);
 }
 
-// Returns whether (factor1 * factor2) > (high << DIGIT_BITS) + low.
-bool ProductGreaterThan(bn_digit_t factor1, bn_digit_t factor2, bn_digit_t high,
-                        bn_digit_t low) {
-  bn_digit_t result_high;
-  bn_digit_t result_low = bn_digit_mul(factor1, factor2, &result_high);
-  return result_high > high || (result_high == high && result_low > low);
+#undef _BN_AVX2
+#undef _BN_IFMA
+
+// 2 products of 2^56 per row fit 64 rows between normalizations, 4 halves
+// of 2^52 per row about a thousand rows. The products of mul take one
+// column of m products, the same bounds.
+static const _bn_lanes_t _BN_LANES_AVX2 = {BN_BATCH_AVX2, 4, 28, 255,
+                                           _bn_lanes_mont_mul_avx2,
+                                           _bn_lanes_mul_avx2};
+static const _bn_lanes_t _BN_LANES_IFMA = {BN_BATCH_IFMA, 8, 52, 1000,
+                                           _bn_lanes_mont_mul_ifma,
+                                           _bn_lanes_mul_ifma};
+
+// Returns true if the OS saves the register state of the XCR0 bits in mask.
+static bool _bn_cpu_xsave(unsigned mask) {
+  unsigned int eax, ebx, ecx, edx;
+  __cpuid(1, eax, ebx, ecx, edx);
+  (void)eax, (void)ebx, (void)edx;
+  if (!(ecx & (1u << 27))) // OSXSAVE
+    return false;
+  unsigned int lo, hi;
+  __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+  (void)hi;
+  return (lo & mask) == mask;
 }
 
-bn_err_t bn_div(bn_t *Q, bn_t *R, const bn_t *A, const bn_t *B) {
-  BN_ASSERT(A != NULL);
-  BN_ASSERT(A->size > 0);
-  BN_ASSERT(B != NULL);
-  BN_ASSERT(B->size > 0);
+// CPUID.(EAX=7, ECX=0):EBX
+static unsigned _bn_cpu_leaf7_ebx(void) {
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid_max(0, NULL) < 7)
+    return 0;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  (void)eax, (void)ecx, (void)edx;
+  return ebx;
+}
+#endif // BN_HAVE_X86_64_ASM
 
-  if (Q != NULL) Q->size = 0ul;
-  if (R != NULL) R->size = 0ul;
+// Returns true if the CPU supports the BN_BATCH_AVX2 kernels.
+static bool _bn_cpu_has_avx2(void) {
+#if BN_HAVE_X86_64_ASM
+  // EBX bit 5 is AVX2, XCR0 bits 1 and 2 the SSE and AVX state.
+  return (_bn_cpu_leaf7_ebx() & (1u << 5)) && _bn_cpu_xsave(0x6);
+#else
+  return false;
+#endif
+}
 
-  if (A->size < B->size) {
-    if (Q != NULL) bn_append_digit(Q, 0ul);
-    return BN_OK;
-  }
+// Returns true if the CPU supports the BN_BATCH_IFMA kernels.
+static bool _bn_cpu_has_ifma(void) {
+#if BN_HAVE_X86_64_ASM
+  // EBX bit 16 is AVX512F, bit 21 AVX512IFMA, XCR0 bits 5 to 7 the AVX-512
+  // state.
+  const unsigned ebx = _bn_cpu_leaf7_ebx();
+  return (ebx & (1u << 16)) && (ebx & (1u << 21)) && _bn_cpu_xsave(0xE6);
+#else
+  return false;
+#endif
+}
 
-  if (B->size == 1ul) {
-    bn_digit_t r;
-    bn_err_t res = bn_div_single(Q, &r, A, B->digits[0]);
-    if (R != NULL) bn_append_digit(R, r);
-    if (Q != NULL) Q->sign *= B->sign;
-    return res;
+static bn_batch_t _bn_batch_selected = BN_BATCH_AUTO;
+
+bn_batch_t bn_select_batch(bn_batch_t batch) {
+  if (batch == BN_BATCH_AUTO) {
+    const char *env = getenv("BN_BATCH");
+    if (env != NULL && strcmp(env, "scalar") == 0)
+      batch = BN_BATCH_SCALAR;
+    else if (env != NULL && strcmp(env, "avx2") == 0)
+      batch = BN_BATCH_AVX2;
+    else if (env != NULL && strcmp(env, "ifma") == 0)
+      batch = BN_BATCH_IFMA;
+    // 4 lanes of 28-bit limbs are about as fast as the ADX kernels, and
+    // only beat the portable ones.
+    else if (_bn_cpu_has_ifma())
+      batch = BN_BATCH_IFMA;
+    else if (_bn_cpu_has_avx2() && bn_get_kernels() != BN_KERNELS_ADX)
+      batch = BN_BATCH_AVX2;
+    else
+      batch = BN_BATCH_SCALAR;
   }
+  if ((batch == BN_BATCH_AVX2 && !_bn_cpu_has_avx2()) ||
+      (batch == BN_BATCH_IFMA && !_bn_cpu_has_ifma()))
+    batch = BN_BATCH_SCALAR;
+  _BN_ATOMIC_STORE_RELAXED(&_bn_batch_selected, batch);
+  return batch;
+}
 
-  const size_t n = B->size;
-  const size_t m = A->size - n;
+bn_batch_t bn_get_batch(void) {
+  bn_batch_t batch = _BN_ATOMIC_LOAD_RELAXED(&_bn_batch_selected);
+  return batch == BN_BATCH_AUTO ? bn_select_batch(BN_BATCH_AUTO) : batch;
+}
 
-  // In each iteration, {qhatv} holds {divisor} * {current quotient digit}.
-  // "v" is the book's name for {divisor}, "qhat" the current quotient digit.
-  bn_t qhatv;
+#if BN_HAVE_X86_64_ASM
+// Returns the lane kernels of the selected batch kernels, NULL for scalar.
+static const _bn_lanes_t *_bn_lanes(void) {
+  switch (bn_get_batch()) {
+  case BN_BATCH_AVX2:
+    return &_BN_LANES_AVX2;
+  case BN_BATCH_IFMA:
+    return &_BN_LANES_IFMA;
+  default:
+    return NULL;
+  }
+}
 
-  // D1.
-  // Left-shift inputs so that the divisor's MSB is set. This is necessary
-  // to prevent the digit-wise divisions (see digit_div call below) from
-  // overflowing (they take a two digits wide input, and return a one digit
-  // result).
-  bn_t b_normalized = {0}, U = {0};
-  int leading_zeros = bn_digit_count_leading_zeros(B->digits[B->size-1]);
-  bn_lshift(&b_normalized, B, leading_zeros);
-  bn_lshift(&U, A, leading_zeros);
-
-  // D2.
-  // Iterate over the dividend's digits (like the "grad school" algorithm).
-  // {vn1} is the divisor's most significant digit.
-  bn_digit_t vn1 = b_normalized.digits[n-1];
-  for (int j = m; j >= 0; j--) {
-    // D3.
-    // Estimate the current iteration's quotient digit (see Knuth for details).
-    // {qhat} is the current quotient digit.
-    bn_digit_t qhat = (bn_digit_t)0 - 1;
-    // {ujn} is the dividend's most significant remaining digit.
-    bn_digit_t ujn = U.digits[j + n];
-    if (ujn != vn1) {
-      // {rhat} is the current iteration's remainder.
-      bn_digit_t rhat = 0;
-      // Estimate the current quotient digit by dividing the most significant
-      // digits of dividend and divisor. The result will not be too small,
-      // but could be a bit too large.
-      qhat = bn_digit_div(ujn, U.digits[j + n - 1], vn1, &rhat);
-      // Decrement the quotient estimate as needed by looking at the next
-      // digit, i.e. by testing whether
-      // qhat * v_{n-2} > (rhat << kDigitBits) + u_{j+n-2}.
-      bn_digit_t vn2 = b_normalized.digits[n - 2];
-      bn_digit_t ujn2 = U.digits[j + n - 2];
-      while (ProductGreaterThan(qhat, vn2, rhat, ujn2)) {
-        qhat--;
-        bn_digit_t prev_rhat = rhat;
-        rhat += vn1;
-        // v[n-1] >= 0, so this tests for overflow.
-        if (rhat < prev_rhat)
-          break;
-      }
+// Lane l of the lane vector {vp, m} = {ap, an}, zero padded.
+static void _bn_lanes_load(uint64_t *vp, size_t m, const _bn_lanes_t *L,
+                           unsigned l, const bn_digit_t *ap, size_t an) {
+  const unsigned bits = L->bits;
+  const uint64_t mask = ((uint64_t)1 << bits) - 1;
+  for (size_t j = 0; j < m; ++j) {
+    const size_t d = j * bits / DIGIT_BITS;
+    const unsigned s = j * bits % DIGIT_BITS;
+    uint64_t v = 0;
+    if (d < an) {
+      v = ap[d] >> s;
+      if (s + bits > DIGIT_BITS && d + 1 < an)
+        v |= ap[d + 1] << (DIGIT_BITS - s);
     }
+    vp[j * L->lanes + l] = v & mask;
+  }
+}
 
-    // D4.
-    // Multiply the divisor with the current quotient digit, and subtract
-    // it from the dividend. If there was "borrow", then the quotient digit
-    // was one too high, so we must correct it and undo one subtraction of
-    // the (shifted) divisor.
-    if (qhat == 0) {
-      qhatv.size = 0;
-    } else {
-      bn_mul_single(&qhatv, &b_normalized, qhat);
-    }
-    bn_t Upj = {.sign=U.sign, .size=U.size-j, .capacity=U.capacity-j, .digits=&U.digits[j]};
-    bn_digit_t c = bn_sub_and_return_borrow_inplace(&Upj, &qhatv);
-    if (c != 0) {
-      c = bn_add_and_return_carry_inplace(&Upj, &b_normalized);
-      bn_set_digit(&U, j+n, (U.size > j+n ? U.digits[j+n] : 0) + c);
-      qhat--;
+// {rp, rn} = lane l of the normalized lane vector {vp, m}, which fits.
+static void _bn_lanes_store(bn_digit_t *rp, size_t rn, const uint64_t *vp,
+                            size_t m, const _bn_lanes_t *L, unsigned l) {
+  const unsigned bits = L->bits;
+  // acc holds the have < DIGIT_BITS bits not stored yet.
+  bn_digit_t acc = 0;
+  unsigned have = 0;
+  size_t i = 0;
+  for (size_t j = 0; j < m && i < rn; ++j) {
+    const uint64_t v = vp[j * L->lanes + l];
+    acc |= (bn_digit_t)v << have;
+    have += bits;
+    if (have >= DIGIT_BITS) {
+      rp[i++] = acc;
+      have -= DIGIT_BITS;
+      acc = have > 0 ? (bn_digit_t)(v >> (bits - have)) : 0;
     }
+  }
+  for (; i < rn; acc = 0)
+    rp[i++] = acc;
+}
 
-    if (Q != NULL) {
-      bn_set_digit(Q, j, qhat);
+// Limbs of the lane vectors for a modulus of the given bits, with 4N < R
+static size_t _bn_lanes_mont_limbs(const _bn_lanes_t *L, size_t bits) {
+  return (bits + 2 + L->bits - 1) / L->bits;
+}
+
+// Z[i] = X[i]^E[i] mod N[i] for the count <= L indices i of idx, all with odd
+// moduli and lane vectors of m limbs. Unused lanes repeat the last index.
+static void _bn_modexp_lanes(const _bn_lanes_t *L, bn_t *Z, const bn_t *X,
+                             const bn_t *E, const bn_t *N, const size_t *idx,
+                             size_t count, size_t m) {
+  const unsigned lanes = L->lanes;
+  const size_t V = m * lanes;
+  const size_t pn = 2 * L->bits * m / DIGIT_BITS + 1;
+  size_t ebits = 0, maxn = 0, itch = 0;
+  for (size_t l = 0; l < count; ++l) {
+    const bn_t *e = &E[idx[l]];
+    BN_ASSERT(e->sign > 0);
+    const size_t en = bn_mpn_normalized_size(BN_DIGITS(e), e->size);
+    const bn_t *m = &N[idx[l]];
+    const size_t n = bn_mpn_normalized_size(BN_DIGITS(m), m->size);
+    ebits = _bn_max(ebits, _bn_mpn_bit_length(BN_DIGITS(e), en));
+    maxn = _bn_max(maxn, n);
+    itch = _bn_max(itch, pn - n + 1 + bn_mpn_div_qr_itch(pn, n));
+  }
+  // Fixed windows need all 2^w powers, sliding ones only the odd half.
+  const unsigned w = _bn_modexp_window_bits(ebits) < 5
+                         ? _bn_modexp_window_bits(ebits)
+                         : 5;
+
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  uint64_t *nv =
+      (uint64_t *)_bn_scratch_alloc(S, (6 + ((size_t)1 << w)) * V + lanes);
+  uint64_t *rr = nv + V;
+  uint64_t *unit = rr + V;
+  uint64_t *acc = unit + V;
+  uint64_t *g = acc + V;
+  uint64_t *t = g + V;
+  uint64_t *table = t + V;
+  uint64_t *ninv = table + ((size_t)1 << w) * V;
+  bn_digit_t *p = _bn_scratch_alloc(S, pn + maxn + itch);
+  bn_digit_t *r = p + pn;
+  bn_digit_t *q = r + maxn;
+
+  // N, R^2 mod N and X mod N of every lane, computed with digits
+  const uint64_t mask = ((uint64_t)1 << L->bits) - 1;
+  for (unsigned l = 0; l < lanes; ++l) {
+    const size_t i = idx[l < count ? l : count - 1];
+    const bn_digit_t *np = BN_DIGITS(&N[i]);
+    const size_t n = bn_mpn_normalized_size(np, N[i].size);
+    _bn_lanes_load(nv, m, L, l, np, n);
+    ninv[l] = -bn_digit_binvert(np[0]) & mask;
+    bn_mpn_zero(p, pn);
+    p[pn - 1] = (bn_digit_t)1 << (2 * L->bits * m % DIGIT_BITS);
+    bn_mpn_div_qr(q, r, p, pn, np, n, q + pn - n + 1);
+    _bn_lanes_load(rr, m, L, l, r, n);
+    _bn_mod_mpn(r, &X[i], np, n);
+    _bn_lanes_load(g, m, L, l, r, n);
+  }
+  memset(unit, 0, V * sizeof(uint64_t));
+  for (unsigned l = 0; l < lanes; ++l)
+    unit[l] = 1;
+
+  // table[k] = X^k R mod N, table[0] = R mod N
+  L->mont_mul(table, rr, unit, nv, ninv, m, t);
+  L->mont_mul(table + V, g, rr, nv, ninv, m, t);
+  for (size_t k = 2; k < ((size_t)1 << w); ++k)
+    L->mont_mul(table + k * V, table + (k - 1) * V, table + V, nv, ninv, m, t);
+
+  // Fixed windows of w bits from the top, the same for all lanes. Shorter
+  // exponents start with zero windows, multiplications by R mod N.
+  const size_t windows = (ebits + w - 1) / w;
+  memcpy(acc, table, V * sizeof(uint64_t));
+  for (size_t win = windows; win-- > 0;) {
+    if (win + 1 < windows)
+      for (unsigned s = 0; s < w; ++s)
+        L->mont_mul(acc, acc, acc, nv, ninv, m, t);
+    for (unsigned l = 0; l < lanes; ++l) {
+      const bn_t *e = &E[idx[l < count ? l : count - 1]];
+      const size_t en = bn_mpn_normalized_size(BN_DIGITS(e), e->size);
+      const size_t ebl = _bn_mpn_bit_length(BN_DIGITS(e), en);
+      size_t k = 0;
+      for (unsigned s = w; s-- > 0;) {
+        const size_t bit = win * w + s;
+        k = 2 * k + (bit < ebl && _bn_mpn_tstbit(BN_DIGITS(e), bit));
+      }
+      for (size_t j = 0; j < m; ++j)
+        g[j * lanes + l] = table[k * V + j * lanes + l];
     }
+    if (win + 1 < windows)
+      L->mont_mul(acc, acc, g, nv, ninv, m, t);
+    else
+      memcpy(acc, g, V * sizeof(uint64_t));
   }
-
-  if (Q != NULL) {
-    bn_normalize(Q);
-    Q->sign = A->sign * B->sign;
+  L->mont_mul(acc, acc, unit, nv, ninv, m, t);
+
+  // Out of Montgomery form the result is at most N.
+  for (unsigned l = 0; l < count; ++l) {
+    const size_t i = idx[l];
+    const size_t n = bn_mpn_normalized_size(BN_DIGITS(&N[i]), N[i].size);
+    _bn_lanes_store(r, n, acc, m, L, l);
+    if (bn_mpn_cmp(r, BN_DIGITS(&N[i]), n) >= 0)
+      bn_mpn_sub_n(r, r, BN_DIGITS(&N[i]), n);
+    _bn_from_mpn(&Z[i], r, n);
   }
+  _bn_scratch_release(S, mark);
+}
 
-  if (R != NULL) {
-    bn_rshift(R, &U, leading_zeros);
-    bn_normalize(R);
+// Z[i] = X[i] Y[i] for the count <= L indices i of idx, all with nonzero
+// operands of at most m limbs.
+static void _bn_mul_lanes(const _bn_lanes_t *L, bn_t *Z, const bn_t *X,
+                          const bn_t *Y, const size_t *idx, size_t count,
+                          size_t m) {
+  const unsigned lanes = L->lanes;
+  const size_t V = m * lanes;
+  bn_scratch_t *S = _bn_scratch();
+  const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+  uint64_t *a = (uint64_t *)_bn_scratch_alloc(S, 4 * V);
+  uint64_t *b = a + V;
+  uint64_t *r = b + V;
+  memset(a, 0, 2 * V * sizeof(uint64_t));
+  for (unsigned l = 0; l < count; ++l) {
+    const size_t i = idx[l];
+    _bn_lanes_load(a, m, L, l, BN_DIGITS(&X[i]), X[i].size);
+    _bn_lanes_load(b, m, L, l, BN_DIGITS(&Y[i]), Y[i].size);
   }
-
-  bn_free(&b_normalized);
-  bn_free(&U);
-  bn_free(&qhatv);
-  return BN_OK;
+  L->mul(r, a, b, m);
+  for (unsigned l = 0; l < count; ++l) {
+    const size_t i = idx[l];
+    const size_t zn = X[i].size + Y[i].size;
+    const int sign = X[i].sign * Y[i].sign;
+    bn_resize(&Z[i], zn);
+    _bn_lanes_store(BN_DIGITS(&Z[i]), zn, r, 2 * m, L, l);
+    Z[i].sign = sign;
+    bn_normalize(&Z[i]);
+  }
+  _bn_scratch_release(S, mark);
 }
 
-bn_err_t bn_lshift(bn_t *Z, const bn_t *X, size_t shift) {
-  BN_ASSERT(shift < DIGIT_BITS);
-  if (shift == 0) return bn_clone(Z, X);
-
-  bn_digit_t carry = 0;
-  size_t i = 0;
-  for (; i < X->size; ++i) {
-    bn_digit_t d = X->digits[i];
-    bn_append_digit(Z, (d << shift) | carry);
-    carry = d >> (DIGIT_BITS - shift);
+// An operation of the batch: its lane vector size and index
+typedef struct {
+  size_t m, i;
+} _bn_batch_item_t;
+
+static int _bn_batch_item_cmp(const void *a, const void *b) {
+  const _bn_batch_item_t *x = a, *y = b;
+  if (x->m != y->m)
+    return x->m < y->m ? -1 : 1;
+  return x->i < y->i ? -1 : x->i > y->i;
+}
+#endif // BN_HAVE_X86_64_ASM
+
+bn_err_t bn_mul_batch(bn_t *Z, const bn_t *X, const bn_t *Y, size_t count) {
+  BN_ASSERT(count == 0 || (Z != NULL && X != NULL && Y != NULL));
+#if BN_HAVE_X86_64_ASM
+  const _bn_lanes_t *L = _bn_lanes();
+  if (L != NULL && count > 1) {
+    bn_scratch_t *S = _bn_scratch();
+    const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+    _bn_batch_item_t *items = (_bn_batch_item_t *)_bn_scratch_alloc(
+        S, count * sizeof(_bn_batch_item_t) / sizeof(bn_digit_t));
+    size_t *idx = (size_t *)_bn_scratch_alloc(S, L->lanes);
+    // Products from the Karatsuba threshold on are better off with bn_mul.
+    size_t batched = 0;
+    for (size_t i = 0; i < count; ++i) {
+      const size_t an = bn_mpn_normalized_size(BN_DIGITS(&X[i]), X[i].size);
+      const size_t bn = bn_mpn_normalized_size(BN_DIGITS(&Y[i]), Y[i].size);
+      const size_t k = _bn_max(an, bn);
+      const size_t m = (k * DIGIT_BITS + L->bits - 1) / L->bits;
+      if (an == 0 || bn == 0 || k < BN_BATCH_MUL_THRESHOLD ||
+          k >= BN_KARATSUBA_THRESHOLD || m > L->max_limbs) {
+        bn_mul(&Z[i], &X[i], &Y[i]);
+        continue;
+      }
+      items[batched].m = m;
+      items[batched].i = i;
+      batched++;
+    }
+    qsort(items, batched, sizeof(_bn_batch_item_t), _bn_batch_item_cmp);
+    for (size_t s = 0; s < batched;) {
+      // Up to L items of the same size
+      size_t e = s;
+      while (e < batched && e - s < L->lanes && items[e].m == items[s].m) {
+        idx[e - s] = items[e].i;
+        e++;
+      }
+      if (e - s == 1)
+        bn_mul(&Z[idx[0]], &X[idx[0]], &Y[idx[0]]);
+      else
+        _bn_mul_lanes(L, Z, X, Y, idx, e - s, items[s].m);
+      s = e;
+    }
+    _bn_scratch_release(S, mark);
+    return BN_OK;
   }
-  if (carry > 0) {
-    bn_append_digit(Z, carry);
+#endif
+  for (size_t i = 0; i < count; ++i) {
+    const bn_err_t err = bn_mul(&Z[i], &X[i], &Y[i]);
+    if (err != BN_OK)
+      return err;
   }
   return BN_OK;
 }
 
-bn_err_t bn_rshift(bn_t *Z, const bn_t *X, size_t shift) {
-  BN_ASSERT(shift < DIGIT_BITS);
-  if (shift == 0) return bn_clone(Z, X);
-
-  bn_digit_t carry = X->digits[0] >> shift;
-  for (size_t i = 0; i < X->size-1; ++i) {
-    bn_digit_t d = X->digits[i+1];
-    bn_append_digit(Z, (d << (DIGIT_BITS - shift)) | carry);
-    carry = d >> shift;
+bn_err_t bn_modexp_batch(bn_t *Z, const bn_t *X, const bn_t *E, const bn_t *N,
+                         size_t count) {
+  BN_ASSERT(count == 0 ||
+            (Z != NULL && X != NULL && E != NULL && N != NULL));
+#if BN_HAVE_X86_64_ASM
+  const _bn_lanes_t *L = _bn_lanes();
+  if (L != NULL && count > 1) {
+    bn_scratch_t *S = _bn_scratch();
+    const _bn_scratch_mark_t mark = _bn_scratch_mark(S);
+    _bn_batch_item_t *items = (_bn_batch_item_t *)_bn_scratch_alloc(
+        S, count * sizeof(_bn_batch_item_t) / sizeof(bn_digit_t));
+    size_t *idx = (size_t *)_bn_scratch_alloc(S, L->lanes);
+    // Even moduli have no Montgomery form.
+    size_t batched = 0;
+    for (size_t i = 0; i < count; ++i) {
+      BN_ASSERT(N[i].sign > 0);
+      const size_t n = bn_mpn_normalized_size(BN_DIGITS(&N[i]), N[i].size);
+      BN_ASSERT(n > 0);
+      const size_t m =
+          _bn_lanes_mont_limbs(L, _bn_mpn_bit_length(BN_DIGITS(&N[i]), n));
+      if (!(BN_DIGITS(&N[i])[0] & 1) || m > L->max_limbs) {
+        bn_modexp(&Z[i], &X[i], &E[i], &N[i]);
+        continue;
+      }
+      items[batched].m = m;
+      items[batched].i = i;
+      batched++;
+    }
+    qsort(items, batched, sizeof(_bn_batch_item_t), _bn_batch_item_cmp);
+    for (size_t s = 0; s < batched;) {
+      size_t e = s;
+      while (e < batched && e - s < L->lanes && items[e].m == items[s].m) {
+        idx[e - s] = items[e].i;
+        e++;
+      }
+      if (e - s == 1)
+        bn_modexp(&Z[idx[0]], &X[idx[0]], &E[idx[0]], &N[idx[0]]);
+      else
+        _bn_modexp_lanes(L, Z, X, E, N, idx, e - s, items[s].m);
+      s = e;
+    }
+    _bn_scratch_release(S, mark);
+    return BN_OK;
   }
-  if (carry > 0) {
-    bn_append_digit(Z, carry);
+#endif
+  for (size_t i = 0; i < count; ++i) {
+    const bn_err_t err = bn_modexp(&Z[i], &X[i], &E[i], &N[i]);
+    if (err != BN_OK)
+      return err;
   }
   return BN_OK;
 }
@@ -1091,6 +8136,7 @@ bn_err_t bn_rshift(bn_t *Z, const bn_t *X, size_t shift) {
 #define add bn_add
 #define sub bn_sub
 #define mul bn_mul
+#define sqr bn_sqr
 #define div bn_div
 
 #endif // BN_STRIP_PREFIX_GUARD
@@ -12,8 +12,8 @@ int main(void) {
   assert(bn_add(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(1ul, c.size, "%zu");
   BN_ASSERT_EQ(1, c.sign, "%d");
-  BN_ASSERT_EQ(3000ul, c.digits[0], "%zu");
-  assert(c.digits[0] == 3000);
+  BN_ASSERT_EQ(3000ul, BN_DIGITS(&c)[0], "%zu");
+  assert(BN_DIGITS(&c)[0] == 3000);
   a.size = 0;
   b.size = 0;
   c.size = 0;
@@ -27,8 +27,8 @@ int main(void) {
   assert(bn_add(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(2ul, c.size, "%zu");
   BN_ASSERT_EQ(1, c.sign, "%d");
-  BN_ASSERT_EQ(4772693935078244352ul, c.digits[0], "%zu");
-  BN_ASSERT_EQ(1626303ul, c.digits[1], "%zu");
+  BN_ASSERT_EQ(4772693935078244352ul, BN_DIGITS(&c)[0], "%zu");
+  BN_ASSERT_EQ(1626303ul, BN_DIGITS(&c)[1], "%zu");
   a.size = 0;
   b.size = 0;
   c.size = 0;
@@ -38,7 +38,7 @@ int main(void) {
   assert(bn_sub(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(1ul, c.size, "%zu");
   BN_ASSERT_EQ(1, c.sign, "%d");
-  BN_ASSERT_EQ(1000ul, c.digits[0], "%zu");
+  BN_ASSERT_EQ(1000ul, BN_DIGITS(&c)[0], "%zu");
   a.size = 0;
   b.size = 0;
   c.size = 0;
@@ -48,7 +48,7 @@ int main(void) {
   assert(bn_sub(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(1ul, c.size, "%zu");
   BN_ASSERT_EQ(-1, c.sign, "%d");
-  BN_ASSERT_EQ(1000ul, c.digits[0], "%zu");
+  BN_ASSERT_EQ(1000ul, BN_DIGITS(&c)[0], "%zu");
   a.size = 0;
   b.size = 0;
   c.size = 0;
@@ -58,7 +58,7 @@ int main(void) {
   assert(bn_sub(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(1, c.sign, "%d");
   BN_ASSERT_EQ(1ul, c.size, "%zu");
-  BN_ASSERT_EQ(3000ul, c.digits[0], "%zu");
+  BN_ASSERT_EQ(3000ul, BN_DIGITS(&c)[0], "%zu");
   a.size = 0;
   b.size = 0;
   c.size = 0;
@@ -68,7 +68,7 @@ int main(void) {
   assert(bn_add(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(1, c.sign, "%d");
   BN_ASSERT_EQ(1ul, c.size, "%zu");
-  BN_ASSERT_EQ(1000ul, c.digits[0], "%zu");
+  BN_ASSERT_EQ(1000ul, BN_DIGITS(&c)[0], "%zu");
   a.size = 0;
   b.size = 0;
   c.size = 0;
@@ -78,7 +78,7 @@ int main(void) {
   assert(bn_add(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(-1, c.sign, "%d");
   BN_ASSERT_EQ(1ul, c.size, "%zu");
-  BN_ASSERT_EQ(3000ul, c.digits[0], "%zu");
+  BN_ASSERT_EQ(3000ul, BN_DIGITS(&c)[0], "%zu");
   a.size = 0;
   b.size = 0;
   c.size = 0;
@@ -88,7 +88,7 @@ int main(void) {
   assert(bn_add(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(-1, c.sign, "%d");
   BN_ASSERT_EQ(1ul, c.size, "%zu");
-  BN_ASSERT_EQ(1000ul, c.digits[0], "%zu");
+  BN_ASSERT_EQ(1000ul, BN_DIGITS(&c)[0], "%zu");
   a.size = 0;
   b.size = 0;
   c.size = 0;
@@ -99,7 +99,7 @@ int main(void) {
   assert(bn_add(&a, &a, &b) == BN_OK);
   BN_ASSERT_EQ(1, a.sign, "%d");
   BN_ASSERT_EQ(1ul, a.size, "%zu");
-  BN_ASSERT_EQ(3000ul, a.digits[0], "%zu");
+  BN_ASSERT_EQ(3000ul, BN_DIGITS(&a)[0], "%zu");
   a.size = 0;
   b.size = 0;
   c.size = 0;
@@ -110,7 +110,7 @@ int main(void) {
   assert(bn_sub(&a, &a, &b) == BN_OK);
   BN_ASSERT_EQ(1, a.sign, "%d");
   BN_ASSERT_EQ(1ul, a.size, "%zu");
-  BN_ASSERT_EQ(1000ul, a.digits[0], "%zu");
+  BN_ASSERT_EQ(1000ul, BN_DIGITS(&a)[0], "%zu");
   a.size = 0;
   b.size = 0;
   c.size = 0;
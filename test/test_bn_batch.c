@@ -0,0 +1,113 @@
+#include <assert.h>
+
+// Multiply products of every size in lanes.
+#define BN_BATCH_MUL_THRESHOLD 1
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0x510E527FADE682D1ull
+#include "test_util.h"
+
+#define COUNT 37
+
+// Checks bn_mul_batch against bn_mul for operands of up to {max} digits,
+// every fourth of them of one size.
+static void check_mul_batch(size_t max) {
+  bn_t x[COUNT] = {{0}}, y[COUNT] = {{0}}, z[COUNT] = {{0}}, r = {0};
+  for (size_t i = 0; i < COUNT; ++i) {
+    const size_t xn = i % 4 ? 1 + rand_digit() % max : max;
+    rand_bn(&x[i], xn, rand_digit() % 2 ? 1 : -1);
+    rand_bn(&y[i], i % 4 ? 1 + rand_digit() % max : xn, 1);
+  }
+  // Zero operands, and one with a zero top digit
+  bn_from_int(&x[3], 0);
+  bn_append_digit(&y[5], 0);
+
+  assert(bn_mul_batch(z, x, y, COUNT) == BN_OK);
+  for (size_t i = 0; i < COUNT; ++i) {
+    assert(bn_mul(&r, &x[i], &y[i]) == BN_OK);
+    assert(bn_cmp(&r, &z[i]) == 0);
+  }
+  // in-place
+  assert(bn_mul_batch(x, x, y, COUNT) == BN_OK);
+  for (size_t i = 0; i < COUNT; ++i)
+    assert(bn_cmp(&x[i], &z[i]) == 0);
+
+  for (size_t i = 0; i < COUNT; ++i) {
+    bn_free(&x[i]);
+    bn_free(&y[i]);
+    bn_free(&z[i]);
+  }
+  bn_free(&r);
+}
+
+// Checks bn_modexp_batch against bn_modexp for moduli of up to {max} digits.
+static void check_modexp_batch(size_t max) {
+  bn_t x[COUNT] = {{0}}, e[COUNT] = {{0}}, n[COUNT] = {{0}},
+       z[COUNT] = {{0}}, r = {0};
+  for (size_t i = 0; i < COUNT; ++i) {
+    // Runs of equal sizes, some of them differing in the top bits only
+    const size_t nn = i % 3 ? max : 1 + rand_digit() % max;
+    rand_bn(&n[i], nn, 1);
+    if (i % 5 == 1)
+      BN_DIGITS(&n[i])[nn - 1] >>= rand_digit() % DIGIT_BITS;
+    if (bn_mpn_normalized_size(BN_DIGITS(&n[i]), nn) == 0)
+      BN_DIGITS(&n[i])[0] = 1;
+    if (i % 7 != 6)
+      BN_DIGITS(&n[i])[0] |= 1;
+    rand_bn(&x[i], 1 + rand_digit() % (2 * max), rand_digit() % 2 ? 1 : -1);
+    rand_bn(&e[i], 1 + rand_digit() % 3, 1);
+  }
+  // X^0 = 1, powers of zero and modulo 1
+  bn_from_int(&e[4], 0);
+  bn_from_int(&x[8], 0);
+  bn_from_int(&n[10], 1);
+
+  assert(bn_modexp_batch(z, x, e, n, COUNT) == BN_OK);
+  for (size_t i = 0; i < COUNT; ++i) {
+    assert(bn_modexp(&r, &x[i], &e[i], &n[i]) == BN_OK);
+    assert(bn_cmp(&r, &z[i]) == 0);
+  }
+  // in-place on the modulus
+  assert(bn_modexp_batch(n, x, e, n, COUNT) == BN_OK);
+  for (size_t i = 0; i < COUNT; ++i)
+    assert(bn_cmp(&n[i], &z[i]) == 0);
+
+  for (size_t i = 0; i < COUNT; ++i) {
+    bn_free(&x[i]);
+    bn_free(&e[i]);
+    bn_free(&n[i]);
+    bn_free(&z[i]);
+  }
+  bn_free(&r);
+}
+
+int main(void) {
+  // Explicit selection falls back to the scalar kernels if unsupported.
+  assert(bn_select_batch(BN_BATCH_SCALAR) == BN_BATCH_SCALAR);
+  assert(bn_get_batch() == BN_BATCH_SCALAR);
+  bn_batch_t ifma = bn_select_batch(BN_BATCH_IFMA);
+  assert(ifma == BN_BATCH_IFMA || ifma == BN_BATCH_SCALAR);
+  assert(bn_get_batch() == ifma);
+
+  for (int batch = BN_BATCH_SCALAR; batch <= BN_BATCH_IFMA; ++batch) {
+    bn_select_batch((bn_batch_t)batch);
+    // Single products and powers, and the empty batch
+    check_mul_batch(1);
+    check_modexp_batch(1);
+    assert(bn_mul_batch(NULL, NULL, NULL, 0) == BN_OK);
+    // Products from a few digits to beyond the Karatsuba threshold
+    check_mul_batch(4);
+    check_mul_batch(BN_KARATSUBA_THRESHOLD - 1);
+    check_mul_batch(2 * BN_KARATSUBA_THRESHOLD);
+    // Moduli up to RSA sizes
+    check_modexp_batch(2);
+    check_modexp_batch(5);
+    check_modexp_batch(16);
+    check_modexp_batch(40);
+  }
+
+  bn_select_batch(BN_BATCH_AUTO);
+  bn_scratch_free(NULL);
+  return 0;
+}
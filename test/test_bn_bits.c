@@ -0,0 +1,197 @@
+#include <assert.h>
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0x6A09E667F3BCC908ull
+#include "test_util.h"
+
+// Random number of up to {size} digits and random sign, with runs of zero
+// and all-ones digits
+static void rand_bn_runs(bn_t *bn, size_t size) {
+  bn_from_int(bn, 0);
+  bn_resize(bn, 1 + rand_digit() % size);
+  for (size_t i = 0; i < bn->size; ++i) {
+    const bn_digit_t r = rand_digit() % 4;
+    BN_DIGITS(bn)[i] = r == 0 ? 0 : r == 1 ? ~(bn_digit_t)0 : rand_digit();
+  }
+  bn_normalize(bn);
+  if (rand_digit() % 2 && bn_mpn_normalized_size(BN_DIGITS(bn), bn->size) > 0)
+    bn->sign = -1;
+}
+
+static void from_i64(bn_t *bn, int64_t v) {
+  bn_from_int(bn, 0);
+  bn_add_single(bn, bn, (bn_digit_t)(v < 0 ? -(uint64_t)v : (uint64_t)v));
+  if (v < 0)
+    bn->sign = -1;
+}
+
+static void check_i64(const bn_t *bn, int64_t v) {
+  bn_t t = {0};
+  from_i64(&t, v);
+  assert(bn_cmp(bn, &t) == 0);
+  bn_free(&t);
+}
+
+int main(void) {
+  bn_t x = {0}, y = {0}, z = {0}, a = {0}, b = {0};
+
+  // Against the two's complement of the machine, for both signs
+  for (int i = 0; i < 5000; ++i) {
+    const int64_t u = (int64_t)rand_digit() >> (rand_digit() % 64);
+    const int64_t v = (int64_t)rand_digit() >> (rand_digit() % 64);
+    from_i64(&x, u);
+    from_i64(&y, v);
+    assert(bn_and(&z, &x, &y) == BN_OK);
+    check_i64(&z, u & v);
+    assert(bn_or(&z, &x, &y) == BN_OK);
+    check_i64(&z, u | v);
+    assert(bn_xor(&z, &x, &y) == BN_OK);
+    check_i64(&z, u ^ v);
+    assert(bn_not(&z, &x) == BN_OK);
+    check_i64(&z, ~u);
+    for (size_t bit = 0; bit < 80; bit += 1 + rand_digit() % 7)
+      assert(bn_tstbit(&x, bit) == (bit < 64 ? (u >> bit & 1) : u < 0));
+    const size_t start = rand_digit() % 70;
+    size_t first0 = SIZE_MAX, first1 = SIZE_MAX;
+    for (size_t bit = start; bit < 64 && first0 == SIZE_MAX; ++bit)
+      if (!(u >> bit & 1))
+        first0 = bit;
+    for (size_t bit = start; bit < 64 && first1 == SIZE_MAX; ++bit)
+      if (u >> bit & 1)
+        first1 = bit;
+    if (first0 == SIZE_MAX && u >= 0)
+      first0 = start < 64 ? 64 : start;
+    if (first1 == SIZE_MAX && u < 0)
+      first1 = start < 64 ? 64 : start;
+    assert(bn_scan0(&x, start) == first0);
+    assert(bn_scan1(&x, start) == first1);
+    if (u >= 0)
+      assert(bn_popcount(&x) == (size_t)bn_digit_popcount((bn_digit_t)u));
+    else
+      assert(bn_popcount(&x) == SIZE_MAX);
+  }
+
+  // Identities on numbers of many digits, also in place
+  for (int i = 0; i < 500; ++i) {
+    rand_bn_runs(&x, 40);
+    rand_bn_runs(&y, 40);
+    // X + Y = (X & Y) + (X | Y), X ^ Y = (X | Y) - (X & Y)
+    bn_and(&a, &x, &y);
+    bn_or(&b, &x, &y);
+    bn_add(&z, &a, &b);
+    bn_add(&a, &x, &y);
+    assert(bn_cmp(&z, &a) == 0);
+    bn_and(&a, &x, &y);
+    bn_sub(&z, &b, &a);
+    bn_clone(&a, &x);
+    bn_xor(&a, &a, &y);
+    assert(bn_cmp(&z, &a) == 0);
+    // ~(X & Y) = ~X | ~Y, and ~~X = X
+    bn_and(&z, &x, &y);
+    bn_not(&z, &z);
+    bn_not(&a, &x);
+    bn_not(&b, &y);
+    bn_or(&a, &a, &b);
+    assert(bn_cmp(&z, &a) == 0);
+    bn_not(&z, &x);
+    bn_not(&z, &z);
+    assert(bn_cmp(&z, &x) == 0);
+    // X & -X is the lowest set bit.
+    bn_clone(&a, &x);
+    a.sign = -x.sign;
+    bn_and(&z, &x, &a);
+    const size_t low = bn_scan1(&x, 0);
+    if (low == SIZE_MAX) {
+      assert(bn_popcount(&z) == 0);
+    } else {
+      assert(bn_popcount(&z) == 1 && bn_scan1(&z, 0) == low);
+      assert(bn_tstbit(&x, low) && bn_scan0(&z, 0) == (low == 0));
+    }
+    // Setting and clearing bits adds and subtracts their powers of two.
+    const size_t bit = rand_digit() % (45 * DIGIT_BITS);
+    const bool was = bn_tstbit(&x, bit);
+    bn_from_int(&b, 1);
+    bn_lshift(&b, &b, bit);
+    bn_clone(&z, &x);
+    assert(bn_setbit(&z, bit, !was) == BN_OK);
+    assert(bn_tstbit(&z, bit) == !was);
+    was ? bn_sub(&a, &x, &b) : bn_add(&a, &x, &b);
+    assert(bn_cmp(&z, &a) == 0);
+    bn_setbit(&z, bit, was);
+    assert(bn_cmp(&z, &x) == 0);
+    // Popcount and bit length of |X| against bn_tstbit
+    bn_abs(&a, &x);
+    size_t count = 0, length = 0;
+    for (size_t j = 0; j < 41 * DIGIT_BITS; ++j) {
+      if (bn_tstbit(&a, j)) {
+        count++;
+        length = j + 1;
+      }
+    }
+    assert(bn_popcount(&a) == count);
+    assert(bn_bitlength(&x) == length);
+  }
+
+  // Shifts of any distance against products and quotients by powers of two,
+  // rounded toward zero
+  for (int i = 0; i < 300; ++i) {
+    rand_bn_runs(&x, 20);
+    const size_t shift = rand_digit() % (25 * DIGIT_BITS);
+    bn_from_int(&b, 1);
+    for (size_t j = 0; j < shift; ++j)
+      bn_mul_single(&b, &b, 2);
+    assert(bn_lshift(&z, &x, shift) == BN_OK);
+    bn_mul(&a, &x, &b);
+    assert(bn_cmp(&z, &a) == 0);
+    assert(bn_rshift(&z, &z, shift) == BN_OK);
+    assert(bn_cmp(&z, &x) == 0);
+    assert(bn_rshift(&z, &x, shift) == BN_OK);
+    bn_div(&a, NULL, &x, &b);
+    assert(bn_cmp(&z, &a) == 0);
+    bn_clone(&z, &x);
+    bn_rshift(&z, &z, shift);
+    assert(bn_cmp(&z, &a) == 0);
+  }
+  bn_from_int(&x, 0);
+  bn_lshift(&x, &x, 1000);
+  assert(bn_bitlength(&x) == 0 && bn_scan1(&x, 0) == SIZE_MAX);
+  bn_from_int(&x, -5);
+  bn_rshift(&x, &x, 3);
+  assert(x.size == 1 && BN_DIGITS(&x)[0] == 0 && x.sign == 1);
+
+  // The digit span loops, of lengths around their steps of four digits
+  bn_digit_t ap[11] = {0}, bp[11] = {0}, rp[11] = {0};
+  for (size_t n = 0; n <= 11; ++n) {
+    for (size_t j = 0; j < n; ++j) {
+      ap[j] = rand_digit();
+      bp[j] = rand_digit();
+    }
+    size_t count = 0;
+    for (size_t j = 0; j < n; ++j)
+      count += bn_digit_popcount(ap[j]);
+    assert(bn_mpn_popcount(ap, n) == count);
+    bn_mpn_and_n(rp, ap, bp, n);
+    for (size_t j = 0; j < n; ++j)
+      assert(rp[j] == (ap[j] & bp[j]));
+    bn_mpn_ior_n(rp, ap, bp, n);
+    for (size_t j = 0; j < n; ++j)
+      assert(rp[j] == (ap[j] | bp[j]));
+    bn_mpn_xor_n(rp, ap, bp, n);
+    for (size_t j = 0; j < n; ++j)
+      assert(rp[j] == (ap[j] ^ bp[j]));
+    bn_mpn_com(rp, ap, n);
+    for (size_t j = 0; j < n; ++j)
+      assert(rp[j] == ~ap[j]);
+  }
+  assert(bn_digit_popcount(~(bn_digit_t)0) == (int)DIGIT_BITS);
+
+  bn_free(&x);
+  bn_free(&y);
+  bn_free(&z);
+  bn_free(&a);
+  bn_free(&b);
+  bn_scratch_free(NULL);
+  return 0;
+}
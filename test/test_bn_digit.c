@@ -0,0 +1,108 @@
+#include <assert.h>
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0xD1B54A32D192ED03ull
+#include "test_util.h"
+
+// Checks the selected digit primitives against the portable versions
+static void check_digits(bn_digit_t a, bn_digit_t b, bn_digit_t c) {
+  bn_digit_t r1, r2, c1, c2;
+
+  r1 = bn_digit_add2(a, b, &c1);
+  r2 = bn_digit_add2_portable(a, b, &c2);
+  BN_ASSERT_EQ(r2, r1, "%zu");
+  BN_ASSERT_EQ(c2, c1, "%zu");
+
+  r1 = bn_digit_add3(a, b, c, &c1);
+  r2 = bn_digit_add3_portable(a, b, c, &c2);
+  BN_ASSERT_EQ(r2, r1, "%zu");
+  BN_ASSERT_EQ(c2, c1, "%zu");
+
+  r1 = bn_digit_sub(a, b, &c1);
+  r2 = bn_digit_sub_portable(a, b, &c2);
+  BN_ASSERT_EQ(r2, r1, "%zu");
+  BN_ASSERT_EQ(c2, c1, "%zu");
+
+  r1 = bn_digit_sub2(a, b, c & 1, &c1);
+  r2 = bn_digit_sub2_portable(a, b, c & 1, &c2);
+  BN_ASSERT_EQ(r2, r1, "%zu");
+  BN_ASSERT_EQ(c2, c1, "%zu");
+
+  r1 = bn_digit_mul(a, b, &c1);
+  r2 = bn_digit_mul_portable(a, b, &c2);
+  BN_ASSERT_EQ(r2, r1, "%zu");
+  BN_ASSERT_EQ(c2, c1, "%zu");
+}
+
+// Checks the reciprocal divisions against bn_digit_div for a normalized d
+static void check_div_pre(bn_digit_t u2, bn_digit_t u1, bn_digit_t u0,
+                          bn_digit_t d1, bn_digit_t d0) {
+  d1 |= (bn_digit_t)1 << (DIGIT_BITS - 1);
+  bn_digit_t q1, q2, r1, r2, h, l, c;
+
+  // 2-by-1 with u1 < d1
+  u1 %= d1;
+  q1 = bn_digit_div(u1, u0, d1, &r1);
+  q2 = bn_digit_div_2by1(u1, u0, d1, bn_digit_reciprocal(d1), &r2);
+  BN_ASSERT_EQ(q1, q2, "%zu");
+  BN_ASSERT_EQ(r1, r2, "%zu");
+
+  // 3-by-2 with {u2, u1} < {d1, d0}: u = q * d + r with r < d
+  u2 %= d1;
+  q1 = bn_digit_div_3by2(u2, u1, u0, d1, d0,
+                         bn_digit_reciprocal_3by2(d1, d0), &r1, &r2);
+  assert(r1 < d1 || (r1 == d1 && r2 < d0));
+  l = bn_digit_mul(q1, d0, &h);
+  l = bn_digit_add2(l, r2, &c);
+  h += c;
+  bn_digit_t m = bn_digit_mul(q1, d1, &q2);
+  m = bn_digit_add3(m, h, r1, &c);
+  BN_ASSERT_EQ(u0, l, "%zu");
+  BN_ASSERT_EQ(u1, m, "%zu");
+  BN_ASSERT_EQ(u2, q2 + c, "%zu");
+}
+
+int main(void) {
+  const bn_digit_t max = ~(bn_digit_t)0;
+  bn_digit_t c;
+
+  // Base cases
+  BN_ASSERT_EQ(0ul, bn_digit_add2(max, 1, &c), "%zu");
+  BN_ASSERT_EQ(1ul, c, "%zu");
+  BN_ASSERT_EQ(max, bn_digit_add3(max, max, 1, &c), "%zu");
+  BN_ASSERT_EQ(1ul, c, "%zu");
+  BN_ASSERT_EQ(max, bn_digit_sub(0, 1, &c), "%zu");
+  BN_ASSERT_EQ(1ul, c, "%zu");
+  BN_ASSERT_EQ(max - 1, bn_digit_sub2(0, 1, 1, &c), "%zu");
+  BN_ASSERT_EQ(1ul, c, "%zu");
+  BN_ASSERT_EQ(1ul, bn_digit_mul(max, max, &c), "%zu");
+  BN_ASSERT_EQ(max - 1, c, "%zu");
+
+  // Edge values
+  const bn_digit_t edges[] = {0, 1, 2, HALF_DIGIT_MASK, HALF_DIGIT_BASE,
+                              max / 2, max / 2 + 1, max - 1, max};
+  const size_t n_edges = sizeof(edges) / sizeof(edges[0]);
+  for (size_t i = 0; i < n_edges; ++i)
+    for (size_t j = 0; j < n_edges; ++j)
+      for (size_t k = 0; k < n_edges; ++k)
+        check_digits(edges[i], edges[j], edges[k]);
+
+  // Random values
+  for (int i = 0; i < 100000; ++i)
+    check_digits(rand_digit(), rand_digit(), rand_digit());
+
+  // Divisions with precomputed reciprocals
+  for (size_t i = 0; i < n_edges; ++i)
+    for (size_t j = 0; j < n_edges; ++j)
+      for (size_t k = 0; k < n_edges; ++k) {
+        check_div_pre(edges[i], edges[j], edges[k], edges[i], edges[j]);
+        check_div_pre(edges[i], edges[j], edges[k], edges[j], edges[k]);
+      }
+  for (int i = 0; i < 100000; ++i)
+    check_div_pre(rand_digit(), rand_digit(), rand_digit(), rand_digit(),
+                  rand_digit());
+
+  return 0;
+}
@@ -3,6 +3,47 @@
 #define BIGNUM_IMPLEMENTATION
 #include "../bignum.h"
 
+#define TEST_SEED 0x6A09E667F3BCC909ull
+#include "test_util.h"
+
+// Random number of {size} digits. Every few numbers consist of runs of all-ones
+// digits, which hit the rare corrections of the quotient estimates.
+static void rand_bn_ones(bn_t *bn, size_t size) {
+  bool ones = rand_digit() % 4 == 0;
+  bn->size = 0;
+  bn->sign = rand_digit() % 2 ? 1 : -1;
+  for (size_t i = 0; i < size; ++i)
+    bn_append_digit(bn, ones && rand_digit() % 8 ? ~(bn_digit_t)0
+                                                 : rand_digit());
+  if (BN_DIGITS(bn)[size - 1] == 0)
+    BN_DIGITS(bn)[size - 1] = 1;
+}
+
+// Checks A == Q * B + R with |R| < |B| and R having the sign of A
+static void check_div(size_t an, size_t bn) {
+  bn_t a = {0}, b = {0}, q = {0}, r = {0}, t = {0};
+  rand_bn_ones(&a, an);
+  rand_bn_ones(&b, bn);
+
+  assert(bn_div(&q, &r, &a, &b) == BN_OK);
+  assert(bn_cmp_abs(&r, &b) < 0);
+  assert(r.sign == a.sign || (r.size == 1 && BN_DIGITS(&r)[0] == 0));
+  assert(bn_mul(&t, &q, &b) == BN_OK);
+  assert(bn_add(&t, &t, &r) == BN_OK);
+  assert(bn_cmp(&t, &a) == 0);
+
+  // in-place
+  assert(bn_div(&a, &b, &a, &b) == BN_OK);
+  assert(bn_cmp(&a, &q) == 0);
+  assert(bn_cmp(&b, &r) == 0);
+
+  bn_free(&a);
+  bn_free(&b);
+  bn_free(&q);
+  bn_free(&r);
+  bn_free(&t);
+}
+
 int main(void) {
   bn_t A = {0}, B = {0}, Q = {0}, R = {0};
   bn_digit_t r;
@@ -15,7 +56,7 @@ int main(void) {
   assert(bn_div_single(&Q, &r, &A, 1000ul) == BN_OK);
   BN_ASSERT_EQ(1ul, Q.size, "%zu");
   BN_ASSERT_EQ(1, Q.sign, "%d");
-  BN_ASSERT_EQ(2ul, Q.digits[0], "%zu");
+  BN_ASSERT_EQ(2ul, BN_DIGITS(&Q)[0], "%zu");
   A.size = 0ul;
   Q.size = 0ul;
 
@@ -26,7 +67,7 @@ int main(void) {
   BN_ASSERT_EQ(0ul, r, "%zu");
   BN_ASSERT_EQ(1ul, Q.size, "%zu");
   BN_ASSERT_EQ(1, Q.sign, "%d");
-  BN_ASSERT_EQ(2000ul, Q.digits[0], "%zu");
+  BN_ASSERT_EQ(2000ul, BN_DIGITS(&Q)[0], "%zu");
   A.size = 0;
   Q.size = 0;
 
@@ -37,7 +78,7 @@ int main(void) {
   BN_ASSERT_EQ(1ul, r, "%zu");
   BN_ASSERT_EQ(1ul, Q.size, "%zu");
   BN_ASSERT_EQ(1, Q.sign, "%d");
-  BN_ASSERT_EQ(2000ul, Q.digits[0], "%zu");
+  BN_ASSERT_EQ(2000ul, BN_DIGITS(&Q)[0], "%zu");
 
   ////////////////////////////////////////
   // bn_div
@@ -49,8 +90,8 @@ int main(void) {
   BN_ASSERT_EQ(1ul, Q.size, "%zu");
   BN_ASSERT_EQ(1ul, R.size, "%zu");
   BN_ASSERT_EQ(1, Q.sign, "%d");
-  BN_ASSERT_EQ(2ul, Q.digits[0], "%zu");
-  BN_ASSERT_EQ(0ul, R.digits[0], "%zu");
+  BN_ASSERT_EQ(2ul, BN_DIGITS(&Q)[0], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&R)[0], "%zu");
   A.size = 0;
   B.size = 0;
   Q.size = 0;
@@ -64,8 +105,8 @@ int main(void) {
   BN_ASSERT_EQ(1ul, Q.size, "%zu");
   BN_ASSERT_EQ(1ul, R.size, "%zu");
   BN_ASSERT_EQ(1, Q.sign, "%d");
-  BN_ASSERT_EQ(2000ul, Q.digits[0], "%zu");
-  BN_ASSERT_EQ(0ul, R.digits[0], "%zu");
+  BN_ASSERT_EQ(2000ul, BN_DIGITS(&Q)[0], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&R)[0], "%zu");
   A.size = 0;
   B.size = 0;
   Q.size = 0;
@@ -80,8 +121,8 @@ int main(void) {
   BN_ASSERT_EQ(1ul, Q.size, "%zu");
   BN_ASSERT_EQ(1ul, R.size, "%zu");
   BN_ASSERT_EQ(-1, Q.sign, "%d");
-  BN_ASSERT_EQ(2000ul, Q.digits[0], "%zu");
-  BN_ASSERT_EQ(0ul, R.digits[0], "%zu");
+  BN_ASSERT_EQ(2000ul, BN_DIGITS(&Q)[0], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&R)[0], "%zu");
 
   // Multiple digits divided by multiple digit: 200000000000000000000 / 100000000000000000000 = 2
   A.size = 0;
@@ -98,8 +139,8 @@ int main(void) {
   BN_ASSERT_EQ(1ul, Q.size, "%zu");
   BN_ASSERT_EQ(1ul, R.size, "%zu");
   BN_ASSERT_EQ(1, Q.sign, "%d");
-  BN_ASSERT_EQ(2ul, Q.digits[0], "%zu");
-  BN_ASSERT_EQ(0ul, R.digits[0], "%zu");
+  BN_ASSERT_EQ(2ul, BN_DIGITS(&Q)[0], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&R)[0], "%zu");
 
   // Multiple digits divided by multiple digit: -200000000000000000000 / 100000000000000000000 = 2
   A.size = 0;
@@ -116,8 +157,72 @@ int main(void) {
   BN_ASSERT_EQ(1ul, Q.size, "%zu");
   BN_ASSERT_EQ(1ul, R.size, "%zu");
   BN_ASSERT_EQ(-1, Q.sign, "%d");
-  BN_ASSERT_EQ(2ul, Q.digits[0], "%zu");
-  BN_ASSERT_EQ(0ul, R.digits[0], "%zu");
+  BN_ASSERT_EQ(2ul, BN_DIGITS(&Q)[0], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&R)[0], "%zu");
+
+  // Dividend shorter than the divisor: -5 / 100000000000000000000 = 0, rest -5
+  assert(bn_from_int(&A, -5) == BN_OK);
+  Q.size = 0;
+  R.size = 0;
+  assert(bn_div(&Q, &R, &A, &B) == BN_OK);
+  BN_ASSERT_EQ(1ul, Q.size, "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&Q)[0], "%zu");
+  BN_ASSERT_EQ(1ul, R.size, "%zu");
+  BN_ASSERT_EQ(-1, R.sign, "%d");
+  BN_ASSERT_EQ(5ul, BN_DIGITS(&R)[0], "%zu");
+
+  // Prepared divisor: -200000000000000000001 / 100000000000000000000 = -2,
+  // rest -1, reused for a second dividend
+  bn_divisor_t D;
+  A.size = 0;
+  A.sign = -1;
+  bn_append_digit(&A, 15532559262904483841ul);
+  bn_append_digit(&A, 10ul);
+  assert(bn_divisor_init(&D, &B) == BN_OK);
+  assert(bn_div_pre(&Q, &R, &A, &D) == BN_OK);
+  BN_ASSERT_EQ(1ul, Q.size, "%zu");
+  BN_ASSERT_EQ(-1, Q.sign, "%d");
+  BN_ASSERT_EQ(2ul, BN_DIGITS(&Q)[0], "%zu");
+  BN_ASSERT_EQ(1ul, R.size, "%zu");
+  BN_ASSERT_EQ(-1, R.sign, "%d");
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&R)[0], "%zu");
+  A.sign = 1;
+  bn_append_digit(&A, 5ul);
+  assert(bn_div_pre(&Q, NULL, &A, &D) == BN_OK);
+  assert(bn_div(&R, NULL, &A, &B) == BN_OK);
+  assert(bn_cmp(&Q, &R) == 0);
+  bn_divisor_free(&D);
+
+  // Prepared single digit: (5 * 2^64 + 5) / 7
+  A.size = 0;
+  bn_append_digit(&A, 5ul);
+  bn_append_digit(&A, 5ul);
+  assert(bn_from_int(&B, 7) == BN_OK);
+  assert(bn_divisor_init(&D, &B) == BN_OK);
+  assert(bn_div_single_pre(&Q, &r, &A, &D) == BN_OK);
+  BN_ASSERT_EQ(1ul, Q.size, "%zu");
+  BN_ASSERT_EQ(13176245766935394012ul, BN_DIGITS(&Q)[0], "%zu");
+  BN_ASSERT_EQ(1ul, r, "%zu");
+  assert(bn_div_single_pre(NULL, &r, &A, &D) == BN_OK);
+  BN_ASSERT_EQ(1ul, r, "%zu");
+  // in-place
+  assert(bn_div_single_pre(&A, &r, &A, &D) == BN_OK);
+  assert(bn_cmp(&A, &Q) == 0);
+  bn_divisor_free(&D);
+
+  // Random operands, schoolbook and Burnikel-Ziegler sizes
+  const size_t sizes[] = {1, 2, 3, 7, BN_BZ_DIV_THRESHOLD - 1,
+                          BN_BZ_DIV_THRESHOLD, 2 * BN_BZ_DIV_THRESHOLD + 1,
+                          5 * BN_BZ_DIV_THRESHOLD - 3};
+  const size_t num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+  for (size_t i = 0; i < num_sizes; ++i) {
+    for (size_t j = 0; j <= i; ++j) {
+      check_div(sizes[i], sizes[j]);
+      check_div(sizes[i] + sizes[j] - 1, sizes[j]);
+      check_div(sizes[i] + sizes[j], sizes[j]);
+      check_div(3 * sizes[i] + 1, sizes[j]);
+    }
+  }
 
   bn_free(&A);
   bn_free(&B);
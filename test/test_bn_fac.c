@@ -0,0 +1,133 @@
+#include <assert.h>
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0x1F83D9AB5BE0CD19ull
+#include "test_util.h"
+
+static bool is_prime(unsigned long n) {
+  if (n < 2)
+    return false;
+  for (unsigned long d = 2; d * d <= n; ++d)
+    if (n % d == 0)
+      return false;
+  return true;
+}
+
+// Checks C(n, k) = n! / (k! (n - k)!) for k <= n.
+static void check_bin(unsigned long n, unsigned long k) {
+  bn_t z = {0}, f = {0}, g = {0};
+  assert(bn_bin_uiui(&z, n, k) == BN_OK);
+  bn_fac_ui(&f, k);
+  bn_fac_ui(&g, n - k);
+  bn_mul(&f, &f, &g);
+  bn_mul(&f, &f, &z);
+  bn_fac_ui(&g, n);
+  assert(bn_cmp(&f, &g) == 0);
+  bn_bin_uiui(&f, n, n - k);
+  assert(bn_cmp(&f, &z) == 0);
+  bn_free(&z);
+  bn_free(&f);
+  bn_free(&g);
+}
+
+int main(void) {
+  bn_t x = {0}, y = {0}, z = {0};
+
+  // Powers against repeated products, of zero, one, powers of two, negative
+  // numbers and numbers of several digits
+  const char *bases[] = {"0",  "1",  "-1", "2",   "-2",  "3", "12",
+                         "-1024", "340282366920938463463374607431768211456",
+                         "-98765432109876543210987654321"};
+  for (size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); ++i) {
+    bn_from_string(&x, bases[i], 10);
+    bn_from_int(&y, 1);
+    for (unsigned long e = 0; e < 70; ++e) {
+      assert(bn_pow_ui(&z, &x, e) == BN_OK);
+      assert(bn_cmp(&z, &y) == 0);
+      bn_mul(&y, &y, &x);
+    }
+  }
+  // In place, and with random bases
+  for (int i = 0; i < 20; ++i) {
+    bn_from_int(&x, 0);
+    bn_resize(&x, 1 + rand_digit() % 5);
+    for (size_t j = 0; j < x.size; ++j)
+      BN_DIGITS(&x)[j] = rand_digit();
+    x.sign = i % 2 ? -1 : 1;
+    const unsigned long e = rand_digit() % 300;
+    bn_from_int(&y, 1);
+    for (unsigned long j = 0; j < e; ++j)
+      bn_mul(&y, &y, &x);
+    bn_pow_ui(&x, &x, e);
+    assert(bn_cmp(&x, &y) == 0);
+  }
+
+  // Factorials against the running product, past the direct base case
+  bn_from_int(&y, 1);
+  for (unsigned long n = 0; n < 1500; ++n) {
+    if (n > 0)
+      bn_mul_single(&y, &y, n);
+    assert(bn_fac_ui(&z, n) == BN_OK);
+    assert(bn_cmp(&z, &y) == 0);
+  }
+  for (unsigned long n = 20000; n < 20002; ++n) {
+    bn_from_int(&y, 1);
+    for (unsigned long i = 2; i <= n; ++i)
+      bn_mul_single(&y, &y, i);
+    bn_fac_ui(&z, n);
+    assert(bn_cmp(&z, &y) == 0);
+  }
+
+  // Binomials by Pascal's triangle, then against factorials on both sides of
+  // the choice between the sieve and the direct quotient
+  for (unsigned long n = 0; n < 200; ++n) {
+    for (unsigned long k = 0; k <= n + 2; ++k) {
+      assert(bn_bin_uiui(&z, n, k) == BN_OK);
+      if (k > n) {
+        assert(z.size == 1 && BN_DIGITS(&z)[0] == 0);
+        continue;
+      }
+      if (k == 0 || k == n) {
+        bn_from_int(&y, 1);
+      } else {
+        bn_bin_uiui(&x, n - 1, k - 1);
+        bn_bin_uiui(&y, n - 1, k);
+        bn_add(&y, &y, &x);
+      }
+      assert(bn_cmp(&z, &y) == 0);
+    }
+  }
+  unsigned long ks[] = {1, 2, 7, 50, 63, 64, 65, 200, 1000, 2500, 5000};
+  for (size_t i = 0; i < sizeof(ks) / sizeof(ks[0]); ++i)
+    check_bin(5000, ks[i]);
+  for (int i = 0; i < 20; ++i) {
+    const unsigned long n = 100 + rand_digit() % 3000;
+    check_bin(n, rand_digit() % (n + 1));
+  }
+  // C(n, 2) of an n which does not fit a sieve
+  const unsigned long big = ~0ul;
+  bn_bin_uiui(&z, big, 2);
+  bn_from_int(&x, 0);
+  bn_add_single(&x, &x, big);
+  bn_sub_single(&y, &x, 1);
+  bn_mul(&y, &y, &x);
+  bn_rshift(&y, &y, 1);
+  assert(bn_cmp(&z, &y) == 0);
+
+  // Primorials against the primes found by trial division
+  bn_from_int(&y, 1);
+  for (unsigned long n = 0; n < 3000; ++n) {
+    if (is_prime(n))
+      bn_mul_single(&y, &y, n);
+    assert(bn_primorial_ui(&z, n) == BN_OK);
+    assert(bn_cmp(&z, &y) == 0);
+  }
+
+  bn_free(&x);
+  bn_free(&y);
+  bn_free(&z);
+  bn_scratch_free(NULL);
+  return 0;
+}
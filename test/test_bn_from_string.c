@@ -3,33 +3,104 @@
 #define BIGNUM_IMPLEMENTATION
 #include "../bignum.h"
 
+#define TEST_SEED 0xBB67AE8584CAA73Bull
+#include "test_util.h"
+
+// Parses a random decimal string of len characters and converts it back.
+static void check_round_trip(size_t len) {
+  bn_t bn = {0};
+  char *s = malloc(len + 1), *back;
+  s[0] = '1' + rand_digit() % 9;
+  for (size_t i = 1; i < len; ++i)
+    s[i] = '0' + rand_digit() % 10;
+  s[len] = '\0';
+  assert(bn_from_string(&bn, s, 10) == BN_OK);
+  assert(bn_to_string(&bn, &back) == BN_OK);
+  BN_ASSERT_STREQ(s, back);
+  free(back);
+  free(s);
+  bn_free(&bn);
+}
+
 int main(void) {
   bn_t bn = {0};
 
   assert(bn_from_string(&bn, "1000", 10) == BN_OK);
   BN_ASSERT_EQ(1ul, bn.size, "%zu");
   BN_ASSERT_EQ(1, bn.sign, "%d");
-  BN_ASSERT_EQ(1000ul, bn.digits[0], "%zu");
+  BN_ASSERT_EQ(1000ul, BN_DIGITS(&bn)[0], "%zu");
 
   bn.size = 0;
   assert(bn_from_string(&bn, "-1000", 10) == BN_OK);
   BN_ASSERT_EQ(1ul, bn.size, "%zu");
   BN_ASSERT_EQ(-1, bn.sign, "%d");
-  BN_ASSERT_EQ(1000ul, bn.digits[0], "%zu");
+  BN_ASSERT_EQ(1000ul, BN_DIGITS(&bn)[0], "%zu");
 
   bn.size = 0;
   assert(bn_from_string(&bn, "10000000000000000000000000", 10) == BN_OK);
   BN_ASSERT_EQ(2ul, bn.size, "%zu");
   BN_ASSERT_EQ(1, bn.sign, "%d");
-  BN_ASSERT_EQ(1590897978359414784ul, bn.digits[0], "%zu");
-  BN_ASSERT_EQ(542101ul, bn.digits[1], "%zu");
+  BN_ASSERT_EQ(1590897978359414784ul, BN_DIGITS(&bn)[0], "%zu");
+  BN_ASSERT_EQ(542101ul, BN_DIGITS(&bn)[1], "%zu");
 
   bn.size = 0;
   assert(bn_from_string(&bn, "-10000000000000000000000000", 10) == BN_OK);
   BN_ASSERT_EQ(2ul, bn.size, "%zu");
   BN_ASSERT_EQ(-1, bn.sign, "%d");
-  BN_ASSERT_EQ(1590897978359414784ul, bn.digits[0], "%zu");
-  BN_ASSERT_EQ(542101ul, bn.digits[1], "%zu");
+  BN_ASSERT_EQ(1590897978359414784ul, BN_DIGITS(&bn)[0], "%zu");
+  BN_ASSERT_EQ(542101ul, BN_DIGITS(&bn)[1], "%zu");
+
+  // Every part of a negative number adds to the magnitude.
+  bn.size = 0;
+  assert(bn_from_string(&bn, "-18446744073709551617", 10) == BN_OK);
+  BN_ASSERT_EQ(2ul, bn.size, "%zu");
+  BN_ASSERT_EQ(-1, bn.sign, "%d");
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&bn)[0], "%zu");
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&bn)[1], "%zu");
+
+  assert(bn_from_string(&bn, "-000", 10) == BN_OK);
+  BN_ASSERT_EQ(1ul, bn.size, "%zu");
+  BN_ASSERT_EQ(1, bn.sign, "%d");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&bn)[0], "%zu");
+
+  // Parsing stops at the first character that is not a digit.
+  assert(bn_from_string(&bn, "123x456", 10) == BN_OK);
+  BN_ASSERT_EQ(1ul, bn.size, "%zu");
+  BN_ASSERT_EQ(123ul, BN_DIGITS(&bn)[0], "%zu");
+
+  // Powers of two as radix, where a full digit's worth of characters would
+  // overflow the chunk power
+  assert(bn_from_string(&bn, "1ffffffffffffffff", 16) == BN_OK);
+  BN_ASSERT_EQ(2ul, bn.size, "%zu");
+  BN_ASSERT_EQ(~0ul, BN_DIGITS(&bn)[0], "%zu");
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&bn)[1], "%zu");
+  assert(bn_from_string(&bn,
+                        "1000000000000000000000000000000000000000000000000000"
+                        "000000000000",
+                        2) == BN_OK);
+  BN_ASSERT_EQ(1ul, bn.size, "%zu");
+  BN_ASSERT_EQ(1ul << 63, BN_DIGITS(&bn)[0], "%zu");
+  assert(bn_from_string(&bn, "zz", 36) == BN_OK);
+  BN_ASSERT_EQ(1295ul, BN_DIGITS(&bn)[0], "%zu");
+
+  // Long strings with leading zeros take the divide-and-conquer path.
+  char *s = malloc(20001), *back;
+  memset(s, '0', 20000);
+  s[20000] = '\0';
+  s[19999] = '7';
+  assert(bn_from_string(&bn, s, 10) == BN_OK);
+  BN_ASSERT_EQ(1ul, bn.size, "%zu");
+  BN_ASSERT_EQ(7ul, BN_DIGITS(&bn)[0], "%zu");
+  s[0] = '-';
+  s[1] = '1';
+  assert(bn_from_string(&bn, s, 10) == BN_OK);
+  assert(bn_to_string(&bn, &back) == BN_OK);
+  BN_ASSERT_STREQ(s, back);
+  free(back);
+  free(s);
+
+  for (size_t len = 1; len < 40000; len += 1 + len / 3)
+    check_round_trip(len);
 
   bn_free(&bn);
   return 0;
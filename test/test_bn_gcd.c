@@ -0,0 +1,193 @@
+#include <assert.h>
+
+// Half-GCD steps and recursion from small sizes on, so the tests reach them.
+#ifndef BN_HGCD_THRESHOLD
+#define BN_HGCD_THRESHOLD 4
+#endif
+#ifndef BN_GCD_DC_THRESHOLD
+#define BN_GCD_DC_THRESHOLD 6
+#endif
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0x9B05688C2B3E6C1Full
+#include "test_util.h"
+
+static bool is_zero(const bn_t *X) {
+  return bn_mpn_normalized_size(BN_DIGITS(X), X->size) == 0;
+}
+
+// Euclid on top of bn_div
+static void gcd_ref(bn_t *G, const bn_t *A, const bn_t *B) {
+  bn_t a = {0}, b = {0}, r = {0};
+  bn_abs(&a, A);
+  bn_abs(&b, B);
+  while (!is_zero(&b)) {
+    bn_div(NULL, &r, &a, &b);
+    bn_clone(&a, &b);
+    bn_clone(&b, &r);
+  }
+  bn_clone(G, &a);
+  bn_free(&a);
+  bn_free(&b);
+  bn_free(&r);
+}
+
+// |X| <= max(|Y| / 2G, 1)
+static bool within_half(const bn_t *X, const bn_t *Y, const bn_t *G) {
+  bn_t x = {0}, y = {0};
+  bn_mul(&x, X, G);
+  bn_add(&x, &x, &x);
+  bn_abs(&y, Y);
+  const bool ok =
+      bn_cmp_abs(&x, &y) <= 0 || (X->size == 1 && BN_DIGITS(X)[0] <= 1);
+  bn_free(&x);
+  bn_free(&y);
+  return ok;
+}
+
+// Checks bn_gcd, bn_gcdext and bn_invmod on A and B.
+static void check_gcd(const bn_t *A, const bn_t *B) {
+  bn_t g = {0}, r = {0}, s = {0}, t = {0}, x = {0}, y = {0};
+  gcd_ref(&r, A, B);
+  assert(bn_gcd(&g, A, B) == BN_OK);
+  assert(bn_cmp(&g, &r) == 0);
+
+  assert(bn_gcdext(&g, &s, &t, A, B) == BN_OK);
+  assert(bn_cmp(&g, &r) == 0);
+  // G = S A + T B
+  bn_mul(&x, &s, A);
+  bn_mul(&y, &t, B);
+  bn_add(&x, &x, &y);
+  assert(bn_cmp(&x, &g) == 0);
+  if (!is_zero(A) && !is_zero(B)) {
+    assert(within_half(&s, B, &g));
+    assert(within_half(&t, A, &g));
+  }
+  // Without T, and into the inputs
+  bn_clone(&x, A);
+  bn_clone(&y, B);
+  assert(bn_gcdext(&x, &y, NULL, &x, &y) == BN_OK);
+  assert(bn_cmp(&x, &g) == 0);
+  assert(bn_cmp(&y, &s) == 0);
+
+  if (!is_zero(B)) {
+    bn_err_t err = bn_invmod(&x, A, B);
+    if (g.size == 1 && BN_DIGITS(&g)[0] == 1) {
+      assert(err == BN_OK);
+      assert(x.sign == 1 && bn_cmp_abs(&x, B) < 0);
+      bn_mul(&y, &x, A);
+      bn_mod(&y, &y, B);
+      bn_abs(&t, B);
+      bn_from_int(&s, t.size == 1 && BN_DIGITS(&t)[0] == 1 ? 0 : 1);
+      assert(bn_cmp(&y, &s) == 0);
+    } else {
+      assert(err == BN_NOT_INVERTIBLE);
+    }
+  }
+  bn_free(&g);
+  bn_free(&r);
+  bn_free(&s);
+  bn_free(&t);
+  bn_free(&x);
+  bn_free(&y);
+}
+
+// Random operands of {an} and {bn} digits with a common factor of {gn}
+// digits
+static void check_random(size_t an, size_t bn, size_t gn) {
+  bn_t a = {0}, b = {0}, g = {0};
+  rand_bn(&a, an, rand_digit() % 2 ? 1 : -1);
+  rand_bn(&b, bn, rand_digit() % 2 ? 1 : -1);
+  check_gcd(&a, &b);
+  if (gn > 0) {
+    rand_bn(&g, gn, 1);
+    bn_mul(&a, &a, &g);
+    bn_mul(&b, &b, &g);
+    check_gcd(&a, &b);
+  }
+  bn_free(&a);
+  bn_free(&b);
+  bn_free(&g);
+}
+
+static void check_fibonacci(size_t count) {
+  // Consecutive Fibonacci numbers take the most steps.
+  bn_t a = {0}, b = {0};
+  bn_from_int(&a, 1);
+  bn_from_int(&b, 1);
+  for (size_t i = 0; i < count; ++i)
+    bn_add(i % 2 ? &b : &a, &a, &b);
+  check_gcd(&a, &b);
+  check_gcd(&b, &a);
+  bn_free(&a);
+  bn_free(&b);
+}
+
+int main(void) {
+  // Single and double digits
+  assert(bn_mpn_gcd_11(0, 0) == 0u);
+  assert(bn_mpn_gcd_11(0, 7) == 7u);
+  assert(bn_mpn_gcd_11(36, 24) == 12u);
+  assert(bn_mpn_gcd_11(~(bn_digit_t)0, ~(bn_digit_t)0 - 1) == 1u);
+  const bn_digit_t top = (bn_digit_t)1 << (DIGIT_BITS - 1);
+  assert(bn_mpn_gcd_11(top, 0) == top);
+  for (int i = 0; i < 1000; ++i) {
+    bn_t A = {0}, B = {0}, G = {0};
+    // Random double digits, every other pair with a common factor
+    rand_bn(&A, 1 + i % 2, 1);
+    rand_bn(&B, 1 + i / 2 % 2, 1);
+    if (i % 4 == 1) {
+      BN_DIGITS(&A)[A.size - 1] >>= rand_digit() % DIGIT_BITS;
+      BN_DIGITS(&B)[B.size - 1] >>= rand_digit() % DIGIT_BITS;
+    } else if (i % 4 == 3) {
+      const bn_digit_t g = rand_digit() >> (rand_digit() % DIGIT_BITS);
+      bn_resize(&A, 1);
+      bn_resize(&B, 1);
+      bn_mul_single(&A, &A, g);
+      bn_mul_single(&B, &B, g);
+    }
+    if (i % 10 == 2)
+      bn_from_int(&A, 0);
+    if (i % 10 == 6)
+      bn_clone(&B, &A);
+    bn_digit_t a[2] = {BN_DIGITS(&A)[0], A.size > 1 ? BN_DIGITS(&A)[1] : 0};
+    bn_digit_t b[2] = {BN_DIGITS(&B)[0], B.size > 1 ? BN_DIGITS(&B)[1] : 0};
+    bn_digit_t r[2];
+    bn_mpn_gcd_22(r, a, b);
+    gcd_ref(&G, &A, &B);
+    assert(bn_mpn_cmp2(BN_DIGITS(&G), G.size, r, 2) == 0);
+    if (a[1] == 0 && b[1] == 0)
+      assert(bn_mpn_gcd_11(a[0], b[0]) == r[0]);
+    bn_free(&A);
+    bn_free(&B);
+    bn_free(&G);
+  }
+
+  // Zeros, units and small numbers
+  bn_t a = {0}, b = {0};
+  int values[] = {0, 1, -1, 2, -6, 9, 35, -35, 12, 1 << 30};
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    for (size_t j = 0; j < sizeof(values) / sizeof(values[0]); ++j) {
+      bn_from_int(&a, values[i]);
+      bn_from_int(&b, values[j]);
+      check_gcd(&a, &b);
+    }
+  }
+  bn_free(&a);
+  bn_free(&b);
+
+  // Lehmer, half-GCD steps and the recursion
+  for (size_t n = 1; n < 40; ++n) {
+    check_random(n, n, 0);
+    check_random(n, 1 + rand_digit() % n, n / 3);
+    check_random(n + 5, n, 1 + rand_digit() % n);
+  }
+  check_random(200, 190, 60);
+  check_random(400, 400, 0);
+  check_fibonacci(5000);
+  check_fibonacci(20000);
+
+  bn_scratch_free(NULL);
+  return 0;
+}
@@ -0,0 +1,165 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0x1F83D9ABFB41BD6Bull
+#include "test_util.h"
+
+#define COUNT 29
+
+enum { PLAIN, MONT, BARRETT };
+
+static bn_err_t invmod_batch(int ctx, bn_t *Z, const bn_t *X, size_t count,
+                             const bn_t *N) {
+  bn_err_t err;
+  if (ctx == MONT) {
+    bn_mont_ctx_t M;
+    assert(bn_mont_ctx_init(&M, N) == BN_OK);
+    err = bn_invmod_batch_mont(Z, X, count, &M);
+    bn_mont_ctx_free(&M);
+  } else if (ctx == BARRETT) {
+    bn_barrett_ctx_t C;
+    assert(bn_barrett_ctx_init(&C, N) == BN_OK);
+    err = bn_invmod_batch_barrett(Z, X, count, &C);
+    bn_barrett_ctx_free(&C);
+  } else {
+    err = bn_invmod_batch(Z, X, count, N);
+  }
+  return err;
+}
+
+// Checks the batch inversion of {count} random numbers modulo N against
+// bn_invmod, with a few zeros and multiples of {factor} mixed in if given.
+static void check_invmod_batch(int ctx, const bn_t *N, size_t count,
+                               const bn_t *factor) {
+  bn_t x[COUNT] = {{0}}, z[COUNT] = {{0}}, r = {0};
+  bool invertible = true;
+  for (size_t i = 0; i < count; ++i) {
+    rand_bn(&x[i], 1 + rand_digit() % (N->size + 2), rand_digit() % 2 ? 1 : -1);
+    if (i % 7 == 3)
+      bn_from_int(&x[i], 0);
+    else if (i % 7 == 5)
+      bn_mul(&x[i], &x[i], N);
+    else if (i % 5 == 1 && factor != NULL)
+      bn_mul(&x[i], &x[i], factor);
+    invertible &= bn_invmod(&r, &x[i], N) == BN_OK;
+  }
+
+  bn_err_t err = invmod_batch(ctx, z, x, count, N);
+  assert(err == (invertible ? BN_OK : BN_NOT_INVERTIBLE));
+  for (size_t i = 0; i < count; ++i) {
+    if (bn_invmod(&r, &x[i], N) != BN_OK)
+      bn_from_int(&r, 0);
+    assert(bn_cmp(&r, &z[i]) == 0);
+  }
+  // in-place
+  assert(invmod_batch(ctx, x, x, count, N) == err);
+  for (size_t i = 0; i < count; ++i)
+    assert(bn_cmp(&x[i], &z[i]) == 0);
+
+  for (size_t i = 0; i < COUNT; ++i) {
+    bn_free(&x[i]);
+    bn_free(&z[i]);
+  }
+  bn_free(&r);
+}
+
+// A large batch modulo N = p q in which only the X[bad[j]] are multiples of
+// q. The others are still inverted.
+static void check_not_invertible(int ctx, const bn_t *p, const bn_t *q,
+                                 size_t count, const size_t *bad,
+                                 size_t nbad) {
+  bn_t n = {0}, r = {0}, one = {0};
+  bn_t *x = calloc(count, sizeof(bn_t)), *z = calloc(count, sizeof(bn_t));
+  assert(x != NULL && z != NULL);
+  bn_mul(&n, p, q);
+  bn_from_int(&one, 1);
+  for (size_t i = 0; i < count; ++i) {
+    do
+      rand_bn(&x[i], n.size, 1);
+    while (bn_invmod(&r, &x[i], &n) != BN_OK);
+  }
+  for (size_t j = 0; j < nbad; ++j)
+    bn_mul(&x[bad[j]], &x[bad[j]], q);
+
+  assert(invmod_batch(ctx, z, x, count, &n) == BN_NOT_INVERTIBLE);
+  for (size_t j = 0; j < nbad; ++j) {
+    BN_ASSERT_EQ(1ul, z[bad[j]].size, "%zu");
+    BN_ASSERT_EQ(0ul, BN_DIGITS(&z[bad[j]])[0], "%zu");
+    bn_from_int(&x[bad[j]], 1);
+    bn_from_int(&z[bad[j]], 1);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    bn_mul(&r, &x[i], &z[i]);
+    bn_mod(&r, &r, &n);
+    assert(bn_cmp(&r, &one) == 0);
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    bn_free(&x[i]);
+    bn_free(&z[i]);
+  }
+  free(x);
+  free(z);
+  bn_free(&n);
+  bn_free(&r);
+  bn_free(&one);
+}
+
+int main(void) {
+  bn_t n = {0}, p = {0}, q = {0};
+  // Modulo 1 everything is invertible.
+  bn_from_int(&n, 1);
+  assert(bn_invmod_batch(NULL, NULL, 0, &n) == BN_OK);
+  check_invmod_batch(PLAIN, &n, COUNT, NULL);
+  check_invmod_batch(MONT, &n, COUNT, NULL);
+
+  for (size_t size = 1; size <= 40; size += 1 + size / 3) {
+    // Odd and even moduli, with factors shared by some of the numbers
+    rand_bn(&p, size, 1);
+    BN_DIGITS(&p)[0] |= 1;
+    rand_bn(&q, 1, 1);
+    BN_DIGITS(&q)[0] |= 1;
+    bn_mul_single(&n, &p, 2 * BN_DIGITS(&q)[0]);
+    for (int ctx = PLAIN; ctx <= BARRETT; ++ctx) {
+      check_invmod_batch(ctx, &p, COUNT, NULL);
+      check_invmod_batch(ctx, &p, 1, NULL);
+      if (ctx != MONT)
+        check_invmod_batch(ctx, &n, COUNT, &q);
+    }
+    bn_mul(&n, &p, &q);
+    check_invmod_batch(PLAIN, &n, COUNT, &q);
+    check_invmod_batch(MONT, &n, 2, &q);
+  }
+  // Elements which are not invertible among many: one at either end or
+  // inside, and several, which are found by the product tree
+  rand_bn(&p, 4, 1);
+  BN_DIGITS(&p)[0] |= 1;
+  rand_bn(&q, 2, 1);
+  BN_DIGITS(&q)[0] |= 1;
+  const size_t bad[] = {0, 617, 999, 3, 4, 500, 998};
+  for (int ctx = PLAIN; ctx <= BARRETT; ++ctx) {
+    check_not_invertible(ctx, &p, &q, 1000, &bad[0], 1);
+    check_not_invertible(ctx, &p, &q, 1000, &bad[1], 1);
+    check_not_invertible(ctx, &p, &q, 1000, &bad[2], 1);
+    check_not_invertible(ctx, &p, &q, 1000, &bad[1], 6);
+    check_not_invertible(ctx, &p, &q, 1001, bad, 7);
+  }
+
+  // A negative modulus, and one of a special form, 2^255 - 19
+  rand_bn(&p, 3, -1);
+  check_invmod_batch(PLAIN, &p, COUNT, NULL);
+  assert(bn_from_string(&p,
+                        "57896044618658097711785492504343953926634992332820282"
+                        "019728792003956564819949",
+                        10) == BN_OK);
+  check_invmod_batch(PLAIN, &p, COUNT, NULL);
+
+  bn_free(&n);
+  bn_free(&p);
+  bn_free(&q);
+  bn_scratch_free(NULL);
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include <assert.h>
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0x853C49E6748FEA9Bull
+#include "test_util.h"
+
+#define N 40
+
+// Checks the selected add_n, sub_n, mul_1, addmul_1, submul_1 and addmul_2
+// kernels against the portable versions for operands of n digits
+static void check_kernels(size_t n) {
+  bn_digit_t a[N], b[N], r1[N + 2], r2[N + 2];
+  for (size_t i = 0; i < n; ++i) {
+    a[i] = rand_edge_digit();
+    b[i] = rand_edge_digit();
+  }
+  bn_digit_t m = rand_edge_digit();
+  // Sentinels behind the operands must not be touched.
+  r1[n] = r2[n] = 42;
+
+  BN_ASSERT_EQ(bn_mpn_add_n_portable(r2, a, b, n), bn_mpn_add_n(r1, a, b, n),
+               "%zu");
+  assert(bn_mpn_cmp(r1, r2, n + 1) == 0);
+
+  BN_ASSERT_EQ(bn_mpn_sub_n_portable(r2, a, b, n), bn_mpn_sub_n(r1, a, b, n),
+               "%zu");
+  assert(bn_mpn_cmp(r1, r2, n + 1) == 0);
+
+  BN_ASSERT_EQ(bn_mpn_mul_1_portable(r2, a, n, m), bn_mpn_mul_1(r1, a, n, m),
+               "%zu");
+  assert(bn_mpn_cmp(r1, r2, n + 1) == 0);
+
+  bn_mpn_copy(r1, b, n);
+  bn_mpn_copy(r2, b, n);
+  BN_ASSERT_EQ(bn_mpn_addmul_1_portable(r2, a, n, m),
+               bn_mpn_addmul_1(r1, a, n, m), "%zu");
+  assert(bn_mpn_cmp(r1, r2, n + 1) == 0);
+
+  bn_mpn_copy(r1, b, n);
+  bn_mpn_copy(r2, b, n);
+  BN_ASSERT_EQ(bn_mpn_submul_1_portable(r2, a, n, m),
+               bn_mpn_submul_1(r1, a, n, m), "%zu");
+  assert(bn_mpn_cmp(r1, r2, n + 1) == 0);
+
+  // addmul_2 is two addmul_1 rows and writes rp[n].
+  if (n >= 1) {
+    bn_digit_t m2[2] = {m, rand_edge_digit()};
+    r1[n + 1] = r2[n + 1] = 42;
+    bn_mpn_copy(r1, b, n);
+    bn_mpn_copy(r2, b, n);
+    r2[n] = bn_mpn_addmul_1_portable(r2, a, n, m2[0]);
+    BN_ASSERT_EQ(bn_mpn_addmul_1_portable(r2 + 1, a, n, m2[1]),
+                 bn_mpn_addmul_2(r1, a, n, m2), "%zu");
+    assert(bn_mpn_cmp(r1, r2, n + 2) == 0);
+  }
+
+  // in-place
+  bn_mpn_copy(r1, a, n);
+  bn_mpn_copy(r2, a, n);
+  BN_ASSERT_EQ(bn_mpn_add_n_portable(r2, r2, b, n), bn_mpn_add_n(r1, r1, b, n),
+               "%zu");
+  assert(bn_mpn_cmp(r1, r2, n + 1) == 0);
+  BN_ASSERT_EQ(bn_mpn_mul_1_portable(r2, r2, n, m), bn_mpn_mul_1(r1, r1, n, m),
+               "%zu");
+  assert(bn_mpn_cmp(r1, r2, n + 1) == 0);
+}
+
+int main(void) {
+  const bn_digit_t max = ~(bn_digit_t)0;
+  bn_digit_t a[N], r[N];
+
+  // Explicit selection falls back to the portable kernels if unsupported.
+  assert(bn_select_kernels(BN_KERNELS_PORTABLE) == BN_KERNELS_PORTABLE);
+  assert(bn_get_kernels() == BN_KERNELS_PORTABLE);
+  bn_kernels_t adx = bn_select_kernels(BN_KERNELS_ADX);
+  assert(adx == BN_KERNELS_ADX || adx == BN_KERNELS_PORTABLE);
+  assert(bn_get_kernels() == adx);
+
+  // Worst-case carries
+  for (size_t i = 0; i < N; ++i)
+    a[i] = max;
+  BN_ASSERT_EQ(max - 1, bn_mpn_mul_1(r, a, N, max), "%zu");
+  BN_ASSERT_EQ(1ul, r[0], "%zu");
+  BN_ASSERT_EQ(max, r[N - 1], "%zu");
+  for (size_t i = 0; i < N; ++i)
+    r[i] = max;
+  BN_ASSERT_EQ(max, bn_mpn_addmul_1(r, a, N, max), "%zu");
+  BN_ASSERT_EQ(0ul, r[0], "%zu");
+  BN_ASSERT_EQ(max, r[N - 1], "%zu");
+  // (B^N - 1) - (B^N - 1) * (B - 1) = (B - 2) - (B - 2) * B^N
+  for (size_t i = 0; i < N; ++i)
+    r[i] = max;
+  BN_ASSERT_EQ(max - 1, bn_mpn_submul_1(r, a, N, max), "%zu");
+  BN_ASSERT_EQ(max - 1, r[0], "%zu");
+  BN_ASSERT_EQ(0ul, r[1], "%zu");
+  BN_ASSERT_EQ(0ul, r[N - 1], "%zu");
+
+  for (int kernels = BN_KERNELS_PORTABLE; kernels <= BN_KERNELS_ADX;
+       ++kernels) {
+    bn_select_kernels((bn_kernels_t)kernels);
+    for (size_t n = 0; n < N; ++n)
+      for (int round = 0; round < 50; ++round)
+        check_kernels(n);
+  }
+
+  // bn_mul gives the same result on either set of kernels.
+  bn_t x = {0}, y = {0}, z1 = {0}, z2 = {0};
+  for (size_t i = 0; i < 3 * BN_KARATSUBA_THRESHOLD; ++i) {
+    bn_append_digit(&x, rand_edge_digit() | 1);
+    bn_append_digit(&y, rand_edge_digit() | 1);
+  }
+  bn_select_kernels(BN_KERNELS_PORTABLE);
+  assert(bn_mul(&z1, &x, &y) == BN_OK);
+  bn_select_kernels(BN_KERNELS_ADX);
+  assert(bn_mul(&z2, &x, &y) == BN_OK);
+  assert(bn_cmp(&z1, &z2) == 0);
+  bn_free(&x);
+  bn_free(&y);
+  bn_free(&z1);
+  bn_free(&z2);
+
+  return 0;
+}
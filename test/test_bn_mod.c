@@ -0,0 +1,102 @@
+#include <assert.h>
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0xBB67AE8584CAA73Bull
+#include "test_util.h"
+
+// Checks the Barrett functions against bn_mod for the modulus n
+static void check_barrett(const bn_t *n) {
+  const size_t k = n->size;
+  bn_t x = {0}, y = {0}, z1 = {0}, z2 = {0};
+  bn_barrett_ctx_t C;
+  assert(bn_barrett_ctx_init(&C, n) == BN_OK);
+  BN_ASSERT_EQ(k, C.size, "%zu");
+
+  // Up to 2k digits are reduced by Barrett, more by division.
+  for (size_t xn = 1; xn <= 2 * k + 2; ++xn) {
+    rand_bn(&x, xn, rand_digit() % 2 ? 1 : -1);
+    assert(bn_mod(&z1, &x, n) == BN_OK);
+    assert(bn_mod_barrett(&z2, &x, &C) == BN_OK);
+    assert(bn_cmp(&z1, &z2) == 0);
+  }
+  // The largest number Barrett reduces, B^2k - 1
+  bn_free(&x);
+  for (size_t i = 0; i < 2 * k; ++i)
+    bn_append_digit(&x, ~(bn_digit_t)0);
+  x.sign = 1;
+  assert(bn_mod(&z1, &x, n) == BN_OK);
+  assert(bn_mod_barrett(&z2, &x, &C) == BN_OK);
+  assert(bn_cmp(&z1, &z2) == 0);
+
+  for (int round = 0; round < 4; ++round) {
+    rand_bn(&x, k + 1, 1);
+    rand_bn(&y, k + 1, 1);
+    assert(bn_mod(&x, &x, n) == BN_OK);
+    assert(bn_mod(&y, &y, n) == BN_OK);
+    assert(bn_mul(&z1, &x, &y) == BN_OK);
+    assert(bn_mod(&z1, &z1, n) == BN_OK);
+    assert(bn_mulmod_barrett(&z2, &x, &y, &C) == BN_OK);
+    assert(bn_cmp(&z1, &z2) == 0);
+    assert(bn_sqr(&z1, &x) == BN_OK);
+    assert(bn_mod(&z1, &z1, n) == BN_OK);
+    assert(bn_sqrmod_barrett(&x, &x, &C) == BN_OK);
+    assert(bn_cmp(&z1, &x) == 0);
+  }
+
+  bn_barrett_ctx_free(&C);
+  bn_free(&x);
+  bn_free(&y);
+  bn_free(&z1);
+  bn_free(&z2);
+}
+
+int main(void) {
+  bn_t x = {0}, n = {0}, z = {0};
+
+  // The remainder is never negative, whatever the signs.
+  bn_from_int(&x, -7);
+  bn_from_int(&n, 3);
+  assert(bn_mod(&z, &x, &n) == BN_OK);
+  BN_ASSERT_EQ(1, z.sign, "%d");
+  BN_ASSERT_EQ(2ul, BN_DIGITS(&z)[0], "%zu");
+  bn_from_int(&x, 7);
+  bn_from_int(&n, -3);
+  assert(bn_mod(&z, &x, &n) == BN_OK);
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&z)[0], "%zu");
+  bn_from_int(&x, -6);
+  assert(bn_mod(&z, &x, &n) == BN_OK);
+  BN_ASSERT_EQ(1, z.sign, "%d");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&z)[0], "%zu");
+  // in-place
+  bn_from_int(&x, 100);
+  bn_from_int(&n, 7);
+  assert(bn_mod(&x, &x, &n) == BN_OK);
+  BN_ASSERT_EQ(2ul, BN_DIGITS(&x)[0], "%zu");
+  assert(bn_mod(&n, &x, &n) == BN_OK);
+  BN_ASSERT_EQ(2ul, BN_DIGITS(&n)[0], "%zu");
+
+  // Random moduli, even and odd, below and above the Karatsuba threshold
+  const size_t sizes[] = {1, 2, 3, 5, 8, 17, 31, 32, 40, 70};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    for (int round = 0; round < 3; ++round) {
+      rand_bn(&n, sizes[i], 1);
+      check_barrett(&n);
+    }
+    // B^k - 1 and B^(k - 1), whose reciprocal does not fit k + 1 digits
+    bn_free(&n);
+    for (size_t j = 0; j < sizes[i]; ++j)
+      bn_append_digit(&n, ~(bn_digit_t)0);
+    n.sign = 1;
+    check_barrett(&n);
+    for (size_t j = 0; j < sizes[i]; ++j)
+      BN_DIGITS(&n)[j] = j + 1 == sizes[i];
+    check_barrett(&n);
+  }
+
+  bn_free(&x);
+  bn_free(&n);
+  bn_free(&z);
+  return 0;
+}
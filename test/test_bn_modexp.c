@@ -0,0 +1,152 @@
+#include <assert.h>
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0x3C6EF372FE94F82Bull
+#include "test_util.h"
+
+// Z = X mod N with 0 <= Z < N
+static void ref_mod(bn_t *Z, const bn_t *X, const bn_t *N) {
+  assert(bn_div(NULL, Z, X, N) == BN_OK);
+  if (Z->sign < 0)
+    assert(bn_add(Z, Z, N) == BN_OK);
+}
+
+// Left-to-right binary exponentiation with bn_mul and bn_div
+static void ref_modexp(bn_t *Z, const bn_t *X, const bn_t *E, const bn_t *N) {
+  bn_t b = {0}, r = {0}, t = {0};
+  ref_mod(&b, X, N);
+  bn_from_int(&t, 1);
+  ref_mod(&r, &t, N);
+  for (size_t i = E->size * DIGIT_BITS; i-- > 0;) {
+    assert(bn_mul(&t, &r, &r) == BN_OK);
+    ref_mod(&r, &t, N);
+    if ((BN_DIGITS(E)[i / DIGIT_BITS] >> (i % DIGIT_BITS)) & 1) {
+      assert(bn_mul(&t, &r, &b) == BN_OK);
+      ref_mod(&r, &t, N);
+    }
+  }
+  bn_clone(Z, &r);
+  bn_free(&b);
+  bn_free(&r);
+  bn_free(&t);
+}
+
+static void check_modexp(size_t xn, size_t en, size_t nn, bool odd) {
+  bn_t x = {0}, e = {0}, n = {0}, z1 = {0}, z2 = {0};
+  rand_bn(&x, xn, rand_digit() % 2 ? 1 : -1);
+  rand_bn(&e, en, 1);
+  rand_bn(&n, nn, 1);
+  if (odd)
+    BN_DIGITS(&n)[0] |= 1;
+  else
+    BN_DIGITS(&n)[0] &= ~(bn_digit_t)1;
+  if (bn_mpn_normalized_size(BN_DIGITS(&n), n.size) == 0)
+    BN_DIGITS(&n)[0] = 2;
+
+  ref_modexp(&z1, &x, &e, &n);
+  assert(bn_modexp(&z2, &x, &e, &n) == BN_OK);
+  assert(bn_cmp(&z1, &z2) == 0);
+
+  // in-place
+  assert(bn_modexp(&x, &x, &e, &n) == BN_OK);
+  assert(bn_cmp(&x, &z1) == 0);
+
+  bn_free(&x);
+  bn_free(&e);
+  bn_free(&n);
+  bn_free(&z1);
+  bn_free(&z2);
+}
+
+int main(void) {
+  bn_t x = {0}, y = {0}, e = {0}, n = {0}, z = {0}, t = {0};
+  bn_mont_ctx_t M;
+
+  // 4^13 mod 497 = 445
+  bn_from_int(&x, 4);
+  bn_from_int(&e, 13);
+  bn_from_int(&n, 497);
+  assert(bn_modexp(&z, &x, &e, &n) == BN_OK);
+  BN_ASSERT_EQ(445ul, BN_DIGITS(&z)[0], "%zu");
+  // Even modulus: 4^13 mod 496 = 64
+  bn_from_int(&n, 496);
+  assert(bn_modexp(&z, &x, &e, &n) == BN_OK);
+  BN_ASSERT_EQ(1ul, z.size, "%zu");
+  BN_ASSERT_EQ(64ul, BN_DIGITS(&z)[0], "%zu");
+  // Negative base: (-4)^13 mod 497 = 497 - 445
+  bn_from_int(&x, -4);
+  bn_from_int(&n, 497);
+  assert(bn_modexp(&z, &x, &e, &n) == BN_OK);
+  BN_ASSERT_EQ(1, z.sign, "%d");
+  BN_ASSERT_EQ(52ul, BN_DIGITS(&z)[0], "%zu");
+  // X^0 = 1, modulo 1 everything is 0
+  bn_from_int(&e, 0);
+  assert(bn_modexp(&z, &x, &e, &n) == BN_OK);
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&z)[0], "%zu");
+  bn_from_int(&n, 1);
+  assert(bn_modexp(&z, &x, &e, &n) == BN_OK);
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&z)[0], "%zu");
+  bn_from_int(&e, 13);
+  assert(bn_modexp(&z, &x, &e, &n) == BN_OK);
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&z)[0], "%zu");
+
+  // Fermat: a^(p - 1) = 1 mod p for the prime p = 2^521 - 1
+  bn_free(&n);
+  for (int i = 0; i < 8; ++i)
+    bn_append_digit(&n, ~(bn_digit_t)0);
+  bn_append_digit(&n, 0x1ff);
+  n.sign = 1;
+  bn_sub_single(&e, &n, 1);
+  rand_bn(&x, 5, 1);
+  assert(bn_modexp(&z, &x, &e, &n) == BN_OK);
+  BN_ASSERT_EQ(1ul, z.size, "%zu");
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&z)[0], "%zu");
+
+  // Montgomery context
+  assert(bn_mont_ctx_init(&M, &n) == BN_OK);
+  BN_ASSERT_EQ(9ul, M.size, "%zu");
+  BN_ASSERT_EQ(1ul, M.digits[0] * -M.ninv, "%zu");
+  assert(bn_modexp_mont(&z, &x, &e, &M) == BN_OK);
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&z)[0], "%zu");
+  // from(to(x) * to(y)) = x * y mod n, and the same for squares
+  rand_bn(&y, 9, 1);
+  assert(bn_mont_to(&t, &x, &M) == BN_OK);
+  assert(bn_mont_to(&z, &y, &M) == BN_OK);
+  assert(bn_mont_mul(&z, &t, &z, &M) == BN_OK);
+  assert(bn_mont_from(&z, &z, &M) == BN_OK);
+  assert(bn_mul(&t, &x, &y) == BN_OK);
+  ref_mod(&t, &t, &n);
+  assert(bn_cmp(&z, &t) == 0);
+  assert(bn_mont_to(&t, &y, &M) == BN_OK);
+  assert(bn_mont_sqr(&z, &t, &M) == BN_OK);
+  assert(bn_mont_from(&z, &z, &M) == BN_OK);
+  assert(bn_mul(&t, &y, &y) == BN_OK);
+  ref_mod(&t, &t, &n);
+  assert(bn_cmp(&z, &t) == 0);
+  bn_mont_ctx_free(&M);
+
+  bn_from_int(&n, 496);
+  assert(bn_mont_ctx_init(&M, &n) == BN_EVEN_MODULUS);
+
+  // Random operands against the reference, with moduli from one digit to
+  // beyond the Karatsuba and Burnikel-Ziegler thresholds.
+  const size_t sizes[] = {1, 2, 3, 5, 8, 17, 40, 70};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    for (int round = 0; round < 3; ++round) {
+      check_modexp(1 + rand_digit() % (2 * sizes[i]), 1 + rand_digit() % 3,
+                   sizes[i], true);
+      check_modexp(1 + rand_digit() % (2 * sizes[i]), 1 + rand_digit() % 3,
+                   sizes[i], false);
+    }
+  }
+
+  bn_free(&x);
+  bn_free(&y);
+  bn_free(&e);
+  bn_free(&n);
+  bn_free(&z);
+  bn_free(&t);
+  return 0;
+}
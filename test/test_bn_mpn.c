@@ -0,0 +1,92 @@
+#include <assert.h>
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0x510E527FADE682D1ull
+#include "test_util.h"
+
+#define N 24
+
+static void check_submul_1(size_t n) {
+  bn_digit_t a[N], r[N], r1[N], r2[N], t[N];
+  for (size_t i = 0; i < n; ++i) {
+    a[i] = rand_edge_digit();
+    r[i] = r1[i] = r2[i] = rand_edge_digit();
+  }
+  bn_digit_t b = rand_edge_digit();
+
+  // submul_1 against mul_1 followed by sub_n
+  bn_digit_t high = bn_mpn_submul_1(r1, a, n, b);
+  bn_digit_t t_high = bn_mpn_mul_1(t, a, n, b);
+  BN_ASSERT_EQ(t_high + bn_mpn_sub_n(r2, r2, t, n), high, "%zu");
+  assert(bn_mpn_cmp(r1, r2, n) == 0);
+
+  // addmul_1 undoes it.
+  BN_ASSERT_EQ(high, bn_mpn_addmul_1(r1, a, n, b), "%zu");
+  assert(bn_mpn_cmp(r, r1, n) == 0);
+}
+
+static void check_shift(size_t n) {
+  bn_digit_t a[N], r[N + 1], s[N + 1];
+  for (size_t i = 0; i < n; ++i)
+    a[i] = rand_edge_digit();
+  unsigned shift = 1 + rand_edge_digit() % (DIGIT_BITS - 1);
+
+  r[n] = bn_mpn_lshift(r, a, n, shift);
+  bn_digit_t out = bn_mpn_rshift(s, r, n + 1, shift);
+  BN_ASSERT_EQ((bn_digit_t)0, out, "%zu");
+  BN_ASSERT_EQ((bn_digit_t)0, s[n], "%zu");
+  assert(bn_mpn_cmp(a, s, n) == 0);
+
+  // in-place
+  bn_mpn_copy(s, a, n);
+  BN_ASSERT_EQ(r[n], bn_mpn_lshift(s, s, n, shift), "%zu");
+  assert(bn_mpn_cmp(r, s, n) == 0);
+  // shifting the digits one place up at the same time
+  bn_mpn_copy(s, a, n);
+  s[0] = bn_mpn_lshift(s + 1, s, n, shift);
+  assert(bn_mpn_cmp(r, s + 1, n) == 0);
+}
+
+int main(void) {
+  for (size_t n = 1; n < N; ++n) {
+    for (int round = 0; round < 100; ++round) {
+      check_submul_1(n);
+      check_shift(n);
+    }
+  }
+
+  // Worst case of submul_1
+  const bn_digit_t max = ~(bn_digit_t)0;
+  bn_digit_t a[3] = {max, max, max}, r[3] = {0, 0, 0};
+  BN_ASSERT_EQ(max, bn_mpn_submul_1(r, a, 3, max), "%zu");
+  BN_ASSERT_EQ(max, r[0], "%zu");
+  BN_ASSERT_EQ(0ul, r[1], "%zu");
+  BN_ASSERT_EQ(0ul, r[2], "%zu");
+
+  bn_digit_t x[2] = {1, 2}, y[2] = {2, 1};
+  assert(bn_mpn_cmp(x, y, 2) == 1);
+  assert(bn_mpn_cmp(y, x, 2) == -1);
+  assert(bn_mpn_cmp(x, x, 2) == 0);
+  assert(bn_mpn_cmp(x, y, 0) == 0);
+
+  // bn_lshift and bn_rshift, also in place
+  bn_t A = {0}, Z = {0};
+  assert(bn_from_string(&A, "-123456789012345678901234567890", 10) == BN_OK);
+  assert(bn_lshift(&Z, &A, 40) == BN_OK);
+  assert(bn_rshift(&Z, &Z, 40) == BN_OK);
+  assert(bn_cmp(&A, &Z) == 0);
+  assert(bn_lshift(&A, &A, 63) == BN_OK);
+  assert(bn_rshift(&A, &A, 63) == BN_OK);
+  assert(bn_cmp(&A, &Z) == 0);
+  assert(bn_from_int(&A, -1) == BN_OK);
+  assert(bn_rshift(&Z, &A, 1) == BN_OK);
+  BN_ASSERT_EQ(1ul, Z.size, "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&Z)[0], "%zu");
+  BN_ASSERT_EQ(1, Z.sign, "%d");
+  bn_free(&A);
+  bn_free(&Z);
+
+  return 0;
+}
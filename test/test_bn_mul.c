@@ -3,6 +3,36 @@
 #define BIGNUM_IMPLEMENTATION
 #include "../bignum.h"
 
+#define TEST_SEED 0x9E3779B97F4A7C15ull
+#include "test_util.h"
+
+// Checks bn_mul against the schoolbook basecase
+static void check_mul(size_t an, size_t bn) {
+  bn_t a = {0}, b = {0}, c = {0}, expected = {0};
+  rand_bn(&a, an, 1);
+  rand_bn(&b, bn, 1);
+  bn_resize(&expected, an + bn);
+  if (an >= bn)
+    bn_mpn_mul_basecase(BN_DIGITS(&expected), BN_DIGITS(&a), an,
+                        BN_DIGITS(&b), bn);
+  else
+    bn_mpn_mul_basecase(BN_DIGITS(&expected), BN_DIGITS(&b), bn,
+                        BN_DIGITS(&a), an);
+  expected.sign = 1;
+  bn_normalize(&expected);
+
+  assert(bn_mul(&c, &a, &b) == BN_OK);
+  assert(bn_cmp(&c, &expected) == 0);
+  // in-place
+  assert(bn_mul(&a, &a, &b) == BN_OK);
+  assert(bn_cmp(&a, &expected) == 0);
+
+  bn_free(&a);
+  bn_free(&b);
+  bn_free(&c);
+  bn_free(&expected);
+}
+
 int main(void) {
   bn_t a = {0}, b = {0}, c = {0};
 
@@ -16,7 +46,7 @@ int main(void) {
   assert(bn_mul_single(&c, &a, 2000ul) == BN_OK);
   BN_ASSERT_EQ(1ul, c.size, "%zu");
   BN_ASSERT_EQ(1, c.sign, "%d");
-  BN_ASSERT_EQ(2000000ul, c.digits[0], "%zu");
+  BN_ASSERT_EQ(2000000ul, BN_DIGITS(&c)[0], "%zu");
 
   // -1000 * 2000 = -2000000
   a.size = 0;
@@ -25,7 +55,7 @@ int main(void) {
   assert(bn_mul_single(&c, &a, 2000ul) == BN_OK);
   BN_ASSERT_EQ(1ul, c.size, "%zu");
   BN_ASSERT_EQ(-1, c.sign, "%d");
-  BN_ASSERT_EQ(2000000ul, c.digits[0], "%zu");
+  BN_ASSERT_EQ(2000000ul, BN_DIGITS(&c)[0], "%zu");
 
   // 10000000000000000000 * 1000 = 10000000000000000000000
   a.size = 0;
@@ -36,8 +66,8 @@ int main(void) {
   assert(bn_mul_single(&c, &a, 1000ul) == BN_OK);
   BN_ASSERT_EQ(2ul, c.size, "%zu");
   BN_ASSERT_EQ(1, c.sign, "%d");
-  BN_ASSERT_EQ(1864712049423024128ul, c.digits[0], "%zu");
-  BN_ASSERT_EQ(542ul, c.digits[1], "%zu");
+  BN_ASSERT_EQ(1864712049423024128ul, BN_DIGITS(&c)[0], "%zu");
+  BN_ASSERT_EQ(542ul, BN_DIGITS(&c)[1], "%zu");
 
   // 10000000000000000000000000 * 1000 = 10000000000000000000000000000
   a.size = 0;
@@ -48,8 +78,8 @@ int main(void) {
   assert(bn_mul_single(&c, &a, 1000ul) == BN_OK);
   BN_ASSERT_EQ(2ul, c.size, "%zu");
   BN_ASSERT_EQ(1, c.sign, "%d");
-  BN_ASSERT_EQ(4477988020393345024ul, c.digits[0], "%zu");
-  BN_ASSERT_EQ(542101086ul, c.digits[1], "%zu");
+  BN_ASSERT_EQ(4477988020393345024ul, BN_DIGITS(&c)[0], "%zu");
+  BN_ASSERT_EQ(542101086ul, BN_DIGITS(&c)[1], "%zu");
 
   ////////////////////////////////////////
   // bn_mul
@@ -63,7 +93,7 @@ int main(void) {
   assert(bn_mul(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(1ul, c.size, "%zu");
   BN_ASSERT_EQ(1, c.sign, "%d");
-  BN_ASSERT_EQ(2000000ul, c.digits[0], "%zu");
+  BN_ASSERT_EQ(2000000ul, BN_DIGITS(&c)[0], "%zu");
 
   // -1000 * 2000 = -2000000
   a.size = 0;
@@ -74,7 +104,7 @@ int main(void) {
   assert(bn_mul(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(1ul, c.size, "%zu");
   BN_ASSERT_EQ(-1, c.sign, "%d");
-  BN_ASSERT_EQ(2000000ul, c.digits[0], "%zu");
+  BN_ASSERT_EQ(2000000ul, BN_DIGITS(&c)[0], "%zu");
 
   // 1000 * -2000 = -2000000
   a.size = 0;
@@ -85,7 +115,7 @@ int main(void) {
   assert(bn_mul(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(1ul, c.size, "%zu");
   BN_ASSERT_EQ(-1, c.sign, "%d");
-  BN_ASSERT_EQ(2000000ul, c.digits[0], "%zu");
+  BN_ASSERT_EQ(2000000ul, BN_DIGITS(&c)[0], "%zu");
 
   // -1000 * -2000 = 2000000
   a.size = 0;
@@ -96,7 +126,7 @@ int main(void) {
   assert(bn_mul(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(1ul, c.size, "%zu");
   BN_ASSERT_EQ(1, c.sign, "%d");
-  BN_ASSERT_EQ(2000000ul, c.digits[0], "%zu");
+  BN_ASSERT_EQ(2000000ul, BN_DIGITS(&c)[0], "%zu");
 
   // 10000000000000000000 * 10000000000000000000 =
   // 100000000000000000000000000000000000000
@@ -110,8 +140,8 @@ int main(void) {
   assert(bn_mul(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(2ul, c.size, "%zu");
   BN_ASSERT_EQ(1, c.sign, "%d");
-  BN_ASSERT_EQ(687399551400673280ul, c.digits[0], "%zu");
-  BN_ASSERT_EQ(5421010862427522170ul, c.digits[1], "%zu");
+  BN_ASSERT_EQ(687399551400673280ul, BN_DIGITS(&c)[0], "%zu");
+  BN_ASSERT_EQ(5421010862427522170ul, BN_DIGITS(&c)[1], "%zu");
 
   // 10000000000000000000 * -10000000000000000000 =
   // -100000000000000000000000000000000000000
@@ -125,8 +155,8 @@ int main(void) {
   assert(bn_mul(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(2ul, c.size, "%zu");
   BN_ASSERT_EQ(-1, c.sign, "%d");
-  BN_ASSERT_EQ(687399551400673280ul, c.digits[0], "%zu");
-  BN_ASSERT_EQ(5421010862427522170ul, c.digits[1], "%zu");
+  BN_ASSERT_EQ(687399551400673280ul, BN_DIGITS(&c)[0], "%zu");
+  BN_ASSERT_EQ(5421010862427522170ul, BN_DIGITS(&c)[1], "%zu");
 
   // 100000000000000000000 + 100000000000000000000 =
   // 10000000000000000000000000000000000000000
@@ -142,9 +172,121 @@ int main(void) {
   assert(bn_mul(&c, &a, &b) == BN_OK);
   BN_ASSERT_EQ(3ul, c.size, "%zu");
   BN_ASSERT_EQ(1, c.sign, "%d");
-  BN_ASSERT_EQ(13399722918938673152ul, c.digits[0], "%zu");
-  BN_ASSERT_EQ(7145508105175220139ul, c.digits[1], "%zu");
-  BN_ASSERT_EQ(29ul, c.digits[2], "%zu");
+  BN_ASSERT_EQ(13399722918938673152ul, BN_DIGITS(&c)[0], "%zu");
+  BN_ASSERT_EQ(7145508105175220139ul, BN_DIGITS(&c)[1], "%zu");
+  BN_ASSERT_EQ(29ul, BN_DIGITS(&c)[2], "%zu");
+
+  // A negative single digit operand, with the product written over either
+  // operand: the sign is taken before Z is overwritten.
+  bn_t d = {0}, expected = {0};
+  assert(bn_from_string(&expected, "-370370367037037036703703703670", 10) ==
+         BN_OK);
+  bn_from_int(&a, -3);
+  bn_from_string(&b, "123456789012345678901234567890", 10);
+  assert(bn_mul(&a, &a, &b) == BN_OK);
+  assert(bn_cmp(&a, &expected) == 0);
+  bn_from_int(&a, -3);
+  assert(bn_mul(&b, &a, &b) == BN_OK);
+  assert(bn_cmp(&b, &expected) == 0);
+  bn_from_string(&b, "123456789012345678901234567890", 10);
+  assert(bn_mul(&b, &b, &a) == BN_OK);
+  assert(bn_cmp(&b, &expected) == 0);
+  // Both negative, and a zero operand, whose product has no sign
+  bn_from_string(&b, "-123456789012345678901234567890", 10);
+  assert(bn_mul(&a, &a, &b) == BN_OK);
+  expected.sign = 1;
+  assert(bn_cmp(&a, &expected) == 0);
+  bn_from_int(&d, 0);
+  assert(bn_mul(&d, &d, &b) == BN_OK);
+  BN_ASSERT_EQ(1ul, d.size, "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&d)[0], "%zu");
+  BN_ASSERT_EQ(1, d.sign, "%d");
+  bn_free(&d);
+  bn_free(&expected);
+
+  ////////////////////////////////////////
+  // Karatsuba
+
+  // balanced, around and above the threshold
+  for (size_t n = BN_KARATSUBA_THRESHOLD - 1; n < 4 * BN_KARATSUBA_THRESHOLD;
+       n += 7)
+    check_mul(n, n);
+  // nearly balanced and unbalanced
+  check_mul(3 * BN_KARATSUBA_THRESHOLD, 2 * BN_KARATSUBA_THRESHOLD + 1);
+  check_mul(2 * BN_KARATSUBA_THRESHOLD + 1, 3 * BN_KARATSUBA_THRESHOLD);
+  check_mul(7 * BN_KARATSUBA_THRESHOLD + 3, BN_KARATSUBA_THRESHOLD);
+  check_mul(5 * BN_KARATSUBA_THRESHOLD, 2 * BN_KARATSUBA_THRESHOLD + 5);
+
+  // all digits set, maximizes the carries
+  a.size = 0;
+  b.size = 0;
+  a.sign = 1;
+  b.sign = 1;
+  for (size_t i = 0; i < 3 * BN_KARATSUBA_THRESHOLD; ++i) {
+    bn_append_digit(&a, ~(bn_digit_t)0);
+    bn_append_digit(&b, ~(bn_digit_t)0);
+  }
+  assert(bn_mul(&c, &a, &b) == BN_OK);
+  // (B^n - 1)^2 = B^2n - 2 * B^n + 1
+  BN_ASSERT_EQ(6ul * BN_KARATSUBA_THRESHOLD, c.size, "%zu");
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&c)[0], "%zu");
+  for (size_t i = 1; i < 3 * BN_KARATSUBA_THRESHOLD; ++i)
+    BN_ASSERT_EQ(0ul, BN_DIGITS(&c)[i], "%zu");
+  BN_ASSERT_EQ(~(bn_digit_t)1, BN_DIGITS(&c)[3 * BN_KARATSUBA_THRESHOLD],
+               "%zu");
+  for (size_t i = 3 * BN_KARATSUBA_THRESHOLD + 1; i < c.size; ++i)
+    BN_ASSERT_EQ(~(bn_digit_t)0, BN_DIGITS(&c)[i], "%zu");
+
+  ////////////////////////////////////////
+  // Toom-Cook
+
+  // make sure every variant is selected for the sizes below
+  _bn_mul_plan_t plan = _bn_mpn_mul_plan(BN_TOOM3_THRESHOLD, BN_TOOM3_THRESHOLD);
+  assert(plan.algorithm == BN_MUL_TOOM && plan.ka == 3 && plan.kb == 3);
+  plan = _bn_mpn_mul_plan(3 * BN_TOOM3_THRESHOLD / 2, BN_TOOM3_THRESHOLD);
+  assert(plan.algorithm == BN_MUL_TOOM && plan.ka == 3 && plan.kb == 2);
+  plan = _bn_mpn_mul_plan(2 * BN_TOOM3_THRESHOLD, BN_TOOM3_THRESHOLD);
+  assert(plan.algorithm == BN_MUL_TOOM && plan.ka == 4 && plan.kb == 2);
+  plan = _bn_mpn_mul_plan(BN_TOOM4_THRESHOLD, BN_TOOM4_THRESHOLD);
+  assert(plan.algorithm == BN_MUL_TOOM && plan.ka == 4 && plan.kb == 4);
+
+  // Toom-33
+  check_mul(BN_TOOM3_THRESHOLD, BN_TOOM3_THRESHOLD);
+  check_mul(BN_TOOM3_THRESHOLD + 1, BN_TOOM3_THRESHOLD + 1);
+  check_mul(BN_TOOM3_THRESHOLD + 2, BN_TOOM3_THRESHOLD);
+  // Toom-32
+  check_mul(3 * BN_TOOM3_THRESHOLD / 2, BN_TOOM3_THRESHOLD);
+  check_mul(3 * BN_TOOM3_THRESHOLD / 2 + 1, BN_TOOM3_THRESHOLD + 3);
+  // Toom-42
+  check_mul(2 * BN_TOOM3_THRESHOLD, BN_TOOM3_THRESHOLD);
+  check_mul(2 * BN_TOOM3_THRESHOLD + 5, BN_TOOM3_THRESHOLD + 1);
+  // Toom-44
+  check_mul(BN_TOOM4_THRESHOLD, BN_TOOM4_THRESHOLD);
+  check_mul(BN_TOOM4_THRESHOLD + 3, BN_TOOM4_THRESHOLD + 1);
+
+#if BN_HAVE_NTT
+  ////////////////////////////////////////
+  // NTT
+
+  check_mul(BN_NTT_THRESHOLD, BN_NTT_THRESHOLD);
+  check_mul(BN_NTT_THRESHOLD + 17, BN_NTT_THRESHOLD);
+
+  // all digits set, the largest possible coefficients
+  a.size = 0;
+  b.size = 0;
+  for (size_t i = 0; i < BN_NTT_THRESHOLD; ++i) {
+    bn_append_digit(&a, ~(bn_digit_t)0);
+    bn_append_digit(&b, ~(bn_digit_t)0);
+  }
+  assert(bn_mul(&c, &a, &b) == BN_OK);
+  BN_ASSERT_EQ(2ul * BN_NTT_THRESHOLD, c.size, "%zu");
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&c)[0], "%zu");
+  for (size_t i = 1; i < BN_NTT_THRESHOLD; ++i)
+    BN_ASSERT_EQ(0ul, BN_DIGITS(&c)[i], "%zu");
+  BN_ASSERT_EQ(~(bn_digit_t)1, BN_DIGITS(&c)[BN_NTT_THRESHOLD], "%zu");
+  for (size_t i = BN_NTT_THRESHOLD + 1; i < c.size; ++i)
+    BN_ASSERT_EQ(~(bn_digit_t)0, BN_DIGITS(&c)[i], "%zu");
+#endif
 
   bn_free(&a);
   bn_free(&b);
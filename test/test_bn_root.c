@@ -0,0 +1,190 @@
+#include <assert.h>
+#include <time.h>
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0x5BE0CD19137E2179ull
+#include "test_util.h"
+
+// Random number of {size} digits with a nonzero top digit, of any bit length
+static void rand_bn_bits(bn_t *bn, size_t size) {
+  rand_bn(bn, size, 1);
+  BN_DIGITS(bn)[size - 1] >>= rand_digit() % DIGIT_BITS;
+  if (BN_DIGITS(bn)[size - 1] == 0)
+    BN_DIGITS(bn)[size - 1] = 1;
+}
+
+// Z^k
+static void power(bn_t *P, const bn_t *Z, unsigned long k) {
+  bn_from_int(P, 1);
+  for (unsigned long i = 0; i < k; ++i)
+    bn_mul(P, P, Z);
+}
+
+// Checks Z = floor(X^(1/k)) and R = X - Z^k for X >= 0.
+static void check_rootrem(const bn_t *X, unsigned long k) {
+  bn_t z = {0}, r = {0}, p = {0};
+  if (k == 2) {
+    assert(bn_sqrtrem(&z, &r, X) == BN_OK);
+    assert(bn_sqrt(&p, X) == BN_OK);
+    assert(bn_cmp(&p, &z) == 0);
+  } else {
+    assert(bn_rootrem(&z, &r, X, k) == BN_OK);
+    assert(bn_root(&p, X, k) == BN_OK);
+    assert(bn_cmp(&p, &z) == 0);
+  }
+  // Z^k <= X < (Z + 1)^k
+  power(&p, &z, k);
+  bn_add(&p, &p, &r);
+  assert(bn_cmp(&p, X) == 0);
+  assert(r.sign > 0 || bn_mpn_normalized_size(BN_DIGITS(&r), r.size) == 0);
+  bn_add_single(&z, &z, 1);
+  power(&p, &z, k);
+  assert(bn_cmp(&p, X) > 0);
+  if (k == 2)
+    assert(bn_is_perfect_square(X) ==
+           (bn_mpn_normalized_size(BN_DIGITS(&r), r.size) == 0));
+  bn_free(&z);
+  bn_free(&r);
+  bn_free(&p);
+}
+
+// Checks roots of Y^k and its neighbours, and that they are powers.
+static void check_power(const bn_t *Y, unsigned long k) {
+  bn_t x = {0}, z = {0};
+  power(&x, Y, k);
+  assert(bn_is_perfect_power(&x));
+  assert(bn_root(&z, &x, k) == BN_OK);
+  assert(bn_cmp(&z, Y) == 0);
+  check_rootrem(&x, k);
+  bn_add_single(&x, &x, 1);
+  check_rootrem(&x, k);
+  bn_sub_single(&x, &x, 2);
+  check_rootrem(&x, k);
+  bn_free(&x);
+  bn_free(&z);
+}
+
+int main(void) {
+  bn_t x = {0}, y = {0}, z = {0}, r = {0};
+
+  // Small numbers
+  for (int i = 0; i < 2000; ++i) {
+    bn_from_int(&x, i);
+    check_rootrem(&x, 2);
+    check_rootrem(&x, 3);
+    check_rootrem(&x, 7);
+  }
+  // All ones, (B^n - 1)^2 and single top bits, of even and odd sizes
+  for (size_t n = 1; n < 12; ++n) {
+    bn_from_int(&x, 0);
+    bn_resize(&x, n);
+    for (size_t i = 0; i < n; ++i)
+      BN_DIGITS(&x)[i] = ~(bn_digit_t)0;
+    check_rootrem(&x, 2);
+    check_power(&x, 2);
+    bn_mpn_zero(BN_DIGITS(&x), n);
+    for (unsigned bit = 0; bit < DIGIT_BITS; bit += 7) {
+      BN_DIGITS(&x)[n - 1] = (bn_digit_t)1 << bit;
+      check_rootrem(&x, 2);
+      check_rootrem(&x, 3);
+    }
+  }
+
+  // Square roots from one digit to beyond the thresholds of the products and
+  // divisions they take
+  for (size_t n = 1; n < 40; ++n) {
+    rand_bn_bits(&x, n);
+    check_rootrem(&x, 2);
+    rand_bn_bits(&y, (n + 1) / 2);
+    check_power(&y, 2);
+  }
+  rand_bn_bits(&x, 301);
+  check_rootrem(&x, 2);
+  rand_bn_bits(&y, 500);
+  check_power(&y, 2);
+
+  // Roots of higher degrees
+  unsigned long degrees[] = {3, 4, 5, 7, 13, 64, 101, 1000};
+  for (size_t d = 0; d < sizeof(degrees) / sizeof(degrees[0]); ++d) {
+    const unsigned long k = degrees[d];
+    for (size_t n = 1; n < 6; ++n) {
+      rand_bn_bits(&x, n * (k < 20 ? 7 : 1) + k / 8);
+      check_rootrem(&x, k);
+    }
+    if (k < 100) {
+      rand_bn_bits(&y, 1 + rand_digit() % 4);
+      check_power(&y, k);
+    }
+    bn_from_int(&y, 3);
+    check_power(&y, k);
+  }
+
+  // Odd roots of negative numbers are negative, and so is the remainder.
+  rand_bn_bits(&x, 5);
+  x.sign = -1;
+  assert(bn_rootrem(&z, &r, &x, 3) == BN_OK);
+  assert(z.sign < 0 && r.sign < 0);
+  power(&y, &z, 3);
+  bn_add(&y, &y, &r);
+  assert(bn_cmp(&y, &x) == 0);
+  assert(!bn_is_perfect_square(&x));
+  bn_from_int(&y, -12345);
+  power(&x, &y, 3);
+  assert(bn_is_perfect_power(&x));
+  power(&x, &y, 2);
+  x.sign = -1;
+  assert(!bn_is_perfect_power(&x));
+
+  // Perfect powers and numbers which are not
+  bn_from_int(&x, 0);
+  assert(bn_is_perfect_square(&x) && bn_is_perfect_power(&x));
+  bn_from_int(&x, -1);
+  assert(!bn_is_perfect_square(&x) && bn_is_perfect_power(&x));
+  int powers[] = {1, 4, 8, 9, 16, 27, 32, 243, 1 << 20, 3 * 3 * 5 * 5};
+  int others[] = {2, 3, 6, 12, 24, 72, 200, 2 * 3 * 5, 1 << 20 | 1};
+  for (size_t i = 0; i < sizeof(powers) / sizeof(powers[0]); ++i) {
+    bn_from_int(&x, powers[i]);
+    assert(bn_is_perfect_power(&x));
+  }
+  for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); ++i) {
+    bn_from_int(&x, others[i]);
+    assert(!bn_is_perfect_power(&x));
+  }
+  // 6^35 * 2, and 2^(5 * 7 * 64)
+  bn_from_int(&y, 6);
+  power(&x, &y, 35);
+  bn_mul_single(&x, &x, 2);
+  assert(!bn_is_perfect_power(&x));
+  bn_from_int(&y, 2);
+  power(&x, &y, 5 * 7 * 64);
+  assert(bn_is_perfect_power(&x));
+  bn_add_single(&x, &x, 1);
+  assert(!bn_is_perfect_power(&x));
+  rand_bn_bits(&y, 3);
+  power(&x, &y, 15);
+  assert(bn_is_perfect_power(&x));
+
+  // Powers with large exponents, whose roots are found from the top digits
+  unsigned long exponents[] = {1009, 2003, 3 * 1024};
+  for (size_t i = 0; i < sizeof(exponents) / sizeof(exponents[0]); ++i) {
+    bn_from_int(&y, 3 + 2 * (int)i);
+    check_power(&y, exponents[i]);
+  }
+
+  // A large non-power is rejected by residues, without full roots: 3 mod 4
+  // rules out squares
+  rand_bn(&x, 1024, 1);
+  BN_DIGITS(&x)[0] |= 3;
+  clock_t start = clock();
+  assert(!bn_is_perfect_power(&x));
+  assert(clock() - start < CLOCKS_PER_SEC / 2);
+
+  bn_free(&x);
+  bn_free(&y);
+  bn_free(&z);
+  bn_free(&r);
+  bn_scratch_free(NULL);
+  return 0;
+}
@@ -0,0 +1,91 @@
+#include <assert.h>
+#include <stdlib.h>
+
+// Counts the heap calls of the library.
+static size_t heap_calls = 0;
+static void *counting_malloc(size_t size) {
+  ++heap_calls;
+  return malloc(size);
+}
+static void *counting_realloc(void *p, size_t size) {
+  ++heap_calls;
+  return realloc(p, size);
+}
+#define BN_MALLOC counting_malloc
+#define BN_REALLOC counting_realloc
+#define BN_FREE free
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0xA54FF53A5F1D36F1ull
+#include "test_util.h"
+
+// Multiplies, squares and divides operands of increasing size.
+static void work(bn_t *a, bn_t *b, bn_t *z, bn_t *q, bn_t *r) {
+  for (size_t size = 1; size <= 600; size += 1 + size / 2) {
+    bn_resize(a, size);
+    bn_resize(b, size / 2 + 1);
+    for (size_t i = 0; i < a->size; ++i)
+      BN_DIGITS(a)[i] = rand_digit() | 1;
+    for (size_t i = 0; i < b->size; ++i)
+      BN_DIGITS(b)[i] = rand_digit() | 1;
+    assert(bn_mul(z, a, b) == BN_OK);
+    assert(bn_div(q, r, z, b) == BN_OK);
+    assert(bn_cmp(q, a) == 0);
+    BN_ASSERT_EQ(1ul, r->size, "%zu");
+    BN_ASSERT_EQ(0ul, BN_DIGITS(r)[0], "%zu");
+    assert(bn_sqr(z, z) == BN_OK);
+    assert(bn_div(q, r, z, a) == BN_OK);
+  }
+}
+
+int main(void) {
+  bn_t a = {0}, b = {0}, z = {0}, q = {0}, r = {0};
+
+  // Word-sized numbers need no heap memory at all.
+  bn_t x = {0}, y = {0};
+  heap_calls = 0;
+  assert(bn_from_int(&x, 123456789) == BN_OK);
+  assert(bn_from_int(&y, -987654321) == BN_OK);
+  assert(bn_mul(&x, &x, &y) == BN_OK);
+  assert(bn_add(&x, &x, &y) == BN_OK);
+  BN_ASSERT_EQ(0ul, heap_calls, "%zu");
+  bn_free(&x);
+  bn_free(&y);
+
+  // Once the arena and the results have grown, the arithmetic runs without
+  // heap calls.
+  work(&a, &b, &z, &q, &r);
+  heap_calls = 0;
+  work(&a, &b, &z, &q, &r);
+  BN_ASSERT_EQ(0ul, heap_calls, "%zu");
+
+  // An arena of the caller's
+  bn_scratch_t S = {0};
+  assert(bn_scratch_use(&S) == NULL);
+  work(&a, &b, &z, &q, &r);
+  assert(S.block != NULL);
+  BN_ASSERT_EQ(0ul, S.used, "%zu");
+  heap_calls = 0;
+  work(&a, &b, &z, &q, &r);
+  BN_ASSERT_EQ(0ul, heap_calls, "%zu");
+  assert(bn_scratch_use(NULL) == &S);
+  bn_scratch_free(&S);
+  assert(S.block == NULL);
+
+  // String conversions draw their temporaries from the arena as well.
+  char *s;
+  assert(bn_to_string(&z, &s) == BN_OK);
+  assert(bn_from_string(&q, s, 10) == BN_OK);
+  assert(bn_cmp(&q, &z) == 0);
+  free(s);
+
+  bn_scratch_free(NULL);
+  bn_free(&a);
+  bn_free(&b);
+  bn_free(&z);
+  bn_free(&q);
+  bn_free(&r);
+  return 0;
+}
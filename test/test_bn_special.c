@@ -0,0 +1,168 @@
+#include <assert.h>
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0x6A09E667F3BCC908ull
+#include "test_util.h"
+
+// T = 2^e
+static void power_of_two(bn_t *T, size_t e) {
+  T->size = 0;
+  T->sign = 1;
+  for (size_t i = 0; i < e / DIGIT_BITS; ++i)
+    bn_append_digit(T, 0);
+  bn_append_digit(T, (bn_digit_t)1 << (e % DIGIT_BITS));
+}
+
+// N = 2^k + sum of sign 2^e, for the pairs (sign, e) of terms
+static void from_powers(bn_t *N, size_t k, const int *terms, size_t count) {
+  bn_t t = {0};
+  power_of_two(N, k);
+  for (size_t i = 0; i < count; ++i) {
+    power_of_two(&t, (size_t)terms[2 * i + 1]);
+    if (terms[2 * i] > 0)
+      assert(bn_add(N, N, &t) == BN_OK);
+    else
+      assert(bn_sub(N, N, &t) == BN_OK);
+  }
+  bn_free(&t);
+}
+
+// Checks the special reduction modulo N against bn_mod.
+static void check_special(const bn_t *N, bn_form_t form) {
+  bn_special_ctx_t C;
+  bn_t x = {0}, y = {0}, e = {0}, z1 = {0}, z2 = {0};
+  const size_t n = bn_mpn_normalized_size(BN_DIGITS(N), N->size);
+
+  BN_ASSERT_EQ(form, bn_modulus_form(N), "%d");
+  assert(bn_special_ctx_init(&C, N) == BN_OK);
+  BN_ASSERT_EQ(form, C.form, "%d");
+  BN_ASSERT_EQ(n, C.size, "%zu");
+
+  for (int round = 0; round < 100; ++round) {
+    // Below N², around it and far beyond, which is divided
+    const size_t xn = 1 + rand_digit() % (round < 90 ? 2 * n : 3 * n);
+    rand_bn(&x, xn, rand_digit() % 2 ? 1 : -1);
+    assert(bn_mod(&z1, &x, N) == BN_OK);
+    assert(bn_mod_special(&z2, &x, &C) == BN_OK);
+    assert(bn_cmp(&z1, &z2) == 0);
+
+    // Worst-case residues: N - 1 and small ones
+    if (round % 10 == 0)
+      bn_sub_single(&x, N, 1);
+    else
+      bn_mod(&x, &x, N);
+    rand_bn(&y, n, 1);
+    bn_mod(&y, &y, N);
+    assert(bn_mul(&z1, &x, &y) == BN_OK);
+    assert(bn_mod(&z1, &z1, N) == BN_OK);
+    assert(bn_mulmod_special(&z2, &x, &y, &C) == BN_OK);
+    assert(bn_cmp(&z1, &z2) == 0);
+    assert(bn_sqr(&z1, &x) == BN_OK);
+    assert(bn_mod(&z1, &z1, N) == BN_OK);
+    assert(bn_sqrmod_special(&z2, &x, &C) == BN_OK);
+    assert(bn_cmp(&z1, &z2) == 0);
+  }
+
+  // modexp against the same product by Barrett reduction
+  bn_barrett_ctx_t B;
+  assert(bn_barrett_ctx_init(&B, N) == BN_OK);
+  rand_bn(&x, n, -1);
+  rand_bn(&e, n, 1);
+  bn_from_int(&z1, 1);
+  for (size_t i = e.size * DIGIT_BITS; i-- > 0;) {
+    assert(bn_sqrmod_barrett(&z1, &z1, &B) == BN_OK);
+    if ((BN_DIGITS(&e)[i / DIGIT_BITS] >> (i % DIGIT_BITS)) & 1) {
+      assert(bn_mod(&y, &x, N) == BN_OK);
+      assert(bn_mulmod_barrett(&z1, &z1, &y, &B) == BN_OK);
+    }
+  }
+  assert(bn_modexp_special(&z2, &x, &e, &C) == BN_OK);
+  assert(bn_cmp(&z1, &z2) == 0);
+  assert(bn_modexp(&z2, &x, &e, N) == BN_OK);
+  assert(bn_cmp(&z1, &z2) == 0);
+  bn_barrett_ctx_free(&B);
+
+  bn_special_ctx_free(&C);
+  bn_free(&x);
+  bn_free(&y);
+  bn_free(&e);
+  bn_free(&z1);
+  bn_free(&z2);
+}
+
+int main(void) {
+  bn_t n = {0};
+  bn_special_ctx_t C;
+
+  // 2^255 - 19
+  const int p25519[] = {-1, 4, -1, 1, -1, 0};
+  from_powers(&n, 255, p25519, 3);
+  check_special(&n, BN_FORM_PSEUDO_MERSENNE);
+  assert(bn_special_ctx_init(&C, &n) == BN_OK);
+  BN_ASSERT_EQ(255ul, C.bits, "%zu");
+  BN_ASSERT_EQ(19ul, C.c, "%zu");
+  bn_special_ctx_free(&C);
+  // 2^521 - 1
+  const int p521[] = {-1, 0};
+  from_powers(&n, 521, p521, 1);
+  check_special(&n, BN_FORM_PSEUDO_MERSENNE);
+  // secp256k1: 2^256 - 2^32 - 977, c above one digit on 32-bit platforms
+  const int k256[] = {-1, 32, -1, 9, -1, 8, -1, 7, -1, 6, -1, 4, -1, 0};
+  from_powers(&n, 256, k256, 7);
+  check_special(&n, DIGIT_BITS == 64 ? BN_FORM_PSEUDO_MERSENNE
+                                     : BN_FORM_SOLINAS);
+  // Two digits with a c of half their bits, whose folds wrap around B^2:
+  // 2^127 - 2^62 + 1, generic on 32-bit platforms, and 2^128 - 2^64 + 59
+  const int p127[] = {-1, 62, 1, 0};
+  from_powers(&n, 127, p127, 2);
+  if (DIGIT_BITS == 64)
+    check_special(&n, BN_FORM_PSEUDO_MERSENNE);
+  const int p128[] = {-1, 64, 1, 5, 1, 4, 1, 3, 1, 1, 1, 0};
+  from_powers(&n, 128, p128, 6);
+  check_special(&n, DIGIT_BITS == 64 ? BN_FORM_PSEUDO_MERSENNE
+                                     : BN_FORM_SOLINAS);
+  // 2^130 - 5, where c 2^s does not fit a digit on 64-bit platforms
+  const int p130[] = {-1, 2, -1, 0};
+  from_powers(&n, 130, p130, 2);
+  check_special(&n, BN_FORM_PSEUDO_MERSENNE);
+  // Small ones: 2^61 - 1 and 2^7 - 1
+  from_powers(&n, 61, p521, 1);
+  check_special(&n, BN_FORM_PSEUDO_MERSENNE);
+  from_powers(&n, 7, p521, 1);
+  check_special(&n, BN_FORM_PSEUDO_MERSENNE);
+
+  // NIST P-192, P-224, P-256 and P-384
+  const int p192[] = {-1, 64, -1, 0};
+  from_powers(&n, 192, p192, 2);
+  check_special(&n, BN_FORM_SOLINAS);
+  const int p224[] = {-1, 96, 1, 0};
+  from_powers(&n, 224, p224, 2);
+  check_special(&n, BN_FORM_SOLINAS);
+  const int p256[] = {-1, 224, 1, 192, 1, 96, -1, 0};
+  from_powers(&n, 256, p256, 4);
+  check_special(&n, BN_FORM_SOLINAS);
+  const int p384[] = {-1, 128, -1, 96, 1, 32, -1, 0};
+  from_powers(&n, 384, p384, 4);
+  check_special(&n, BN_FORM_SOLINAS);
+  // 2^1024 - 2^64 - 1, which bn_modexp folds too
+  from_powers(&n, 1024, p192, 2);
+  check_special(&n, BN_FORM_SOLINAS);
+  // Even: 2^192 - 2^64, which bn_modexp reduces the same way
+  const int e192[] = {-1, 64};
+  from_powers(&n, 192, e192, 1);
+  check_special(&n, BN_FORM_SOLINAS);
+
+  // Generic moduli: c too long, and an RSA-like random one
+  const int big_c[] = {-1, 200, -1, 0};
+  from_powers(&n, 255, big_c, 2);
+  BN_ASSERT_EQ(BN_FORM_GENERIC, bn_modulus_form(&n), "%d");
+  rand_bn(&n, 8, 1);
+  BN_DIGITS(&n)[0] |= 1;
+  BN_ASSERT_EQ(BN_FORM_GENERIC, bn_modulus_form(&n), "%d");
+  assert(bn_special_ctx_init(&C, &n) == BN_NO_SPECIAL_FORM);
+
+  bn_free(&n);
+  return 0;
+}
@@ -0,0 +1,92 @@
+#include <assert.h>
+
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0x2545F4914F6CDD1Dull
+#include "test_util.h"
+
+// Checks bn_sqr and bn_mul(A, A) against the schoolbook multiplication
+static void check_sqr(size_t n) {
+  bn_t a = {0}, c = {0}, expected = {0};
+  a.sign = -1;
+  for (size_t i = 0; i < n; ++i)
+    bn_append_digit(&a, rand_digit());
+  BN_DIGITS(&a)[n - 1] |= 1;
+  bn_resize(&expected, 2 * n);
+  bn_mpn_mul_basecase(BN_DIGITS(&expected), BN_DIGITS(&a), n, BN_DIGITS(&a), n);
+  expected.sign = 1;
+  bn_normalize(&expected);
+
+  assert(bn_sqr(&c, &a) == BN_OK);
+  assert(bn_cmp(&c, &expected) == 0);
+  c.size = 0;
+  assert(bn_mul(&c, &a, &a) == BN_OK);
+  assert(bn_cmp(&c, &expected) == 0);
+  // in-place
+  assert(bn_sqr(&a, &a) == BN_OK);
+  assert(bn_cmp(&a, &expected) == 0);
+
+  bn_free(&a);
+  bn_free(&c);
+  bn_free(&expected);
+}
+
+int main(void) {
+  bn_t a = {0}, c = {0};
+
+  // 1000^2 = 1000000
+  assert(bn_from_int(&a, -1000) == BN_OK);
+  assert(bn_sqr(&c, &a) == BN_OK);
+  BN_ASSERT_EQ(1ul, c.size, "%zu");
+  BN_ASSERT_EQ(1, c.sign, "%d");
+  BN_ASSERT_EQ(1000000ul, BN_DIGITS(&c)[0], "%zu");
+
+  // 10000000000000000000^2 = 100000000000000000000000000000000000000
+  a.size = 0;
+  c.size = 0;
+  bn_append_digit(&a, 10000000000000000000ul);
+  assert(bn_sqr(&c, &a) == BN_OK);
+  BN_ASSERT_EQ(2ul, c.size, "%zu");
+  BN_ASSERT_EQ(687399551400673280ul, BN_DIGITS(&c)[0], "%zu");
+  BN_ASSERT_EQ(5421010862427522170ul, BN_DIGITS(&c)[1], "%zu");
+
+  // basecase
+  for (size_t n = 1; n < BN_SQR_KARATSUBA_THRESHOLD; n += 5)
+    check_sqr(n);
+  // Karatsuba
+  check_sqr(BN_SQR_KARATSUBA_THRESHOLD);
+  check_sqr(2 * BN_SQR_KARATSUBA_THRESHOLD + 1);
+  // Toom-3
+  assert(_bn_mpn_sqr_plan(BN_SQR_TOOM3_THRESHOLD).ka == 3);
+  check_sqr(BN_SQR_TOOM3_THRESHOLD);
+  check_sqr(BN_SQR_TOOM3_THRESHOLD + 1);
+  // Toom-4
+  assert(_bn_mpn_sqr_plan(BN_SQR_TOOM4_THRESHOLD).ka == 4);
+  check_sqr(BN_SQR_TOOM4_THRESHOLD);
+  check_sqr(BN_SQR_TOOM4_THRESHOLD + 2);
+#if BN_HAVE_NTT
+  // NTT
+  assert(_bn_mpn_sqr_plan(BN_SQR_NTT_THRESHOLD).algorithm == BN_MUL_NTT);
+  check_sqr(BN_SQR_NTT_THRESHOLD);
+#endif
+
+  // (B^n - 1)^2 = B^2n - 2 * B^n + 1
+  const size_t n = BN_SQR_TOOM4_THRESHOLD + 1;
+  a.size = 0;
+  a.sign = 1;
+  for (size_t i = 0; i < n; ++i)
+    bn_append_digit(&a, ~(bn_digit_t)0);
+  assert(bn_sqr(&c, &a) == BN_OK);
+  BN_ASSERT_EQ(2 * n, c.size, "%zu");
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&c)[0], "%zu");
+  for (size_t i = 1; i < n; ++i)
+    BN_ASSERT_EQ(0ul, BN_DIGITS(&c)[i], "%zu");
+  BN_ASSERT_EQ(~(bn_digit_t)1, BN_DIGITS(&c)[n], "%zu");
+  for (size_t i = n + 1; i < c.size; ++i)
+    BN_ASSERT_EQ(~(bn_digit_t)0, BN_DIGITS(&c)[i], "%zu");
+
+  bn_free(&a);
+  bn_free(&c);
+  return 0;
+}
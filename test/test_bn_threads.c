@@ -0,0 +1,127 @@
+#include <assert.h>
+#include <stdio.h>
+
+// Fork down to small subproducts, so every level of the recursion runs in
+// parallel.
+#define BN_PARALLEL_THRESHOLD 64
+#define BIGNUM_IMPLEMENTATION
+#include "../bignum.h"
+
+#define TEST_SEED 0xBB67AE8584CAA73Bull
+#include "test_util.h"
+
+// Products, squares and quotients of operands of an x bn digits are the same
+// with {threads} threads as on the calling thread alone.
+static void check_threads(size_t an, size_t bn, unsigned threads) {
+  bn_t a = {0}, b = {0}, p = {0}, s = {0}, z = {0}, q1 = {0}, q2 = {0},
+       r1 = {0}, r2 = {0};
+  rand_bn(&a, an, 1);
+  rand_bn(&b, bn, 1);
+
+  BN_ASSERT_EQ(1u, bn_set_threads(1), "%u");
+  assert(bn_mul(&p, &a, &b) == BN_OK);
+  assert(bn_sqr(&s, &a) == BN_OK);
+  assert(bn_add(&z, &s, &b) == BN_OK);
+  assert(bn_div(&q1, &r1, &z, &b) == BN_OK);
+
+  if (bn_set_threads(threads) == 1)
+    assert(!BN_HAVE_THREADS);
+  assert(bn_mul(&z, &a, &b) == BN_OK);
+  assert(bn_cmp(&p, &z) == 0);
+  assert(bn_sqr(&z, &a) == BN_OK);
+  assert(bn_cmp(&s, &z) == 0);
+  // Burnikel-Ziegler division multiplies in parallel as well.
+  assert(bn_add(&z, &s, &b) == BN_OK);
+  assert(bn_div(&q2, &r2, &z, &b) == BN_OK);
+  assert(bn_cmp(&q1, &q2) == 0);
+  assert(bn_cmp(&r1, &r2) == 0);
+
+  bn_free(&a);
+  bn_free(&b);
+  bn_free(&p);
+  bn_free(&s);
+  bn_free(&z);
+  bn_free(&q1);
+  bn_free(&q2);
+  bn_free(&r1);
+  bn_free(&r2);
+}
+
+#if BN_HAVE_THREADS
+// Several callers share the pool.
+static void *caller(void *arg) {
+  bn_t *x = arg;
+  bn_t z = {0};
+  for (int i = 0; i < 4; ++i) {
+    assert(bn_sqr(&z, x) == BN_OK);
+    assert(bn_div(&z, NULL, &z, x) == BN_OK);
+    assert(bn_cmp(&z, x) == 0);
+  }
+  bn_free(&z);
+  bn_scratch_free(NULL);
+  return NULL;
+}
+
+// Threads of the process, or 0 where /proc does not tell
+static unsigned process_threads(void) {
+  unsigned count = 0;
+  FILE *f = fopen("/proc/self/status", "r");
+  if (f == NULL)
+    return 0;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (sscanf(line, "Threads: %u", &count) == 1)
+      break;
+  fclose(f);
+  return count;
+}
+#endif
+
+int main(void) {
+  BN_ASSERT_EQ(1u, bn_get_threads(), "%u");
+
+  // Karatsuba, Toom-3, Toom-4 and unbalanced products
+  check_threads(100, 80, 2);
+  check_threads(300, 250, 4);
+  check_threads(700, 650, 3);
+  check_threads(900, 320, 4);
+#if BN_HAVE_NTT
+  check_threads(BN_NTT_THRESHOLD + 100, BN_NTT_THRESHOLD, 4);
+#endif
+  // Fewer threads again
+  check_threads(500, 500, 2);
+
+#if BN_HAVE_THREADS
+  bn_set_threads(3);
+  bn_t x[3] = {{0}};
+  pthread_t callers[3];
+  for (int i = 0; i < 3; ++i) {
+    rand_bn(&x[i], 400 + 100 * i, 1);
+    assert(pthread_create(&callers[i], NULL, caller, &x[i]) == 0);
+  }
+  for (int i = 0; i < 3; ++i) {
+    pthread_join(callers[i], NULL);
+    bn_free(&x[i]);
+  }
+#endif
+
+  bn_set_threads(1);
+  BN_ASSERT_EQ(1u, bn_get_threads(), "%u");
+
+#if BN_HAVE_THREADS
+  // Lowering the count stops the workers beyond it.
+  const unsigned before = process_threads();
+  BN_ASSERT_EQ(4u, bn_set_threads(4), "%u");
+  check_threads(300, 250, 4);
+  if (before != 0)
+    BN_ASSERT_EQ(before + 3, process_threads(), "%u");
+  BN_ASSERT_EQ(2u, bn_set_threads(2), "%u");
+  if (before != 0)
+    BN_ASSERT_EQ(before + 1, process_threads(), "%u");
+  bn_set_threads(1);
+  if (before != 0)
+    BN_ASSERT_EQ(before, process_threads(), "%u");
+#endif
+  bn_scratch_free(NULL);
+  return 0;
+}
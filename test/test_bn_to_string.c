@@ -3,10 +3,47 @@
 #define BIGNUM_IMPLEMENTATION
 #include "../bignum.h"
 
+#define TEST_SEED 0x3C6EF372FE94F82Bull
+#include "test_util.h"
+
+// Converts {bn} to a string and back.
+static void check_round_trip(const bn_t *bn) {
+  bn_t back = {0};
+  char *s;
+  assert(bn_to_string(bn, &s) == BN_OK);
+  assert(s[0] != '0' || s[1] == '\0');
+  assert(bn_from_string(&back, s, 10) == BN_OK);
+  assert(bn_cmp(bn, &back) == 0);
+  free(s);
+  bn_free(&back);
+}
+
+// Converts {bn} to radix into a buffer of exactly bn_sizeinbase + 2
+// characters and back.
+static void check_radix(const bn_t *bn, bn_digit_t radix) {
+  bn_t back = {0};
+  const size_t size = bn_sizeinbase(bn, radix) + 2;
+  char *s = malloc(size);
+  assert(bn_to_string_buf(bn, s, size, radix) == BN_OK);
+  assert(s[0] != '0' || s[1] == '\0');
+  if ((radix & (radix - 1)) == 0)
+    BN_ASSERT_EQ(size - 2 + (bn->sign == -1), strlen(s), "%zu");
+  assert(bn_from_string(&back, s, radix) == BN_OK);
+  assert(bn_cmp(bn, &back) == 0);
+  free(s);
+  bn_free(&back);
+}
+
 int main(void) {
   bn_t bn = {0};
   char *s;
 
+  assert(bn_from_int(&bn, 0) == BN_OK);
+  assert(bn_to_string(&bn, &s) == BN_OK);
+  BN_ASSERT_STREQ("0", s);
+  free(s);
+
+  bn.size = 0;
   assert(bn_from_int(&bn, 1000) == BN_OK);
   assert(bn_to_string(&bn, &s) == BN_OK);
   assert(!strcmp("1000", s));
@@ -34,6 +71,76 @@ int main(void) {
   BN_ASSERT_STREQ("-10000000000000000000000000", s);
   free(s);
 
+  // 10^k and 10^k - 1 across the divide-and-conquer threshold, which have long
+  // runs of zeros and nines in every half.
+  bn.size = 0;
+  bn.sign = 1;
+  assert(bn_from_int(&bn, 1) == BN_OK);
+  bn_t nines = {0};
+  for (size_t k = 1; k <= 2000; ++k) {
+    assert(bn_mul_single(&bn, &bn, 10) == BN_OK);
+    if (k % 97 != 0 && k != 2000)
+      continue;
+    assert(bn_to_string(&bn, &s) == BN_OK);
+    BN_ASSERT_EQ(k + 1, strlen(s), "%zu");
+    assert(s[0] == '1');
+    for (size_t i = 1; i <= k; ++i)
+      assert(s[i] == '0');
+    free(s);
+
+    assert(bn_sub_single(&nines, &bn, 1) == BN_OK);
+    assert(bn_to_string(&nines, &s) == BN_OK);
+    BN_ASSERT_EQ(k, strlen(s), "%zu");
+    for (size_t i = 0; i < k; ++i)
+      assert(s[i] == '9');
+    free(s);
+  }
+  bn_free(&nines);
+
+  // Random numbers of up to several levels of the power table
+  for (size_t size = 1; size < 600; size += 1 + size / 4) {
+    bn.size = 0;
+    bn.sign = 1;
+    for (size_t i = 0; i < size; ++i)
+      bn_append_digit(&bn, rand_digit());
+    check_round_trip(&bn);
+  }
+
+  // Other radixes
+  bn.size = 0;
+  bn.sign = -1;
+  bn_append_digit(&bn, 0xfedcba9876543210ul);
+  bn_append_digit(&bn, 0x1ul);
+  assert(bn_to_string_radix(&bn, &s, 16) == BN_OK);
+  BN_ASSERT_STREQ("-1fedcba9876543210", s);
+  free(s);
+  BN_ASSERT_EQ(17ul, bn_sizeinbase(&bn, 16), "%zu");
+  BN_ASSERT_EQ(65ul, bn_sizeinbase(&bn, 2), "%zu");
+  BN_ASSERT_EQ(22ul, bn_sizeinbase(&bn, 8), "%zu");
+  assert(bn_to_string_radix(&bn, &s, 8) == BN_OK);
+  BN_ASSERT_STREQ("-3773345651416625031020", s);
+  free(s);
+  assert(bn_to_string_radix(&bn, &s, 36) == BN_OK);
+  BN_ASSERT_STREQ("-7rocsm465pxcg", s);
+  free(s);
+
+  char buf[24];
+  assert(bn_to_string_buf(&bn, buf, 18, 16) == BN_BUFFER_TOO_SMALL);
+  assert(bn_to_string_buf(&bn, buf, 19, 16) == BN_OK);
+  BN_ASSERT_STREQ("-1fedcba9876543210", buf);
+  bn.size = 0;
+  assert(bn_to_string_buf(&bn, buf, 3, 2) == BN_OK);
+  BN_ASSERT_STREQ("0", buf);
+
+  for (size_t size = 1; size < 400; size += 1 + size / 3) {
+    bn.size = 0;
+    bn.sign = size % 2 ? 1 : -1;
+    for (size_t i = 0; i < size; ++i)
+      bn_append_digit(&bn, rand_digit() >> (i % 7));
+    for (bn_digit_t radix = 2; radix <= 36; ++radix)
+      check_radix(&bn, radix);
+  }
+
   bn_free(&bn);
   return 0;
 }
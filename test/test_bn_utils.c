@@ -1,37 +1,43 @@
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define BIGNUM_IMPLEMENTATION
 #include "../bignum.h"
 
+static int cmp_bn(const void *a, const void *b) {
+  return bn_cmp((const bn_t *)a, (const bn_t *)b);
+}
+
 int main(void) {
   bn_t A = {0};
 
   // Resize
   bn_resize(&A, 10);
   BN_ASSERT_EQ(10ul, A.size, "%zu");
-  BN_ASSERT_EQ(0ul, A.digits[0], "%zu");
-  BN_ASSERT_EQ(0ul, A.digits[1], "%zu");
-  BN_ASSERT_EQ(0ul, A.digits[2], "%zu");
-  BN_ASSERT_EQ(0ul, A.digits[3], "%zu");
-  BN_ASSERT_EQ(0ul, A.digits[4], "%zu");
-  BN_ASSERT_EQ(0ul, A.digits[5], "%zu");
-  BN_ASSERT_EQ(0ul, A.digits[6], "%zu");
-  BN_ASSERT_EQ(0ul, A.digits[7], "%zu");
-  BN_ASSERT_EQ(0ul, A.digits[8], "%zu");
-  BN_ASSERT_EQ(0ul, A.digits[9], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&A)[0], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&A)[1], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&A)[2], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&A)[3], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&A)[4], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&A)[5], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&A)[6], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&A)[7], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&A)[8], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&A)[9], "%zu");
 
   // Append digit
   A.size = 0;
   bn_append_digit(&A, 1ul);
   BN_ASSERT_EQ(1ul, A.size, "%zu");
-  BN_ASSERT_EQ(1ul, A.digits[0], "%zu");
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&A)[0], "%zu");
 
   // From int
   A.size = 0;
   bn_from_int(&A, -1000);
   BN_ASSERT_EQ(-1, A.sign, "%d");
   BN_ASSERT_EQ(1ul, A.size, "%zu");
-  BN_ASSERT_EQ(1000ul, A.digits[0], "%zu");
+  BN_ASSERT_EQ(1000ul, BN_DIGITS(&A)[0], "%zu");
 
   // Reverse digits
   A.size = 0;
@@ -39,9 +45,9 @@ int main(void) {
   bn_append_digit(&A, 2ul);
   bn_append_digit(&A, 3ul);
   bn_reverse_digits(&A);
-  BN_ASSERT_EQ(A.digits[0], 3ul, "%zu");
-  BN_ASSERT_EQ(A.digits[1], 2ul, "%zu");
-  BN_ASSERT_EQ(A.digits[2], 1ul, "%zu");
+  BN_ASSERT_EQ(BN_DIGITS(&A)[0], 3ul, "%zu");
+  BN_ASSERT_EQ(BN_DIGITS(&A)[1], 2ul, "%zu");
+  BN_ASSERT_EQ(BN_DIGITS(&A)[2], 1ul, "%zu");
 
   // Normalize
   A.size = 0;
@@ -51,7 +57,7 @@ int main(void) {
   bn_append_digit(&A, 0ul);
   bn_normalize(&A);
   BN_ASSERT_EQ(1ul, A.size, "%zu");
-  BN_ASSERT_EQ(0ul, A.digits[0], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&A)[0], "%zu");
   A.size = 0;
   bn_append_digit(&A, 0ul);
   bn_append_digit(&A, 1ul);
@@ -59,10 +65,88 @@ int main(void) {
   bn_append_digit(&A, 0ul);
   bn_normalize(&A);
   BN_ASSERT_EQ(2ul, A.size, "%zu");
-  BN_ASSERT_EQ(0ul, A.digits[0], "%zu");
-  BN_ASSERT_EQ(1ul, A.digits[1], "%zu");
+  BN_ASSERT_EQ(0ul, BN_DIGITS(&A)[0], "%zu");
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&A)[1], "%zu");
 
   bn_free(&A);
+  assert(A.heap == NULL && A.capacity == 0);
+
+  // Small numbers live in the inline digits and move to the heap as they grow.
+  bn_t B = {0}, C = {0};
+  bn_from_int(&B, 7);
+  assert(BN_DIGITS(&B) == B.inline_digits);
+  for (size_t i = 1; i < BN_INLINE_DIGITS; ++i)
+    bn_append_digit(&B, i);
+  assert(BN_DIGITS(&B) == B.inline_digits);
+  bn_clone(&C, &B);
+  assert(BN_DIGITS(&C) == C.inline_digits);
+  assert(bn_cmp(&B, &C) == 0);
+  bn_append_digit(&B, 42ul);
+  assert(BN_DIGITS(&B) != B.inline_digits);
+  BN_ASSERT_EQ(BN_INLINE_DIGITS + 1ul, B.size, "%zu");
+  BN_ASSERT_EQ(7ul, BN_DIGITS(&B)[0], "%zu");
+  BN_ASSERT_EQ(42ul, BN_DIGITS(&B)[BN_INLINE_DIGITS], "%zu");
+  bn_clone(&C, &B);
+  assert(BN_DIGITS(&C) != C.inline_digits);
+  assert(bn_cmp(&B, &C) == 0);
+  // Shrinking keeps the heap storage.
+  bn_from_int(&B, 1);
+  assert(BN_DIGITS(&B) != B.inline_digits);
+  BN_ASSERT_EQ(1ul, BN_DIGITS(&B)[0], "%zu");
+  bn_free(&B);
+  bn_free(&C);
+  bn_resize(&B, BN_INLINE_DIGITS);
+  assert(BN_DIGITS(&B) == B.inline_digits);
+  bn_free(&B);
+
+  // Numbers move by value, inline ones included: swapped, copied with
+  // memcpy, in an array moved by realloc and sorted by qsort.
+  bn_from_int(&B, -5);
+  const char *large = "12345678901234567890123456789012345678901234567890"
+                      "1234567890123456789012345678901234567890";
+  bn_from_string(&C, large, 10);
+  bn_swap(&B, &C);
+  BN_ASSERT_EQ(-1, C.sign, "%d");
+  BN_ASSERT_EQ(5ul, BN_DIGITS(&C)[0], "%zu");
+  assert(B.size > BN_INLINE_DIGITS);
+  bn_t D;
+  memcpy(&D, &C, sizeof(bn_t));
+  bn_free(&C);
+  BN_ASSERT_EQ(5ul, BN_DIGITS(&D)[0], "%zu");
+
+  const int values[] = {42, -7, 1000000, 0, 3, -1000};
+  const size_t count = sizeof(values) / sizeof(values[0]);
+  bn_t *array = malloc(2 * sizeof(bn_t));
+  assert(array != NULL);
+  for (size_t i = 0; i < count; ++i) {
+    if (i >= 2) {
+      bn_t *moved = realloc(array, (i + 1) * sizeof(bn_t));
+      assert(moved != NULL);
+      array = moved;
+    }
+    bn_t x = {0};
+    bn_from_int(&x, values[i]);
+    array[i] = x;
+  }
+  // A large number in the middle, moved as well
+  bn_free(&array[2]);
+  array[2] = B;
+  memset(&B, 0, sizeof(bn_t));
+  qsort(array, count, sizeof(bn_t), cmp_bn);
+  const int sorted[] = {-1000, -7, 0, 3, 42};
+  for (size_t i = 0; i < count - 1; ++i) {
+    bn_from_int(&C, sorted[i]);
+    assert(bn_cmp(&array[i], &C) == 0);
+  }
+  char *s;
+  bn_to_string(&array[count - 1], &s);
+  assert(strcmp(s, large) == 0);
+  free(s);
+  for (size_t i = 0; i < count; ++i)
+    bn_free(&array[i]);
+  free(array);
+  bn_free(&C);
+  bn_free(&D);
 
   return 0;
 }
@@ -5,7 +5,7 @@
 #include "../bignum.h"
 
 int main(void) {
-  bn_sb_t sb;
+  bn_sb_t sb = {0};
 
   bn_sb_append(&sb, "hello");
   assert(strcmp("hello", bn_sb_to_str(&sb)) == 0);
@@ -0,0 +1,44 @@
+// Random operands for the tests, included after bignum.h. Define TEST_SEED
+// before including it to give a test a sequence of its own.
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#ifndef TEST_SEED
+#define TEST_SEED 0x9E3779B97F4A7C15ull
+#endif
+
+// xorshift64
+static uint64_t rng_state = TEST_SEED;
+static inline bn_digit_t rand_digit(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (bn_digit_t)rng_state;
+}
+
+// Random digit which is zero or all ones one time in eight each, for long
+// carry and borrow chains
+static inline bn_digit_t rand_edge_digit(void) {
+  const bn_digit_t r = rand_digit();
+  switch (rng_state % 8) {
+  case 0:
+    return 0;
+  case 1:
+    return ~(bn_digit_t)0;
+  default:
+    return r;
+  }
+}
+
+// Random number of {size} digits with a nonzero top digit, a quarter of its
+// digits all ones
+static inline void rand_bn(bn_t *bn, size_t size, int sign) {
+  bn->size = 0;
+  bn->sign = sign;
+  for (size_t i = 0; i < size; ++i)
+    bn_append_digit(bn, rand_digit() % 4 ? rand_digit() : ~(bn_digit_t)0);
+  if (BN_DIGITS(bn)[size - 1] == 0)
+    BN_DIGITS(bn)[size - 1] = 1;
+}
+
+#endif // TEST_UTIL_H